@@ -12,6 +12,11 @@ public class MainActivity extends AppCompatActivity {
     protected void onCreate(Bundle savedInstanceState) {
         super.onCreate(savedInstanceState);
         setContentView(R.layout.activity_main);
-        VirtualARM.launch();
+        // am start -n com.swift.virtualarm/.MainActivity --ez bench true
+        if (getIntent().getBooleanExtra("bench", false)) {
+            VirtualARM.bench();
+        } else {
+            VirtualARM.launch();
+        }
     }
 }
@@ -7,4 +7,6 @@ public class VirtualARM {
     }
 
     public static native void launch();
+
+    public static native void bench();
 }
@@ -110,7 +110,9 @@ namespace CPU::A64 {
             Brk,
             Hlt,
             ErrorInstr,
-            PageFatal
+            PageFatal,
+            // access to a ReadSpec/WriteSpec page, fatal_addr is the guest address
+            MemorySpec
         };
         Reason reason;
         union {
@@ -139,9 +141,29 @@ namespace CPU::A64 {
         VAddr pte;
     };
 
+    // local half of the emulated exclusive monitor, the global half is Memory::ExclusiveMonitor
+    struct ExclusiveState {
+        // guest address of the last load exclusive, exclusive_none if open
+        VAddr addr;
+        // global monitor entry and the tag it had
+        VAddr tag_entry;
+        u64 tag;
+        // what the load exclusive read, the store exclusive compares against it
+        u64 value[2];
+    };
+
+    constexpr VAddr exclusive_none = ~VAddr(0);
+
     constexpr size_t l1_page_bits = 6;
     constexpr size_t l1_page_count = 1 << l1_page_bits;
 
+    // bits of CPUContext::suspend_flag, guest returns to host at the next poll if any is set
+    enum SuspendFlag : u64 {
+        SuspendRequest = 1 << 0,
+        // an entry of this thread's tlb was shot down, l1 dcache must go too
+        TLBShootdown = 1 << 1
+    };
+
     struct CPUContext {
         Reg cpu_registers[29];
         Reg fp; // x29
@@ -163,6 +185,13 @@ namespace CPU::A64 {
         // memory
         VAddr tlb;
         VAddr page_table;
+        VAddr fastmem_base;
+        // page lookup stub: result pte and its own scratch
+        VAddr query_pte;
+        u64 page_lookup_scratch[4];
+        // exclusive monitor
+        VAddr exclusive_table;
+        ExclusiveState exclusive;
         // host stubs
         VAddr host_stubs;
         union {
@@ -174,6 +203,8 @@ namespace CPU::A64 {
         VAddr host_sp;
         // flags
         u64 suspend_flag;
+        // hot block waiting for optimized tier
+        VAddr tier_up_entry;
         // ticks
         u64 ticks_now;
         u64 ticks_max;
@@ -6,9 +6,92 @@
 
 using namespace Instructions::A64;
 
+namespace {
+
+    // bucket of an instruction = bits [31:21], holds every opcode that may match in table order
+    constexpr u8 decode_key_shift = 21;
+    constexpr size_t decode_buckets = size_t(1) << (32 - decode_key_shift);
+    constexpr InstrA64 decode_key_mask = ~InstrA64(0) << decode_key_shift;
+
+    static_assert(static_cast<size_t>(OpcodeA64::NUM_INSTRUCTIONS) <= UINT8_MAX);
+
+    constexpr bool InBucket(const InstrA64Encoding &encoding, size_t key) {
+        auto key_bits = static_cast<InstrA64>(key) << decode_key_shift;
+        return encoding.mask && !((key_bits ^ encoding.value) & encoding.mask & decode_key_mask);
+    }
+
+    constexpr size_t MaxBucketSize() {
+        size_t max = 0;
+        for (size_t key = 0; key < decode_buckets; ++key) {
+            size_t count = 0;
+            for (auto &encoding : instr_encodings) {
+                count += InBucket(encoding, key);
+            }
+            max = count > max ? count : max;
+        }
+        return max;
+    }
+
+    constexpr size_t max_bucket_size = MaxBucketSize();
+
+    struct DecodeBucket {
+        u8 count;
+        u8 opcodes[max_bucket_size];
+    };
+
+    constexpr auto BuildDecodeTable() {
+        std::array<DecodeBucket, decode_buckets> table{};
+        for (size_t key = 0; key < decode_buckets; ++key) {
+            auto &bucket = table[key];
+            for (size_t opcode = 0; opcode < instr_encodings.size(); ++opcode) {
+                if (InBucket(instr_encodings[opcode], key)) {
+                    bucket.opcodes[bucket.count++] = static_cast<u8>(opcode);
+                }
+            }
+        }
+        return table;
+    }
+
+    constexpr auto decode_table = BuildDecodeTable();
+
+}
+
 OpcodeA64 DefaultDecoder::DecodeOpCode(InstrA64 instr_bits, InstrTypeA64 type) {
+    auto &bucket = decode_table[instr_bits >> decode_key_shift];
+    for (u8 i = 0; i < bucket.count; ++i) {
+        auto &encoding = instr_encodings[bucket.opcodes[i]];
+        if (encoding.Test(instr_bits) && (type == Invalid || encoding.type == type)) {
+            return static_cast<OpcodeA64>(bucket.opcodes[i]);
+        }
+    }
+    return OpcodeA64::INVALID;
+}
+
+bool DefaultDecoder::Decode(InstrA64 instr_bits, DecodedA64 &out) {
+    out.inst.raw = instr_bits;
+    out.opcode = DecodeOpCode(instr_bits);
+    auto opcode_index = static_cast<int>(out.opcode);
+    out.type = instr_encodings[opcode_index].type;
+    auto &field_list = instr_field_lists[opcode_index];
+    for (u8 i = 0; i < field_list.count; ++i) {
+        out.fields[i] = GetAArch64Field(field_list.fields[i], out.inst);
+    }
+    return out.Valid();
+}
+
+size_t DefaultDecoder::DecodeBlock(const InstrA64 *start, size_t count, DecodedA64 *out, bool stop_at_branch) {
+    for (size_t i = 0; i < count; ++i) {
+        Decode(start[i], out[i]);
+        if (stop_at_branch && out[i].type == Branches) {
+            return i + 1;
+        }
+    }
+    return count;
+}
+
+OpcodeA64 DefaultDecoder::DecodeOpCodeLinear(InstrA64 instr_bits, InstrTypeA64 type) {
     const auto& instr_map = type == Invalid ? InstructionTableA64::Get().GetInstrTable() : InstructionTableA64::Get().GetInstrTable(type);
-    for (const auto item:instr_map) {
+    for (const auto &item:instr_map) {
         if (item.second.Test(instr_bits)) {
             return item.first;
         }
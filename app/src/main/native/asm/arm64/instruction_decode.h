@@ -9,6 +9,27 @@
 
 namespace Instructions::A64 {
 
+    // decoded instruction as plain data, no allocation, can be kept in arrays
+    struct DecodedA64 {
+        AArch64Inst inst;
+        OpcodeA64 opcode;
+        InstrTypeA64 type;
+        // values of the FIELDn list of the opcode, in table order
+        u32 fields[InstrA64FieldList::max_fields];
+
+        bool Valid() const {
+            return opcode != OpcodeA64::INVALID;
+        }
+
+        u8 FieldCount() const {
+            return instr_field_lists[static_cast<int>(opcode)].count;
+        }
+
+        AArch64Fields::Fields FieldType(u8 index) const {
+            return instr_field_lists[static_cast<int>(opcode)].fields[index];
+        }
+    };
+
     class Decoder {
     public:
         virtual InstrA64Ref Decode(InstrA64 *instr_bits) = 0;
@@ -18,11 +39,26 @@ namespace Instructions::A64 {
     public:
         InstrA64Ref Decode(InstrA64 *instr_bits) override;
 
+        // table lookup on the top bits, then a few mask tests
         static OpcodeA64 DecodeOpCode(InstrA64 instr_bits, InstrTypeA64 type = Invalid);
+
+        // walks the whole table, reference for DecodeOpCode
+        static OpcodeA64 DecodeOpCodeLinear(InstrA64 instr_bits, InstrTypeA64 type = Invalid);
+
+        // false if invalid, out is filled anyway
+        static bool Decode(InstrA64 instr_bits, DecodedA64 &out);
+
+        // decodes count instructions into out, or up to and including the first branch
+        // returns the number decoded
+        static size_t DecodeBlock(const InstrA64 *start, size_t count, DecodedA64 *out,
+                                  bool stop_at_branch = false);
     };
 
     class FastBranchDecoder : public DefaultDecoder {
     public:
+        // value decode is shared, see DefaultDecoder::DecodeBlock
+        using DefaultDecoder::Decode;
+
         InstrA64Ref Decode(InstrA64 *instr_bits) override;
 
         InstrA64Ref DecodeDPImm(InstrA64 instr_bits);
@@ -78,5 +78,7 @@ const std::function<u32(AArch64Inst&)> Instructions::A64::GetAArch64FieldGetFunc
 }
 
 u32 Instructions::A64::GetAArch64Field(AArch64Fields::Fields type, AArch64Inst &inst) {
-    return GetAArch64FieldGetFunc(type)(inst);
+    auto range = AArch64Fields::field_ranges[type];
+    u32 width = range.to - range.from + 1u;
+    return (inst.raw >> range.from) & (width == 32 ? ~u32(0) : (u32(1) << width) - 1);
 }
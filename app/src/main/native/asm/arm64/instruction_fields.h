@@ -429,6 +429,24 @@ namespace Instructions::A64 {
 
 #include "fields_table.inl"
 
+#undef FIELD
+        };
+
+    }
+
+    namespace AArch64Fields {
+
+        struct FieldRange {
+            u8 from;
+            u8 to;
+        };
+
+        constexpr FieldRange field_ranges[] = {
+
+#define FIELD(name, from, to) {from, to},
+
+#include "fields_table.inl"
+
 #undef FIELD
         };
 
@@ -438,4 +456,13 @@ namespace Instructions::A64 {
 
     u32 GetAArch64Field(AArch64Fields::Fields type, AArch64Inst &inst);
 
+    // field known at compile time, no table or function pointer in between
+    template<AArch64Fields::Fields field>
+    FORCE_INLINE u32 GetAArch64Field(const AArch64Inst &inst) {
+        constexpr auto range = AArch64Fields::field_ranges[field];
+        constexpr u32 width = range.to - range.from + 1;
+        constexpr u32 mask = width == 32 ? ~u32(0) : (u32(1) << width) - 1;
+        return (inst.raw >> range.from) & mask;
+    }
+
 }
@@ -8,30 +8,23 @@ using namespace Instructions;
 using namespace Instructions::A64;
 
 bool InstrA64Info::Test(InstrA64 bits) const {
-    return (bits & mask_pair_.first) == mask_pair_.second;
+    return mask_pair_.first && (bits & mask_pair_.first) == mask_pair_.second;
 }
 
 InstrA64Info::InstrA64Info() {}
 
-MaskValuePair A64::ParseMaskValuePair(std::string mask_str) {
-    InstrA64 mask = 0, value = 0;
-    for (size_t i = 0; i < mask_str.size(); i++) {
-        mask |= ((mask_str[i] == 'x') ? 0 : 1) << i;
-        value |= ((mask_str[i] == '1') ? 1 : 0) << i;
-    }
-    return std::make_pair(mask, value);
-}
-
 void InstructionTableA64::init() {
-#define INST(x, name, regs, mask, ...) \
+    // masks come parsed from instr_encodings
+#define INST(x, name, regs, mask_str, ...) \
     instr_table_[OpcodeA64::x] = InstrA64Info( \
         OpcodeA64::x, \
-        ParseMaskValuePair(mask), \
+        {instr_encodings[static_cast<size_t>(OpcodeA64::x)].mask, \
+         instr_encodings[static_cast<size_t>(OpcodeA64::x)].value}, \
         name, \
         {}, \
-        cur_type_ \
+        instr_encodings[static_cast<size_t>(OpcodeA64::x)].type \
     );
-#define Type(x) cur_type_ = InstrTypeA64::x;
+#define Type(x)
 
     instr_table_[OpcodeA64::INVALID] = InstrA64Info(OpcodeA64::INVALID, {},"INVALID", {}, Unallocated);
 #include "instructions_table_all.inl"
@@ -67,7 +60,7 @@ const std::map<OpcodeA64, InstrA64Info> &InstructionTableA64::GetInstrTable() co
 }
 
 InstrTypeA64 InstructionTableA64::Type(OpcodeA64 opcode) {
-    return Unallocated;
+    return instr_encodings[static_cast<size_t>(opcode)].type;
 }
 
 InstrA64Info &InstructionTableA64::GetInstrInfo(OpcodeA64 opcode) {
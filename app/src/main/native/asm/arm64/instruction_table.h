@@ -5,14 +5,25 @@
 #pragma once
 
 #include "instruction_fields.h"
+#include <array>
 #include <map>
+#include <string_view>
 #include <vector>
 
 namespace Instructions::A64 {
 
     using MaskValuePair = std::pair<InstrA64, InstrA64>;
 
-    MaskValuePair ParseMaskValuePair(std::string mask_str);
+    // "01x..." is bit 31 first, x = don't care
+    constexpr MaskValuePair ParseMaskValuePair(std::string_view mask_str) {
+        InstrA64 mask = 0, value = 0;
+        for (size_t i = 0; i < mask_str.size(); i++) {
+            InstrA64 bit = InstrA64(1) << (mask_str.size() - 1 - i);
+            mask |= mask_str[i] == 'x' ? 0 : bit;
+            value |= mask_str[i] == '1' ? bit : 0;
+        }
+        return {mask, value};
+    }
 
     enum InstrTypeA64 {
         Invalid,
@@ -46,46 +57,101 @@ namespace Instructions::A64 {
 #undef INST
 #undef Type
 
+    struct InstrA64Encoding {
+        InstrA64 mask;
+        InstrA64 value;
+        InstrTypeA64 type;
+
+        constexpr bool Test(InstrA64 bits) const {
+            return mask && (bits & mask) == value;
+        }
+    };
+
+    namespace EncodingTable {
+
+        // one row per INST or Type line, UN_DECODED marks a Type line
+        struct Row {
+            OpcodeA64 opcode;
+            InstrTypeA64 type;
+            std::string_view mask;
+        };
+
+#define INST(x, name, fields, mask, ...) {OpcodeA64::x, Invalid, mask},
+#define Type(x) {OpcodeA64::UN_DECODED, InstrTypeA64::x, {}},
+        constexpr Row rows[] = {
+#include "instructions_table_all.inl"
+        };
+#undef INST
+#undef Type
+
+        constexpr auto Build() {
+            std::array<InstrA64Encoding, static_cast<size_t>(OpcodeA64::NUM_INSTRUCTIONS)> res{};
+            InstrTypeA64 cur_type = Invalid;
+            for (auto &row : rows) {
+                if (row.opcode == OpcodeA64::UN_DECODED) {
+                    cur_type = row.type;
+                    continue;
+                }
+                auto pair = ParseMaskValuePair(row.mask);
+                res[static_cast<size_t>(row.opcode)] = {pair.first, pair.second, cur_type};
+            }
+            // INVALID, NUM_INSTRUCTIONS have no mask and never match
+            res[static_cast<size_t>(OpcodeA64::INVALID)].type = Unallocated;
+            return res;
+        }
+    }
+
+    // instructions_table_all.inl parsed at compile time, indexed by opcode
+    constexpr auto instr_encodings = EncodingTable::Build();
+
+    // FIELDn list of an opcode
+    struct InstrA64FieldList {
+        constexpr static int max_fields = 4;
+        u8 count;
+        AArch64Fields::Fields fields[max_fields];
+    };
+
+#define FIELD1(f1) 1, {AArch64Fields::f1}
+#define FIELD2(f1, f2) 2, {AArch64Fields::f1, AArch64Fields::f2}
+#define FIELD3(f1, f2, f3) 3, {AArch64Fields::f1, AArch64Fields::f2, AArch64Fields::f3}
+#define FIELD4(f1, f2, f3, f4) 4, {AArch64Fields::f1, AArch64Fields::f2, AArch64Fields::f3, AArch64Fields::f4}
+#define INST(x, name, fields, ...) {fields},
+#define Type(x)
+    constexpr InstrA64FieldList instr_field_lists[static_cast<int>(OpcodeA64::NUM_INSTRUCTIONS)] = {
+            // UN_DECODED, INVALID
+            {},
+            {},
+#include "instructions_table_all.inl"
+    };
+#undef INST
+#undef Type
+#undef FIELD1
+#undef FIELD2
+#undef FIELD3
+#undef FIELD4
+
     template<typename FnT>
     struct VisitorCaller;
 
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable:4800) // forcing value to bool 'true' or 'false' (performance warning)
-#endif
-
+    // fields are template arguments, each one is a shift and a mask inlined into the call
     template<typename Visitor, typename ...Args, typename CallRetT>
     struct VisitorCaller<CallRetT(Visitor::*)(Args...)> {
-        template<size_t ...iota>
-        static auto Make(std::integer_sequence<size_t, iota...>,
-                         CallRetT (Visitor::* const fn)(Args...),
-                         const std::array<AArch64Fields::Fields, sizeof...(iota)> f_types) {
-            return [fn, f_types](Visitor& v, AArch64Inst &inst) {
-                (void)inst;
-                (void)f_types;
-                return (v.*fn)(static_cast<Args>(GetAArch64FieldGetFunc(f_types[iota])(inst))...);
-            };
+        template<CallRetT (Visitor::*fn)(Args...), AArch64Fields::Fields ...fields>
+        static CallRetT Call(Visitor &v, AArch64Inst &inst) {
+            static_assert(sizeof...(fields) == sizeof...(Args), "field list does not match visitor");
+            return (v.*fn)(static_cast<Args>(GetAArch64Field<fields>(inst))...);
         }
     };
 
     template<typename Visitor, typename ...Args, typename CallRetT>
     struct VisitorCaller<CallRetT(Visitor::*)(Args...) const> {
-        template<size_t ...iota>
-        static auto Make(std::integer_sequence<size_t, iota...>,
-                         CallRetT (Visitor::* const fn)(Args...) const,
-                         const std::array<AArch64Fields::Fields, sizeof...(iota)> f_types) {
-            return [fn, f_types](const Visitor& v, AArch64Inst &inst) {
-                (void)inst;
-                (void)f_types;
-                return (v.*fn)(static_cast<Args>(GetAArch64FieldGetFunc(f_types[iota])(inst))...);
-            };
+        template<CallRetT (Visitor::*fn)(Args...) const, AArch64Fields::Fields ...fields>
+        static CallRetT Call(Visitor &v, AArch64Inst &inst) {
+            static_assert(sizeof...(fields) == sizeof...(Args), "field list does not match visitor");
+            return (v.*fn)(static_cast<Args>(GetAArch64Field<fields>(inst))...);
         }
     };
 
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
-
     class InstrA64Info {
     public:
 
@@ -104,53 +170,59 @@ namespace Instructions::A64 {
         InstrTypeA64 type_;
     };
 
+#define FIELD1(f1) , AArch64Fields::f1
+#define FIELD2(f1, f2) , AArch64Fields::f1, AArch64Fields::f2
+#define FIELD3(f1, f2, f3) , AArch64Fields::f1, AArch64Fields::f2, AArch64Fields::f3
+#define FIELD4(f1, f2, f3, f4) , AArch64Fields::f1, AArch64Fields::f2, AArch64Fields::f3, AArch64Fields::f4
+#define VISITOR_CALLER(x, ...) VisitorCaller<decltype(&Visitor::x)>::template Call<&Visitor::x __VA_ARGS__>
+#define Type(x)
+
     template <typename Visitor>
     class Dispatcher {
     public:
         using VisitorReturnType = typename Visitor::instruction_return_type;
-        using VisitorCallerFunc = std::function<VisitorReturnType(Visitor&, AArch64Inst&)>;
-
-        void Init() {
-            using namespace AArch64Fields;
-
-#define FIELD1(...) __VA_ARGS__
-#define FIELD2(...) __VA_ARGS__
-#define FIELD3(...) __VA_ARGS__
-#define FIELD4(...) __VA_ARGS__
-#define Type(x)
-#define INST(x, name, fields, mask, ...) \
-    callers_[static_cast<int>(OpcodeA64::x)] = Dispatcher<Visitor>::GetCaller(&Visitor::x, {fields});
-
-#include "instructions_table_all.inl"
-
-#undef INST
-#undef ARG_LIST
-#undef Type
-#undef FIELD1
-#undef FIELD2
-#undef FIELD3
-#undef FIELD4
-        }
+        using VisitorCallerFunc = VisitorReturnType (*)(Visitor&, AArch64Inst&);
 
         Dispatcher(Visitor &visitor) : visitor(visitor) {}
 
-        template<typename FnT, size_t args_count = FunctionInfo<FnT>::args_count>
-        auto GetCaller(FnT fn, std::array<AArch64Fields::Fields, args_count> fields) {
-            using Iota = std::make_index_sequence<args_count>;
-            const auto proxy_fn = VisitorCaller<FnT>::Make(Iota(), fn, fields);
-            return proxy_fn;
+        // nullptr for UN_DECODED and INVALID
+        static constexpr VisitorCallerFunc GetCaller(OpcodeA64 opcode) {
+            return callers_[static_cast<int>(opcode)];
         }
 
-        FORCE_INLINE VisitorReturnType Call(OpcodeA64 opcodeA64, AArch64Inst &inst) {
+        // generated switch, the visitor call inlines into its case
+        FORCE_INLINE VisitorReturnType Call(OpcodeA64 opcode, AArch64Inst &inst) {
             visitor.inst = &inst;
-            callers_[static_cast<int>(opcodeA64)](visitor, inst);
+            switch (opcode) {
+#define INST(x, name, fields, ...) \
+                case OpcodeA64::x: \
+                    return VISITOR_CALLER(x, fields)(visitor, inst);
+#include "instructions_table_all.inl"
+#undef INST
+                default:
+                    return VisitorReturnType();
+            }
         }
 
     private:
         Visitor &visitor;
-        VisitorCallerFunc callers_[static_cast<int>(OpcodeA64::NUM_INSTRUCTIONS)];
+
+#define INST(x, name, fields, ...) &VISITOR_CALLER(x, fields),
+        static constexpr VisitorCallerFunc callers_[static_cast<int>(OpcodeA64::NUM_INSTRUCTIONS)] = {
+                nullptr,
+                nullptr,
+#include "instructions_table_all.inl"
+        };
+#undef INST
     };
 
+#undef Type
+#undef VISITOR_CALLER
+#undef FIELD1
+#undef FIELD2
+#undef FIELD3
+#undef FIELD4
+
     struct BaseVisitor {
         AArch64Inst *inst;
         // maybe a so or exe load base
@@ -175,7 +247,6 @@ namespace Instructions::A64 {
         InstrA64Info &GetInstrInfo(OpcodeA64 opcode);
 
     private:
-        InstrTypeA64 cur_type_;
         std::map<OpcodeA64, InstrA64Info> instr_table_;
         std::map<InstrTypeA64, std::map<OpcodeA64, InstrA64Info>> instr_type_table_;
     };
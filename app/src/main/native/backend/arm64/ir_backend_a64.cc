@@ -0,0 +1,1047 @@
+//
+// Created by SwiftGan on 2020/11/28.
+//
+
+#include "svm/arm64/svm_jit_context.h"
+#include "svm/arm64/svm_arm64.h"
+#include "frontend/arm64/ir_lifter_a64.h"
+#include "frontend/arm64/pass_a64.h"
+#include "ir_backend_a64.h"
+
+using namespace Backend::A64;
+using namespace Instructions::IR;
+using Instructions::A64::OpcodeIRA64;
+using vixl::aarch64::Label;
+using vixl::aarch64::MemOperand;
+using vixl::aarch64::Operand;
+using vixl::aarch64::Register;
+
+#define IR_OP(name) static_cast<u8>(OpcodeIR::name)
+#define A64_OP(name) static_cast<u8>(OpcodeIRA64::name)
+
+#define __ masm_->
+
+// flags id of the guest flags at block entry
+constexpr static u32 entry_flags_id = UINT32_MAX - 1;
+
+// host code of one lowered op or constant
+constexpr static u32 max_instr_code = 4 * 4;
+// spills of evicted registers, entry flags and fastmem base
+constexpr static u32 max_prologue_code = 33 * 4;
+// register shuffle, NZCV and one terminal path
+constexpr static u32 max_exit_code = 320 * 4;
+
+// imm can go into add/sub (or the inverse op) as is, no macro assembler scratch register
+static bool AddSubImm(u64 imm, bool wide, s64 &out) {
+    out = wide ? static_cast<s64>(imm) : static_cast<s64>(static_cast<int32_t>(imm));
+    return out != INT64_MIN && (vixl::aarch64::Assembler::IsImmAddSub(out) || vixl::aarch64::Assembler::IsImmAddSub(-out));
+}
+
+static bool LogicalImm(u64 imm, bool wide) {
+    u64 ones = wide ? UINT64_MAX : UINT32_MAX;
+    imm &= ones;
+    return !imm || imm == ones || vixl::aarch64::Assembler::IsImmLogical(imm, wide ? 64 : 32);
+}
+
+// same as the interpreter, cond below AL
+static bool CondHolds(u32 nzcv, u8 cond) {
+    bool n = (nzcv >> 31) & 1;
+    bool z = (nzcv >> 30) & 1;
+    bool c = (nzcv >> 29) & 1;
+    bool v = (nzcv >> 28) & 1;
+    bool result;
+    switch (cond >> 1) {
+        case 0:
+            result = z;
+            break;
+        case 1:
+            result = c;
+            break;
+        case 2:
+            result = n;
+            break;
+        case 3:
+            result = v;
+            break;
+        case 4:
+            result = c && !z;
+            break;
+        case 5:
+            result = n == v;
+            break;
+        default:
+            result = n == v && !z;
+            break;
+    }
+    return (cond & 1) ? !result : result;
+}
+
+static bool IsWide(const InstrIR &instr) {
+    return instr.return_.size_ == DataSize::U64;
+}
+
+IRBackendA64::IRBackendA64(SVM::A64::Instance &instance) : instance_(instance) {
+    auto &config = instance.GetJitConfig();
+    context_reg_ = config.context_reg;
+    auto mmu = instance.GetMmu().get();
+    fastmem_ = mmu && instance.GetFastMem() != nullptr;
+    memory_ok_ = !mmu || fastmem_;
+    lifter_ = std::make_unique<Instructions::A64::IRLifterA64>();
+    passes_ = std::make_unique<Jit::IR::PassManagerIR>();
+    passes_->Add(std::make_unique<Instructions::A64::ContextForwardPassA64>());
+    passes_->Add(std::make_unique<Jit::IR::ConstantFoldPass>());
+    passes_->Add(std::make_unique<Jit::IR::DeadCodePass>());
+}
+
+IRBackendA64::~IRBackendA64() = default;
+
+VAddr IRBackendA64::Translate(Jit::A64::JitContext &context, VAddr start) {
+    VAddr end{0};
+    bool begun{false};
+    {
+        Jit::IR::CodeBlock block{start};
+        auto mmu = instance_.GetMmu().get();
+        bool lifted = lifter_->Lift(block, [mmu](VAddr va) -> VAddr {
+            if (!mmu) {
+                return va;
+            }
+            auto pte = mmu->GetPage(va & ~mmu->page_mask_);
+            return pte && mmu->PageExecutable(*pte) ? mmu->GetPageStart(*pte) + (va & mmu->page_mask_) : 0;
+        });
+        if (lifted) {
+            passes_->Run(block);
+        }
+        if (lifted && Plan(block) && CodeSizeBound() <= Jit::A64::JitContext::max_block_code_size) {
+            context.BeginBlock(start);
+            begun = true;
+            if (context.Assembler().GetBuffer()->GetRemainingBytes() >= CodeSizeBound()) {
+                Emit(context, block);
+                end = start + block.GuestInstrCount() * 4;
+            } else {
+                // code block about full, the decoder splits the block
+                context.AbortBlock();
+            }
+        }
+    }
+    Instructions::IR::InstrIRArena::Current().Reset();
+    if (end) {
+        translated_++;
+    } else if (!begun) {
+        rejected_++;
+    }
+    return end;
+}
+
+u64 IRBackendA64::Translated() const {
+    return translated_;
+}
+
+u64 IRBackendA64::Rejected() const {
+    return rejected_;
+}
+
+u32 IRBackendA64::NewValue(u32 start, bool narrow, int8_t fixed) {
+    auto id = alloc_.Add({start, start, fixed});
+    infos_.push_back({narrow, false, false, 0, 0, none, 0});
+    return id;
+}
+
+IRBackendA64::Value IRBackendA64::Ref(const InstrIR &instr, u32 arg) {
+    auto &argument = instr.args_[arg];
+    if (argument.IsValue()) {
+        return values_[argument.value_.instr->id_];
+    }
+    if (argument.IsImm()) {
+        return {Value::Imm, none, argument.ImmValue()};
+    }
+    return {};
+}
+
+IRBackendA64::Value IRBackendA64::EntryX(u8 code) {
+    if (entry_[code] == none) {
+        entry_[code] = NewValue(0, false, static_cast<int8_t>(code));
+    }
+    return {Value::Reg, entry_[code]};
+}
+
+void IRBackendA64::Use(const Value &v, u32 index) {
+    if (v.kind != Value::Reg) {
+        return;
+    }
+    auto &interval = alloc_[v.id];
+    interval.end = std::max(interval.end, 2 * index + 1);
+    infos_[v.id].used = true;
+}
+
+IRBackendA64::Value IRBackendA64::ToReg(Value v, u32 index, bool zero) {
+    switch (v.kind) {
+        case Value::Imm: {
+            if (zero && !v.imm) {
+                return {Value::Zero};
+            }
+            // defined right before the op, the result of the op before may still be live
+            auto id = NewValue(2 * index, v.imm <= UINT32_MAX);
+            auto &info = infos_[id];
+            info.constant = true;
+            info.const_at = index;
+            info.imm = v.imm;
+            constants_.push_back(id);
+            v = {Value::Reg, id};
+            break;
+        }
+        case Value::EntryFlags:
+            if (entry_flags_ == none) {
+                entry_flags_ = NewValue(0, true);
+            }
+            v = {Value::Reg, entry_flags_};
+            break;
+        default:
+            break;
+    }
+    Use(v, index);
+    return v;
+}
+
+u32 IRBackendA64::FlagsId(const Value &v) const {
+    switch (v.kind) {
+        case Value::EntryFlags:
+            return entry_flags_id;
+        case Value::Reg:
+            return v.id;
+        default:
+            return none;
+    }
+}
+
+bool IRBackendA64::UseFlags(Value &v, u32 index) {
+    auto id = FlagsId(v);
+    if (id != none && flags_holder_ == id) {
+        return false;
+    }
+    v = ToReg(v, index, true);
+    flags_holder_ = id != none ? id : v.id;
+    return true;
+}
+
+bool IRBackendA64::Plan(Jit::IR::CodeBlock &block) {
+    infos_.clear();
+    lowerings_.clear();
+    constants_.clear();
+    values_.assign(block.InstrCount(), Value{});
+    guest_.fill(Value{});
+    entry_.fill(none);
+    nzcv_ = {Value::EntryFlags};
+    flags_holder_ = entry_flags_id;
+    entry_flags_ = none;
+    fastmem_base_ = none;
+    u32 untouched = (1U << 31) - 1;
+    for (auto &instr : block.Instrs()) {
+        switch (instr.opcode_) {
+            case A64_OP(A64GetX):
+            case A64_OP(A64GetW):
+                // a dropped read does not pin the entry value
+                if (instr.use_count) {
+                    untouched &= ~(1U << instr.args_[0].value_.fronted.code);
+                }
+                break;
+            case A64_OP(A64SetX):
+            case A64_OP(A64SetW):
+                untouched &= ~(1U << instr.args_[0].value_.fronted.code);
+                break;
+            default:
+                break;
+        }
+    }
+    alloc_.Reset(1U << context_reg_, untouched);
+    u32 index{0};
+    for (auto &instr : block.Instrs()) {
+        lowerings_.push_back({});
+        auto &lowering = lowerings_.back();
+        lowering.instr = &instr;
+        lowering.emit = true;
+        if (!PlanInstr(instr, lowering, index)) {
+            return false;
+        }
+        index++;
+    }
+    PlanExit(block, index);
+    return alloc_.Run();
+}
+
+bool IRBackendA64::PlanInstr(const InstrIR &instr, Lowering &lowering, u32 index) {
+    auto &args = lowering.args;
+    auto result = [&]() {
+        lowering.result = {Value::Reg, NewValue(2 * index + 2, !IsWide(instr))};
+        values_[instr.id_] = lowering.result;
+    };
+    // a value nothing reads, the passes leave few
+    bool unused = !instr.use_count;
+    switch (instr.opcode_) {
+        case IR_OP(Nop):
+            lowering.emit = false;
+            return true;
+        case IR_OP(AddReg32):
+        case IR_OP(AddReg64):
+        case IR_OP(SubReg32):
+        case IR_OP(SubReg64):
+        case IR_OP(AddFlags32):
+        case IR_OP(AddFlags64):
+        case IR_OP(SubFlags32):
+        case IR_OP(SubFlags64):
+        case IR_OP(AndReg32):
+        case IR_OP(AndReg64):
+        case IR_OP(OrReg32):
+        case IR_OP(OrReg64):
+        case IR_OP(EorReg32):
+        case IR_OP(EorReg64):
+        case IR_OP(MulReg32):
+        case IR_OP(MulReg64):
+        case IR_OP(LslReg32):
+        case IR_OP(LslReg64):
+        case IR_OP(LsrReg32):
+        case IR_OP(LsrReg64):
+        case IR_OP(AsrReg32):
+        case IR_OP(AsrReg64):
+        case IR_OP(RorReg32):
+        case IR_OP(RorReg64):
+        case IR_OP(UDivReg32):
+        case IR_OP(UDivReg64):
+        case IR_OP(SDivReg32):
+        case IR_OP(SDivReg64): {
+            if (unused) {
+                lowering.emit = false;
+                return true;
+            }
+            auto op = instr.opcode_;
+            bool wide = op == IR_OP(AddReg64) || op == IR_OP(SubReg64) || op == IR_OP(AddFlags64) ||
+                        op == IR_OP(SubFlags64) || op == IR_OP(AndReg64) || op == IR_OP(OrReg64) ||
+                        op == IR_OP(EorReg64) || op == IR_OP(MulReg64) || op == IR_OP(LslReg64) ||
+                        op == IR_OP(LsrReg64) || op == IR_OP(AsrReg64) || op == IR_OP(RorReg64) ||
+                        op == IR_OP(UDivReg64) || op == IR_OP(SDivReg64);
+            bool commutative = (op < IR_OP(LslReg32) && op != IR_OP(SubReg32) && op != IR_OP(SubReg64)) ||
+                               op == IR_OP(AddFlags32) || op == IR_OP(AddFlags64);
+            auto a = Ref(instr, 0);
+            auto b = Ref(instr, 1);
+            if (commutative && a.kind == Value::Imm && b.kind != Value::Imm) {
+                std::swap(a, b);
+            }
+            bool imm_ok{false};
+            if (b.kind == Value::Imm) {
+                s64 unused_imm;
+                switch (op) {
+                    case IR_OP(AddReg32):
+                    case IR_OP(AddReg64):
+                    case IR_OP(SubReg32):
+                    case IR_OP(SubReg64):
+                    case IR_OP(AddFlags32):
+                    case IR_OP(AddFlags64):
+                    case IR_OP(SubFlags32):
+                    case IR_OP(SubFlags64):
+                        imm_ok = AddSubImm(b.imm, wide, unused_imm);
+                        break;
+                    case IR_OP(AndReg32):
+                    case IR_OP(AndReg64):
+                    case IR_OP(OrReg32):
+                    case IR_OP(OrReg64):
+                    case IR_OP(EorReg32):
+                    case IR_OP(EorReg64):
+                        imm_ok = LogicalImm(b.imm, wide);
+                        break;
+                    case IR_OP(LslReg32):
+                    case IR_OP(LslReg64):
+                    case IR_OP(LsrReg32):
+                    case IR_OP(LsrReg64):
+                    case IR_OP(AsrReg32):
+                    case IR_OP(AsrReg64):
+                    case IR_OP(RorReg32):
+                    case IR_OP(RorReg64):
+                        imm_ok = true;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            args[0] = ToReg(a, index);
+            args[1] = imm_ok ? b : ToReg(b, index);
+            result();
+            if (op >= IR_OP(AddFlags32) && op <= IR_OP(SubFlags64)) {
+                flags_holder_ = lowering.result.id;
+            }
+            return true;
+        }
+        case IR_OP(NotReg32):
+        case IR_OP(NotReg64):
+        case IR_OP(ClzReg32):
+        case IR_OP(ClzReg64):
+        case IR_OP(RevReg32):
+        case IR_OP(RevReg64):
+        case IR_OP(SignExtend8):
+        case IR_OP(SignExtend16):
+        case IR_OP(SignExtend32):
+        case IR_OP(CheckZero32):
+        case IR_OP(CheckZero64):
+        case IR_OP(TestBit):
+        case IR_OP(LogicFlags32):
+        case IR_OP(LogicFlags64):
+            if (unused) {
+                lowering.emit = false;
+                return true;
+            }
+            args[0] = ToReg(Ref(instr, 0), index);
+            args[1] = Ref(instr, 1);
+            result();
+            if (instr.opcode_ == IR_OP(LogicFlags32) || instr.opcode_ == IR_OP(LogicFlags64)) {
+                flags_holder_ = lowering.result.id;
+            }
+            return true;
+        case IR_OP(CheckCond): {
+            if (unused) {
+                lowering.emit = false;
+                return true;
+            }
+            auto flags = Ref(instr, 0);
+            auto cond = static_cast<u8>(instr.args_[1].ImmValue());
+            if (cond >= static_cast<u8>(Instructions::Condition::AL) || flags.kind == Value::Imm) {
+                bool holds = cond >= static_cast<u8>(Instructions::Condition::AL) ||
+                             CondHolds(static_cast<u32>(flags.imm), cond);
+                values_[instr.id_] = {Value::Imm, none, holds};
+                lowering.emit = false;
+                return true;
+            }
+            auto flags_id = FlagsId(flags);
+            lowering.to_flags = UseFlags(flags, index);
+            args[0] = flags;
+            lowering.cond = cond;
+            result();
+            auto &info = infos_[lowering.result.id];
+            info.cond_flags = flags_id;
+            info.cond = cond;
+            return true;
+        }
+        case IR_OP(Select32):
+        case IR_OP(Select64): {
+            if (unused) {
+                lowering.emit = false;
+                return true;
+            }
+            auto cond = Ref(instr, 0);
+            if (cond.kind == Value::Reg && infos_[cond.id].cond_flags != none &&
+                infos_[cond.id].cond_flags == flags_holder_) {
+                lowering.fused = true;
+                lowering.cond = infos_[cond.id].cond;
+            } else {
+                args[0] = ToReg(cond, index);
+                // tst
+                flags_holder_ = none;
+            }
+            args[1] = ToReg(Ref(instr, 1), index);
+            args[2] = ToReg(Ref(instr, 2), index);
+            result();
+            return true;
+        }
+        case IR_OP(Ldr8):
+        case IR_OP(Ldr16):
+        case IR_OP(Ldr32):
+        case IR_OP(Ldr64):
+        case IR_OP(Str8):
+        case IR_OP(Str16):
+        case IR_OP(Str32):
+        case IR_OP(Str64): {
+            if (!memory_ok_) {
+                return false;
+            }
+            if (fastmem_) {
+                if (fastmem_base_ == none) {
+                    fastmem_base_ = NewValue(0, false);
+                }
+                Use({Value::Reg, fastmem_base_}, index);
+            }
+            args[0] = ToReg(Ref(instr, 0), index);
+            if (instr.opcode_ >= IR_OP(Str8) && instr.opcode_ <= IR_OP(Str64)) {
+                args[1] = ToReg(Ref(instr, 1), index, true);
+            } else {
+                // loads are kept, they may fault
+                result();
+            }
+            return true;
+        }
+        case IR_OP(Fence):
+            return true;
+        case A64_OP(A64GetX):
+        case A64_OP(A64GetW): {
+            auto code = instr.args_[0].value_.fronted.code;
+            bool wide = instr.opcode_ == A64_OP(A64GetX);
+            if (unused) {
+                lowering.emit = false;
+                return true;
+            }
+            if (code == 31 || code == context_reg_) {
+                // host sp, or the guest value the context keeps
+                result();
+                return true;
+            }
+            auto current = guest_[code].kind == Value::None ? EntryX(code) : guest_[code];
+            if (current.kind == Value::Imm) {
+                values_[instr.id_] = {Value::Imm, none, wide ? current.imm : current.imm & UINT32_MAX};
+                lowering.emit = false;
+            } else if (wide || infos_[current.id].narrow) {
+                values_[instr.id_] = current;
+                lowering.emit = false;
+            } else {
+                args[0] = current;
+                Use(current, index);
+                result();
+            }
+            return true;
+        }
+        case A64_OP(A64SetX):
+        case A64_OP(A64SetW): {
+            auto code = instr.args_[0].value_.fronted.code;
+            auto value = Ref(instr, 1);
+            bool wide = instr.opcode_ == A64_OP(A64SetX);
+            if (value.kind == Value::EntryFlags) {
+                value = ToReg(value, index);
+            }
+            if (!wide) {
+                if (value.kind == Value::Imm) {
+                    value.imm &= UINT32_MAX;
+                } else if (!infos_[value.id].narrow) {
+                    // zero extends
+                    args[0] = value;
+                    Use(value, index);
+                    result();
+                    value = lowering.result;
+                }
+            }
+            if (code == 31 || code == context_reg_) {
+                bool zero = code != 31;
+                if (lowering.result.kind == Value::Reg) {
+                    // read right after its mov
+                    Use(value, index + 1);
+                    args[1] = value;
+                } else {
+                    args[1] = ToReg(value, index, zero);
+                }
+                return true;
+            }
+            guest_[code] = value;
+            lowering.emit = lowering.result.kind == Value::Reg;
+            return true;
+        }
+        case A64_OP(A64GetNZCV):
+            values_[instr.id_] = nzcv_;
+            lowering.emit = false;
+            return true;
+        case A64_OP(A64SetNZCV):
+            nzcv_ = Ref(instr, 0);
+            lowering.emit = false;
+            return true;
+        default:
+            // exclusives, system registers, simd
+            return false;
+    }
+}
+
+void IRBackendA64::PlanExit(Jit::IR::CodeBlock &block, u32 index) {
+    exit_value_ = {};
+    auto value = block.TerminalValue();
+    if (value) {
+        exit_value_ = value->IsValue() ? values_[value->value_.instr->id_]
+                                       : Value{Value::Imm, none, value->ImmValue()};
+        if (exit_value_.kind != Value::Imm) {
+            exit_value_ = ToReg(exit_value_, index);
+        }
+    }
+    exit_flags_ = nzcv_;
+    exit_to_flags_ = UseFlags(exit_flags_, index);
+    for (u8 code = 0; code < guest_.size(); ++code) {
+        if (code == context_reg_) {
+            continue;
+        }
+        auto &current = guest_[code];
+        if (current.kind == Value::None) {
+            if (entry_[code] != none) {
+                Use({Value::Reg, entry_[code]}, index);
+            }
+            continue;
+        }
+        if (current.kind == Value::EntryFlags) {
+            current = ToReg(current, index);
+        }
+        if (current.kind == Value::Reg) {
+            Use(current, index);
+            auto &interval = alloc_[current.id];
+            if (interval.hint < 0 && interval.fixed < 0) {
+                interval.hint = static_cast<int8_t>(code);
+            }
+        }
+    }
+}
+
+u32 IRBackendA64::CodeSizeBound() const {
+    // check bit shuffles on both paths
+    return static_cast<u32>(lowerings_.size() + constants_.size()) * max_instr_code + max_prologue_code +
+           2 * max_exit_code;
+}
+
+void IRBackendA64::Emit(Jit::A64::JitContext &context, Jit::IR::CodeBlock &block) {
+    auto start = block.Start();
+    // guest code pages of the block
+    for (u32 i = 0; i < block.GuestInstrCount(); ++i) {
+        context.FetchInstr(start + i * 4);
+    }
+    context.Tick(block.GuestInstrCount());
+    masm_ = &context.Assembler();
+    const auto &ctx = Register::GetXRegFromCode(context_reg_);
+    {
+        // nothing may use x16/x17 behind our back, they hold guest registers
+        vixl::aarch64::UseScratchRegisterScope scratch(masm_);
+        scratch.ExcludeAll();
+        auto evicted = alloc_.Evicted();
+        for (u8 code = 0; code < LinearScanA64::reg_count; ++code) {
+            if ((evicted >> code) & 1) {
+                __ Str(Register::GetXRegFromCode(code), MemOperand(ctx, 8 * code));
+            }
+        }
+        if (entry_flags_ != none) {
+            __ Mrs(Register::GetXRegFromCode(alloc_[entry_flags_].reg), vixl::aarch64::NZCV);
+        }
+        if (fastmem_base_ != none) {
+            __ Ldr(Register::GetXRegFromCode(alloc_[fastmem_base_].reg),
+                   MemOperand(ctx, OFFSET_OF(CPU::A64::CPUContext, fastmem_base)));
+        }
+        u32 next_constant{0};
+        for (u32 index = 0; index < lowerings_.size(); ++index) {
+            for (; next_constant < constants_.size() && infos_[constants_[next_constant]].const_at == index;
+                   next_constant++) {
+                auto id = constants_[next_constant];
+                __ Mov(Register::GetXRegFromCode(alloc_[id].reg), infos_[id].imm);
+            }
+            if (lowerings_[index].emit) {
+                EmitInstr(lowerings_[index]);
+            }
+        }
+        for (; next_constant < constants_.size(); next_constant++) {
+            auto id = constants_[next_constant];
+            __ Mov(Register::GetXRegFromCode(alloc_[id].reg), infos_[id].imm);
+        }
+        if (exit_to_flags_) {
+            __ Msr(vixl::aarch64::NZCV, Register::GetXRegFromCode(alloc_[exit_flags_.id].reg));
+        }
+    }
+    EmitExit(context, block);
+    context.EndBlock();
+}
+
+void IRBackendA64::EmitInstr(const Lowering &lowering) {
+    auto &instr = *lowering.instr;
+    auto &args = lowering.args;
+    auto op = instr.opcode_;
+    auto x = [this](const Value &v) -> Register {
+        if (v.kind == Value::Zero) {
+            return vixl::aarch64::xzr;
+        }
+        assert(v.kind == Value::Reg);
+        return Register::GetXRegFromCode(alloc_[v.id].reg);
+    };
+    auto w = [this](const Value &v) -> Register {
+        if (v.kind == Value::Zero) {
+            return vixl::aarch64::wzr;
+        }
+        assert(v.kind == Value::Reg);
+        return Register::GetWRegFromCode(alloc_[v.id].reg);
+    };
+    // registers of the op width
+    bool wide = IsWide(instr);
+    auto r = [&](const Value &v) {
+        return wide ? x(v) : w(v);
+    };
+    // pure ops nobody reads the register of
+    bool live = lowering.result.kind != Value::Reg || infos_[lowering.result.id].used;
+    auto &rd = lowering.result;
+    auto add_sub_operand = [&](const Value &v, bool op_wide) -> Operand {
+        if (v.kind == Value::Imm) {
+            s64 imm;
+            AddSubImm(v.imm, op_wide, imm);
+            return Operand(imm);
+        }
+        return Operand(op_wide ? x(v) : w(v));
+    };
+    auto logical_operand = [&](const Value &v) -> Operand {
+        if (v.kind == Value::Imm) {
+            return Operand(static_cast<s64>(wide ? v.imm : v.imm & UINT32_MAX));
+        }
+        return Operand(r(v));
+    };
+    auto memory = [&](const Value &address) {
+        if (fastmem_) {
+            return MemOperand(Register::GetXRegFromCode(alloc_[fastmem_base_].reg), x(address));
+        }
+        return MemOperand(x(address));
+    };
+    auto shift = [&](void (vixl::aarch64::MacroAssembler::*by_imm)(const Register &, const Register &, unsigned),
+                     void (vixl::aarch64::MacroAssembler::*by_reg)(const Register &, const Register &,
+                                                                  const Register &)) {
+        if (args[1].kind == Value::Imm) {
+            (masm_->*by_imm)(r(rd), r(args[0]), static_cast<unsigned>(args[1].imm & (wide ? 63 : 31)));
+        } else {
+            (masm_->*by_reg)(r(rd), r(args[0]), r(args[1]));
+        }
+    };
+    switch (op) {
+        case IR_OP(AddReg32):
+        case IR_OP(AddReg64):
+            if (live) {
+                __ Add(r(rd), r(args[0]), add_sub_operand(args[1], wide));
+            }
+            break;
+        case IR_OP(SubReg32):
+        case IR_OP(SubReg64):
+            if (live) {
+                __ Sub(r(rd), r(args[0]), add_sub_operand(args[1], wide));
+            }
+            break;
+        case IR_OP(MulReg32):
+        case IR_OP(MulReg64):
+            if (live) {
+                __ Mul(r(rd), r(args[0]), r(args[1]));
+            }
+            break;
+        case IR_OP(AndReg32):
+        case IR_OP(AndReg64):
+            if (live) {
+                __ And(r(rd), r(args[0]), logical_operand(args[1]));
+            }
+            break;
+        case IR_OP(OrReg32):
+        case IR_OP(OrReg64):
+            if (live) {
+                __ Orr(r(rd), r(args[0]), logical_operand(args[1]));
+            }
+            break;
+        case IR_OP(EorReg32):
+        case IR_OP(EorReg64):
+            if (live) {
+                __ Eor(r(rd), r(args[0]), logical_operand(args[1]));
+            }
+            break;
+        case IR_OP(NotReg32):
+        case IR_OP(NotReg64):
+            if (live) {
+                __ Mvn(r(rd), r(args[0]));
+            }
+            break;
+        case IR_OP(LslReg32):
+        case IR_OP(LslReg64):
+            if (live) {
+                shift(&vixl::aarch64::MacroAssembler::Lsl, &vixl::aarch64::MacroAssembler::Lsl);
+            }
+            break;
+        case IR_OP(LsrReg32):
+        case IR_OP(LsrReg64):
+            if (live) {
+                shift(&vixl::aarch64::MacroAssembler::Lsr, &vixl::aarch64::MacroAssembler::Lsr);
+            }
+            break;
+        case IR_OP(AsrReg32):
+        case IR_OP(AsrReg64):
+            if (live) {
+                shift(&vixl::aarch64::MacroAssembler::Asr, &vixl::aarch64::MacroAssembler::Asr);
+            }
+            break;
+        case IR_OP(RorReg32):
+        case IR_OP(RorReg64):
+            if (live) {
+                shift(&vixl::aarch64::MacroAssembler::Ror, &vixl::aarch64::MacroAssembler::Ror);
+            }
+            break;
+        case IR_OP(UDivReg32):
+        case IR_OP(UDivReg64):
+            // x / 0 = 0 on the host too
+            if (live) {
+                __ Udiv(r(rd), r(args[0]), r(args[1]));
+            }
+            break;
+        case IR_OP(SDivReg32):
+        case IR_OP(SDivReg64):
+            if (live) {
+                __ Sdiv(r(rd), r(args[0]), r(args[1]));
+            }
+            break;
+        case IR_OP(ClzReg32):
+        case IR_OP(ClzReg64):
+            if (live) {
+                __ Clz(r(rd), r(args[0]));
+            }
+            break;
+        case IR_OP(RevReg32):
+        case IR_OP(RevReg64):
+            if (live) {
+                __ Rev(r(rd), r(args[0]));
+            }
+            break;
+        case IR_OP(SignExtend8):
+            if (live) {
+                __ Sxtb(x(rd), x(args[0]));
+            }
+            break;
+        case IR_OP(SignExtend16):
+            if (live) {
+                __ Sxth(x(rd), x(args[0]));
+            }
+            break;
+        case IR_OP(SignExtend32):
+            if (live) {
+                __ Sxtw(x(rd), x(args[0]));
+            }
+            break;
+        case IR_OP(AddFlags32):
+        case IR_OP(AddFlags64):
+        case IR_OP(SubFlags32):
+        case IR_OP(SubFlags64): {
+            bool op_wide = op == IR_OP(AddFlags64) || op == IR_OP(SubFlags64);
+            auto a = op_wide ? x(args[0]) : w(args[0]);
+            if (op == IR_OP(AddFlags32) || op == IR_OP(AddFlags64)) {
+                __ Cmn(a, add_sub_operand(args[1], op_wide));
+            } else {
+                __ Cmp(a, add_sub_operand(args[1], op_wide));
+            }
+            if (live) {
+                __ Mrs(x(rd), vixl::aarch64::NZCV);
+            }
+            break;
+        }
+        case IR_OP(LogicFlags32):
+        case IR_OP(LogicFlags64): {
+            auto a = op == IR_OP(LogicFlags64) ? x(args[0]) : w(args[0]);
+            __ Tst(a, a);
+            if (live) {
+                __ Mrs(x(rd), vixl::aarch64::NZCV);
+            }
+            break;
+        }
+        case IR_OP(CheckCond):
+            if (lowering.to_flags) {
+                __ Msr(vixl::aarch64::NZCV, x(args[0]));
+            }
+            if (live) {
+                __ Cset(w(rd), static_cast<vixl::aarch64::Condition>(lowering.cond));
+            }
+            break;
+        case IR_OP(Select32):
+        case IR_OP(Select64):
+            if (lowering.fused) {
+                if (live) {
+                    __ Csel(r(rd), r(args[1]), r(args[2]), static_cast<vixl::aarch64::Condition>(lowering.cond));
+                }
+            } else {
+                // flags were counted clobbered by the plan either way
+                __ Tst(w(args[0]), 1);
+                if (live) {
+                    __ Csel(r(rd), r(args[1]), r(args[2]), vixl::aarch64::ne);
+                }
+            }
+            break;
+        case IR_OP(CheckZero32):
+            // clz of 0 is the only one with bit 5 set, no flags touched
+            if (live) {
+                __ Clz(w(rd), w(args[0]));
+                __ Lsr(w(rd), w(rd), 5);
+            }
+            break;
+        case IR_OP(CheckZero64):
+            if (live) {
+                __ Clz(x(rd), x(args[0]));
+                __ Lsr(x(rd), x(rd), 6);
+            }
+            break;
+        case IR_OP(TestBit):
+            if (live) {
+                __ Ubfx(x(rd), x(args[0]), static_cast<unsigned>(args[1].imm & 63), 1);
+            }
+            break;
+        case IR_OP(Ldr8):
+            __ Ldrb(w(rd), memory(args[0]));
+            break;
+        case IR_OP(Ldr16):
+            __ Ldrh(w(rd), memory(args[0]));
+            break;
+        case IR_OP(Ldr32):
+            __ Ldr(w(rd), memory(args[0]));
+            break;
+        case IR_OP(Ldr64):
+            __ Ldr(x(rd), memory(args[0]));
+            break;
+        case IR_OP(Str8):
+            __ Strb(w(args[1]), memory(args[0]));
+            break;
+        case IR_OP(Str16):
+            __ Strh(w(args[1]), memory(args[0]));
+            break;
+        case IR_OP(Str32):
+            __ Str(w(args[1]), memory(args[0]));
+            break;
+        case IR_OP(Str64):
+            __ Str(x(args[1]), memory(args[0]));
+            break;
+        case IR_OP(Fence):
+            __ Dmb(vixl::aarch64::InnerShareable, vixl::aarch64::BarrierAll);
+            break;
+        case A64_OP(A64GetX):
+        case A64_OP(A64GetW): {
+            auto code = instr.args_[0].value_.fronted.code;
+            Register dst = op == A64_OP(A64GetX) ? x(rd) : w(rd);
+            if (code == 31) {
+                __ Mov(dst, op == A64_OP(A64GetX) ? Register(vixl::aarch64::sp) : Register(vixl::aarch64::wsp));
+            } else if (code == context_reg_) {
+                __ Ldr(dst, MemOperand(Register::GetXRegFromCode(context_reg_), 8 * code));
+            } else {
+                __ Mov(w(rd), w(args[0]));
+            }
+            break;
+        }
+        case A64_OP(A64SetX):
+        case A64_OP(A64SetW): {
+            auto code = instr.args_[0].value_.fronted.code;
+            if (rd.kind == Value::Reg) {
+                __ Mov(w(rd), w(args[0]));
+            }
+            if (code == 31) {
+                __ Mov(vixl::aarch64::sp, x(args[1]));
+            } else if (code == context_reg_) {
+                __ Str(x(args[1]), MemOperand(Register::GetXRegFromCode(context_reg_), 8 * code));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void IRBackendA64::EmitShuffle() {
+    const auto &ctx = Register::GetXRegFromCode(context_reg_);
+    vixl::aarch64::UseScratchRegisterScope scratch(masm_);
+    scratch.ExcludeAll();
+    struct Move {
+        u8 dst;
+        u8 src;
+    };
+    std::array<Move, 31> moves;
+    u32 move_count{0};
+    for (u8 code = 0; code < guest_.size(); ++code) {
+        auto &current = guest_[code];
+        if (code == context_reg_ || current.kind != Value::Reg) {
+            continue;
+        }
+        auto src = static_cast<u8>(alloc_[current.id].reg);
+        if (src != code) {
+            moves[move_count++] = {code, src};
+        }
+    }
+    // a register is written once nothing else still reads it, a cycle is broken through the context
+    u32 reload{0};
+    while (move_count) {
+        bool progress{false};
+        for (u32 i = 0; i < move_count; ++i) {
+            auto dst = moves[i].dst;
+            bool read = false;
+            for (u32 j = 0; j < move_count; ++j) {
+                if (j != i && moves[j].src == dst) {
+                    read = true;
+                    break;
+                }
+            }
+            if (!read) {
+                __ Mov(Register::GetXRegFromCode(dst), Register::GetXRegFromCode(moves[i].src));
+                moves[i] = moves[--move_count];
+                progress = true;
+                break;
+            }
+        }
+        if (!progress) {
+            auto &move = moves[--move_count];
+            __ Str(Register::GetXRegFromCode(move.src), MemOperand(ctx, 8 * move.dst));
+            reload |= 1U << move.dst;
+        }
+    }
+    for (u8 code = 0; code < guest_.size(); ++code) {
+        if (code != context_reg_ && guest_[code].kind == Value::Imm) {
+            __ Mov(Register::GetXRegFromCode(code), guest_[code].imm);
+        }
+    }
+    reload |= alloc_.Evicted();
+    for (u8 code = 0; code < LinearScanA64::reg_count; ++code) {
+        if ((reload >> code) & 1) {
+            __ Ldr(Register::GetXRegFromCode(code), MemOperand(ctx, 8 * code));
+        }
+    }
+}
+
+void IRBackendA64::EmitExit(Jit::A64::JitContext &context, Jit::IR::CodeBlock &block) {
+    auto last_pc = block.Start() + (block.GuestInstrCount() - 1) * 4;
+    auto exit = [&](VAddr target) {
+        EmitShuffle();
+        context.SetPC(last_pc);
+        context.Terminal();
+        context.Forward(target);
+    };
+    switch (block.GetTerminalType()) {
+        case Jit::IR::CodeBlock::IF: {
+            auto &ter = block.GetIf();
+            auto cond = static_cast<u8>(ter.if_);
+            EmitShuffle();
+            context.SetPC(last_pc);
+            context.Terminal();
+            if (cond >= static_cast<u8>(Instructions::Condition::AL)) {
+                context.Forward(ter.then_.pc_);
+                break;
+            }
+            auto then_label = context.GetLabelAlloc().AllocLabel();
+            __ B(then_label, static_cast<vixl::aarch64::Condition>(cond));
+            context.Forward(ter.else_.pc_);
+            __ Bind(then_label);
+            context.Forward(ter.then_.pc_);
+            break;
+        }
+        case Jit::IR::CodeBlock::CHECK_BIT: {
+            auto &ter = block.GetCheckBit();
+            if (exit_value_.kind == Value::Imm) {
+                exit((exit_value_.imm & 1) ? ter.then_.pc_ : ter.else_.pc_);
+                break;
+            }
+            auto then_label = context.GetLabelAlloc().AllocLabel();
+            __ Tbnz(Register::GetXRegFromCode(alloc_[exit_value_.id].reg), 0, then_label);
+            exit(ter.else_.pc_);
+            __ Bind(then_label);
+            exit(ter.then_.pc_);
+            break;
+        }
+        case Jit::IR::CodeBlock::INDIRECT: {
+            if (exit_value_.kind == Value::Imm) {
+                exit(exit_value_.imm);
+                break;
+            }
+            const auto &ctx = Register::GetXRegFromCode(context_reg_);
+            // no register is left for the target once the guest ones are back
+            __ Str(Register::GetXRegFromCode(alloc_[exit_value_.id].reg), MemOperand(ctx, OFFSET_CTX_A64_QUERY_PAGE));
+            EmitShuffle();
+            context.SetPC(last_pc);
+            context.Terminal();
+            context.Forward(MemOperand(ctx, OFFSET_CTX_A64_QUERY_PAGE));
+            break;
+        }
+        case Jit::IR::CodeBlock::TRAP: {
+            auto &ter = block.GetTrap();
+            EmitShuffle();
+            context.SetPC(ter.at_.pc_);
+            CPU::A64::InterruptHelp interrupt{};
+            interrupt.reason = static_cast<CPU::A64::InterruptHelp::Reason>(ter.reason_);
+            interrupt.data = ter.data_;
+            context.Interrupt(interrupt);
+            break;
+        }
+        default:
+            exit(block.GetLink().next_.pc_);
+            break;
+    }
+}
@@ -0,0 +1,173 @@
+//
+// Created by SwiftGan on 2020/11/28.
+//
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <base/marcos.h>
+#include "linear_scan_a64.h"
+
+namespace SVM::A64 {
+    class Instance;
+}
+
+namespace Jit::A64 {
+    class JitContext;
+}
+
+namespace Jit::IR {
+    class CodeBlock;
+    class PassManagerIR;
+}
+
+namespace Instructions::IR {
+    class InstrIR;
+}
+
+namespace Instructions::A64 {
+    class IRLifterA64;
+}
+
+namespace vixl::aarch64 {
+    class MacroAssembler;
+}
+
+namespace Backend::A64 {
+
+    // optimized tier, lowers the lifted and optimized ir of a block to host code.
+    // the block enters and leaves with the baseline register state (guest x_i in host x_i,
+    // guest flags in host flags), in between guest registers and ir values share the host
+    // registers as the linear scan gives them out and are put back at the exit only.
+    // blocks with ops it has no lowering for are left to the decoder: system registers,
+    // exclusives, simd and memory behind a page table walk (fastmem or no mmu only)
+    class IRBackendA64 {
+    public:
+        explicit IRBackendA64(SVM::A64::Instance &instance);
+
+        ~IRBackendA64();
+
+        // emits the block at start between BeginBlock and EndBlock of context,
+        // returns the end of its guest code, 0 if nothing was emitted.
+        // a block it can not take leaves context untouched and counts as rejected,
+        // one aborted for lack of code space was begun and goes on in the decoder
+        VAddr Translate(Jit::A64::JitContext &context, VAddr start);
+
+        // blocks emitted, blocks it can not take
+        u64 Translated() const;
+
+        u64 Rejected() const;
+
+    private:
+        constexpr static u32 none = UINT32_MAX;
+
+        // operand of a lowered instruction
+        struct Value {
+            enum Kind : u8 {
+                None,
+                Imm,
+                // interval id
+                Reg,
+                Zero,
+                // guest flags of the block entry, still in host flags until clobbered
+                EntryFlags
+            };
+            Kind kind{None};
+            u32 id{none};
+            u64 imm{};
+        };
+
+        struct ValueInfo {
+            // zero extended from 32 bits
+            bool narrow;
+            // some instruction reads the register, else the definition can be skipped
+            bool used;
+            // constant materialized before lowering index const_at
+            bool constant;
+            u32 const_at;
+            u64 imm;
+            // CheckCond results: the flags value and condition, for Select to fuse
+            u32 cond_flags;
+            u8 cond;
+        };
+
+        struct Lowering {
+            const Instructions::IR::InstrIR *instr;
+            Value result;
+            std::array<Value, 3> args;
+            bool emit;
+            // CheckCond: the flags value is moved into host flags first
+            bool to_flags;
+            // Select: csel on the condition of the host flags
+            bool fused;
+            u8 cond;
+        };
+
+        bool Plan(Jit::IR::CodeBlock &block);
+
+        bool PlanInstr(const Instructions::IR::InstrIR &instr, Lowering &lowering, u32 index);
+
+        void PlanExit(Jit::IR::CodeBlock &block, u32 index);
+
+        u32 NewValue(u32 start, bool narrow, int8_t fixed = -1);
+
+        Value Ref(const Instructions::IR::InstrIR &instr, u32 arg);
+
+        // the register of guest code at block entry
+        Value EntryX(u8 code);
+
+        // v as register operand read at lowering index, constants are materialized
+        Value ToReg(Value v, u32 index, bool zero = false);
+
+        void Use(const Value &v, u32 index);
+
+        // v read as flags at lowering index, true if it has to be moved to host flags
+        bool UseFlags(Value &v, u32 index);
+
+        u32 FlagsId(const Value &v) const;
+
+        // upper bound of the host code, checked against the code buffer
+        u32 CodeSizeBound() const;
+
+        void Emit(Jit::A64::JitContext &context, Jit::IR::CodeBlock &block);
+
+        void EmitInstr(const Lowering &lowering);
+
+        void EmitExit(Jit::A64::JitContext &context, Jit::IR::CodeBlock &block);
+
+        // guest registers back to their host registers
+        void EmitShuffle();
+
+        SVM::A64::Instance &instance_;
+        u8 context_reg_;
+        bool fastmem_;
+        bool memory_ok_;
+        std::unique_ptr<Instructions::A64::IRLifterA64> lifter_;
+        std::unique_ptr<Jit::IR::PassManagerIR> passes_;
+        LinearScanA64 alloc_;
+        vixl::aarch64::MacroAssembler *masm_{};
+
+        // per block
+        std::vector<ValueInfo> infos_;
+        std::vector<Value> values_;
+        std::vector<Lowering> lowerings_;
+        std::vector<u32> constants_;
+        // guest x0 - x30 state: None is the value of the block entry
+        std::array<Value, 31> guest_;
+        std::array<u32, 31> entry_;
+        Value nzcv_;
+        u32 flags_holder_;
+        u32 entry_flags_;
+        u32 fastmem_base_;
+        // exit
+        Value exit_value_;
+        Value exit_flags_;
+        bool exit_to_flags_;
+
+        u64 translated_{0};
+        u64 rejected_{0};
+    };
+
+}
@@ -0,0 +1,93 @@
+//
+// Created by SwiftGan on 2020/11/28.
+//
+
+#include <algorithm>
+#include <array>
+#include "linear_scan_a64.h"
+
+using namespace Backend::A64;
+
+void LinearScanA64::Reset(u32 reserved, u32 untouched) {
+    intervals_.clear();
+    reserved_ = reserved;
+    untouched_ = untouched & ~reserved;
+    evicted_ = 0;
+}
+
+u32 LinearScanA64::Add(const LiveInterval &interval) {
+    intervals_.push_back(interval);
+    return static_cast<u32>(intervals_.size() - 1);
+}
+
+LiveInterval &LinearScanA64::operator[](u32 id) {
+    return intervals_[id];
+}
+
+u32 LinearScanA64::Count() const {
+    return static_cast<u32>(intervals_.size());
+}
+
+bool LinearScanA64::Run() {
+    // fixed intervals all start at the block entry, so a register is free
+    // once the last interval put into it has ended
+    std::array<s64, reg_count> busy_until;
+    busy_until.fill(-1);
+    u32 hinted{0};
+    order_.clear();
+    for (u32 id = 0; id < intervals_.size(); ++id) {
+        auto &interval = intervals_[id];
+        if (interval.fixed >= 0) {
+            interval.reg = interval.fixed;
+            busy_until[interval.fixed] = std::max<s64>(busy_until[interval.fixed], interval.end);
+            continue;
+        }
+        if (interval.hint >= 0) {
+            hinted |= 1U << interval.hint;
+        }
+        order_.push_back(id);
+    }
+    std::stable_sort(order_.begin(), order_.end(), [this](u32 a, u32 b) {
+        return intervals_[a].start < intervals_[b].start;
+    });
+    for (auto id : order_) {
+        auto &interval = intervals_[id];
+        u32 blocked = reserved_ | (untouched_ & ~evicted_);
+        auto free = [&](int8_t reg) {
+            return !((blocked >> reg) & 1) && busy_until[reg] < static_cast<s64>(interval.start);
+        };
+        int8_t pick = -1;
+        if (interval.hint >= 0 && free(interval.hint)) {
+            pick = interval.hint;
+        } else {
+            // leave the registers other values want to end in to them
+            for (int8_t reg = 0; reg < reg_count; ++reg) {
+                if (!free(reg)) {
+                    continue;
+                }
+                if (!((hinted >> reg) & 1)) {
+                    pick = reg;
+                    break;
+                }
+                if (pick < 0) {
+                    pick = reg;
+                }
+            }
+        }
+        if (pick < 0) {
+            u32 candidates = untouched_ & ~evicted_;
+            if (!candidates) {
+                return false;
+            }
+            pick = static_cast<int8_t>(31 - __builtin_clz(candidates));
+            evicted_ |= 1U << pick;
+        }
+        interval.reg = pick;
+        busy_until[pick] = interval.end;
+    }
+    return true;
+}
+
+u32 LinearScanA64::Evicted() const {
+    return evicted_;
+}
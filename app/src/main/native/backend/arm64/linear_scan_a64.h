@@ -0,0 +1,55 @@
+//
+// Created by SwiftGan on 2020/11/28.
+//
+
+#pragma once
+
+#include <vector>
+#include <base/marcos.h>
+
+namespace Backend::A64 {
+
+    // values of a block live at positions [start, end], the instruction reading
+    // a value and the one defining the next can share a register
+    struct LiveInterval {
+        u32 start;
+        u32 end;
+        // host register the value is in from the block entry, a guest register
+        int8_t fixed{-1};
+        // host register it better goes to, the guest register it is left in at the exit
+        int8_t hint{-1};
+        // allocated host register
+        int8_t reg{-1};
+    };
+
+    // linear scan of the values of one block onto host x0 - x30.
+    // a guest register the block never names keeps its value in its host register,
+    // it is taken only if nothing else is free: spilled to the context at entry, reloaded at the exits
+    class LinearScanA64 {
+    public:
+        constexpr static u8 reg_count = 31;
+
+        // reserved registers are never handed out
+        void Reset(u32 reserved, u32 untouched);
+
+        u32 Add(const LiveInterval &interval);
+
+        LiveInterval &operator[](u32 id);
+
+        u32 Count() const;
+
+        // false if more values are live at once than there are registers
+        bool Run();
+
+        // guest registers to spill at block entry and reload at the exits
+        u32 Evicted() const;
+
+    private:
+        std::vector<LiveInterval> intervals_;
+        std::vector<u32> order_;
+        u32 reserved_{};
+        u32 untouched_{};
+        u32 evicted_{};
+    };
+
+}
@@ -2,15 +2,528 @@
 // Created by 甘尧 on 2019-11-08.
 //
 
+#include <atomic>
+#include <cstring>
 #include "interpreter_ir.h"
 
 using namespace Backend::IR;
+using namespace CPU::A64;
+using namespace Jit::IR;
+using namespace SVM::A64;
 
-void InterpreterIR::run(void *context, InstrIR &instr) {
-    switch (instr.opcode_) {
-        case static_cast<u8>(OpcodeIR::Nop):
+static InterpreterOp ToInterpreterOp(u8 opcode) {
+    switch (opcode) {
+#define OP(name) case static_cast<u8>(OpcodeIR::name): return InterpreterOp::name;
+        INTERPRETER_OPS_IR(OP)
+#undef OP
+#define OP(name) case static_cast<u8>(Instructions::A64::OpcodeIRA64::name): return InterpreterOp::name;
+        INTERPRETER_OPS_A64(OP)
+#undef OP
+        default:
+            return InterpreterOp::Count;
+    }
+}
+
+// ops that have to run even if nothing reads their result
+static bool HasSideEffect(InterpreterOp op) {
+    switch (op) {
+        // loads may fault
+        case InterpreterOp::Str8:
+        case InterpreterOp::Str16:
+        case InterpreterOp::Str32:
+        case InterpreterOp::Str64:
+        case InterpreterOp::Ldr8:
+        case InterpreterOp::Ldr16:
+        case InterpreterOp::Ldr32:
+        case InterpreterOp::Ldr64:
+        case InterpreterOp::Strx8:
+        case InterpreterOp::Strx16:
+        case InterpreterOp::Strx32:
+        case InterpreterOp::Strx64:
+        case InterpreterOp::Ldrx8:
+        case InterpreterOp::Ldrx16:
+        case InterpreterOp::Ldrx32:
+        case InterpreterOp::Ldrx64:
+        case InterpreterOp::ClearExclusive:
+        case InterpreterOp::Fence:
+        case InterpreterOp::A64SetX:
+        case InterpreterOp::A64SetW:
+        case InterpreterOp::A64SetNZCV:
+        case InterpreterOp::A64SetSys:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline bool CondHolds(u32 nzcv, u8 cond) {
+    bool n = (nzcv >> 31) & 1;
+    bool z = (nzcv >> 30) & 1;
+    bool c = (nzcv >> 29) & 1;
+    bool v = (nzcv >> 28) & 1;
+    bool result;
+    switch (cond >> 1) {
+        case 0:
+            result = z;
+            break;
+        case 1:
+            result = c;
+            break;
+        case 2:
+            result = n;
+            break;
+        case 3:
+            result = v;
+            break;
+        case 4:
+            result = c && !z;
+            break;
+        case 5:
+            result = n == v;
+            break;
+        case 6:
+            result = n == v && !z;
             break;
         default:
+            result = true;
+            break;
+    }
+    // odd conditions are the inverse, except nv
+    return (cond & 1) && cond != 15 ? !result : result;
+}
+
+template<typename T>
+static inline u32 AddFlags(T a, T b) {
+    constexpr u32 top = sizeof(T) * 8 - 1;
+    T r = a + b;
+    u32 n = static_cast<u32>(r >> top);
+    u32 z = r == 0;
+    u32 c = r < a;
+    u32 v = static_cast<u32>(((~(a ^ b) & (a ^ r)) >> top) & 1);
+    return (n << 31) | (z << 30) | (c << 29) | (v << 28);
+}
+
+template<typename T>
+static inline u32 SubFlags(T a, T b) {
+    constexpr u32 top = sizeof(T) * 8 - 1;
+    T r = a - b;
+    u32 n = static_cast<u32>(r >> top);
+    u32 z = r == 0;
+    u32 c = a >= b;
+    u32 v = static_cast<u32>((((a ^ b) & (a ^ r)) >> top) & 1);
+    return (n << 31) | (z << 30) | (c << 29) | (v << 28);
+}
+
+template<typename T>
+static inline u32 LogicFlags(T r) {
+    constexpr u32 top = sizeof(T) * 8 - 1;
+    return (static_cast<u32>(r >> top) << 31) | (u32(r == 0) << 30);
+}
+
+InterpreterIR::InterpreterIR(CPUContext *context, A64MMU *mmu, Memory::ExclusiveMonitor *monitor)
+        : context_(context), mmu_(mmu), monitor_(monitor) {
+    if (mmu_) {
+        page_mask_ = (VAddr(1) << mmu_->GetPageBits()) - 1;
+    }
+    static_assert(OFFSET_OF(CPUContext, sp) == 31 * sizeof(u64), "x0 - x30 and sp are indexed by code");
+}
+
+std::unique_ptr<ProgramIR> InterpreterIR::Compile(CodeBlock &block) {
+    // slot indexes are u16, constants take at most three per op
+    if (block.InstrCount() * 4 + 1 > UINT16_MAX) {
+        return nullptr;
+    }
+    auto program = std::make_unique<ProgramIR>();
+    program->start = block.Start();
+    program->guest_count = block.GuestInstrCount();
+    program->slots.resize(block.InstrCount());
+    auto slot = [&program](const Argument &arg) -> u16 {
+        if (arg.IsValue()) {
+            return static_cast<u16>(arg.value_.instr->id_);
+        }
+        if (arg.IsFrontedReg()) {
+            return arg.value_.fronted.code;
+        }
+        if (!arg.IsImm()) {
+            return 0;
+        }
+        program->slots.push_back(arg.ImmValue());
+        return static_cast<u16>(program->slots.size() - 1);
+    };
+    program->ops.reserve(block.InstrCount() + 1);
+    for (auto &instr : block.Instrs()) {
+        if (instr.opcode_ == static_cast<u8>(OpcodeIR::Nop)) {
+            continue;
+        }
+        auto op = ToInterpreterOp(instr.opcode_);
+        if (op == InterpreterOp::Count) {
+            return nullptr;
+        }
+        if (!instr.use_count && !HasSideEffect(op)) {
+            continue;
+        }
+        auto &out = program->ops.emplace_back();
+        out.handler = nullptr;
+        out.op = op;
+        out.guest_index = instr.guest_index_;
+        out.dst = static_cast<u16>(instr.id_);
+        out.a = slot(instr.args_[0]);
+        out.b = slot(instr.args_[1]);
+        out.c = slot(instr.args_[2]);
+    }
+    program->ops.push_back({nullptr, InterpreterOp::End, program->guest_count, 0, 0, 0, 0});
+    program->terminal = block.GetTerminalType();
+    switch (program->terminal) {
+        case CodeBlock::LINK:
+            program->then_pc = block.GetLink().next_.pc_;
+            break;
+        case CodeBlock::IF: {
+            auto &ter = block.GetIf();
+            program->cond = static_cast<u8>(ter.if_);
+            program->then_pc = ter.then_.pc_;
+            program->else_pc = ter.else_.pc_;
+            break;
+        }
+        case CodeBlock::CHECK_BIT: {
+            auto &ter = block.GetCheckBit();
+            program->value_slot = slot(ter.bit_);
+            program->then_pc = ter.then_.pc_;
+            program->else_pc = ter.else_.pc_;
+            break;
+        }
+        case CodeBlock::INDIRECT:
+            program->value_slot = slot(block.GetIndirect().target_);
+            break;
+        case CodeBlock::TRAP: {
+            auto &ter = block.GetTrap();
+            program->trap_reason = ter.reason_;
+            program->trap_data = ter.data_;
+            program->then_pc = ter.at_.pc_;
+            break;
+        }
+        default:
+            return nullptr;
+    }
+    return program;
+}
+
+bool InterpreterIR::Run(ProgramIR &program) {
+    static const void *const handlers[] = {
+            &&End,
+#define OP(name) &&Op##name,
+            INTERPRETER_OPS_IR(OP)
+            INTERPRETER_OPS_A64(OP)
+#undef OP
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == static_cast<size_t>(InterpreterOp::Count));
+
+    if (!program.threaded) {
+        for (auto &op : program.ops) {
+            op.handler = handlers[static_cast<size_t>(op.op)];
+        }
+        program.threaded = true;
+    }
+
+    auto regs = reinterpret_cast<u64 *>(context_->cpu_registers);
+    auto slots = program.slots.data();
+    auto op = program.ops.data();
+
+#define DISPATCH() goto *(++op)->handler
+#define DST slots[op->dst]
+#define SA slots[op->a]
+#define SB slots[op->b]
+#define SC slots[op->c]
+#define HANDLER(name, ...) Op##name: { __VA_ARGS__; } DISPATCH();
+
+    goto *op->handler;
+
+    HANDLER(AddReg32, DST = static_cast<u32>(SA + SB))
+    HANDLER(AddReg64, DST = SA + SB)
+    HANDLER(SubReg32, DST = static_cast<u32>(SA - SB))
+    HANDLER(SubReg64, DST = SA - SB)
+    HANDLER(MulReg32, DST = static_cast<u32>(SA * SB))
+    HANDLER(MulReg64, DST = SA * SB)
+    HANDLER(AndReg32, DST = static_cast<u32>(SA & SB))
+    HANDLER(AndReg64, DST = SA & SB)
+    HANDLER(EorReg32, DST = static_cast<u32>(SA ^ SB))
+    HANDLER(EorReg64, DST = SA ^ SB)
+    HANDLER(OrReg32, DST = static_cast<u32>(SA | SB))
+    HANDLER(OrReg64, DST = SA | SB)
+    HANDLER(NotReg32, DST = static_cast<u32>(~SA))
+    HANDLER(NotReg64, DST = ~SA)
+    HANDLER(LslReg32, DST = static_cast<u32>(SA << (SB & 31)))
+    HANDLER(LslReg64, DST = SA << (SB & 63))
+    HANDLER(LsrReg32, DST = static_cast<u32>(SA) >> (SB & 31))
+    HANDLER(LsrReg64, DST = SA >> (SB & 63))
+    HANDLER(AsrReg32, DST = static_cast<u32>(static_cast<s32>(SA) >> (SB & 31)))
+    HANDLER(AsrReg64, DST = static_cast<u64>(static_cast<s64>(SA) >> (SB & 63)))
+    HANDLER(RorReg32,
+            auto value = static_cast<u32>(SA);
+            auto shift = SB & 31;
+            DST = shift ? static_cast<u32>((value >> shift) | (value << (32 - shift))) : value)
+    HANDLER(RorReg64,
+            auto shift = SB & 63;
+            DST = shift ? (SA >> shift) | (SA << (64 - shift)) : SA)
+    HANDLER(UDivReg32,
+            auto divisor = static_cast<u32>(SB);
+            DST = divisor ? static_cast<u32>(SA) / divisor : 0)
+    HANDLER(UDivReg64, DST = SB ? SA / SB : 0)
+    HANDLER(SDivReg32,
+            auto dividend = static_cast<s32>(SA);
+            auto divisor = static_cast<s32>(SB);
+            // min / -1 wraps
+            DST = !divisor ? 0 : static_cast<u32>(divisor == -1 ? 0 - static_cast<u32>(dividend)
+                                                                : static_cast<u32>(dividend / divisor)))
+    HANDLER(SDivReg64,
+            auto dividend = static_cast<s64>(SA);
+            auto divisor = static_cast<s64>(SB);
+            DST = !divisor ? 0 : (divisor == -1 ? 0 - static_cast<u64>(dividend)
+                                                : static_cast<u64>(dividend / divisor)))
+    HANDLER(ClzReg32,
+            auto value = static_cast<u32>(SA);
+            DST = value ? __builtin_clz(value) : 32)
+    HANDLER(ClzReg64, DST = SA ? __builtin_clzll(SA) : 64)
+    HANDLER(RevReg32, DST = __builtin_bswap32(static_cast<u32>(SA)))
+    HANDLER(RevReg64, DST = __builtin_bswap64(SA))
+    HANDLER(SignExtend8, DST = static_cast<u64>(static_cast<s64>(static_cast<s8>(SA))))
+    HANDLER(SignExtend16, DST = static_cast<u64>(static_cast<s64>(static_cast<s16>(SA))))
+    HANDLER(SignExtend32, DST = static_cast<u64>(static_cast<s64>(static_cast<s32>(SA))))
+    HANDLER(AddFlags32, DST = AddFlags<u32>(static_cast<u32>(SA), static_cast<u32>(SB)))
+    HANDLER(AddFlags64, DST = AddFlags<u64>(SA, SB))
+    HANDLER(SubFlags32, DST = SubFlags<u32>(static_cast<u32>(SA), static_cast<u32>(SB)))
+    HANDLER(SubFlags64, DST = SubFlags<u64>(SA, SB))
+    HANDLER(LogicFlags32, DST = LogicFlags<u32>(static_cast<u32>(SA)))
+    HANDLER(LogicFlags64, DST = LogicFlags<u64>(SA))
+    HANDLER(CheckCond, DST = CondHolds(static_cast<u32>(SA), static_cast<u8>(SB)))
+    HANDLER(Select32, DST = static_cast<u32>((SA & 1) ? SB : SC))
+    HANDLER(Select64, DST = (SA & 1) ? SB : SC)
+    HANDLER(CheckZero32, DST = static_cast<u32>(SA) == 0)
+    HANDLER(CheckZero64, DST = SA == 0)
+    HANDLER(TestBit, DST = (SA >> (SB & 63)) & 1)
+    HANDLER(Str8, if (!Write<u8>(SA, SB)) goto fault)
+    HANDLER(Str16, if (!Write<u16>(SA, SB)) goto fault)
+    HANDLER(Str32, if (!Write<u32>(SA, SB)) goto fault)
+    HANDLER(Str64, if (!Write<u64>(SA, SB)) goto fault)
+    HANDLER(Ldr8, if (!Read<u8>(SA, DST)) goto fault)
+    HANDLER(Ldr16, if (!Read<u16>(SA, DST)) goto fault)
+    HANDLER(Ldr32, if (!Read<u32>(SA, DST)) goto fault)
+    HANDLER(Ldr64, if (!Read<u64>(SA, DST)) goto fault)
+    HANDLER(Strx8, if (!StoreExclusive<u8>(SA, SB, DST)) goto fault)
+    HANDLER(Strx16, if (!StoreExclusive<u16>(SA, SB, DST)) goto fault)
+    HANDLER(Strx32, if (!StoreExclusive<u32>(SA, SB, DST)) goto fault)
+    HANDLER(Strx64, if (!StoreExclusive<u64>(SA, SB, DST)) goto fault)
+    HANDLER(Ldrx8, if (!LoadExclusive<u8>(SA, DST)) goto fault)
+    HANDLER(Ldrx16, if (!LoadExclusive<u16>(SA, DST)) goto fault)
+    HANDLER(Ldrx32, if (!LoadExclusive<u32>(SA, DST)) goto fault)
+    HANDLER(Ldrx64, if (!LoadExclusive<u64>(SA, DST)) goto fault)
+    HANDLER(ClearExclusive, context_->exclusive.addr = exclusive_none)
+    HANDLER(Fence, std::atomic_thread_fence(std::memory_order_seq_cst))
+    HANDLER(A64SetX, regs[op->a] = SB)
+    HANDLER(A64SetW, regs[op->a] = static_cast<u32>(SB))
+    HANDLER(A64GetX, DST = regs[op->a])
+    HANDLER(A64GetW, DST = static_cast<u32>(regs[op->a]))
+    HANDLER(A64GetNZCV, DST = context_->pstate.NZCV)
+    HANDLER(A64SetNZCV, context_->pstate.NZCV = static_cast<u32>(SA))
+    HANDLER(A64GetSys, DST = GetSys(static_cast<u16>(SA)))
+    HANDLER(A64SetSys, SetSys(static_cast<u16>(SA), SB))
+
+#undef HANDLER
+#undef SC
+#undef SB
+#undef SA
+#undef DST
+#undef DISPATCH
+
+    End: {
+        VAddr next;
+        switch (program.terminal) {
+            case CodeBlock::IF:
+                next = CondHolds(context_->pstate.NZCV, program.cond) ? program.then_pc : program.else_pc;
+                break;
+            case CodeBlock::CHECK_BIT:
+                next = (slots[program.value_slot] & 1) ? program.then_pc : program.else_pc;
+                break;
+            case CodeBlock::INDIRECT:
+                next = slots[program.value_slot];
+                break;
+            case CodeBlock::TRAP:
+                context_->pc = program.then_pc;
+                context_->interrupt.reason = static_cast<InterruptHelp::Reason>(program.trap_reason);
+                context_->interrupt.data = program.trap_data;
+                context_->ticks_now += program.guest_count;
+                return false;
+            default:
+                next = program.then_pc;
+                break;
+        }
+        context_->pc = next;
+        context_->ticks_now += program.guest_count;
+        return true;
+    }
+
+    fault:
+    // instructions before the faulting one are done, interrupt was set by the access
+    context_->pc = program.start + op->guest_index * 4;
+    context_->ticks_now += op->guest_index;
+    return false;
+}
+
+VAddr InterpreterIR::HostAddress(VAddr va, size_t size, bool write) {
+    VAddr offset = va & page_mask_;
+    if (offset + size > page_mask_ + 1) {
+        return 0;
+    }
+    auto pte = mmu_->GetPage(va - offset);
+    if (!pte) {
+        return 0;
+    }
+    auto attrs = pte->attrs_;
+    if (write ? !(attrs & PageAttrs::Write) || (attrs & PageAttrs::WriteSpec)
+              : !(attrs & PageAttrs::Read) || (attrs & PageAttrs::ReadSpec)) {
+        return 0;
+    }
+    return mmu_->GetPageStart(*pte) + offset;
+}
+
+bool InterpreterIR::SlowAccess(VAddr va, void *data, size_t size, bool write) {
+    bool spec = false;
+    VAddr last_page = (va + size - 1) & ~page_mask_;
+    for (VAddr page = va & ~page_mask_;; page += page_mask_ + 1) {
+        auto pte = mmu_->GetPage(page);
+        if (!pte || !(write ? mmu_->PageWritable(*pte) : mmu_->PageReadable(*pte))) {
+            context_->interrupt.reason = InterruptHelp::PageFatal;
+            context_->interrupt.fatal_addr = va;
+            return false;
+        }
+        spec |= (pte->attrs_ & (write ? PageAttrs::WriteSpec : PageAttrs::ReadSpec)) != 0;
+        if (page == last_page) {
+            break;
+        }
+    }
+    if (spec && mmu_->CallMemoryHooks(va, size, write, data)) {
+        return true;
+    }
+    if (write) {
+        mmu_->WriteMemory(va, data, size);
+    } else {
+        mmu_->ReadMemory(va, data, size);
+    }
+    return true;
+}
+
+template<typename T>
+bool InterpreterIR::Read(VAddr va, u64 &value) {
+    T data;
+    VAddr host = mmu_ ? HostAddress(va, sizeof(T), false) : va;
+    if (host) {
+        std::memcpy(&data, reinterpret_cast<const void *>(host), sizeof(T));
+    } else if (!SlowAccess(va, &data, sizeof(T), false)) {
+        return false;
+    }
+    value = data;
+    return true;
+}
+
+template<typename T>
+bool InterpreterIR::Write(VAddr va, u64 value) {
+    auto data = static_cast<T>(value);
+    VAddr host = mmu_ ? HostAddress(va, sizeof(T), true) : va;
+    if (host) {
+        std::memcpy(reinterpret_cast<void *>(host), &data, sizeof(T));
+        return true;
+    }
+    return SlowAccess(va, &data, sizeof(T), true);
+}
+
+template<typename T>
+bool InterpreterIR::LoadExclusive(VAddr va, u64 &value) {
+    auto &exclusive = context_->exclusive;
+    if (monitor_) {
+        exclusive.tag_entry = reinterpret_cast<VAddr>(&monitor_->Entry(va));
+        exclusive.tag = monitor_->Load(va);
+    }
+    if (!Read<T>(va, value)) {
+        exclusive.addr = exclusive_none;
+        return false;
+    }
+    exclusive.addr = va;
+    exclusive.value[0] = value;
+    return true;
+}
+
+template<typename T>
+bool InterpreterIR::StoreExclusive(VAddr va, u64 value, u64 &status) {
+    auto &exclusive = context_->exclusive;
+    bool open = exclusive.addr == va;
+    exclusive.addr = exclusive_none;
+    status = 1;
+    if (!open) {
+        return true;
+    }
+    if (monitor_) {
+        // same global monitor as the generated code
+        if (monitor_->Claim(va, exclusive.tag)) {
+            status = 0;
+            return Write<T>(va, value);
+        }
+        return true;
+    }
+    VAddr host = mmu_ ? HostAddress(va, sizeof(T), true) : va;
+    if (!host) {
+        status = 0;
+        return Write<T>(va, value);
+    }
+    // no host monitor across ir ops, the value seen by the load exclusive has to be still there
+    auto expected = static_cast<T>(exclusive.value[0]);
+    if (__atomic_compare_exchange_n(reinterpret_cast<T *>(host), &expected, static_cast<T>(value), false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        status = 0;
+    }
+    return true;
+}
+
+u64 InterpreterIR::GetSys(u16 reg) {
+    switch (static_cast<Instructions::A64::SysRegA64>(reg)) {
+        case Instructions::A64::SysRegA64::TPIDR:
+            return context_->tpidr;
+        case Instructions::A64::SysRegA64::TPIDRRO:
+            return context_->tpidrro;
+        case Instructions::A64::SysRegA64::CNTFREQ:
+            return context_->cntfreq;
+        case Instructions::A64::SysRegA64::CNTPCT:
+            return context_->ticks_now;
+        case Instructions::A64::SysRegA64::NZCV:
+            return context_->pstate.NZCV;
+        case Instructions::A64::SysRegA64::FPCR:
+            return context_->fpcr;
+        case Instructions::A64::SysRegA64::FPSR:
+            return context_->fpsr;
+    }
+    return 0;
+}
+
+void InterpreterIR::SetSys(u16 reg, u64 value) {
+    switch (static_cast<Instructions::A64::SysRegA64>(reg)) {
+        case Instructions::A64::SysRegA64::TPIDR:
+            context_->tpidr = value;
+            break;
+        case Instructions::A64::SysRegA64::TPIDRRO:
+            context_->tpidrro = value;
+            break;
+        case Instructions::A64::SysRegA64::CNTFREQ:
+            context_->cntfreq = value;
+            break;
+        case Instructions::A64::SysRegA64::CNTPCT:
+            context_->ticks_now = value;
+            break;
+        case Instructions::A64::SysRegA64::NZCV:
+            context_->pstate.NZCV = static_cast<u32>(value);
+            break;
+        case Instructions::A64::SysRegA64::FPCR:
+            context_->fpcr = static_cast<u32>(value);
+            break;
+        case Instructions::A64::SysRegA64::FPSR:
+            context_->fpsr = static_cast<u32>(value);
             break;
     }
 }
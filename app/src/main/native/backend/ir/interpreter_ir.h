@@ -4,15 +4,175 @@
 
 #pragma once
 
-#include <frontend/ir/instruction_ir.h>
+#include <frontend/ir/block_ir.h>
+#include <frontend/arm64/ir_for_a64.h>
+#include <asm/arm64/cpu_arm64.h>
+#include <memory/exclusive_monitor.h>
+#include <svm/arm64/svm_mmu.h>
 
 using namespace Instructions::IR;
 
+// ir ops the interpreter runs, one handler each
+#define INTERPRETER_OPS_IR(V) \
+  V(AddReg32)                 \
+  V(AddReg64)                 \
+  V(SubReg32)                 \
+  V(SubReg64)                 \
+  V(MulReg32)                 \
+  V(MulReg64)                 \
+  V(AndReg32)                 \
+  V(AndReg64)                 \
+  V(EorReg32)                 \
+  V(EorReg64)                 \
+  V(OrReg32)                  \
+  V(OrReg64)                  \
+  V(NotReg32)                 \
+  V(NotReg64)                 \
+  V(LslReg32)                 \
+  V(LslReg64)                 \
+  V(LsrReg32)                 \
+  V(LsrReg64)                 \
+  V(AsrReg32)                 \
+  V(AsrReg64)                 \
+  V(RorReg32)                 \
+  V(RorReg64)                 \
+  V(UDivReg32)                \
+  V(UDivReg64)                \
+  V(SDivReg32)                \
+  V(SDivReg64)                \
+  V(ClzReg32)                 \
+  V(ClzReg64)                 \
+  V(RevReg32)                 \
+  V(RevReg64)                 \
+  V(SignExtend8)              \
+  V(SignExtend16)             \
+  V(SignExtend32)             \
+  V(AddFlags32)               \
+  V(AddFlags64)               \
+  V(SubFlags32)               \
+  V(SubFlags64)               \
+  V(LogicFlags32)             \
+  V(LogicFlags64)             \
+  V(CheckCond)                \
+  V(Select32)                 \
+  V(Select64)                 \
+  V(CheckZero32)              \
+  V(CheckZero64)              \
+  V(TestBit)                  \
+  V(Str8)                     \
+  V(Str16)                    \
+  V(Str32)                    \
+  V(Str64)                    \
+  V(Ldr8)                     \
+  V(Ldr16)                    \
+  V(Ldr32)                    \
+  V(Ldr64)                    \
+  V(Strx8)                    \
+  V(Strx16)                   \
+  V(Strx32)                   \
+  V(Strx64)                   \
+  V(Ldrx8)                    \
+  V(Ldrx16)                   \
+  V(Ldrx32)                   \
+  V(Ldrx64)                   \
+  V(ClearExclusive)           \
+  V(Fence)
+
+#define INTERPRETER_OPS_A64(V) \
+  V(A64SetX)                   \
+  V(A64SetW)                   \
+  V(A64GetX)                   \
+  V(A64GetW)                   \
+  V(A64GetNZCV)                \
+  V(A64SetNZCV)                \
+  V(A64GetSys)                 \
+  V(A64SetSys)
+
 namespace Backend::IR {
 
+    enum class InterpreterOp : u16 {
+        // end of the ops, the terminal follows
+        End,
+#define OP(name) name,
+        INTERPRETER_OPS_IR(OP)
+        INTERPRETER_OPS_A64(OP)
+#undef OP
+        Count
+    };
+
+    // operands are slot indexes, fronted registers are their code
+    struct OpIR {
+        // handler label once threaded, null before
+        const void *handler;
+        InterpreterOp op;
+        // guest instruction of the block, for faults
+        u16 guest_index;
+        u16 dst;
+        u16 a;
+        u16 b;
+        u16 c;
+    };
 
+    // one block compiled for the interpreter, private to the thread running it
+    struct ProgramIR {
+        VAddr start;
+        u16 guest_count;
+        Jit::IR::CodeBlock::TerminalType terminal;
+        // If
+        u8 cond;
+        // CheckBit bit, Indirect target
+        u16 value_slot;
+        // Link and Trap use then_pc
+        VAddr then_pc;
+        VAddr else_pc;
+        u32 trap_reason;
+        u64 trap_data;
+        std::vector<OpIR> ops;
+        // results of the ops, constants behind them
+        std::vector<u64> slots;
+        bool threaded{false};
+    };
+
+    // portable tier, runs lifted blocks on the host directly from the ir.
+    // guest registers live in the context, memory goes through the mmu if there is one
     class InterpreterIR {
-        void run(void *context, InstrIR &instr);
+    public:
+        InterpreterIR(CPU::A64::CPUContext *context, SVM::A64::A64MMU *mmu,
+                      Memory::ExclusiveMonitor *monitor);
+
+        // null if the block uses an op the interpreter does not have
+        std::unique_ptr<ProgramIR> Compile(Jit::IR::CodeBlock &block);
+
+        // context pc is the next block after it, false if context interrupt has to be handled first
+        bool Run(ProgramIR &program);
+
+    private:
+        VAddr HostAddress(VAddr va, size_t size, bool write);
+
+        // spec pages, page crossing and faults
+        bool SlowAccess(VAddr va, void *data, size_t size, bool write);
+
+        template<typename T>
+        bool Read(VAddr va, u64 &value);
+
+        template<typename T>
+        bool Write(VAddr va, u64 value);
+
+        template<typename T>
+        bool LoadExclusive(VAddr va, u64 &value);
+
+        // status 0 if stored
+        template<typename T>
+        bool StoreExclusive(VAddr va, u64 value, u64 &status);
+
+        u64 GetSys(u16 reg);
+
+        void SetSys(u16 reg, u64 value);
+
+        CPU::A64::CPUContext *context_;
+        SVM::A64::A64MMU *mmu_;
+        Memory::ExclusiveMonitor *monitor_;
+        VAddr page_mask_{};
     };
 
-}
\ No newline at end of file
+}
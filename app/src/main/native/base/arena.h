@@ -0,0 +1,96 @@
+//
+// Created by SwiftGan on 2020/11/2.
+//
+
+#pragma once
+
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include "marcos.h"
+
+namespace Utils {
+
+    // bump allocator, memory is only given back on Reset
+    // chunks are kept across Reset, so a warmed up arena never calls malloc
+    class BumpArena : public NonCopyable {
+    public:
+
+        explicit BumpArena(size_t chunk_size = 16 * 1024) : chunk_size_{chunk_size} {}
+
+        ~BumpArena() {
+            for (auto &chunk : chunks_) {
+                std::free(reinterpret_cast<void *>(chunk.start));
+            }
+        }
+
+        void *Alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+            auto ptr = AlignUp(cursor_, align);
+            if (!cursor_ || ptr + size > limit_) {
+                NextChunk(size + align);
+                ptr = AlignUp(cursor_, align);
+            }
+            cursor_ = ptr + size;
+            return reinterpret_cast<void *>(ptr);
+        }
+
+        template<typename T, typename... Args>
+        T *New(Args &&... args) {
+            return new(Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        void Reset() {
+            current_chunk_ = 0;
+            if (chunks_.empty()) {
+                cursor_ = limit_ = 0;
+            } else {
+                cursor_ = chunks_[0].start;
+                limit_ = chunks_[0].start + chunks_[0].size;
+            }
+        }
+
+        // how many times the arena hit malloc
+        u64 MallocCount() const {
+            return malloc_count_;
+        }
+
+    private:
+
+        struct Chunk {
+            VAddr start;
+            size_t size;
+        };
+
+        static VAddr AlignUp(VAddr addr, size_t align) {
+            return (addr + align - 1) & ~(align - 1);
+        }
+
+        void NextChunk(size_t min_size) {
+            while (chunks_.size() > 0 && current_chunk_ + 1 < chunks_.size()) {
+                auto &chunk = chunks_[++current_chunk_];
+                if (chunk.size >= min_size) {
+                    cursor_ = chunk.start;
+                    limit_ = chunk.start + chunk.size;
+                    return;
+                }
+            }
+            size_t size = std::max(chunk_size_, min_size);
+            auto start = reinterpret_cast<VAddr>(std::malloc(size));
+            assert(start);
+            malloc_count_++;
+            chunks_.push_back({start, size});
+            current_chunk_ = chunks_.size() - 1;
+            cursor_ = start;
+            limit_ = start + size;
+        }
+
+        const size_t chunk_size_;
+        std::vector<Chunk> chunks_;
+        size_t current_chunk_{0};
+        VAddr cursor_{0};
+        VAddr limit_{0};
+        u64 malloc_count_{0};
+    };
+
+}
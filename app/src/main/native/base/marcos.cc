@@ -44,6 +44,11 @@ void ClearCachePlatform(VAddr start, VAddr size) {
     __builtin___clear_cache(reinterpret_cast<char *>(start), end);
 }
 
+u64 &ThreadHeapAllocs() {
+    static thread_local u64 allocs{0};
+    return allocs;
+}
+
 SpinLockGuard::SpinLockGuard(SpinMutex &mutex) : mutex_(mutex) {
     mutex.Lock();
 }
@@ -348,6 +348,9 @@ using equivalent_function_type_t = typename FunctionInfo<Function>::equivalent_f
 
 void ClearCachePlatform(VAddr start, VAddr size);
 
+// operator new calls of this thread, stays 0 unless the binary installs a counting operator new
+u64 &ThreadHeapAllocs();
+
 class NonCopyable {
 protected:
     constexpr NonCopyable() = default;
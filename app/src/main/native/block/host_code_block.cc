@@ -38,6 +38,87 @@ void BaseBlock::FlushCodeBuffer(Buffer *buffer, u32 size) {
     current_offset_ += AlignUp(buffer->size_, 2);
 }
 
+VAddr BaseBlock::ReserveCodeBuffer(Buffer *buffer, u32 &size, u32 min_size) {
+    LockGuard lck(lock_);
+    u32 space_left = static_cast<u32>(AlignDown(size_ - (current_offset_ << 2), 8));
+    size = AlignDown(size, 8);
+    if (space_left < size) {
+        // tail too short, the largest freed range may do
+        auto largest = free_ranges_.end();
+        for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+            if (largest == free_ranges_.end() || it->second > largest->second) {
+                largest = it;
+            }
+        }
+        u32 free_size = largest != free_ranges_.end() ? AlignDown(largest->second << 2, 8) : 0;
+        if (free_size > space_left && free_size >= min_size) {
+            size = std::min(size, free_size);
+            auto offset = largest->first;
+            auto rest = largest->second - (size >> 2);
+            free_ranges_.erase(largest);
+            if (rest) {
+                free_ranges_[offset + (size >> 2)] = rest;
+            }
+            buffer->offset_ = offset;
+            return GetBufferStart(buffer);
+        }
+        if (space_left < min_size) {
+            size = 0;
+            return 0;
+        }
+        size = space_left;
+    }
+    buffer->offset_ = current_offset_;
+    current_offset_ += size >> 2;
+    return GetBufferStart(buffer);
+}
+
+void BaseBlock::CommitCodeBuffer(Buffer *buffer, u32 size, u32 reserved) {
+    assert(size <= reserved && size <= (UINT16_MAX << 2));
+    buffer->size_ = static_cast<u16>(size >> 2);
+    LockGuard lck(lock_);
+    u32 used = AlignUp(buffer->size_, 2);
+    u32 unused = (reserved >> 2) - used;
+    if (unused) {
+        // others may have reserved after us, the tail goes to the free ranges then
+        FreeCodeRangeLocked(buffer->offset_ + used, unused);
+    }
+}
+
+void BaseBlock::FreeCodeRange(u32 offset, u32 size) {
+    LockGuard lck(lock_);
+    FreeCodeRangeLocked(offset, size);
+}
+
+void BaseBlock::FreeCodeRangeLocked(u32 offset, u32 size) {
+    if (!size) {
+        return;
+    }
+    // merge with the neighbours
+    auto next = free_ranges_.lower_bound(offset);
+    if (next != free_ranges_.end() && offset + size == next->first) {
+        size += next->second;
+        next = free_ranges_.erase(next);
+    }
+    if (next != free_ranges_.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            free_ranges_.erase(prev);
+        }
+    }
+    if (offset + size == current_offset_) {
+        current_offset_ = offset;
+    } else {
+        free_ranges_[offset] = size;
+    }
+}
+
+VAddr BaseBlock::ToWritable(VAddr addr) const {
+    return addr + rw_offset_;
+}
+
 VAddr BaseBlock::GetBufferStart(Buffer *buffer) {
     return start_ + (buffer->offset_ << 2);
 }
@@ -50,7 +131,8 @@ VAddr BaseBlock::GetBufferEnd(Buffer *buffer) {
     return GetBufferStart(buffer) + buffer->size_ << 2;
 }
 
-BaseBlock::BaseBlock(VAddr start, VAddr size) : start_(start), size_(size) {}
+BaseBlock::BaseBlock(VAddr start, VAddr size, VAddr start_rw) : start_(start), size_(size),
+                                                                rw_offset_(start_rw ? start_rw - start : 0) {}
 
 Buffer *BaseBlock::GetBuffer(u16 id) {
     return &buffers_[id];
@@ -78,13 +160,15 @@ bool BaseBlock::Full() {
     return max_id || max_buffer;
 }
 
-A64::CodeBlock::CodeBlock(u32 block_size) : BaseBlock(
-        reinterpret_cast<VAddr>(Platform::MapExecutableMemory(
-                std::min(BLOCK_SIZE_A64_MAX, AlignUp(block_size, PAGE_SIZE)))),
-        std::min(BLOCK_SIZE_A64_MAX, AlignUp(block_size, PAGE_SIZE))) {
+A64::CodeBlock::CodeBlock(u32 block_size) : CodeBlock(
+        Platform::MapDualExecutableMemory(std::min(BLOCK_SIZE_A64_MAX, AlignUp(block_size, PAGE_SIZE))),
+        block_size) {}
+
+A64::CodeBlock::CodeBlock(const Platform::DualMapping &mapping, u32 block_size) : BaseBlock(
+        mapping.rx, std::min(BLOCK_SIZE_A64_MAX, AlignUp(block_size, PAGE_SIZE)), mapping.rw) {
     // init block base
-    assert(Base() % PAGE_SIZE == 0);
-    module_base_ = reinterpret_cast<VAddr *>(Base());
+    assert(Base() && Base() % PAGE_SIZE == 0);
+    module_base_ = reinterpret_cast<VAddr *>(ToWritable(Base()));
     // init dispatcher table
     buffer_count_ = std::min<u32>(block_size >> 8, UINT16_MAX);
     buffers_.resize(buffer_count_);
@@ -93,7 +177,7 @@ A64::CodeBlock::CodeBlock(u32 block_size) : BaseBlock(
 }
 
 A64::CodeBlock::~CodeBlock() {
-    Platform::UnMapExecutableMemory(start_, size_);
+    Platform::UnMapDualExecutableMemory({start_, ToWritable(start_)}, size_);
 }
 
 void A64::CodeBlock::GenDispatcher(Buffer *buffer) {
@@ -106,7 +190,9 @@ void A64::CodeBlock::GenDispatcher(Buffer *buffer) {
     auto delta = GetBufferStart(buffer) - reinterpret_cast<VAddr>(&dispatcher);
 
     // B offset
-    dispatcher = 0x14000000 | (0x03ffffff & (static_cast<u32>(delta) >> 2));
+    // single aligned word, other threads may be running through this slot while a hot block is swapped
+    __atomic_store_n(reinterpret_cast<u32 *>(ToWritable(reinterpret_cast<VAddr>(&dispatcher))),
+                     0x14000000 | (0x03ffffff & (static_cast<u32>(delta) >> 2)), __ATOMIC_RELEASE);
 
     ClearCachePlatform(reinterpret_cast<VAddr>(&dispatcher), 4);
 }
@@ -146,7 +232,7 @@ void A64::CodeBlock::GenDispatcherStub(u8 forward_reg, VAddr dispatcher_trampoli
     auto buffer = AllocCodeBuffer(dispatcher_trampoline);
     FlushCodeBuffer(buffer, stub_size);
 
-    std::memcpy(reinterpret_cast<void *>(GetBufferStart(buffer)),
+    std::memcpy(reinterpret_cast<void *>(ToWritable(GetBufferStart(buffer))),
                 __ GetBuffer()->GetStartAddress<void *>(), stub_size);
 
     GenDispatcher(buffer);
@@ -156,13 +242,18 @@ void A64::CodeBlock::GenDispatcherStub(u8 forward_reg, VAddr dispatcher_trampoli
 
 Buffer *A64::CodeBlock::AllocCodeBuffer(VAddr source) {
     auto buffer = BaseBlock::AllocCodeBuffer(source);
-    if (buffer->id_ != 0) {
-        auto &dispatcher = dispatchers_[buffer->id_].go_forward_;
-        auto delta = GetBufferStart(GetBuffer(0)) - reinterpret_cast<VAddr>(&dispatcher);
-        // B offset
-        dispatcher = 0x14000000 | (0x03ffffff & (static_cast<u32>(delta) >> 2));
-
-        ClearCachePlatform(reinterpret_cast<VAddr>(&dispatcher), 4);
+    if (buffer && buffer->id_ != 0) {
+        ResetDispatcher(buffer);
     }
     return buffer;
 }
+
+void A64::CodeBlock::ResetDispatcher(Buffer *buffer) {
+    auto &dispatcher = dispatchers_[buffer->id_].go_forward_;
+    auto delta = GetBufferStart(GetBuffer(0)) - reinterpret_cast<VAddr>(&dispatcher);
+    // B offset
+    __atomic_store_n(reinterpret_cast<u32 *>(ToWritable(reinterpret_cast<VAddr>(&dispatcher))),
+                     0x14000000 | (0x03ffffff & (static_cast<u32>(delta) >> 2)), __ATOMIC_RELEASE);
+
+    ClearCachePlatform(reinterpret_cast<VAddr>(&dispatcher), 4);
+}
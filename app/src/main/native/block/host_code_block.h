@@ -5,6 +5,7 @@
 #pragma once
 
 #include <base/marcos.h>
+#include <platform/memory.h>
 #include <map>
 #include <vector>
 
@@ -36,7 +37,7 @@ namespace Jit {
     class BaseBlock {
     public:
 
-        BaseBlock(VAddr start, VAddr size);
+        BaseBlock(VAddr start, VAddr size, VAddr start_rw = 0);
 
         VAddr GetBufferStart(u16 id);
 
@@ -50,6 +51,20 @@ namespace Jit {
 
         virtual void FlushCodeBuffer(Buffer *buffer, u32 size);
 
+        // reserve up to size bytes for code emitted in place, at the tail or in a freed range,
+        // size is clamped to the space found, returns the executable start.
+        // 0 with size 0 if less than min_size is left, the caller moves to another block
+        VAddr ReserveCodeBuffer(Buffer *buffer, u32 &size, u32 min_size);
+
+        // give back the unused tail of a reservation
+        void CommitCodeBuffer(Buffer *buffer, u32 size, u32 reserved);
+
+        // [offset, offset + size) in instructions holds no live code, it can be reserved again
+        void FreeCodeRange(u32 offset, u32 size);
+
+        // writable alias of an executable address in this block
+        VAddr ToWritable(VAddr addr) const;
+
         void Align(u32 size);
 
         virtual bool SaveToDisk(std::string path);
@@ -65,10 +80,17 @@ namespace Jit {
     protected:
         VAddr start_;
         VAddr size_;
+        // rw view - rx view, 0 when not dual mapped
+        ptrdiff_t rw_offset_;
         std::mutex lock_;
         u16 current_buffer_id_{0};
         u32 current_offset_{0};
         std::vector<Buffer> buffers_;
+        // offset -> size of ranges below current_offset_ that can be reserved again, in instructions
+        std::map<u32, u32> free_ranges_;
+
+    private:
+        void FreeCodeRangeLocked(u32 offset, u32 size);
     };
 
     namespace A64 {
@@ -90,6 +112,7 @@ namespace Jit {
         class CodeBlock : public BaseBlock {
         public:
             CodeBlock(u32 block_size = BLOCK_SIZE_A64);
+            CodeBlock(const Platform::DualMapping &mapping, u32 block_size);
             virtual ~CodeBlock();
 
             Buffer *AllocCodeBuffer(VAddr source) override;
@@ -100,6 +123,9 @@ namespace Jit {
 
             void GenDispatcher(Buffer *buffer);
 
+            // slot of buffer goes back to the lookup stub, callers find the block through the find table again
+            void ResetDispatcher(Buffer *buffer);
+
             VAddr GetDispatcherAddr(Buffer*buffer);
 
             VAddr GetDispatcherOffset(Buffer *buffer);
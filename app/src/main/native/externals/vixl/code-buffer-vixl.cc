@@ -163,6 +163,24 @@ void CodeBuffer::Reset() {
 }
 
 
+void CodeBuffer::Reset(byte* buffer, size_t capacity) {
+  VIXL_ASSERT(buffer != NULL);
+  if (managed_) {
+#ifdef VIXL_CODE_BUFFER_MALLOC
+    free(buffer_);
+#elif defined(VIXL_CODE_BUFFER_MMAP)
+    munmap(buffer_, capacity_);
+#else
+#error Unknown code buffer allocator.
+#endif
+    managed_ = false;
+  }
+  buffer_ = buffer;
+  capacity_ = capacity;
+  Reset();
+}
+
+
 void CodeBuffer::Grow(size_t new_capacity) {
   VIXL_ASSERT(managed_);
   VIXL_ASSERT(new_capacity > capacity_);
@@ -44,6 +44,10 @@ class CodeBuffer {
 
   void Reset();
 
+  // Start over on another backing store provided by the user. A managed
+  // backing store is released first, the buffer is unmanaged afterwards.
+  void Reset(byte* buffer, size_t capacity);
+
   // Make the buffer executable or writable. These states are mutually
   // exclusive.
   // Note that these require page-aligned memory blocks, which we can only
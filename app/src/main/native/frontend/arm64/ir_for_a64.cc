@@ -7,20 +7,25 @@
 using namespace Instructions::A64;
 
 // IR Assembler
-#define INST0(name, ret) ret& AssemblerIR::name() { \
+#define INST0(name, ret) ret AssemblerIR::name() { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIRA64::name), {}); \
 }
 
-#define INST1(name, ret, arg1) ret& AssemblerIR::name(const arg1& a1) { \
+#define INST1(name, ret, arg1) ret AssemblerIR::name(const arg1& a1) { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIRA64::name), {a1}); \
 }
 
-#define INST2(name, ret, arg1, arg2) ret& AssemblerIR::name(const arg1& a1, const arg2& a2) { \
+#define INST2(name, ret, arg1, arg2) ret AssemblerIR::name(const arg1& a1, const arg2& a2) { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIRA64::name), {a1, a2}); \
 }
 
+#define INST3(name, ret, arg1, arg2, arg3) ret AssemblerIR::name(const arg1& a1, const arg2& a2, const arg3& a3) { \
+    return block_->Emit<ret>(static_cast<u8>(OpcodeIRA64::name), {a1, a2, a3}); \
+}
+
 #include "opcodes_ir_a64.inl"
 
 #undef INST0
 #undef INST1
-#undef INST2
\ No newline at end of file
+#undef INST2
+#undef INST3
\ No newline at end of file
@@ -15,14 +15,17 @@ namespace Instructions::A64 {
 #define INST0(x, ...) x,
 #define INST1(x, ...) x,
 #define INST2(x, ...) x,
+#define INST3(x, ...) x,
 #define Type(x)
     enum class OpcodeIRA64 {
         A64Start = static_cast<u8>(OpcodeIR::NUM_INSTRUCTIONS) + 1,
 #include "opcodes_ir_a64.inl"
+        A64End
     };
 #undef INST0
 #undef INST1
 #undef INST2
+#undef INST3
 #undef Type
 
     enum class RegisterType : u8 {
@@ -69,21 +72,33 @@ namespace Instructions::A64 {
         }
     };
 
-    class AssemblerIR {
+    // system registers the ir reads and writes in the context
+    enum class SysRegA64 : u16 {
+        TPIDR,
+        TPIDRRO,
+        CNTFREQ,
+        CNTPCT,
+        NZCV,
+        FPCR,
+        FPSR
+    };
+
+    class AssemblerIR : public Instructions::IR::Assembler {
     public:
+        explicit AssemblerIR(Jit::IR::CodeBlock *block) : Assembler(block) {}
+
         // IR Assembler
-#define INST0(name, ret) ret& name();
-#define INST1(name, ret, arg1) ret& name(const arg1& a1);
-#define INST2(name, ret, arg1, arg2) ret& name(const arg1& a1, const arg2& a2);
+#define INST0(name, ret) ret name();
+#define INST1(name, ret, arg1) ret name(const arg1& a1);
+#define INST2(name, ret, arg1, arg2) ret name(const arg1& a1, const arg2& a2);
+#define INST3(name, ret, arg1, arg2, arg3) ret name(const arg1& a1, const arg2& a2, const arg3& a3);
 
 #include "opcodes_ir_a64.inl"
 
 #undef INST0
 #undef INST1
 #undef INST2
-
-    private:
-        CodeBlock *block_;
+#undef INST3
     };
 
 }
@@ -0,0 +1,1004 @@
+//
+// Created by SwiftGan on 2020/11/24.
+//
+
+#include "ir_lifter_a64.h"
+
+using namespace Instructions::A64;
+using namespace CPU::A64;
+
+using VixlInstr = vixl::aarch64::Instruction;
+
+static inline u32 Bits(u32 instr, u32 msb, u32 lsb) {
+    return (instr >> lsb) & ((u32(1) << (msb - lsb + 1)) - 1);
+}
+
+IRLifterA64::IRLifterA64() {
+    decoder_.AppendVisitor(this);
+}
+
+void IRLifterA64::Begin() {
+    block_->NextGuestInstr();
+    lifted_ = true;
+}
+
+Argument IRLifterA64::Value(const Return &ret) {
+    return Argument(ret.instr);
+}
+
+Argument IRLifterA64::Imm(bool sf, u64 value) {
+    return sf ? Argument(value) : Argument(static_cast<u32>(value));
+}
+
+Argument IRLifterA64::GetReg(bool sf, u8 code, bool sp) {
+    if (code == 31 && !sp) {
+        return Imm(sf, 0);
+    }
+    if (sf) {
+        return Value(ir_->A64GetX(A64XReg(code)));
+    }
+    return Value(ir_->A64GetW(A64WReg(code)));
+}
+
+void IRLifterA64::SetReg(bool sf, u8 code, const Argument &value, bool sp) {
+    if (code == 31 && !sp) {
+        return;
+    }
+    if (sf) {
+        ir_->A64SetX(A64XReg(code), RegU64(value));
+    } else {
+        ir_->A64SetW(A64WReg(code), RegU32(value));
+    }
+}
+
+#define BINARY_OP(name) \
+Argument IRLifterA64::name(bool sf, const Argument &a, const Argument &b) { \
+    if (sf) { \
+        return Value(ir_->name##Reg64(RegU64(a), RegU64(b))); \
+    } \
+    return Value(ir_->name##Reg32(RegU32(a), RegU32(b))); \
+}
+
+BINARY_OP(Add)
+BINARY_OP(Sub)
+BINARY_OP(Mul)
+BINARY_OP(And)
+BINARY_OP(Or)
+BINARY_OP(Eor)
+BINARY_OP(Lsl)
+BINARY_OP(Lsr)
+BINARY_OP(Asr)
+BINARY_OP(Ror)
+
+#undef BINARY_OP
+
+Argument IRLifterA64::Not(bool sf, const Argument &a) {
+    if (sf) {
+        return Value(ir_->NotReg64(RegU64(a)));
+    }
+    return Value(ir_->NotReg32(RegU32(a)));
+}
+
+Argument IRLifterA64::Select(bool sf, const Argument &cond, const Argument &a, const Argument &b) {
+    if (sf) {
+        return Value(ir_->Select64(RegU1(cond), RegU64(a), RegU64(b)));
+    }
+    return Value(ir_->Select32(RegU1(cond), RegU32(a), RegU32(b)));
+}
+
+Argument IRLifterA64::AddFlags(bool sf, const Argument &a, const Argument &b) {
+    if (sf) {
+        return Value(ir_->AddFlags64(RegU64(a), RegU64(b)));
+    }
+    return Value(ir_->AddFlags32(RegU32(a), RegU32(b)));
+}
+
+Argument IRLifterA64::SubFlags(bool sf, const Argument &a, const Argument &b) {
+    if (sf) {
+        return Value(ir_->SubFlags64(RegU64(a), RegU64(b)));
+    }
+    return Value(ir_->SubFlags32(RegU32(a), RegU32(b)));
+}
+
+Argument IRLifterA64::Cond(u8 cond) {
+    // al, nv
+    if (cond >= 14) {
+        return Argument(true);
+    }
+    return Value(ir_->CheckCond(ir_->A64GetNZCV(), Imm8(cond)));
+}
+
+Argument IRLifterA64::IsZero(bool sf, const Argument &value) {
+    if (sf) {
+        return Value(ir_->CheckZero64(RegU64(value)));
+    }
+    return Value(ir_->CheckZero32(RegU32(value)));
+}
+
+Argument IRLifterA64::ShiftOperand(bool sf, const Argument &value, u32 shift, u32 amount) {
+    if (!amount) {
+        return value;
+    }
+    auto imm = Imm(sf, amount);
+    switch (shift) {
+        case 0:
+            return Lsl(sf, value, imm);
+        case 1:
+            return Lsr(sf, value, imm);
+        case 2:
+            return Asr(sf, value, imm);
+        default:
+            return Ror(sf, value, imm);
+    }
+}
+
+Argument IRLifterA64::ExtendOperand(bool sf, const Argument &value, u32 extend, u32 left_shift) {
+    Argument extended;
+    switch (extend) {
+        // uxtb, uxth, uxtw
+        case 0:
+            extended = And(sf, value, Imm(sf, 0xff));
+            break;
+        case 1:
+            extended = And(sf, value, Imm(sf, 0xffff));
+            break;
+        case 2:
+            extended = sf ? And(sf, value, Imm(sf, 0xffffffff)) : value;
+            break;
+        // sxtb, sxth, sxtw
+        case 4:
+            extended = Value(ir_->SignExtend8(RegU8(value)));
+            break;
+        case 5:
+            extended = Value(ir_->SignExtend16(RegU16(value)));
+            break;
+        case 6:
+            extended = sf ? Value(ir_->SignExtend32(RegU32(value))) : value;
+            break;
+        // uxtx, sxtx
+        default:
+            extended = value;
+            break;
+    }
+    return ShiftOperand(sf, extended, 0, left_shift);
+}
+
+void IRLifterA64::AddSub(bool sf, bool sub, bool set_flags, u8 rd, const Argument &a, const Argument &b,
+                         bool rd_sp) {
+    auto result = sub ? Sub(sf, a, b) : Add(sf, a, b);
+    if (set_flags) {
+        auto nzcv = sub ? SubFlags(sf, a, b) : AddFlags(sf, a, b);
+        ir_->A64SetNZCV(RegU32(nzcv));
+    }
+    SetReg(sf, rd, result, rd_sp);
+}
+
+void IRLifterA64::Logical(bool sf, u32 opc, u8 rd, const Argument &a, const Argument &b, bool rd_sp) {
+    Argument result;
+    switch (opc) {
+        case 1:
+            result = Or(sf, a, b);
+            break;
+        case 2:
+            result = Eor(sf, a, b);
+            break;
+        default:
+            result = And(sf, a, b);
+            break;
+    }
+    // ands
+    if (opc == 3) {
+        auto nzcv = sf ? ir_->LogicFlags64(RegU64(result)) : ir_->LogicFlags32(RegU32(result));
+        ir_->A64SetNZCV(nzcv);
+    }
+    SetReg(sf, rd, result, rd_sp);
+}
+
+Argument IRLifterA64::Load(u32 size_log2, const Argument &address) {
+    RegAddr addr{address};
+    switch (size_log2) {
+        case 0:
+            return Value(ir_->Ldr8(addr));
+        case 1:
+            return Value(ir_->Ldr16(addr));
+        case 2:
+            return Value(ir_->Ldr32(addr));
+        default:
+            return Value(ir_->Ldr64(addr));
+    }
+}
+
+void IRLifterA64::Store(u32 size_log2, const Argument &address, const Argument &value) {
+    RegAddr addr{address};
+    switch (size_log2) {
+        case 0:
+            ir_->Str8(addr, RegU8(value));
+            break;
+        case 1:
+            ir_->Str16(addr, RegU16(value));
+            break;
+        case 2:
+            ir_->Str32(addr, RegU32(value));
+            break;
+        default:
+            ir_->Str64(addr, RegU64(value));
+            break;
+    }
+}
+
+void IRLifterA64::LoadStore(u32 size_log2, u32 opc, u8 rt, const Argument &address) {
+    if (opc == 0) {
+        Store(size_log2, address, GetReg(size_log2 == 3, rt));
+        return;
+    }
+    auto value = Load(size_log2, address);
+    // ldrs*
+    if (opc >= 2) {
+        switch (size_log2) {
+            case 0:
+                value = Value(ir_->SignExtend8(RegU8(value)));
+                break;
+            case 1:
+                value = Value(ir_->SignExtend16(RegU16(value)));
+                break;
+            case 2:
+                value = Value(ir_->SignExtend32(RegU32(value)));
+                break;
+            default:
+                break;
+        }
+    }
+    SetReg(opc != 3, rt, value);
+}
+
+void IRLifterA64::LoadStoreImm(u32 instr, s64 offset, bool write_back, bool post_index) {
+    u32 size = Bits(instr, 31, 30);
+    u32 opc = Bits(instr, 23, 22);
+    bool simd = Bits(instr, 26, 26);
+    if (simd || (size >= 2 && opc == 3)) {
+        return;
+    }
+    Begin();
+    // prfm
+    if (size == 3 && opc == 2) {
+        return;
+    }
+    u8 rt = static_cast<u8>(Bits(instr, 4, 0));
+    u8 rn = static_cast<u8>(Bits(instr, 9, 5));
+    auto base = GetReg(true, rn, true);
+    auto address = offset ? Add(true, base, Imm(true, static_cast<u64>(offset))) : base;
+    LoadStore(size, opc, rt, post_index ? base : address);
+    if (write_back) {
+        SetReg(true, rn, address, true);
+    }
+}
+
+void IRLifterA64::LoadStorePair(const VixlInstr *instr, bool write_back, bool post_index) {
+    u32 bits = instr->GetInstructionBits();
+    u32 opc = Bits(bits, 31, 30);
+    bool simd = Bits(bits, 26, 26);
+    bool load = Bits(bits, 22, 22);
+    // opc 1 is ldpsw, stgp without load
+    if (simd || opc == 3 || (opc == 1 && !load)) {
+        return;
+    }
+    Begin();
+    u32 size = opc == 2 ? 3 : 2;
+    u8 rt = static_cast<u8>(instr->GetRt());
+    u8 rt2 = static_cast<u8>(instr->GetRt2());
+    u8 rn = static_cast<u8>(instr->GetRn());
+    auto offset = static_cast<u64>(instr->GetImmLSPair() * (s64(1) << size));
+    auto base = GetReg(true, rn, true);
+    auto address = offset ? Add(true, base, Imm(true, offset)) : base;
+    auto first = post_index ? base : address;
+    auto second = Add(true, first, Imm(true, u64(1) << size));
+    if (load) {
+        // both loads before the writes, rt may be rn
+        auto value1 = Load(size, first);
+        auto value2 = Load(size, second);
+        if (opc == 1) {
+            value1 = Value(ir_->SignExtend32(RegU32(value1)));
+            value2 = Value(ir_->SignExtend32(RegU32(value2)));
+        }
+        SetReg(true, rt, value1);
+        SetReg(true, rt2, value2);
+    } else {
+        Store(size, first, GetReg(size == 3, rt));
+        Store(size, second, GetReg(size == 3, rt2));
+    }
+    if (write_back) {
+        SetReg(true, rn, address, true);
+    }
+}
+
+void IRLifterA64::Branch(VAddr target) {
+    block_->Terminal(LinkBlock{{target}});
+}
+
+void IRLifterA64::BranchIf(const Argument &cond, VAddr target) {
+    block_->Terminal(CheckBit{cond, {target}, {pc_ + 4}});
+}
+
+void IRLifterA64::VisitAddSubImmediate(const VixlInstr *instr) {
+    if (instr->GetShiftAddSub() > 1) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    bool sub = Bits(instr->GetInstructionBits(), 30, 30);
+    bool set_flags = instr->GetFlagsUpdate();
+    u64 imm = u64(instr->GetImmAddSub()) << (instr->GetShiftAddSub() * 12);
+    AddSub(sf, sub, set_flags, static_cast<u8>(instr->GetRd()),
+           GetReg(sf, static_cast<u8>(instr->GetRn()), true), Imm(sf, imm), !set_flags);
+}
+
+void IRLifterA64::VisitAddSubShifted(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    u32 shift = instr->GetShiftDP();
+    u32 amount = instr->GetImmDPShift();
+    if (shift == 3 || (!sf && amount >= 32)) {
+        return;
+    }
+    Begin();
+    bool sub = Bits(instr->GetInstructionBits(), 30, 30);
+    auto operand = ShiftOperand(sf, GetReg(sf, static_cast<u8>(instr->GetRm())), shift, amount);
+    AddSub(sf, sub, instr->GetFlagsUpdate(), static_cast<u8>(instr->GetRd()),
+           GetReg(sf, static_cast<u8>(instr->GetRn())), operand, false);
+}
+
+void IRLifterA64::VisitAddSubExtended(const VixlInstr *instr) {
+    u32 shift = instr->GetImmExtendShift();
+    if (shift > 4) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    bool sub = Bits(instr->GetInstructionBits(), 30, 30);
+    bool set_flags = instr->GetFlagsUpdate();
+    auto operand = ExtendOperand(sf, GetReg(sf, static_cast<u8>(instr->GetRm())), instr->GetExtendMode(), shift);
+    AddSub(sf, sub, set_flags, static_cast<u8>(instr->GetRd()),
+           GetReg(sf, static_cast<u8>(instr->GetRn()), true), operand, !set_flags);
+}
+
+void IRLifterA64::VisitAddSubWithCarry(const VixlInstr *instr) {
+    // adcs/sbcs need the flags of a three operand add
+    if (instr->GetFlagsUpdate()) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    bool sub = Bits(instr->GetInstructionBits(), 30, 30);
+    auto carry = And(false, Lsr(false, Value(ir_->A64GetNZCV()), Imm(false, 29)), Imm(false, 1));
+    auto operand = GetReg(sf, static_cast<u8>(instr->GetRm()));
+    if (sub) {
+        operand = Not(sf, operand);
+    }
+    auto result = Add(sf, Add(sf, GetReg(sf, static_cast<u8>(instr->GetRn())), operand), carry);
+    SetReg(sf, static_cast<u8>(instr->GetRd()), result);
+}
+
+void IRLifterA64::VisitLogicalImmediate(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    if (!sf && instr->GetBitN()) {
+        return;
+    }
+    Begin();
+    u32 opc = Bits(instr->GetInstructionBits(), 30, 29);
+    Logical(sf, opc, static_cast<u8>(instr->GetRd()), GetReg(sf, static_cast<u8>(instr->GetRn())),
+            Imm(sf, instr->GetImmLogical()), opc != 3);
+}
+
+void IRLifterA64::VisitLogicalShifted(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    u32 amount = instr->GetImmDPShift();
+    if (!sf && amount >= 32) {
+        return;
+    }
+    Begin();
+    u32 bits = instr->GetInstructionBits();
+    auto operand = ShiftOperand(sf, GetReg(sf, static_cast<u8>(instr->GetRm())), instr->GetShiftDP(), amount);
+    // bic, orn, eon, bics
+    if (Bits(bits, 21, 21)) {
+        operand = Not(sf, operand);
+    }
+    Logical(sf, Bits(bits, 30, 29), static_cast<u8>(instr->GetRd()),
+            GetReg(sf, static_cast<u8>(instr->GetRn())), operand, false);
+}
+
+void IRLifterA64::VisitMoveWideImmediate(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    u32 opc = Bits(instr->GetInstructionBits(), 30, 29);
+    u32 shift = instr->GetShiftMoveWide() * 16;
+    if (opc == 1 || (!sf && shift > 16)) {
+        return;
+    }
+    Begin();
+    u8 rd = static_cast<u8>(instr->GetRd());
+    u64 imm = u64(instr->GetImmMoveWide()) << shift;
+    switch (opc) {
+        // movn
+        case 0:
+            SetReg(sf, rd, Imm(sf, ~imm));
+            break;
+        // movz
+        case 2:
+            SetReg(sf, rd, Imm(sf, imm));
+            break;
+        // movk
+        default: {
+            auto keep = And(sf, GetReg(sf, rd), Imm(sf, ~(u64(0xffff) << shift)));
+            SetReg(sf, rd, Or(sf, keep, Imm(sf, imm)));
+            break;
+        }
+    }
+}
+
+void IRLifterA64::VisitBitfield(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    u32 opc = Bits(instr->GetInstructionBits(), 30, 29);
+    u32 width = sf ? 64 : 32;
+    u32 immr = instr->GetImmR();
+    u32 imms = instr->GetImmS();
+    if (opc == 3 || instr->GetBitN() != sf || immr >= width || imms >= width) {
+        return;
+    }
+    Begin();
+    u8 rd = static_cast<u8>(instr->GetRd());
+    auto src = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    // bfm
+    if (opc == 1) {
+        u64 mask;
+        Argument field;
+        if (imms >= immr) {
+            // bfxil, src[s:r] to dst[s-r:0]
+            u32 len = imms - immr + 1;
+            mask = len == 64 ? ~u64(0) : (u64(1) << len) - 1;
+            field = And(sf, immr ? Lsr(sf, src, Imm(sf, immr)) : src, Imm(sf, mask));
+        } else {
+            // bfi, src[s:0] to dst[w-r+s:w-r]
+            u32 lsb = width - immr;
+            mask = ((u64(1) << (imms + 1)) - 1) << lsb;
+            field = And(sf, Lsl(sf, src, Imm(sf, lsb)), Imm(sf, mask));
+        }
+        SetReg(sf, rd, Or(sf, And(sf, GetReg(sf, rd), Imm(sf, ~mask)), field));
+        return;
+    }
+    // sbfm/ubfm: the top bit of the field goes to the top, then back down
+    u32 left = width - 1 - imms;
+    u32 right = imms >= immr ? left + immr : immr - 1 - imms;
+    auto value = left ? Lsl(sf, src, Imm(sf, left)) : src;
+    if (right) {
+        value = opc == 0 ? Asr(sf, value, Imm(sf, right)) : Lsr(sf, value, Imm(sf, right));
+    }
+    SetReg(sf, rd, value);
+}
+
+void IRLifterA64::VisitExtract(const VixlInstr *instr) {
+    bool sf = instr->GetSixtyFourBits();
+    u32 lsb = instr->GetImmS();
+    if (instr->GetBitN() != sf || Bits(instr->GetInstructionBits(), 21, 21) || (!sf && lsb >= 32)) {
+        return;
+    }
+    Begin();
+    u8 rm = static_cast<u8>(instr->GetRm());
+    u8 rn = static_cast<u8>(instr->GetRn());
+    auto low = GetReg(sf, rm);
+    Argument result;
+    if (!lsb) {
+        result = low;
+    } else if (rn == rm) {
+        // ror
+        result = Ror(sf, low, Imm(sf, lsb));
+    } else {
+        result = Or(sf, Lsr(sf, low, Imm(sf, lsb)), Lsl(sf, GetReg(sf, rn), Imm(sf, (sf ? 64 : 32) - lsb)));
+    }
+    SetReg(sf, static_cast<u8>(instr->GetRd()), result);
+}
+
+void IRLifterA64::VisitPCRelAddressing(const VixlInstr *instr) {
+    Begin();
+    auto offset = static_cast<u64>(instr->GetImmPCRel());
+    VAddr value;
+    if (Bits(instr->GetInstructionBits(), 31, 31)) {
+        // adrp
+        value = (pc_ & ~VAddr(0xfff)) + (offset << 12);
+    } else {
+        value = pc_ + offset;
+    }
+    SetReg(true, static_cast<u8>(instr->GetRd()), Imm(true, value));
+}
+
+void IRLifterA64::VisitConditionalSelect(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    bool op = Bits(bits, 30, 30);
+    u32 op2 = Bits(bits, 11, 10);
+    if (Bits(bits, 29, 29) || op2 > 1) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    auto cond = Cond(static_cast<u8>(instr->GetCondition()));
+    auto a = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    auto b = GetReg(sf, static_cast<u8>(instr->GetRm()));
+    if (!op && op2) {
+        // csinc
+        b = Add(sf, b, Imm(sf, 1));
+    } else if (op && !op2) {
+        // csinv
+        b = Not(sf, b);
+    } else if (op && op2) {
+        // csneg
+        b = Sub(sf, Imm(sf, 0), b);
+    }
+    SetReg(sf, static_cast<u8>(instr->GetRd()), Select(sf, cond, a, b));
+}
+
+void IRLifterA64::CondCompare(const VixlInstr *instr, bool imm) {
+    u32 bits = instr->GetInstructionBits();
+    if (!Bits(bits, 29, 29) || Bits(bits, 10, 10) || Bits(bits, 4, 4)) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    auto nzcv = ir_->A64GetNZCV();
+    auto pass = Value(ir_->CheckCond(nzcv, Imm8(static_cast<u8>(instr->GetCondition()))));
+    auto a = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    auto b = imm ? Imm(sf, instr->GetImmCondCmp()) : GetReg(sf, static_cast<u8>(instr->GetRm()));
+    // ccmp, ccmn
+    auto flags = Bits(bits, 30, 30) ? SubFlags(sf, a, b) : AddFlags(sf, a, b);
+    auto result = Select(false, pass, flags, Imm(false, u64(instr->GetNzcv()) << 28));
+    ir_->A64SetNZCV(RegU32(result));
+}
+
+void IRLifterA64::VisitConditionalCompareRegister(const VixlInstr *instr) {
+    CondCompare(instr, false);
+}
+
+void IRLifterA64::VisitConditionalCompareImmediate(const VixlInstr *instr) {
+    CondCompare(instr, true);
+}
+
+void IRLifterA64::VisitDataProcessing1Source(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    bool sf = instr->GetSixtyFourBits();
+    u32 opcode = Bits(bits, 15, 10);
+    bool clz = opcode == 4;
+    bool rev = opcode == (sf ? 3 : 2);
+    if (Bits(bits, 29, 29) || Bits(bits, 20, 16) || (!clz && !rev)) {
+        return;
+    }
+    Begin();
+    auto src = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    Argument result;
+    if (clz) {
+        result = sf ? Value(ir_->ClzReg64(RegU64(src))) : Value(ir_->ClzReg32(RegU32(src)));
+    } else {
+        result = sf ? Value(ir_->RevReg64(RegU64(src))) : Value(ir_->RevReg32(RegU32(src)));
+    }
+    SetReg(sf, static_cast<u8>(instr->GetRd()), result);
+}
+
+void IRLifterA64::VisitDataProcessing2Source(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    u32 opcode = Bits(bits, 15, 10);
+    if (Bits(bits, 29, 29) || opcode < 2 || opcode > 11 || (opcode > 3 && opcode < 8)) {
+        return;
+    }
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    auto a = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    auto b = GetReg(sf, static_cast<u8>(instr->GetRm()));
+    Argument result;
+    switch (opcode) {
+        case 2:
+            result = sf ? Value(ir_->UDivReg64(RegU64(a), RegU64(b)))
+                        : Value(ir_->UDivReg32(RegU32(a), RegU32(b)));
+            break;
+        case 3:
+            result = sf ? Value(ir_->SDivReg64(RegU64(a), RegU64(b)))
+                        : Value(ir_->SDivReg32(RegU32(a), RegU32(b)));
+            break;
+        case 8:
+            result = Lsl(sf, a, b);
+            break;
+        case 9:
+            result = Lsr(sf, a, b);
+            break;
+        case 10:
+            result = Asr(sf, a, b);
+            break;
+        default:
+            result = Ror(sf, a, b);
+            break;
+    }
+    SetReg(sf, static_cast<u8>(instr->GetRd()), result);
+}
+
+void IRLifterA64::VisitDataProcessing3Source(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    bool sf = instr->GetSixtyFourBits();
+    u32 op31 = Bits(bits, 23, 21);
+    // madd/msub, smaddl/smsubl, umaddl/umsubl
+    bool widen = op31 == 1 || op31 == 5;
+    if (Bits(bits, 30, 29) || (op31 && !(sf && widen))) {
+        return;
+    }
+    Begin();
+    auto a = GetReg(sf, static_cast<u8>(instr->GetRn()));
+    auto b = GetReg(sf, static_cast<u8>(instr->GetRm()));
+    if (widen) {
+        a = ExtendOperand(true, a, op31 == 1 ? 6 : 2, 0);
+        b = ExtendOperand(true, b, op31 == 1 ? 6 : 2, 0);
+    }
+    auto product = Mul(sf, a, b);
+    auto accumulate = GetReg(sf, static_cast<u8>(instr->GetRa()));
+    auto result = Bits(bits, 15, 15) ? Sub(sf, accumulate, product) : Add(sf, accumulate, product);
+    SetReg(sf, static_cast<u8>(instr->GetRd()), result);
+}
+
+void IRLifterA64::VisitUnconditionalBranch(const VixlInstr *instr) {
+    Begin();
+    VAddr target = pc_ + static_cast<u64>(instr->GetImmUncondBranch() * 4);
+    // bl
+    if (Bits(instr->GetInstructionBits(), 31, 31)) {
+        SetReg(true, 30, Imm(true, pc_ + 4));
+    }
+    Branch(target);
+}
+
+void IRLifterA64::VisitConditionalBranch(const VixlInstr *instr) {
+    if (Bits(instr->GetInstructionBits(), 4, 4)) {
+        return;
+    }
+    Begin();
+    VAddr target = pc_ + static_cast<u64>(instr->GetImmCondBranch() * 4);
+    auto cond = static_cast<u8>(instr->GetConditionBranch());
+    if (cond >= 14) {
+        Branch(target);
+        return;
+    }
+    block_->Terminal(If{static_cast<Condition>(cond), {target}, {pc_ + 4}});
+}
+
+void IRLifterA64::VisitCompareBranch(const VixlInstr *instr) {
+    Begin();
+    bool sf = instr->GetSixtyFourBits();
+    VAddr target = pc_ + static_cast<u64>(instr->GetImmCmpBranch() * 4);
+    auto zero = IsZero(sf, GetReg(sf, static_cast<u8>(instr->GetRt())));
+    // cbnz
+    if (Bits(instr->GetInstructionBits(), 24, 24)) {
+        block_->Terminal(CheckBit{zero, {pc_ + 4}, {target}});
+    } else {
+        BranchIf(zero, target);
+    }
+}
+
+void IRLifterA64::VisitTestBranch(const VixlInstr *instr) {
+    Begin();
+    VAddr target = pc_ + static_cast<u64>(instr->GetImmTestBranch() * 4);
+    auto bit = static_cast<u8>((instr->GetImmTestBranchBit5() << 5) | instr->GetImmTestBranchBit40());
+    auto set = Value(ir_->TestBit(RegU64(GetReg(true, static_cast<u8>(instr->GetRt()))), Imm8(bit)));
+    // tbnz
+    if (Bits(instr->GetInstructionBits(), 24, 24)) {
+        BranchIf(set, target);
+    } else {
+        block_->Terminal(CheckBit{set, {pc_ + 4}, {target}});
+    }
+}
+
+void IRLifterA64::VisitUnconditionalBranchToRegister(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    u32 opc = Bits(bits, 24, 21);
+    u32 op3 = Bits(bits, 15, 10);
+    u32 op4 = Bits(bits, 4, 0);
+    u8 rn = static_cast<u8>(instr->GetRn());
+    if (Bits(bits, 20, 16) != 0x1f) {
+        return;
+    }
+    bool pac;
+    switch (opc) {
+        // br, blr, ret and their pac forms with zero modifier
+        case 0:
+        case 1:
+        case 2:
+            if (!op3 && !op4) {
+                pac = false;
+            } else if ((op3 >> 1) == 1 && op4 == 0x1f) {
+                pac = true;
+            } else {
+                return;
+            }
+            break;
+        // braa, blraa
+        case 8:
+        case 9:
+            if ((op3 >> 1) != 1) {
+                return;
+            }
+            pac = true;
+            break;
+        default:
+            return;
+    }
+    Begin();
+    // retaa/retab return to lr
+    auto target = GetReg(true, opc == 2 && pac ? u8(30) : rn);
+    if (pac) {
+        // pointer is not authenticated, only the pac bits are stripped
+        target = And(true, target, Imm(true, (u64(1) << 48) - 1));
+    }
+    if (opc & 1) {
+        SetReg(true, 30, Imm(true, pc_ + 4));
+    }
+    block_->Terminal(Indirect{target});
+}
+
+void IRLifterA64::VisitException(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    u32 opc = Bits(bits, 23, 21);
+    u32 ll = Bits(bits, 1, 0);
+    if (Bits(bits, 4, 2)) {
+        return;
+    }
+    InterruptHelp::Reason reason;
+    if (opc == 0 && ll == 1) {
+        reason = InterruptHelp::Svc;
+    } else if (opc == 0 && ll == 2) {
+        reason = InterruptHelp::Hvc;
+    } else if (opc == 1 && ll == 0) {
+        reason = InterruptHelp::Brk;
+    } else {
+        return;
+    }
+    Begin();
+    u64 data = reason == InterruptHelp::Brk ? 0 : instr->GetImmException();
+    block_->Terminal(Trap{reason, data, {pc_}});
+}
+
+void IRLifterA64::VisitSystem(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    // hints, nop yield paciasp ...
+    if ((bits & 0xfffff01f) == 0xd503201f) {
+        Begin();
+        return;
+    }
+    if ((bits & 0xfffff01f) == 0xd503301f) {
+        u32 op2 = Bits(bits, 7, 5);
+        // clrex, dsb, dmb, isb
+        if (op2 == 2) {
+            Begin();
+            ir_->ClearExclusive();
+        } else if (op2 >= 4 && op2 <= 6) {
+            Begin();
+            ir_->Fence();
+        }
+        return;
+    }
+    // mrs, msr (register)
+    if ((bits & 0xffd00000) == 0xd5100000) {
+        SysRegA64 reg;
+        switch (instr->GetImmSystemRegister()) {
+            case vixl::aarch64::TPIDR_EL0:
+                reg = SysRegA64::TPIDR;
+                break;
+            case vixl::aarch64::TPIDRRO_EL0:
+                reg = SysRegA64::TPIDRRO;
+                break;
+            case vixl::aarch64::CNTFREQ_EL0:
+                reg = SysRegA64::CNTFREQ;
+                break;
+            case vixl::aarch64::CNTPCT_EL0:
+                reg = SysRegA64::CNTPCT;
+                break;
+            case vixl::aarch64::NZCV:
+                reg = SysRegA64::NZCV;
+                break;
+            case vixl::aarch64::FPCR:
+                reg = SysRegA64::FPCR;
+                break;
+            case vixl::aarch64::FPSR:
+                reg = SysRegA64::FPSR;
+                break;
+            default:
+                return;
+        }
+        Begin();
+        Imm16 sys_reg{static_cast<u16>(reg)};
+        u8 rt = static_cast<u8>(instr->GetRt());
+        if (Bits(bits, 21, 21)) {
+            SetReg(true, rt, Value(ir_->A64GetSys(sys_reg)));
+        } else {
+            ir_->A64SetSys(sys_reg, RegU64(GetReg(true, rt)));
+        }
+    }
+}
+
+void IRLifterA64::VisitLoadLiteral(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    u32 opc = Bits(bits, 31, 30);
+    if (Bits(bits, 26, 26)) {
+        return;
+    }
+    Begin();
+    // prfm
+    if (opc == 3) {
+        return;
+    }
+    VAddr address = pc_ + static_cast<u64>(instr->GetImmLLiteral() * 4);
+    // ldr w, ldr x, ldrsw
+    LoadStore(opc == 1 ? 3 : 2, opc == 2 ? 2 : 1, static_cast<u8>(instr->GetRt()), Imm(true, address));
+}
+
+void IRLifterA64::VisitLoadStoreUnsignedOffset(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    LoadStoreImm(bits, static_cast<s64>(instr->GetImmLSUnsigned()) << Bits(bits, 31, 30), false, false);
+}
+
+void IRLifterA64::VisitLoadStoreUnscaledOffset(const VixlInstr *instr) {
+    LoadStoreImm(instr->GetInstructionBits(), instr->GetImmLS(), false, false);
+}
+
+void IRLifterA64::VisitLoadStorePreIndex(const VixlInstr *instr) {
+    LoadStoreImm(instr->GetInstructionBits(), instr->GetImmLS(), true, false);
+}
+
+void IRLifterA64::VisitLoadStorePostIndex(const VixlInstr *instr) {
+    LoadStoreImm(instr->GetInstructionBits(), instr->GetImmLS(), true, true);
+}
+
+void IRLifterA64::VisitLoadStoreRegisterOffset(const VixlInstr *instr) {
+    u32 bits = instr->GetInstructionBits();
+    u32 size = Bits(bits, 31, 30);
+    u32 opc = Bits(bits, 23, 22);
+    u32 option = instr->GetExtendMode();
+    if (Bits(bits, 26, 26) || (size >= 2 && opc == 3) || !(option & 2)) {
+        return;
+    }
+    Begin();
+    // prfm
+    if (size == 3 && opc == 2) {
+        return;
+    }
+    auto offset = ExtendOperand(true, GetReg(true, static_cast<u8>(instr->GetRm())), option,
+                                instr->GetImmShiftLS() ? size : 0);
+    auto address = Add(true, GetReg(true, static_cast<u8>(instr->GetRn()), true), offset);
+    LoadStore(size, opc, static_cast<u8>(instr->GetRt()), address);
+}
+
+void IRLifterA64::VisitLoadStorePairOffset(const VixlInstr *instr) {
+    LoadStorePair(instr, false, false);
+}
+
+void IRLifterA64::VisitLoadStorePairNonTemporal(const VixlInstr *instr) {
+    LoadStorePair(instr, false, false);
+}
+
+void IRLifterA64::VisitLoadStorePairPreIndex(const VixlInstr *instr) {
+    LoadStorePair(instr, true, false);
+}
+
+void IRLifterA64::VisitLoadStorePairPostIndex(const VixlInstr *instr) {
+    LoadStorePair(instr, true, true);
+}
+
+void IRLifterA64::VisitLoadStoreExclusive(const VixlInstr *instr) {
+    // pairs and cas
+    if (instr->GetLdStXPair()) {
+        return;
+    }
+    Begin();
+    u32 size = instr->GetLdStXSizeLog2();
+    bool load = instr->GetLdStXLoad();
+    bool ordered = instr->GetLdStXAcquireRelease();
+    u8 rt = static_cast<u8>(instr->GetRt());
+    RegAddr address{GetReg(true, static_cast<u8>(instr->GetRn()), true)};
+    if (instr->GetLdStXNotExclusive()) {
+        // ldar, stlr and the limited ordering forms
+        if (load) {
+            auto value = Load(size, address);
+            ir_->Fence();
+            SetReg(true, rt, value);
+        } else {
+            ir_->Fence();
+            Store(size, address, GetReg(size == 3, rt));
+        }
+        return;
+    }
+    if (load) {
+        Argument value;
+        switch (size) {
+            case 0:
+                value = Value(ir_->Ldrx8(address));
+                break;
+            case 1:
+                value = Value(ir_->Ldrx16(address));
+                break;
+            case 2:
+                value = Value(ir_->Ldrx32(address));
+                break;
+            default:
+                value = Value(ir_->Ldrx64(address));
+                break;
+        }
+        if (ordered) {
+            ir_->Fence();
+        }
+        SetReg(true, rt, value);
+        return;
+    }
+    if (ordered) {
+        ir_->Fence();
+    }
+    auto value = GetReg(size == 3, rt);
+    Argument status;
+    switch (size) {
+        case 0:
+            status = Value(ir_->Strx8(address, RegU8(value)));
+            break;
+        case 1:
+            status = Value(ir_->Strx16(address, RegU16(value)));
+            break;
+        case 2:
+            status = Value(ir_->Strx32(address, RegU32(value)));
+            break;
+        default:
+            status = Value(ir_->Strx64(address, RegU64(value)));
+            break;
+    }
+    SetReg(false, static_cast<u8>(instr->GetRs()), status);
+}
+
+// left to the native translator
+#define UNSUPPORTED(A) \
+void IRLifterA64::Visit##A(const VixlInstr *) {}
+
+UNSUPPORTED(AtomicMemory)
+UNSUPPORTED(Crypto2RegSHA)
+UNSUPPORTED(Crypto3RegSHA)
+UNSUPPORTED(CryptoAES)
+UNSUPPORTED(EvaluateIntoFlags)
+UNSUPPORTED(FPCompare)
+UNSUPPORTED(FPConditionalCompare)
+UNSUPPORTED(FPConditionalSelect)
+UNSUPPORTED(FPDataProcessing1Source)
+UNSUPPORTED(FPDataProcessing2Source)
+UNSUPPORTED(FPDataProcessing3Source)
+UNSUPPORTED(FPFixedPointConvert)
+UNSUPPORTED(FPImmediate)
+UNSUPPORTED(FPIntegerConvert)
+UNSUPPORTED(LoadStorePAC)
+UNSUPPORTED(LoadStoreRCpcUnscaledOffset)
+UNSUPPORTED(NEON2RegMisc)
+UNSUPPORTED(NEON2RegMiscFP16)
+UNSUPPORTED(NEON3Different)
+UNSUPPORTED(NEON3Same)
+UNSUPPORTED(NEON3SameExtra)
+UNSUPPORTED(NEON3SameFP16)
+UNSUPPORTED(NEONAcrossLanes)
+UNSUPPORTED(NEONByIndexedElement)
+UNSUPPORTED(NEONCopy)
+UNSUPPORTED(NEONExtract)
+UNSUPPORTED(NEONLoadStoreMultiStruct)
+UNSUPPORTED(NEONLoadStoreMultiStructPostIndex)
+UNSUPPORTED(NEONLoadStoreSingleStruct)
+UNSUPPORTED(NEONLoadStoreSingleStructPostIndex)
+UNSUPPORTED(NEONModifiedImmediate)
+UNSUPPORTED(NEONPerm)
+UNSUPPORTED(NEONScalar2RegMisc)
+UNSUPPORTED(NEONScalar2RegMiscFP16)
+UNSUPPORTED(NEONScalar3Diff)
+UNSUPPORTED(NEONScalar3Same)
+UNSUPPORTED(NEONScalar3SameExtra)
+UNSUPPORTED(NEONScalar3SameFP16)
+UNSUPPORTED(NEONScalarByIndexedElement)
+UNSUPPORTED(NEONScalarCopy)
+UNSUPPORTED(NEONScalarPairwise)
+UNSUPPORTED(NEONScalarShiftImmediate)
+UNSUPPORTED(NEONShiftImmediate)
+UNSUPPORTED(NEONTable)
+UNSUPPORTED(RotateRightIntoFlags)
+UNSUPPORTED(Unallocated)
+UNSUPPORTED(Unimplemented)
+UNSUPPORTED(Reserved)
+
+#undef UNSUPPORTED
@@ -0,0 +1,118 @@
+//
+// Created by SwiftGan on 2020/11/24.
+//
+
+#pragma once
+
+#include <aarch64/decoder-aarch64.h>
+#include <asm/arm64/cpu_arm64.h>
+#include "ir_for_a64.h"
+
+namespace Instructions::A64 {
+
+    // guest A64 to ir, integer instructions only.
+    // a block ends at its first branch, or before the first instruction it can not lift
+    class IRLifterA64 : public vixl::aarch64::DecoderVisitor {
+    public:
+        constexpr static u16 max_block_instrs = 256;
+
+        IRLifterA64();
+
+        // fetch(pc) returns the host address of pc or 0.
+        // false if the first instruction can not be lifted, the block is left empty then
+        template<typename Fetch>
+        bool Lift(Jit::IR::CodeBlock &block, Fetch &&fetch) {
+            AssemblerIR ir{&block};
+            block_ = &block;
+            ir_ = &ir;
+            for (pc_ = block.Start(); !block.Termed(); pc_ += 4) {
+                VAddr host = fetch(pc_);
+                if (host && block.GuestInstrCount() < max_block_instrs) {
+                    lifted_ = false;
+                    decoder_.Decode(reinterpret_cast<const vixl::aarch64::Instruction *>(host));
+                    if (lifted_) {
+                        continue;
+                    }
+                }
+                if (!block.GuestInstrCount()) {
+                    return false;
+                }
+                block.Terminal(LinkBlock{{pc_}});
+            }
+            return true;
+        }
+
+#define DECLARE(A) \
+  void Visit##A(const vixl::aarch64::Instruction* instr) override;
+        VISITOR_LIST(DECLARE)
+#undef DECLARE
+
+    private:
+        // the instruction is supported, everything emitted from here on is its
+        void Begin();
+
+        Argument Value(const Return &ret);
+
+        Argument Imm(bool sf, u64 value);
+
+        // 31 is zr unless sp
+        Argument GetReg(bool sf, u8 code, bool sp = false);
+
+        void SetReg(bool sf, u8 code, const Argument &value, bool sp = false);
+
+        Argument Add(bool sf, const Argument &a, const Argument &b);
+        Argument Sub(bool sf, const Argument &a, const Argument &b);
+        Argument Mul(bool sf, const Argument &a, const Argument &b);
+        Argument And(bool sf, const Argument &a, const Argument &b);
+        Argument Or(bool sf, const Argument &a, const Argument &b);
+        Argument Eor(bool sf, const Argument &a, const Argument &b);
+        Argument Not(bool sf, const Argument &a);
+        Argument Lsl(bool sf, const Argument &a, const Argument &b);
+        Argument Lsr(bool sf, const Argument &a, const Argument &b);
+        Argument Asr(bool sf, const Argument &a, const Argument &b);
+        Argument Ror(bool sf, const Argument &a, const Argument &b);
+        Argument Select(bool sf, const Argument &cond, const Argument &a, const Argument &b);
+
+        Argument AddFlags(bool sf, const Argument &a, const Argument &b);
+        Argument SubFlags(bool sf, const Argument &a, const Argument &b);
+
+        Argument Cond(u8 cond);
+
+        // shift is LSL, LSR, ASR or ROR
+        Argument ShiftOperand(bool sf, const Argument &value, u32 shift, u32 amount);
+
+        // extend is UXTB ... SXTX, then shifted left
+        Argument ExtendOperand(bool sf, const Argument &value, u32 extend, u32 left_shift);
+
+        void AddSub(bool sf, bool sub, bool set_flags, u8 rd, const Argument &a, const Argument &b, bool rd_sp);
+
+        void Logical(bool sf, u32 opc, u8 rd, const Argument &a, const Argument &b, bool rd_sp);
+
+        Argument Load(u32 size_log2, const Argument &address);
+
+        void Store(u32 size_log2, const Argument &address, const Argument &value);
+
+        // integer load/store of a single register, opc as in the encoding
+        void LoadStore(u32 size_log2, u32 opc, u8 rt, const Argument &address);
+
+        // base + offset, written back to rn for pre/post index
+        void LoadStoreImm(u32 instr, s64 offset, bool write_back, bool post_index);
+
+        void LoadStorePair(const vixl::aarch64::Instruction *instr, bool write_back, bool post_index);
+
+        void CondCompare(const vixl::aarch64::Instruction *instr, bool imm);
+
+        void Branch(VAddr target);
+
+        void BranchIf(const Argument &cond, VAddr target);
+
+        Argument IsZero(bool sf, const Argument &value);
+
+        vixl::aarch64::Decoder decoder_;
+        Jit::IR::CodeBlock *block_{};
+        AssemblerIR *ir_{};
+        VAddr pc_{};
+        bool lifted_{false};
+    };
+
+}
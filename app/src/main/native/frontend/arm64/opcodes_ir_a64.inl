@@ -1,6 +1,6 @@
 //INST(OpCode, Ret, args...)
 
-//Frontend Register Get/Set
+//Frontend Register Get/Set, code 31 is sp, SetW zero extends
 INST2(A64SetX, RetVoid, A64XReg, RegU64)
 INST2(A64SetW, RetVoid, A64WReg, RegU32)
 INST2(A64SetV, RetVoid, A64VReg, RegU128)
@@ -9,3 +9,8 @@ INST1(A64GetX, RetU64, A64XReg)
 INST1(A64GetW, RetU32, A64WReg)
 INST1(A64GetV, RetU128, A64VReg)
 
+//Flags and system registers (SysRegA64)
+INST0(A64GetNZCV, RetU32)
+INST1(A64SetNZCV, RetVoid, RegU32)
+INST1(A64GetSys, RetU64, Imm16)
+INST2(A64SetSys, RetVoid, Imm16, RegU64)
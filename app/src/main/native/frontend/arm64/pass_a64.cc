@@ -0,0 +1,125 @@
+//
+// Created by SwiftGan on 2020/11/26.
+//
+
+#include <array>
+#include "pass_a64.h"
+
+using namespace Instructions::A64;
+
+// x0 - x30, sp, nzcv
+constexpr static u8 nzcv_slot = 32;
+constexpr static u8 context_slots = 33;
+
+namespace {
+
+    struct KnownValue {
+        Argument value;
+        // the whole register is value
+        bool wide;
+        // the low 32 bits zero extended are value
+        bool narrow;
+    };
+
+}
+
+const char *ContextForwardPassA64::Name() const {
+    return "ContextForwardA64";
+}
+
+void ContextForwardPassA64::Run(Jit::IR::CodeBlock &block, Jit::IR::PassStats &stats) {
+    std::array<KnownValue, context_slots> known{};
+    // last write of each slot nothing has seen yet
+    std::array<InstrIR *, context_slots> pending{};
+    std::vector<bool> dead(block.InstrCount());
+    ResetForwards(block);
+
+    auto write = [&](u8 slot, InstrIR &instr, const KnownValue &value) {
+        auto overwritten = pending[slot];
+        if (overwritten) {
+            for (auto &arg : overwritten->args_) {
+                if (arg.IsValue()) {
+                    arg.value_.instr->use_count--;
+                }
+            }
+            dead[overwritten->id_] = true;
+        }
+        pending[slot] = &instr;
+        known[slot] = value;
+    };
+
+    for (auto &instr : block.Instrs()) {
+        stats.rewritten += Rewrite(instr);
+        switch (static_cast<OpcodeIRA64>(instr.opcode_)) {
+            case OpcodeIRA64::A64SetX: {
+                auto &value = instr.args_[1];
+                write(instr.args_[0].value_.fronted.code, instr, {value, true, IsNarrow(value)});
+                break;
+            }
+            case OpcodeIRA64::A64SetW: {
+                // zero extends, only a narrow value is the whole register
+                auto &value = instr.args_[1];
+                write(instr.args_[0].value_.fronted.code, instr,
+                      IsNarrow(value) ? KnownValue{value, true, true} : KnownValue{});
+                break;
+            }
+            case OpcodeIRA64::A64SetNZCV:
+                write(nzcv_slot, instr, {instr.args_[0], true, true});
+                break;
+            case OpcodeIRA64::A64GetX:
+            case OpcodeIRA64::A64GetNZCV: {
+                auto slot = instr.opcode_ == static_cast<u8>(OpcodeIRA64::A64GetX)
+                            ? instr.args_[0].value_.fronted.code : nzcv_slot;
+                auto &value = known[slot];
+                if (value.wide) {
+                    Forward(instr, value.value);
+                } else {
+                    pending[slot] = nullptr;
+                    value = {Argument(&instr), true, instr.opcode_ == static_cast<u8>(OpcodeIRA64::A64GetNZCV)};
+                }
+                break;
+            }
+            case OpcodeIRA64::A64GetW: {
+                auto slot = instr.args_[0].value_.fronted.code;
+                auto &value = known[slot];
+                if (value.narrow) {
+                    Forward(instr, value.value);
+                } else {
+                    pending[slot] = nullptr;
+                    if (!value.wide) {
+                        value = {Argument(&instr), false, true};
+                    }
+                }
+                break;
+            }
+            case OpcodeIRA64::A64GetSys:
+            case OpcodeIRA64::A64SetSys:
+                // msr/mrs nzcv go around the tracking
+                if (instr.args_[0].ImmValue() == static_cast<u16>(SysRegA64::NZCV)) {
+                    pending[nzcv_slot] = nullptr;
+                    if (instr.opcode_ == static_cast<u8>(OpcodeIRA64::A64SetSys)) {
+                        known[nzcv_slot] = {};
+                    }
+                }
+                break;
+            default:
+                switch (static_cast<OpcodeIR>(instr.opcode_)) {
+                    case OpcodeIR::Nop:
+                    case OpcodeIR::Fence:
+                    case OpcodeIR::ClearExclusive:
+                        break;
+                    default:
+                        // memory ops may leave the block at this guest instruction
+                        if (HasSideEffect(instr)) {
+                            pending.fill(nullptr);
+                        }
+                        break;
+                }
+                break;
+        }
+    }
+    stats.rewritten += RewriteTerminal(block);
+    block.Instrs().remove_if([&dead](const InstrIR &instr) {
+        return dead[instr.id_];
+    });
+}
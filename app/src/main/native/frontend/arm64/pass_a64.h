@@ -0,0 +1,22 @@
+//
+// Created by SwiftGan on 2020/11/26.
+//
+
+#pragma once
+
+#include "frontend/ir/pass_ir.h"
+#include "ir_for_a64.h"
+
+namespace Instructions::A64 {
+
+    // guest registers and flags live in the context.
+    // a read after a write or read of the block takes that value, a write overwritten
+    // before anything could see it (a fault or the block end) is dropped
+    class ContextForwardPassA64 : public Jit::IR::PassIR {
+    public:
+        const char *Name() const override;
+
+        void Run(Jit::IR::CodeBlock &block, Jit::IR::PassStats &stats) override;
+    };
+
+}
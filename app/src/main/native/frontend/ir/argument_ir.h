@@ -32,13 +32,13 @@ namespace Instructions::IR {
             MemOprand
         };
 
-        Argument() {}
+        Argument() = default;
 
         explicit Argument(InstrIR *inst) : type_(RegisterFromRet) {
             value_.instr = inst;
         }
 
-        explicit Argument(FrontedReg &reg) : type_(RegisterFronted) {
+        explicit Argument(const FrontedReg &reg) : type_(RegisterFronted) {
             value_.fronted = reg;
         }
 
@@ -68,7 +68,7 @@ namespace Instructions::IR {
 
 
         Type ArgType() const {
-            return Unknown;
+            return type_;
         };
 
         FORCE_INLINE bool IsCond() const {
@@ -87,6 +87,27 @@ namespace Instructions::IR {
             return ArgType() == Imme;
         }
 
+        // value produced by another instruction of the block
+        FORCE_INLINE bool IsValue() const {
+            return ArgType() == RegisterFromRet || ArgType() == RegisterState || ArgType() == StateFromRet;
+        }
+
+        // immediates are held zero extended
+        FORCE_INLINE u64 ImmValue() const {
+            switch (size_) {
+                case DataSize::U1:
+                    return value_.imm_u1;
+                case DataSize::U8:
+                    return value_.imm_u8;
+                case DataSize::U16:
+                    return value_.imm_u16;
+                case DataSize::U32:
+                    return value_.imm_u32;
+                default:
+                    return value_.imm_u64;
+            }
+        }
+
         Type type_;
 
         DataSize size_;
@@ -112,8 +133,8 @@ namespace Instructions::IR {
 
         Return(InstrIR *inst) : instr(inst) {}
 
-        DataSize size_;
-        InstrIR *instr;
+        DataSize size_{DataSize::Void};
+        InstrIR *instr{};
     };
 
 
@@ -129,39 +150,51 @@ namespace Instructions::IR {
     class State : public Argument {
     public:
         State() = default;
-        State(Return &ret) : Argument(ret.instr) {
+        State(const Return &ret) : Argument(ret.instr) {
             type_ = StateFromRet;
         }
     };
 
 
+    template<typename D>
+    class Imm : public Argument {
+    public:
+        Imm() = default;
+        Imm(D d) : Argument(d) {}
+    };
+
+
     template<DataSize data_size>
     class RegisterIR : public Argument {
     public:
 
         RegisterIR() = default;
 
-        RegisterIR(FrontedReg &reg) : Argument(reg) {
+        RegisterIR(const FrontedReg &reg) : Argument(reg) {
             size_ = data_size;
         }
 
-        RegisterIR(ReturnType<data_size> &ret) : Argument(ret.instr) {
+        // values are held zero extended, so a narrower one widens for free
+        template<DataSize ret_size>
+        RegisterIR(const ReturnType<ret_size> &ret) : Argument(ret.instr) {
+            static_assert(static_cast<u16>(ret_size) <= static_cast<u16>(data_size), "narrowing needs a Truncate");
             size_ = data_size;
         }
 
-        RegisterIR(State &state) : Argument(state.value_.instr) {
+        RegisterIR(const State &state) : Argument(state.value_.instr) {
             size_ = data_size;
             type_ = RegisterState;
         }
-    };
 
-    template<typename D>
-    class Imm : public Argument {
-    public:
-        Imm() = default;
-        Imm(D d) : Argument(d) {}
-    };
+        template<typename D>
+        RegisterIR(const Imm<D> &imm) : Argument(imm) {}
 
+        explicit RegisterIR(const Argument &arg) : Argument(arg) {
+            if (!arg.IsImm()) {
+                size_ = data_size;
+            }
+        }
+    };
 
     using RetVoid = ReturnType<DataSize::Void>;
     using RetU1 = ReturnType<DataSize::U1>;
@@ -8,20 +8,25 @@ using namespace Instructions::IR;
 
 
 // IR Assembler
-#define INST0(name, ret) ret& Assembler::name() { \
+#define INST0(name, ret) ret Assembler::name() { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIR::name), {}); \
 }
 
-#define INST1(name, ret, arg1) ret& Assembler::name(const arg1& a1) { \
+#define INST1(name, ret, arg1) ret Assembler::name(const arg1& a1) { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIR::name), {a1}); \
 }
 
-#define INST2(name, ret, arg1, arg2) ret& Assembler::name(const arg1& a1, const arg2& a2) { \
+#define INST2(name, ret, arg1, arg2) ret Assembler::name(const arg1& a1, const arg2& a2) { \
     return block_->Emit<ret>(static_cast<u8>(OpcodeIR::name), {a1, a2}); \
 }
 
+#define INST3(name, ret, arg1, arg2, arg3) ret Assembler::name(const arg1& a1, const arg2& a2, const arg3& a3) { \
+    return block_->Emit<ret>(static_cast<u8>(OpcodeIR::name), {a1, a2, a3}); \
+}
+
 #include "opcodes_ir.inl"
 
 #undef INST0
 #undef INST1
 #undef INST2
+#undef INST3
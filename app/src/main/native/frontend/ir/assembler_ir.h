@@ -14,18 +14,22 @@ namespace Instructions::IR {
 
     class Assembler {
     public:
+        explicit Assembler(Jit::IR::CodeBlock *block) : block_(block) {}
+
         // IR Assembler
-#define INST0(name, ret) ret& name();
-#define INST1(name, ret, arg1) ret& name(const arg1& a1);
-#define INST2(name, ret, arg1, arg2) ret& name(const arg1& a1, const arg2& a2);
+#define INST0(name, ret) ret name();
+#define INST1(name, ret, arg1) ret name(const arg1& a1);
+#define INST2(name, ret, arg1, arg2) ret name(const arg1& a1, const arg2& a2);
+#define INST3(name, ret, arg1, arg2, arg3) ret name(const arg1& a1, const arg2& a2, const arg3& a3);
 
 #include "opcodes_ir.inl"
 
 #undef INST0
 #undef INST1
 #undef INST2
+#undef INST3
     protected:
-        CodeBlock *block_;
+        Jit::IR::CodeBlock *block_;
     };
 
 }
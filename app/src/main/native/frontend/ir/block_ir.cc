@@ -6,16 +6,124 @@
 
 using namespace Jit::IR;
 
+CodeBlock::CodeBlock(VAddr start) : start_(start) {}
+
 void CodeBlock::Emit(InstrIR &instr) {
     instrs_.push_back(instr);
+    instr_count_++;
+}
+
+void CodeBlock::Use(const Argument &arg) {
+    if (arg.IsValue()) {
+        arg.value_.instr->use_count++;
+    }
+}
+
+void CodeBlock::Release(const Argument &arg) {
+    if (arg.IsValue()) {
+        arg.value_.instr->use_count--;
+    }
 }
 
-void CodeBlock::Terminal(If &ter) {
+void CodeBlock::ReleaseTerminal() {
+    auto value = TerminalValue();
+    if (value) {
+        Release(*value);
+    }
+}
+
+void CodeBlock::Terminal(const If &ter) {
+    ReleaseTerminal();
     terminal_type_ = IF;
     if_ = ter;
 }
 
-void CodeBlock::Terminal(CheckBit &ter) {
+void CodeBlock::Terminal(const CheckBit &ter) {
+    ReleaseTerminal();
     terminal_type_ = CHECK_BIT;
     check_bit_ = ter;
+    Use(ter.bit_);
+}
+
+void CodeBlock::Terminal(const LinkBlock &ter) {
+    ReleaseTerminal();
+    terminal_type_ = LINK;
+    link_ = ter;
+}
+
+void CodeBlock::Terminal(const Indirect &ter) {
+    ReleaseTerminal();
+    terminal_type_ = INDIRECT;
+    indirect_ = ter;
+    Use(ter.target_);
+}
+
+void CodeBlock::Terminal(const Trap &ter) {
+    ReleaseTerminal();
+    terminal_type_ = TRAP;
+    trap_ = ter;
+}
+
+void CodeBlock::NextGuestInstr() {
+    guest_count_++;
+}
+
+VAddr CodeBlock::Start() const {
+    return start_;
+}
+
+u16 CodeBlock::GuestInstrCount() const {
+    return guest_count_;
+}
+
+u32 CodeBlock::InstrCount() const {
+    return instr_count_;
+}
+
+bool CodeBlock::Termed() const {
+    return terminal_type_ != NONE;
+}
+
+CodeBlock::TerminalType CodeBlock::GetTerminalType() const {
+    return terminal_type_;
+}
+
+const If &CodeBlock::GetIf() const {
+    assert(terminal_type_ == IF);
+    return if_;
+}
+
+const CheckBit &CodeBlock::GetCheckBit() const {
+    assert(terminal_type_ == CHECK_BIT);
+    return check_bit_;
+}
+
+const LinkBlock &CodeBlock::GetLink() const {
+    assert(terminal_type_ == LINK);
+    return link_;
+}
+
+const Indirect &CodeBlock::GetIndirect() const {
+    assert(terminal_type_ == INDIRECT);
+    return indirect_;
+}
+
+const Trap &CodeBlock::GetTrap() const {
+    assert(terminal_type_ == TRAP);
+    return trap_;
+}
+
+Argument *CodeBlock::TerminalValue() {
+    switch (terminal_type_) {
+        case CHECK_BIT:
+            return &check_bit_.bit_;
+        case INDIRECT:
+            return &indirect_.target_;
+        default:
+            return nullptr;
+    }
+}
+
+slist<InstrIR, cache_last<true>> &CodeBlock::Instrs() {
+    return instrs_;
 }
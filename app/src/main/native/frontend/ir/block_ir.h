@@ -8,55 +8,120 @@
 #include "includes/instruction.h"
 #include "instruction_ir.h"
 
-using namespace Instructions;
-using namespace boost::intrusive;
-using namespace Instructions::IR;
-
 namespace Jit::IR {
 
+    using namespace Instructions;
+    using namespace boost::intrusive;
+    using namespace Instructions::IR;
+
 
+    // guest pc the block continues at
     struct Terminal {
-        u32 block_id_;
+        VAddr pc_;
     };
 
+    // on the guest flags left by the block
     struct If {
         If() = default;
-        If(Condition if_, Terminal then_, Terminal else_) : if_(if_), then_(std::move(then_)),
+        If(Instructions::Condition if_, Terminal then_, Terminal else_) : if_(if_), then_(std::move(then_)),
                                                             else_(std::move(else_)) {}
-        Condition if_;
+        Instructions::Condition if_;
         Terminal then_;
         Terminal else_;
     };
 
     struct CheckBit {
         CheckBit() = default;
-        CheckBit(Terminal then_, Terminal else_) : then_(std::move(then_)),
-                                                   else_(std::move(else_)) {}
+        CheckBit(const Argument &bit_, Terminal then_, Terminal else_) : bit_(bit_), then_(std::move(then_)),
+                                                                         else_(std::move(else_)) {}
+        Argument bit_;
         Terminal then_;
         Terminal else_;
     };
 
+    struct LinkBlock {
+        LinkBlock() = default;
+        LinkBlock(Terminal next_) : next_(next_) {}
+        Terminal next_;
+    };
+
+    struct Indirect {
+        Indirect() = default;
+        Indirect(const Argument &target_) : target_(target_) {}
+        Argument target_;
+    };
+
+    // hand the guest to the host at pc, reason and data are those of the frontend
+    struct Trap {
+        Trap() = default;
+        Trap(u32 reason_, u64 data_, Terminal at_) : reason_(reason_), data_(data_), at_(at_) {}
+        u32 reason_;
+        u64 data_;
+        Terminal at_;
+    };
+
     class CodeBlock {
     public:
 
         enum TerminalType : u8 {
+            NONE,
+            LINK,
             IF,
-            CHECK_BIT
+            CHECK_BIT,
+            INDIRECT,
+            TRAP
         };
 
+        explicit CodeBlock(VAddr start = 0);
+
         void Emit(InstrIR &instr);
-        void Terminal(If &ter);
-        void Terminal(CheckBit &ter);
+        // replaces the terminal, the value the old one read is released
+        void Terminal(const If &ter);
+        void Terminal(const CheckBit &ter);
+        void Terminal(const LinkBlock &ter);
+        void Terminal(const Indirect &ter);
+        void Terminal(const Trap &ter);
+
+        // instructions emitted from here on belong to the next guest instruction
+        void NextGuestInstr();
+
+        VAddr Start() const;
+
+        u16 GuestInstrCount() const;
+
+        u32 InstrCount() const;
+
+        bool Termed() const;
+
+        TerminalType GetTerminalType() const;
+
+        const If &GetIf() const;
+
+        const CheckBit &GetCheckBit() const;
+
+        const LinkBlock &GetLink() const;
+
+        const Indirect &GetIndirect() const;
+
+        const Trap &GetTrap() const;
+
+        // value the terminal reads, null if it reads none
+        Argument *TerminalValue();
+
+        slist<InstrIR, cache_last<true>> &Instrs();
 
 
         template <typename Ret = Return>
-        Ret &Emit(u8 opcode, std::initializer_list<Argument> args) {
-            InstrIR &inst = InstrIRPool::Get().Acquire();
+        Ret Emit(u8 opcode, std::initializer_list<Argument> args) {
+            InstrIR &inst = InstrIRArena::Current().Acquire();
             inst.opcode_ = opcode;
+            inst.id_ = instr_count_;
+            inst.guest_index_ = guest_count_ ? guest_count_ - 1 : 0;
             Ret r(&inst);
             inst.return_ = r;
             std::for_each(args.begin(), args.end(), [&inst, index = size_t(0)](const auto& arg) mutable {
                 inst.SetArg(index, arg);
+                Use(arg);
                 index++;
             });
             Emit(inst);
@@ -64,13 +129,25 @@ namespace Jit::IR {
         }
 
     private:
+        static void Use(const Argument &arg);
+
+        static void Release(const Argument &arg);
+
+        void ReleaseTerminal();
+
         slist<InstrIR, cache_last<true>> instrs_;
-        TerminalType terminal_type_;
+        VAddr start_;
+        u32 instr_count_{0};
+        u16 guest_count_{0};
+        TerminalType terminal_type_{NONE};
         union {
             If if_;
             CheckBit check_bit_;
+            LinkBlock link_;
+            Indirect indirect_;
+            Trap trap_;
         };
         u32 exe_count_ {0};
     };
 
-}
\ No newline at end of file
+}
@@ -20,12 +20,90 @@ InstrIRPool &InstrIRPool::Get() {
     return pool;
 }
 
-InstrIR &InstrIRPool::Acquire() {
-    LockGuard lock(pool_lock_);
+static constexpr u64 FreeHead(u32 id_plus_one, u32 tag) {
+    return (u64(tag) << 32) | id_plus_one;
+}
+
+InstrIRChunk *InstrIRPool::AcquireChunk() {
+    auto head = free_head_.load(std::memory_order_acquire);
+    while (u32(head)) {
+        // chunks are never freed, next_free of a chunk just taken by another thread may be stale,
+        // the tag makes the cas fail then
+        auto chunk = chunks_[u32(head) - 1];
+        auto next = FreeHead(chunk->next_free.load(std::memory_order_relaxed), u32(head >> 32) + 1);
+        if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                             std::memory_order_acquire)) {
+            chunk_reuses_.fetch_add(1, std::memory_order_relaxed);
+            chunk->used = 0;
+            return chunk;
+        }
+    }
+    auto chunk = new InstrIRChunk;
+    chunk_mallocs_.fetch_add(1, std::memory_order_relaxed);
+    chunk->used = 0;
+    chunk->next_free.store(0, std::memory_order_relaxed);
+    auto id = chunk_count_.fetch_add(1, std::memory_order_relaxed);
+    if (id < max_chunks) {
+        chunk->id = id;
+        // published by the release cas in ReleaseChunk
+        chunks_[id] = chunk;
+    } else {
+        chunk->id = UINT32_MAX;
+    }
+    return chunk;
+}
+
+void InstrIRPool::ReleaseChunk(InstrIRChunk *chunk) {
+    if (chunk->id == UINT32_MAX) {
+        delete chunk;
+        return;
+    }
+    auto head = free_head_.load(std::memory_order_relaxed);
+    do {
+        chunk->next_free.store(u32(head), std::memory_order_relaxed);
+    } while (!free_head_.compare_exchange_weak(head, FreeHead(chunk->id + 1, u32(head >> 32) + 1),
+                                               std::memory_order_release, std::memory_order_relaxed));
+}
+
+u64 InstrIRPool::ChunkMallocs() const {
+    return chunk_mallocs_.load(std::memory_order_relaxed);
+}
 
+u64 InstrIRPool::ChunkReuses() const {
+    return chunk_reuses_.load(std::memory_order_relaxed);
 }
 
-void InstrIRPool::Release(InstrIR &instr) {
-    LockGuard lock(pool_lock_);
+InstrIRArena &InstrIRArena::Current() {
+    static thread_local InstrIRArena arena;
+    return arena;
+}
+
+InstrIRArena::~InstrIRArena() {
+    for (auto chunk : chunks_) {
+        InstrIRPool::Get().ReleaseChunk(chunk);
+    }
+}
+
+InstrIR &InstrIRArena::Acquire() {
+    if (chunks_.empty() || chunks_.back()->used == InstrIRChunk::capacity) {
+        chunks_.push_back(InstrIRPool::Get().AcquireChunk());
+    }
+    auto chunk = chunks_.back();
+    alloc_count_++;
+    return *new(chunk->At(chunk->used++)) InstrIR();
+}
+
+void InstrIRArena::Reset() {
+    if (chunks_.empty()) {
+        return;
+    }
+    for (size_t i = 1; i < chunks_.size(); ++i) {
+        InstrIRPool::Get().ReleaseChunk(chunks_[i]);
+    }
+    chunks_.resize(1);
+    chunks_[0]->used = 0;
+}
 
+u64 InstrIRArena::AllocCount() const {
+    return alloc_count_;
 }
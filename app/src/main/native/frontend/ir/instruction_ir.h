@@ -5,6 +5,8 @@
 #pragma once
 
 #include <base/marcos.h>
+#include <vector>
+#include <type_traits>
 #include "opcode_ir.h"
 #include "argument_ir.h"
 #include <boost/intrusive/slist_hook.hpp>
@@ -26,22 +28,74 @@ namespace Instructions::IR {
         void SetArg(int pos, const Argument &argument);
 
         u8 opcode_;
+        // position in the block
+        u32 id_{};
+        // guest instruction of the block it was lifted from
+        u16 guest_index_{};
         u32 use_count = 0;
         std::array<Argument, max_arg_count> args_;
         Return return_;
     };
 
+    // fixed block of InstrIR storage, recycled through InstrIRPool
+    struct InstrIRChunk {
+        constexpr static u32 capacity = 256;
+
+        InstrIR *At(u32 index) {
+            return reinterpret_cast<InstrIR *>(&storage[index]);
+        }
+
+        // index in the pool table, UINT32_MAX if the table was full
+        u32 id;
+        // id + 1 of the next free chunk, may be read while another thread pops the chunk
+        std::atomic<u32> next_free;
+        u32 used;
+        std::aligned_storage_t<sizeof(InstrIR), alignof(InstrIR)> storage[capacity];
+    };
+
+    // global free list of chunks shared by all jit threads, lock free
     class InstrIRPool {
     public:
+        constexpr static u32 max_chunks = 4096;
 
         static InstrIRPool &Get();
 
+        InstrIRChunk *AcquireChunk();
+
+        void ReleaseChunk(InstrIRChunk *chunk);
+
+        u64 ChunkMallocs() const;
+
+        u64 ChunkReuses() const;
+
+    private:
+        // id + 1 of the top chunk in the low half, aba tag in the high half
+        std::atomic<u64> free_head_{0};
+        std::atomic<u32> chunk_count_{0};
+        InstrIRChunk *chunks_[max_chunks]{};
+        std::atomic<u64> chunk_mallocs_{0};
+        std::atomic<u64> chunk_reuses_{0};
+    };
+
+    // InstrIR of the blocks built by one thread, bump allocated, no single frees
+    class InstrIRArena : public NonCopyable {
+    public:
+
+        static InstrIRArena &Current();
+
+        ~InstrIRArena();
+
         InstrIR &Acquire();
-        void Release(InstrIR &instr);
+
+        // all InstrIR handed out are dead after this, the blocks linking them must be gone.
+        // the first chunk is kept, the rest goes back to the pool
+        void Reset();
+
+        u64 AllocCount() const;
 
     private:
-        std::mutex pool_lock_;
-        slist<InstrIR, cache_last<true>> free_list_;
+        std::vector<InstrIRChunk *> chunks_;
+        u64 alloc_count_{0};
     };
 
 }
\ No newline at end of file
@@ -10,6 +10,7 @@ namespace Instructions::IR {
 #define INST0(x, ...) x,
 #define INST1(x, ...) x,
 #define INST2(x, ...) x,
+#define INST3(x, ...) x,
 #define Type(x)
     enum class OpcodeIR : u8 {
         UN_DECODED,
@@ -22,5 +23,6 @@ namespace Instructions::IR {
 #undef INST0
 #undef INST1
 #undef INST2
+#undef INST3
 #undef Type
 }
\ No newline at end of file
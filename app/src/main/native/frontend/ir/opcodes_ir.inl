@@ -1,4 +1,5 @@
 //INST(OpCode, Ret, args...)
+//N bit ops only read the low N bits of their operands, results are zero extended
 
 INST0(Nop, RetVoid)
 INST0(BreakPoint, RetVoid)
@@ -18,6 +19,39 @@ INST2(OrReg32, RetU32, RegU32, RegU32)
 INST2(OrReg64, RetU64, RegU64, RegU64)
 INST1(NotReg32, RetU32, RegU32)
 INST1(NotReg64, RetU64, RegU64)
+//shift amount is taken modulo the width
+INST2(LslReg32, RetU32, RegU32, RegU32)
+INST2(LslReg64, RetU64, RegU64, RegU64)
+INST2(LsrReg32, RetU32, RegU32, RegU32)
+INST2(LsrReg64, RetU64, RegU64, RegU64)
+INST2(AsrReg32, RetU32, RegU32, RegU32)
+INST2(AsrReg64, RetU64, RegU64, RegU64)
+INST2(RorReg32, RetU32, RegU32, RegU32)
+INST2(RorReg64, RetU64, RegU64, RegU64)
+//x / 0 = 0, min / -1 = min
+INST2(UDivReg32, RetU32, RegU32, RegU32)
+INST2(UDivReg64, RetU64, RegU64, RegU64)
+INST2(SDivReg32, RetU32, RegU32, RegU32)
+INST2(SDivReg64, RetU64, RegU64, RegU64)
+INST1(ClzReg32, RetU32, RegU32)
+INST1(ClzReg64, RetU64, RegU64)
+//byte reverse
+INST1(RevReg32, RetU32, RegU32)
+INST1(RevReg64, RetU64, RegU64)
+INST1(SignExtend8, RetU64, RegU8)
+INST1(SignExtend16, RetU64, RegU16)
+INST1(SignExtend32, RetU64, RegU32)
+
+//Flags, nzcv in bits 31:28
+INST2(AddFlags32, RetU32, RegU32, RegU32)
+INST2(AddFlags64, RetU32, RegU64, RegU64)
+INST2(SubFlags32, RetU32, RegU32, RegU32)
+INST2(SubFlags64, RetU32, RegU64, RegU64)
+INST1(LogicFlags32, RetU32, RegU32)
+INST1(LogicFlags64, RetU32, RegU64)
+INST2(CheckCond, RetU1, RegU32, Imm8)
+INST3(Select32, RetU32, RegU1, RegU32, RegU32)
+INST3(Select64, RetU64, RegU1, RegU64, RegU64)
 
 INST1(CheckZero32, RetU1, RegU32)
 INST1(CheckZero64, RetU1, RegU64)
@@ -35,17 +69,19 @@ INST1(Ldr16, RetU16, RegAddr)
 INST1(Ldr32, RetU32, RegAddr)
 INST1(Ldr64, RetU64, RegAddr)
 INST1(Ldr128, RetU128, RegAddr)
-//Load And Store (Exclusive)
-INST2(Strx8, RetVoid, RegAddr, RegU8)
-INST2(Strx16, RetVoid, RegAddr, RegU16)
-INST2(Strx32, RetVoid, RegAddr, RegU32)
-INST2(Strx64, RetVoid, RegAddr, RegU64)
-INST2(Strx128, RetVoid, RegAddr, RegU128)
+//Load And Store (Exclusive), store returns 0 on success
+INST2(Strx8, RetU32, RegAddr, RegU8)
+INST2(Strx16, RetU32, RegAddr, RegU16)
+INST2(Strx32, RetU32, RegAddr, RegU32)
+INST2(Strx64, RetU32, RegAddr, RegU64)
+INST2(Strx128, RetU32, RegAddr, RegU128)
 INST1(Ldrx8, RetU8, RegAddr)
 INST1(Ldrx16, RetU16, RegAddr)
 INST1(Ldrx32, RetU32, RegAddr)
 INST1(Ldrx64, RetU64, RegAddr)
 INST1(Ldrx128, RetU128, RegAddr)
+INST0(ClearExclusive, RetVoid)
+INST0(Fence, RetVoid)
 
 
 //STATE
@@ -0,0 +1,360 @@
+//
+// Created by SwiftGan on 2020/11/26.
+//
+
+#include <base/log.h>
+#include "pass_ir.h"
+
+using namespace Jit::IR;
+
+bool PassIR::HasSideEffect(const InstrIR &instr) {
+    switch (static_cast<OpcodeIR>(instr.opcode_)) {
+        case OpcodeIR::Ldr8:
+        case OpcodeIR::Ldr16:
+        case OpcodeIR::Ldr32:
+        case OpcodeIR::Ldr64:
+        case OpcodeIR::Ldr128:
+        case OpcodeIR::Ldrx8:
+        case OpcodeIR::Ldrx16:
+        case OpcodeIR::Ldrx32:
+        case OpcodeIR::Ldrx64:
+        case OpcodeIR::Ldrx128:
+        case OpcodeIR::Strx8:
+        case OpcodeIR::Strx16:
+        case OpcodeIR::Strx32:
+        case OpcodeIR::Strx64:
+        case OpcodeIR::Strx128:
+            return true;
+        default:
+            return instr.return_.size_ == DataSize::Void;
+    }
+}
+
+bool PassIR::IsNarrow(const Argument &arg) {
+    if (arg.IsImm()) {
+        return arg.ImmValue() <= UINT32_MAX;
+    }
+    if (arg.IsValue()) {
+        auto size = arg.value_.instr->return_.size_;
+        return size != DataSize::Void && static_cast<u16>(size) <= static_cast<u16>(DataSize::U32);
+    }
+    return false;
+}
+
+void PassIR::ReplaceArg(Argument &arg, const Argument &value) {
+    if (arg.IsValue()) {
+        arg.value_.instr->use_count--;
+    }
+    if (value.IsValue()) {
+        if (!arg.IsValue()) {
+            arg.type_ = Argument::RegisterFromRet;
+        }
+        arg.value_.instr = value.value_.instr;
+        value.value_.instr->use_count++;
+    } else {
+        arg = value;
+    }
+}
+
+void PassIR::ResetForwards(CodeBlock &block) {
+    forwards_.assign(block.InstrCount(), Argument{});
+}
+
+void PassIR::Forward(const InstrIR &instr, const Argument &value) {
+    forwards_[instr.id_] = value;
+}
+
+u32 PassIR::Rewrite(InstrIR &instr) {
+    u32 count{0};
+    for (auto &arg : instr.args_) {
+        if (arg.IsValue() && !forwards_[arg.value_.instr->id_].IsUnknown()) {
+            ReplaceArg(arg, forwards_[arg.value_.instr->id_]);
+            count++;
+        }
+    }
+    return count;
+}
+
+u32 PassIR::RewriteTerminal(CodeBlock &block) {
+    auto value = block.TerminalValue();
+    if (value && value->IsValue() && !forwards_[value->value_.instr->id_].IsUnknown()) {
+        ReplaceArg(*value, forwards_[value->value_.instr->id_]);
+        return 1;
+    }
+    return 0;
+}
+
+// same results as the interpreter gives
+static bool FoldConstant(OpcodeIR opcode, u64 a, u64 b, u64 c, u64 &result) {
+    switch (opcode) {
+        case OpcodeIR::AddReg32:
+            result = static_cast<u32>(a + b);
+            break;
+        case OpcodeIR::AddReg64:
+            result = a + b;
+            break;
+        case OpcodeIR::SubReg32:
+            result = static_cast<u32>(a - b);
+            break;
+        case OpcodeIR::SubReg64:
+            result = a - b;
+            break;
+        case OpcodeIR::MulReg32:
+            result = static_cast<u32>(a * b);
+            break;
+        case OpcodeIR::MulReg64:
+            result = a * b;
+            break;
+        case OpcodeIR::AndReg32:
+            result = static_cast<u32>(a & b);
+            break;
+        case OpcodeIR::AndReg64:
+            result = a & b;
+            break;
+        case OpcodeIR::EorReg32:
+            result = static_cast<u32>(a ^ b);
+            break;
+        case OpcodeIR::EorReg64:
+            result = a ^ b;
+            break;
+        case OpcodeIR::OrReg32:
+            result = static_cast<u32>(a | b);
+            break;
+        case OpcodeIR::OrReg64:
+            result = a | b;
+            break;
+        case OpcodeIR::NotReg32:
+            result = static_cast<u32>(~a);
+            break;
+        case OpcodeIR::NotReg64:
+            result = ~a;
+            break;
+        case OpcodeIR::LslReg32:
+            result = static_cast<u32>(a << (b & 31));
+            break;
+        case OpcodeIR::LslReg64:
+            result = a << (b & 63);
+            break;
+        case OpcodeIR::LsrReg32:
+            result = static_cast<u32>(a) >> (b & 31);
+            break;
+        case OpcodeIR::LsrReg64:
+            result = a >> (b & 63);
+            break;
+        case OpcodeIR::AsrReg32:
+            result = static_cast<u32>(static_cast<s32>(a) >> (b & 31));
+            break;
+        case OpcodeIR::AsrReg64:
+            result = static_cast<u64>(static_cast<s64>(a) >> (b & 63));
+            break;
+        case OpcodeIR::SignExtend8:
+            result = static_cast<u64>(static_cast<s64>(static_cast<s8>(a)));
+            break;
+        case OpcodeIR::SignExtend16:
+            result = static_cast<u64>(static_cast<s64>(static_cast<s16>(a)));
+            break;
+        case OpcodeIR::SignExtend32:
+            result = static_cast<u64>(static_cast<s64>(static_cast<s32>(a)));
+            break;
+        case OpcodeIR::CheckZero32:
+            result = static_cast<u32>(a) == 0;
+            break;
+        case OpcodeIR::CheckZero64:
+            result = a == 0;
+            break;
+        case OpcodeIR::TestBit:
+            result = (a >> (b & 63)) & 1;
+            break;
+        case OpcodeIR::Select32:
+            result = static_cast<u32>((a & 1) ? b : c);
+            break;
+        case OpcodeIR::Select64:
+            result = (a & 1) ? b : c;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static Argument MakeImm(DataSize size, u64 value) {
+    switch (size) {
+        case DataSize::U1:
+            return Argument(value != 0);
+        case DataSize::U64:
+            return Argument(value);
+        default:
+            return Argument(static_cast<u32>(value));
+    }
+}
+
+// result of instr is one of its operands, or unknown
+static Argument FoldIdentity(InstrIR &instr) {
+    auto &a = instr.args_[0];
+    auto &b = instr.args_[1];
+    auto is = [](const Argument &arg, u64 value) {
+        return arg.IsImm() && arg.ImmValue() == value;
+    };
+    bool wide = instr.return_.size_ == DataSize::U64;
+    u64 ones = wide ? UINT64_MAX : UINT32_MAX;
+    Argument result{};
+    switch (static_cast<OpcodeIR>(instr.opcode_)) {
+        case OpcodeIR::AddReg32:
+        case OpcodeIR::AddReg64:
+        case OpcodeIR::OrReg32:
+        case OpcodeIR::OrReg64:
+        case OpcodeIR::EorReg32:
+        case OpcodeIR::EorReg64:
+            if (is(b, 0)) {
+                result = a;
+            } else if (is(a, 0)) {
+                result = b;
+            }
+            break;
+        case OpcodeIR::SubReg32:
+        case OpcodeIR::SubReg64:
+        case OpcodeIR::LslReg32:
+        case OpcodeIR::LslReg64:
+        case OpcodeIR::LsrReg32:
+        case OpcodeIR::LsrReg64:
+        case OpcodeIR::AsrReg32:
+        case OpcodeIR::AsrReg64:
+        case OpcodeIR::RorReg32:
+        case OpcodeIR::RorReg64:
+            if (is(b, 0)) {
+                result = a;
+            }
+            break;
+        case OpcodeIR::AndReg32:
+        case OpcodeIR::AndReg64:
+            if (is(b, 0) || is(a, 0)) {
+                return MakeImm(instr.return_.size_, 0);
+            } else if (b.IsImm() && (b.ImmValue() & ones) == ones) {
+                result = a;
+            } else if (a.IsImm() && (a.ImmValue() & ones) == ones) {
+                result = b;
+            }
+            break;
+        case OpcodeIR::MulReg32:
+        case OpcodeIR::MulReg64:
+            if (is(b, 0) || is(a, 0)) {
+                return MakeImm(instr.return_.size_, 0);
+            } else if (is(b, 1)) {
+                result = a;
+            } else if (is(a, 1)) {
+                result = b;
+            }
+            break;
+        case OpcodeIR::Select32:
+        case OpcodeIR::Select64:
+            if (a.IsImm()) {
+                result = (a.ImmValue() & 1) ? b : instr.args_[2];
+            }
+            break;
+        default:
+            break;
+    }
+    // an N bit op leaves the upper bits clear, the operand has to as well
+    if (result.IsUnknown() || result.IsFrontedReg() || (!wide && !PassIR::IsNarrow(result))) {
+        return {};
+    }
+    if (result.IsImm()) {
+        return MakeImm(instr.return_.size_, result.ImmValue() & ones);
+    }
+    return result;
+}
+
+const char *ConstantFoldPass::Name() const {
+    return "ConstantFold";
+}
+
+void ConstantFoldPass::Run(CodeBlock &block, PassStats &stats) {
+    ResetForwards(block);
+    for (auto &instr : block.Instrs()) {
+        stats.rewritten += Rewrite(instr);
+        if (HasSideEffect(instr)) {
+            continue;
+        }
+        auto &args = instr.args_;
+        u64 result;
+        bool constant = std::all_of(args.begin(), args.end(), [](const Argument &arg) {
+            return arg.IsUnknown() || arg.IsImm();
+        }) && !args[0].IsUnknown();
+        if (constant && FoldConstant(static_cast<OpcodeIR>(instr.opcode_), args[0].ImmValue(),
+                                     args[1].IsImm() ? args[1].ImmValue() : 0,
+                                     args[2].IsImm() ? args[2].ImmValue() : 0, result)) {
+            Forward(instr, MakeImm(instr.return_.size_, result));
+            continue;
+        }
+        auto identity = FoldIdentity(instr);
+        if (!identity.IsUnknown()) {
+            Forward(instr, identity);
+        }
+    }
+    stats.rewritten += RewriteTerminal(block);
+    // branch on a constant
+    auto value = block.TerminalValue();
+    if (value && value->IsImm()) {
+        if (block.GetTerminalType() == CodeBlock::CHECK_BIT) {
+            auto &ter = block.GetCheckBit();
+            block.Terminal(LinkBlock{(value->ImmValue() & 1) ? ter.then_ : ter.else_});
+        } else {
+            block.Terminal(LinkBlock{{value->ImmValue()}});
+        }
+    }
+}
+
+const char *DeadCodePass::Name() const {
+    return "DeadCode";
+}
+
+void DeadCodePass::Run(CodeBlock &block, PassStats &stats) {
+    std::vector<InstrIR *> instrs;
+    instrs.reserve(block.Instrs().size());
+    for (auto &instr : block.Instrs()) {
+        instrs.push_back(&instr);
+    }
+    // users come after their values, one backward walk frees whole chains
+    std::vector<bool> dead(block.InstrCount());
+    for (auto it = instrs.rbegin(); it != instrs.rend(); ++it) {
+        auto &instr = **it;
+        if (instr.use_count || HasSideEffect(instr)) {
+            continue;
+        }
+        for (auto &arg : instr.args_) {
+            if (arg.IsValue()) {
+                arg.value_.instr->use_count--;
+            }
+        }
+        dead[instr.id_] = true;
+        stats.removed++;
+    }
+    block.Instrs().remove_if([&dead](const InstrIR &instr) {
+        return dead[instr.id_];
+    });
+}
+
+void PassManagerIR::Add(std::unique_ptr<PassIR> pass) {
+    stats_.push_back({pass->Name()});
+    passes_.push_back(std::move(pass));
+}
+
+void PassManagerIR::Run(CodeBlock &block) {
+    for (size_t i = 0; i < passes_.size(); ++i) {
+        auto &stats = stats_[i];
+        passes_[i]->Run(block, stats);
+        stats.blocks++;
+    }
+}
+
+const std::vector<PassStats> &PassManagerIR::Stats() const {
+    return stats_;
+}
+
+void PassManagerIR::DumpStats() const {
+    for (auto &stats : stats_) {
+        LOGD("IR pass %s: %llu blocks, %llu instrs removed, %llu operands rewritten", stats.name,
+             static_cast<unsigned long long>(stats.blocks), static_cast<unsigned long long>(stats.removed),
+             static_cast<unsigned long long>(stats.rewritten));
+    }
+}
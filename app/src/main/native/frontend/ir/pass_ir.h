@@ -0,0 +1,85 @@
+//
+// Created by SwiftGan on 2020/11/26.
+//
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "block_ir.h"
+
+namespace Jit::IR {
+
+    struct PassStats {
+        const char *name;
+        u64 blocks{0};
+        // instructions dropped from the blocks, counted by the pass that drops them
+        u64 removed{0};
+        // operands pointed at an earlier value or a constant
+        u64 rewritten{0};
+    };
+
+    class PassIR {
+    public:
+        virtual ~PassIR() = default;
+
+        virtual const char *Name() const = 0;
+
+        virtual void Run(CodeBlock &block, PassStats &stats) = 0;
+
+        // stores, loads that may fault and everything returning nothing
+        static bool HasSideEffect(const InstrIR &instr);
+
+        // a constant or a value zero extended from 32 bits
+        static bool IsNarrow(const Argument &arg);
+
+        // use counts follow
+        static void ReplaceArg(Argument &arg, const Argument &value);
+
+    protected:
+        void ResetForwards(CodeBlock &block);
+
+        // later reads of the result of instr read value instead
+        void Forward(const InstrIR &instr, const Argument &value);
+
+        // returns the number of operands rewritten
+        u32 Rewrite(InstrIR &instr);
+
+        u32 RewriteTerminal(CodeBlock &block);
+
+        std::vector<Argument> forwards_;
+    };
+
+    // all operands constant, identities and selects on a constant
+    class ConstantFoldPass : public PassIR {
+    public:
+        const char *Name() const override;
+
+        void Run(CodeBlock &block, PassStats &stats) override;
+    };
+
+    // values nobody reads, transitively
+    class DeadCodePass : public PassIR {
+    public:
+        const char *Name() const override;
+
+        void Run(CodeBlock &block, PassStats &stats) override;
+    };
+
+    // one block at a time in the order added, not thread safe
+    class PassManagerIR {
+    public:
+        void Add(std::unique_ptr<PassIR> pass);
+
+        void Run(CodeBlock &block);
+
+        const std::vector<PassStats> &Stats() const;
+
+        void DumpStats() const;
+
+    private:
+        std::vector<std::unique_ptr<PassIR>> passes_;
+        std::vector<PassStats> stats_;
+    };
+
+}
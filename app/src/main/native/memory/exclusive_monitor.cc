@@ -0,0 +1,34 @@
+//
+// Created by SwiftGan on 2020/11/7.
+//
+
+#include "exclusive_monitor.h"
+
+using namespace Memory;
+
+ExclusiveMonitor::ExclusiveMonitor(u8 table_bits) : table_bits_(table_bits),
+                                                    table_(new std::atomic<u64>[size_t(1) << table_bits]) {
+    for (size_t i = 0; i < (size_t(1) << table_bits_); ++i) {
+        table_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+VAddr ExclusiveMonitor::TablePtr() const {
+    return reinterpret_cast<VAddr>(table_.get());
+}
+
+u8 ExclusiveMonitor::TableBits() const {
+    return table_bits_;
+}
+
+std::atomic<u64> &ExclusiveMonitor::Entry(VAddr vaddr) {
+    return table_[Index(vaddr, table_bits_)];
+}
+
+u64 ExclusiveMonitor::Load(VAddr vaddr) {
+    return Entry(vaddr).load(std::memory_order_acquire);
+}
+
+bool ExclusiveMonitor::Claim(VAddr vaddr, u64 tag) {
+    return Entry(vaddr).compare_exchange_strong(tag, tag + 1, std::memory_order_acq_rel);
+}
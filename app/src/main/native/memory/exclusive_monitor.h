@@ -0,0 +1,46 @@
+//
+// Created by SwiftGan on 2020/11/7.
+//
+
+#pragma once
+
+#include <base/marcos.h>
+#include <atomic>
+#include <memory>
+
+namespace Memory {
+
+    // global half of the emulated exclusive monitor, shared by all guest cores
+    // every successful store exclusive bumps the tag of its granule, a core whose
+    // load exclusive saw an older tag loses its store exclusive
+    class ExclusiveMonitor : public BaseObject, NonCopyable {
+    public:
+        // reservation granule of most arm64 cores
+        constexpr static u8 granule_bits = 6;
+
+        explicit ExclusiveMonitor(u8 table_bits = 12);
+
+        // generated code hashes into the table itself, see Index
+        VAddr TablePtr() const;
+
+        u8 TableBits() const;
+
+        std::atomic<u64> &Entry(VAddr vaddr);
+
+        u64 Load(VAddr vaddr);
+
+        // false if another core claimed the granule since tag was loaded
+        bool Claim(VAddr vaddr, u64 tag);
+
+        // granule bits above the table are folded in, so mappings a table size apart do not collide
+        static VAddr Index(VAddr vaddr, u8 table_bits) {
+            auto granule = vaddr >> granule_bits;
+            return (granule ^ (granule >> table_bits)) & ((VAddr(1) << table_bits) - 1);
+        }
+
+    private:
+        const u8 table_bits_;
+        std::unique_ptr<std::atomic<u64>[]> table_;
+    };
+
+}
@@ -0,0 +1,380 @@
+//
+// Created by SwiftGan on 2020/11/5.
+//
+
+#include <sys/mman.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <mutex>
+#include <base/log.h>
+#include "fastmem.h"
+
+using namespace Memory;
+
+constexpr static int max_fastmem_regions = 8;
+
+static std::atomic<FastMemory *> fastmem_regions_[max_fastmem_regions]{};
+static struct sigaction prev_segv_action_{};
+static std::once_flag segv_handler_once_;
+static std::once_flag self_mem_once_;
+static int self_mem_fd_ = -1;
+// a page that faults on write faults for every core, so stores only reach it through the handler.
+// taking this around each of them makes cas and store exclusive atomic against the others
+static SpinMutex fault_store_lock_;
+
+// local half of the monitor for exclusives that faulted, they never armed the host monitor
+struct FaultExclusive {
+    VAddr vaddr{~VAddr(0)};
+    u32 size{0};
+    u64 tag{0};
+    u8 value[16]{};
+};
+static thread_local FaultExclusive fault_exclusive_;
+
+static void FastMemSegvHandler(int signum, siginfo_t *siginfo, void *context) {
+    if (FastMemory::HandleFault(reinterpret_cast<VAddr>(siginfo->si_addr), context)) {
+        return;
+    }
+    // not ours
+    if (prev_segv_action_.sa_flags & SA_SIGINFO) {
+        prev_segv_action_.sa_sigaction(signum, siginfo, context);
+    } else if (prev_segv_action_.sa_handler == SIG_DFL || prev_segv_action_.sa_handler == SIG_IGN) {
+        // fault again with the default action
+        sigaction(SIGSEGV, &prev_segv_action_, nullptr);
+    } else {
+        prev_segv_action_.sa_handler(signum);
+    }
+}
+
+static void InstallSegvHandler() {
+    std::call_once(segv_handler_once_, []() {
+        struct sigaction action{};
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        action.sa_sigaction = FastMemSegvHandler;
+        if (sigaction(SIGSEGV, &action, &prev_segv_action_) == -1) {
+            LOGE("Fastmem: install sigsegv handler failed");
+        }
+    });
+}
+
+static int ToProt(bool readable, bool writable) {
+    int prot = PROT_NONE;
+    if (readable) {
+        prot |= PROT_READ;
+    }
+    if (writable) {
+        prot |= PROT_READ | PROT_WRITE;
+    }
+    return prot;
+}
+
+FastMemory::FastMemory(u8 addr_width, u8 page_bits) : page_bits_(page_bits) {
+    size_ = size_t(1) << addr_width;
+    auto base = mmap(nullptr, size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        LOGE("Fastmem: reserve %d bits address space failed", addr_width);
+        size_ = 0;
+        return;
+    }
+    base_ = reinterpret_cast<VAddr>(base);
+    for (auto &region : fastmem_regions_) {
+        FastMemory *expected = nullptr;
+        if (region.compare_exchange_strong(expected, this)) {
+            InstallSegvHandler();
+            return;
+        }
+    }
+    LOGE("Fastmem: too many regions");
+    munmap(base, size_);
+    base_ = 0;
+    size_ = 0;
+}
+
+FastMemory::~FastMemory() {
+    if (!Valid()) {
+        return;
+    }
+    for (auto &region : fastmem_regions_) {
+        FastMemory *expected = this;
+        region.compare_exchange_strong(expected, nullptr);
+    }
+    munmap(reinterpret_cast<void *>(base_), size_);
+}
+
+bool FastMemory::Valid() const {
+    return base_ != 0;
+}
+
+VAddr FastMemory::Base() const {
+    return base_;
+}
+
+bool FastMemory::Contains(VAddr host_addr) const {
+    return host_addr >= base_ && host_addr - base_ < size_;
+}
+
+VAddr FastMemory::Map(VAddr vaddr, size_t size, bool readable, bool writable) {
+    assert(Valid() && vaddr + size <= size_);
+    auto host = mmap(reinterpret_cast<void *>(base_ + vaddr), size, ToProt(readable, writable),
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    assert(host != MAP_FAILED);
+    return reinterpret_cast<VAddr>(host);
+}
+
+void FastMemory::Protect(VAddr vaddr, size_t size, bool readable, bool writable) {
+    assert(Valid() && vaddr + size <= size_);
+    mprotect(reinterpret_cast<void *>(base_ + vaddr), size, ToProt(readable, writable));
+}
+
+void FastMemory::Unmap(VAddr vaddr, size_t size) {
+    assert(Valid() && vaddr + size <= size_);
+    // back to a reserved hole
+    mmap(reinterpret_cast<void *>(base_ + vaddr), size, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+
+void FastMemory::SetFaultCallback(const FaultCallback &callback) {
+    fault_callback_ = callback;
+}
+
+bool FastMemory::ForceAccess(VAddr vaddr, void *buffer, size_t size, bool write) {
+    assert(Valid() && vaddr + size <= size_);
+    // kernel side access of /proc/self/mem ignores PROT_NONE of our own pages
+    std::call_once(self_mem_once_, []() {
+        self_mem_fd_ = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+        if (self_mem_fd_ < 0) {
+            LOGE("Fastmem: open /proc/self/mem failed");
+        }
+    });
+    if (self_mem_fd_ < 0) {
+        return false;
+    }
+    auto host = static_cast<off64_t>(base_ + vaddr);
+    auto res = write ? pwrite64(self_mem_fd_, buffer, size, host) : pread64(self_mem_fd_, buffer, size, host);
+    return res == static_cast<ssize_t>(size);
+}
+
+// fp/simd registers live in the extension area of the signal frame
+static u8 *HostVReg(sigcontext *context, u8 code) {
+    auto head = reinterpret_cast<_aarch64_ctx *>(context->__reserved);
+    while (head->magic) {
+        if (head->magic == FPSIMD_MAGIC) {
+            return reinterpret_cast<u8 *>(&reinterpret_cast<fpsimd_context *>(head)->vregs[code]);
+        }
+        head = reinterpret_cast<_aarch64_ctx *>(reinterpret_cast<VAddr>(head) + head->size);
+    }
+    return nullptr;
+}
+
+static u64 &HostReg(sigcontext *context, u8 code) {
+    return code == 31 ? context->sp : context->regs[code];
+}
+
+// decode the faulting ldr/str/ldp/stp/ldxr/stxr/cas, make the slow path result visible and step over it.
+// exclusives go through an emulated monitor, see FaultExclusive
+bool FastMemory::HandleFault(VAddr fault_addr, void *context) {
+    FastMemory *fastmem{};
+    for (auto &region : fastmem_regions_) {
+        auto cur = region.load(std::memory_order_acquire);
+        if (cur && cur->Contains(fault_addr)) {
+            fastmem = cur;
+            break;
+        }
+    }
+    if (!fastmem || !fastmem->fault_callback_) {
+        return false;
+    }
+    sigcontext *host_context = &reinterpret_cast<ucontext_t *>(context)->uc_mcontext;
+    u32 instr = *reinterpret_cast<u32 *>(host_context->pc);
+    // ldxr/stxr/ldar/stlr/cas
+    bool ordered = (instr & 0x3f000000) == 0x08000000;
+    bool pair = !ordered && ((instr >> 27) & 0b111) == 0b101;
+    bool simd = !ordered && ((instr >> 26) & 1);
+    u8 rt = static_cast<u8>(instr & 0x1f);
+    u8 rn = static_cast<u8>((instr >> 5) & 0x1f);
+    u8 rt2 = static_cast<u8>((instr >> 10) & 0x1f);
+    u8 rs = static_cast<u8>((instr >> 16) & 0x1f);
+    bool write;
+    u32 elem_size;
+    bool sign_extend = false;
+    bool to_w = false;
+    bool write_back = false;
+    bool exclusive = false;
+    bool status = false;
+    s64 offset = 0;
+    // si_addr is the first byte that faulted, not where the access starts
+    u64 address = HostReg(host_context, rn);
+    if (ordered) {
+        auto vaddr = address - fastmem->base_;
+        u32 size = instr >> 30;
+        bool o2 = ((instr >> 23) & 1) != 0;
+        bool o1 = ((instr >> 21) & 1) != 0;
+        if (o1 && !o2 && size < 2) {
+            // casp
+            return false;
+        }
+        elem_size = (o1 && !o2) ? (4U << (size & 1)) : (1U << size);
+        if (o1 && o2) {
+            // cas, the hooks see a load and maybe a store, atomic under the fault store lock
+            u64 old{0};
+            SpinLockGuard guard(fault_store_lock_);
+            if (!fastmem->fault_callback_(vaddr, elem_size, false, &old)) {
+                return false;
+            }
+            u64 mask = elem_size == 8 ? ~u64(0) : (u64(1) << (elem_size * 8)) - 1;
+            u64 compare = rs == 31 ? 0 : HostReg(host_context, rs);
+            if (old == (compare & mask)) {
+                u64 value = rt == 31 ? 0 : HostReg(host_context, rt);
+                fastmem->fault_callback_(vaddr, elem_size, true, &value);
+            }
+            if (rs != 31) {
+                HostReg(host_context, rs) = old;
+            }
+            host_context->pc += 4;
+            return true;
+        }
+        pair = o1;
+        write = !((instr >> 22) & 1);
+        exclusive = !o2;
+        status = exclusive && write;
+    } else if (pair) {
+        u32 opc = instr >> 30;
+        elem_size = simd ? (4U << opc) : ((opc & 2) ? 8 : 4);
+        write = !((instr >> 22) & 1);
+        // ldpsw
+        sign_extend = !simd && opc == 1;
+        // 01 post index, 11 pre index
+        write_back = ((instr >> 23) & 1) != 0;
+        offset = SignExtendX<s64>(7, (instr >> 15) & 0x7f) * elem_size;
+        // post index accesses the base as is
+        bool post_index = ((instr >> 23) & 3) == 1;
+        if (!post_index) {
+            address += offset;
+        }
+    } else {
+        u32 opc = (instr >> 22) & 3;
+        write = simd ? !(opc & 1) : opc == 0;
+        elem_size = (simd && (opc & 2)) ? 16 : (1U << (instr >> 30));
+        sign_extend = !simd && opc >= 2;
+        to_w = !simd && opc == 3;
+        // pre/post index: bit 24 and 21 clear, bit 10 set
+        write_back = !((instr >> 24) & 1) && !((instr >> 21) & 1) && ((instr >> 10) & 1);
+        offset = SignExtendX<s64>(9, (instr >> 12) & 0x1ff);
+        u32 size_log = __builtin_ctz(elem_size);
+        if ((instr >> 24) & 1) {
+            // unsigned offset, scaled
+            address += u64((instr >> 10) & 0xfff) << size_log;
+        } else if ((instr >> 21) & 1) {
+            // register offset, xm extended and maybe shifted by the access size
+            u8 rm = static_cast<u8>((instr >> 16) & 0x1f);
+            u64 index = rm == 31 ? 0 : HostReg(host_context, rm);
+            switch ((instr >> 13) & 7) {
+                case 0b010:
+                    index &= UINT32_MAX;
+                    break;
+                case 0b110:
+                    index = static_cast<u64>(SignExtendX<s64>(32, index & UINT32_MAX));
+                    break;
+                default:
+                    break;
+            }
+            address += index << (((instr >> 12) & 1) ? size_log : 0);
+        } else if (((instr >> 10) & 3) != 1) {
+            // unscaled, unprivileged and pre index, post index accesses the base as is
+            address += offset;
+        }
+    }
+    auto vaddr = address - fastmem->base_;
+    u32 count = pair ? 2 : 1;
+    u8 transfer[2] = {rt, rt2};
+    u8 data[32]{};
+    if (write) {
+        for (u32 i = 0; i < count; ++i) {
+            if (simd) {
+                auto vreg = HostVReg(host_context, transfer[i]);
+                if (vreg) {
+                    std::memcpy(data + i * elem_size, vreg, elem_size);
+                }
+            } else if (transfer[i] != 31) {
+                std::memcpy(data + i * elem_size, &HostReg(host_context, transfer[i]), elem_size);
+            }
+        }
+    }
+    if (status) {
+        // store exclusive: our faulting load exclusive is still on it, no other core claimed
+        // the granule since, and memory still holds what it read
+        auto &local = fault_exclusive_;
+        bool pass = local.vaddr == vaddr && local.size == elem_size * count;
+        local.vaddr = ~VAddr(0);
+        SpinLockGuard guard(fault_store_lock_);
+        if (pass) {
+            u8 current[16]{};
+            if (!fastmem->fault_callback_(vaddr, elem_size * count, false, current)) {
+                return false;
+            }
+            pass = std::memcmp(current, local.value, elem_size * count) == 0 &&
+                   fastmem->monitor_.Claim(vaddr, local.tag);
+        }
+        if (pass && !fastmem->fault_callback_(vaddr, elem_size * count, true, data)) {
+            return false;
+        }
+        if (rs != 31) {
+            HostReg(host_context, rs) = pass ? 0 : 1;
+        }
+        host_context->pc += 4;
+        return true;
+    }
+    if (exclusive) {
+        // load exclusive: tag before value, a store exclusive in between is seen by the tag
+        auto &local = fault_exclusive_;
+        local.tag = fastmem->monitor_.Load(vaddr);
+        if (!fastmem->fault_callback_(vaddr, elem_size * count, false, data)) {
+            local.vaddr = ~VAddr(0);
+            return false;
+        }
+        local.vaddr = vaddr;
+        local.size = elem_size * count;
+        std::memcpy(local.value, data, local.size);
+    } else if (write) {
+        SpinLockGuard guard(fault_store_lock_);
+        if (!fastmem->fault_callback_(vaddr, elem_size * count, write, data)) {
+            return false;
+        }
+    } else if (!fastmem->fault_callback_(vaddr, elem_size * count, write, data)) {
+        return false;
+    }
+    // invalid pages read back zero, same as MMU::ReadMemory
+    if (!write) {
+        for (u32 i = 0; i < count; ++i) {
+            if (simd) {
+                auto vreg = HostVReg(host_context, transfer[i]);
+                if (vreg) {
+                    std::memset(vreg, 0, 16);
+                    std::memcpy(vreg, data + i * elem_size, elem_size);
+                }
+                continue;
+            }
+            if (transfer[i] == 31) {
+                continue;
+            }
+            u64 value{0};
+            std::memcpy(&value, data + i * elem_size, elem_size);
+            if (sign_extend && elem_size < 8) {
+                value = static_cast<u64>(SignExtendX<s64>(elem_size * 8, value));
+            }
+            if (to_w) {
+                value &= UINT32_MAX;
+            }
+            HostReg(host_context, transfer[i]) = value;
+        }
+    }
+    if (write_back) {
+        HostReg(host_context, rn) += offset;
+    }
+    host_context->pc += 4;
+    return true;
+}
@@ -0,0 +1,55 @@
+//
+// Created by SwiftGan on 2020/11/5.
+//
+
+#pragma once
+
+#include <base/marcos.h>
+#include <functional>
+#include "exclusive_monitor.h"
+
+namespace Memory {
+
+    // guest address space mirrored into one host reservation,
+    // guest vaddr x lives at Base() + x, holes stay PROT_NONE and fault
+    class FastMemory : public BaseObject {
+    public:
+        // return false to let the fault fall through to the previous handler
+        // data: value being stored, or buffer to fill for a load
+        using FaultCallback = std::function<bool(VAddr vaddr, size_t size, bool write, void *data)>;
+
+        FastMemory(u8 addr_width, u8 page_bits);
+
+        virtual ~FastMemory();
+
+        // reservation may fail on hosts with a smaller address space
+        bool Valid() const;
+
+        VAddr Base() const;
+
+        bool Contains(VAddr host_addr) const;
+
+        // returns the host address of vaddr
+        VAddr Map(VAddr vaddr, size_t size, bool readable, bool writable);
+
+        void Protect(VAddr vaddr, size_t size, bool readable, bool writable);
+
+        void Unmap(VAddr vaddr, size_t size);
+
+        void SetFaultCallback(const FaultCallback &callback);
+
+        // access guest memory regardless of the protection of the mirror
+        bool ForceAccess(VAddr vaddr, void *buffer, size_t size, bool write);
+
+        static bool HandleFault(VAddr fault_addr, void *context);
+
+    private:
+        VAddr base_{};
+        size_t size_{};
+        u8 page_bits_;
+        FaultCallback fault_callback_;
+        // global half of the monitor for exclusives that faulted
+        ExclusiveMonitor monitor_{8};
+    };
+
+}
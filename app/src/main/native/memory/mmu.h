@@ -6,8 +6,16 @@
 
 #include <base/marcos.h>
 #include <vector>
+#include <cstring>
 #include <optional>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <type_traits>
 #include "tlb.h"
+#include "table_arena.h"
 
 namespace Memory {
 
@@ -88,11 +96,101 @@ namespace Memory {
             pte_bits_ /= level_;
             pte_size_ = 1ULL << pte_bits_;
             pages_.resize(pte_size_);
+            // root doubles as final table with one level
+            static_assert(sizeof(PTE) == sizeof(VAddr));
+            table_arena_ = std::make_unique<TableArena>(pte_size_ * sizeof(VAddr));
             if (!tlb_per_thread) {
-                tlb_ = SharedPtr<TLB<AddrType, PTE>>(new TLB<AddrType, PTE>(page_bits_, 16));
+                tlb_ = SharedPtr<TLB<AddrType, PTE>>(new TLB<AddrType, PTE>(page_bits_, tlb_bits_));
             }
         }
 
+        u8 TLBBits() const {
+            return tlb_bits_;
+        }
+
+        // tlb of one guest thread, unmap/remap shoot down its entries
+        SharedPtr<TLB<AddrType, PTE>> CreateThreadTLB() {
+            auto tlb = SharedPtr<TLB<AddrType, PTE>>(new TLB<AddrType, PTE>(page_bits_, tlb_bits_));
+            std::lock_guard guard(thread_tlbs_lock_);
+            thread_tlbs_.push_back(tlb.get());
+            return tlb;
+        }
+
+        void DestroyThreadTLB(const SharedPtr<TLB<AddrType, PTE>> &tlb) {
+            std::lock_guard guard(thread_tlbs_lock_);
+            thread_tlbs_.erase(std::remove(thread_tlbs_.begin(), thread_tlbs_.end(), tlb.get()),
+                               thread_tlbs_.end());
+        }
+
+        // bumped by every shootdown
+        u64 TLBGeneration() const {
+            return tlb_generation_.load(std::memory_order_acquire);
+        }
+
+        // translation of vaddr changed, drop it from every tlb that holds it
+        void ShootdownPage(AddrType vaddr) {
+            if (tlb_) {
+                tlb_->ClearPageCache(vaddr);
+            }
+            std::lock_guard guard(thread_tlbs_lock_);
+            for (auto tlb : thread_tlbs_) {
+                tlb->Shootdown(vaddr);
+            }
+            tlb_generation_.fetch_add(1, std::memory_order_release);
+        }
+
+        void ShootdownRange(AddrType vaddr, AddrType size) {
+            auto pages = size >> page_bits_;
+            if (pages == 1) {
+                ShootdownPage(vaddr);
+                return;
+            }
+            // cheaper to drop everything than to probe more pages than the tlb holds
+            bool flush_all = pages >= (AddrType(1) << tlb_bits_);
+            if (tlb_) {
+                if (flush_all) {
+                    tlb_->Flush();
+                } else {
+                    for (AddrType page = vaddr; page < vaddr + size; page += page_size_) {
+                        tlb_->ClearPageCache(page);
+                    }
+                }
+            }
+            std::lock_guard guard(thread_tlbs_lock_);
+            for (auto tlb : thread_tlbs_) {
+                if (flush_all) {
+                    tlb->ShootdownAll();
+                } else {
+                    for (AddrType page = vaddr; page < vaddr + size; page += page_size_) {
+                        tlb->Shootdown(page);
+                    }
+                }
+            }
+            tlb_generation_.fetch_add(1, std::memory_order_release);
+        }
+
+        // every thread tlb dropped what was shot down so far, host pages unmapped before may go.
+        // a shared tlb is cleared in place and can not tell when its readers are done
+        bool ShootdownAcked() {
+            std::lock_guard guard(thread_tlbs_lock_);
+            return std::all_of(thread_tlbs_.begin(), thread_tlbs_.end(), [](auto tlb) {
+                return tlb->ShootdownAcked();
+            });
+        }
+
+        // tables unlinked before the last shootdown go back to the arena once it is acked,
+        // until then a walker of another thread may still be reading them
+        void ReleaseRetiredTables() {
+            std::lock_guard guard(table_lock_);
+            if (retired_tables_.empty() || !ShootdownAcked()) {
+                return;
+            }
+            for (auto table : retired_tables_) {
+                table_arena_->Free(reinterpret_cast<void *>(table));
+            }
+            retired_tables_.clear();
+        }
+
         u8 GetPteBits() const {
             return pte_bits_;
         }
@@ -110,182 +208,325 @@ namespace Memory {
         }
 
         u8 GetUnusedBits() const {
-            return sizeof(AddrType) - addr_width_;
+            return sizeof(AddrType) * 8 - addr_width_;
         }
 
         void MapPage(AddrType vaddr, PTE &pte) {
-            assert(vaddr % (1 << page_bits_) == 0);
-            AddrType all_page_bits = BitRange<AddrType>(vaddr, page_bits_,
-                                                        sizeof(AddrType) - addr_width_ - 1);
-            AddrType index;
-            Table table = reinterpret_cast<Table>(pages_.data());
-            for (int i = 0; i < level_; ++i) {
-                index = BitRange<AddrType>(all_page_bits, pte_bits_ * (level_ - i - 1),
-                                           pte_bits_ * (level_ - i) - 1);
-                if (i < level_ - 2) {
-                    auto tmp = reinterpret_cast<Table>(table[index]);
-                    if (tmp == nullptr) {
-                        tmp = static_cast<Table>(malloc(sizeof(Table) * pte_size_));
-                        table[index] = reinterpret_cast<VAddr>(tmp);
+            MapRange(vaddr, page_size_, [&pte](AddrType) -> PTE {
+                return pte;
+            });
+        }
+
+        void UnMapPage(AddrType vaddr) {
+            UnmapRange(vaddr, page_size_);
+        }
+
+        // pte_of(vaddr) gives the pte of every page in range, each table level is walked once per final table
+        template<typename PteOf>
+        void MapRange(AddrType vaddr, AddrType size, PteOf &&pte_of) {
+            assert(vaddr % page_size_ == 0 && size % page_size_ == 0);
+            std::lock_guard guard(table_lock_);
+            bool remap = false;
+            ForEachFinalTable(vaddr, size, true, [&](FinalTable final_table, AddrType start, AddrType end) {
+                u32 mapped = 0;
+                for (auto page = start; page < end; page += page_size_) {
+                    auto &entry = final_table[PteIndex(page)];
+                    if (entry != PTE{}) {
+                        remap = true;
+                    } else {
+                        mapped++;
                     }
-                    table = tmp;
-                } else {
-                    //Final level
-                    FinalTable final_table = reinterpret_cast<FinalTable>(table[index]);
-                    if (final_table == nullptr) {
-                        final_table = static_cast<FinalTable>(malloc(sizeof(PTE) * pte_size_));
-                        table[index] = reinterpret_cast<VAddr>(final_table);
+                    entry = pte_of(page);
+                }
+                if (!IsRootTable(final_table)) {
+                    table_entries_[reinterpret_cast<VAddr>(final_table)] += mapped;
+                }
+                return false;
+            });
+            if (remap) {
+                ShootdownRange(vaddr, size);
+            }
+        }
+
+        // host contiguous range starting at pte, aligned spans of BlockSize() become one block descriptor
+        // the host page number of PTE must start at page_bits
+        void MapLinear(AddrType vaddr, AddrType size, const PTE &pte) {
+            assert(vaddr % page_size_ == 0 && size % page_size_ == 0);
+            auto first = ToRaw(pte);
+            auto page_of = [this, vaddr, first](AddrType page) -> PTE {
+                return ToPte(first + (((page - vaddr) >> page_bits_) << page_bits_));
+            };
+            std::lock_guard guard(table_lock_);
+            bool remap = false;
+            ForEachFinalTable(vaddr, size, true, [&](FinalTable final_table, AddrType start, AddrType end) {
+                u32 mapped = 0;
+                for (auto page = start; page < end; page += page_size_) {
+                    auto &entry = final_table[PteIndex(page)];
+                    if (entry != PTE{}) {
+                        remap = true;
+                    } else {
+                        mapped++;
                     }
-                    auto pte_index = BitRange<AddrType>(all_page_bits, 0, pte_bits_ - 1);
-                    final_table[pte_index] = pte;
-                    if (tlb_) {
-                        tlb_->CachePage(vaddr, pte);
+                    entry = page_of(page);
+                }
+                if (!IsRootTable(final_table)) {
+                    table_entries_[reinterpret_cast<VAddr>(final_table)] += mapped;
+                }
+                return false;
+            }, [&](VAddr &slot, AddrType start, AddrType end) -> bool {
+                if (!BlockSize() || end - start != BlockSize()) {
+                    return false;
+                }
+                if (slot) {
+                    remap = true;
+                    if (!IsBlock(slot)) {
+                        // every page of the old table is replaced
+                        RetireTable(slot);
                     }
-                    break;
                 }
+                slot = ToRaw(page_of(start)) | block_flag_;
+                return true;
+            });
+            if (remap) {
+                ShootdownRange(vaddr, size);
             }
         }
 
-        void UnMapPage(AddrType vaddr) {
-            assert(vaddr % (1 << page_bits_) == 0);
-            AddrType all_page_bits = BitRange<AddrType>(vaddr, page_bits_,
-                                                        sizeof(AddrType) - addr_width_ - 1);
-            AddrType index;
-            Table table = reinterpret_cast<Table>(pages_.data());
-            for (int i = 0; i < level_; ++i) {
-                index = BitRange<AddrType>(all_page_bits, pte_bits_ * (level_ - i - 1),
-                                           pte_bits_ * (level_ - i) - 1);
-                if (i < level_ - 2) {
-                    auto tmp = reinterpret_cast<Table>(table[index]);
-                    if (tmp == nullptr) {
-                        break;
+        // 0 if the page table can not hold blocks
+        AddrType BlockSize() const {
+            // blocks only live in the root, so no table above them counts entries
+            return (block_flag_ && level_ == 2) ? page_size_ << pte_bits_ : 0;
+        }
+
+        void UnmapRange(AddrType vaddr, AddrType size) {
+            assert(vaddr % page_size_ == 0 && size % page_size_ == 0);
+            std::lock_guard guard(table_lock_);
+            bool unmapped = false;
+            ForEachFinalTable(vaddr, size, false, [&](FinalTable final_table, AddrType start, AddrType end) {
+                u32 cleared = 0;
+                for (auto page = start; page < end; page += page_size_) {
+                    auto &entry = final_table[PteIndex(page)];
+                    if (entry != PTE{}) {
+                        entry = {};
+                        cleared++;
                     }
-                    table = tmp;
+                }
+                unmapped |= cleared > 0;
+                if (IsRootTable(final_table) || !cleared) {
+                    return false;
+                }
+                auto &entries = table_entries_[reinterpret_cast<VAddr>(final_table)];
+                entries -= cleared;
+                // tell the walker to reclaim the empty table
+                return entries == 0;
+            }, [&](VAddr &slot, AddrType start, AddrType end) -> bool {
+                if (!IsBlock(slot) || end - start != BlockSize()) {
+                    return false;
+                }
+                slot = 0;
+                unmapped = true;
+                return true;
+            });
+            if (unmapped) {
+                ShootdownRange(vaddr, size);
+            }
+        }
+
+        // update(pte) may change attrs of every mapped page in range, holes are skipped.
+        // update(pte, start, end) also sees the pages [start, end) the pte maps, it returns false
+        // without touching pte if they can not be treated alike, a block descriptor is split then
+        template<typename Update>
+        void ProtectRange(AddrType vaddr, AddrType size, Update &&update) {
+            assert(vaddr % page_size_ == 0 && size % page_size_ == 0);
+            auto apply = [&update](PTE &pte, AddrType start, AddrType end) -> bool {
+                if constexpr (std::is_invocable_v<Update, PTE &, AddrType, AddrType>) {
+                    return update(pte, start, end);
                 } else {
-                    //Final
-                    FinalTable final_table = reinterpret_cast<FinalTable>(table[index]);
-                    if (final_table == nullptr) {
-                        break;
-                    }
-                    auto pte_index = BitRange<AddrType>(all_page_bits, 0, pte_bits_ - 1);
-                    final_table[pte_index] = {};
-                    if (tlb_) {
-                        tlb_->ClearPageCache(vaddr);
+                    update(pte);
+                    return true;
+                }
+            };
+            std::lock_guard guard(table_lock_);
+            ForEachFinalTable(vaddr, size, false, [&](FinalTable final_table, AddrType start, AddrType end) {
+                for (auto page = start; page < end; page += page_size_) {
+                    auto &entry = final_table[PteIndex(page)];
+                    if (entry != PTE{}) {
+                        apply(entry, page, page + page_size_);
                     }
-                    break;
                 }
-            }
+                return false;
+            }, [&](VAddr &slot, AddrType start, AddrType end) -> bool {
+                if (!IsBlock(slot) || end - start != BlockSize()) {
+                    return false;
+                }
+                auto block = ToPte(slot & ~block_flag_);
+                if (!apply(block, start, end)) {
+                    return false;
+                }
+                slot = ToRaw(block) | block_flag_;
+                return true;
+            });
+            ShootdownRange(vaddr, size);
         }
 
         std::optional<PTE> GetPage(AddrType vaddr) {
             assert(vaddr % (1 << page_bits_) == 0);
-            if (tlb_) {
-                PTE pte = tlb_->GetPage(vaddr);
+            auto tlb = HostTLB();
+            if (tlb) {
+                PTE pte = tlb->GetPage(vaddr);
                 if (pte != PTE{}) {
                     return pte;
                 }
             }
-            AddrType all_page_bits = BitRange<AddrType>(vaddr, page_bits_,
-                                                        sizeof(AddrType) - addr_width_ - 1);
-            AddrType index;
-            Table table = reinterpret_cast<Table>(pages_.data());
-            for (int i = 0; i < level_; ++i) {
-                index = BitRange<AddrType>(all_page_bits, pte_bits_ * (level_ - i - 1),
-                                           pte_bits_ * (level_ - i) - 1);
-                if (i < level_ - 2) {
-                    auto tmp = reinterpret_cast<Table>(table[index]);
-                    if (tmp == nullptr) {
-                        return {};
-                    }
-                    table = tmp;
-                } else {
-                    //Final
-                    FinalTable final_table = reinterpret_cast<FinalTable>(table[index]);
-                    if (final_table == nullptr) {
-                        return {};
+            auto pte = Translate(vaddr);
+            if (tlb && pte && *pte != PTE{}) {
+                tlb->CachePage(vaddr, *pte);
+            }
+            return pte;
+        }
+
+        // host side accesses of this thread go through its guest tlb, see HostTLB
+        void SetThreadTLB(TLB<AddrType, PTE> *tlb) {
+            thread_tlb_ = {this, tlb};
+        }
+
+        // guest range cut into host spans, pages contiguous on the host with the same access are merged
+        struct HostSpan {
+            AddrType vaddr;
+            VAddr host;
+            std::size_t size;
+            // false if any page of the span can not be accessed
+            bool valid;
+        };
+
+        // visit(span) returns false to stop, returns false if stopped
+        template<typename Visit>
+        bool ForEachSpan(AddrType vaddr, std::size_t size, bool write, Visit &&visit) {
+            HostSpan span{vaddr, 0, 0, false};
+            AddrType page_offset = vaddr & page_mask_;
+            while (size > 0) {
+                auto amount = std::min(static_cast<std::size_t>(page_size_ - page_offset), size);
+                auto pte = GetPage(vaddr - page_offset);
+                bool valid = pte && (write ? PageWritable(*pte) : PageReadable(*pte));
+                VAddr host = valid ? GetPageStart(*pte) + page_offset : 0;
+                if (span.size && (span.valid != valid || (valid && span.host + span.size != host))) {
+                    if (!visit(span)) {
+                        return false;
                     }
-                    auto pte_index = BitRange<AddrType>(all_page_bits, 0, pte_bits_ - 1);
-                    return final_table[pte_index];
+                    span = {vaddr, host, 0, valid};
+                } else if (!span.size) {
+                    span = {vaddr, host, 0, valid};
                 }
+                span.size += amount;
+                vaddr += amount;
+                size -= amount;
+                page_offset = 0;
             }
-            return {};
+            return !span.size || visit(span);
+        }
+
+        // tables allocated for the levels below the root
+        size_t LiveTables() const {
+            return table_arena_->LiveTables();
         }
 
         std::optional<void*> GetPoint(const AddrType src_addr) {
-            AddrType page_index = src_addr >> page_bits_;
             AddrType page_offset = src_addr & page_mask_;
-            auto pte = GetPage(page_index << page_bits_);
-            if (pte) {
-                return (*pte >> page_bits_) << page_bits_ + page_offset;
+            auto pte = GetPage(src_addr - page_offset);
+            if (pte && *pte != PTE{}) {
+                return reinterpret_cast<void *>(GetPageStart(*pte) + page_offset);
             }
             return {};
         }
 
         void ReadMemory(const AddrType src_addr, void *dest_buffer, const std::size_t size) {
-            AddrType remaining_size = size;
-            AddrType page_index = src_addr >> page_bits_;
-            AddrType page_offset = src_addr & page_mask_;
-
-            while (remaining_size > 0) {
-                const std::size_t copy_amount =
-                        std::min(static_cast<std::size_t>(page_size_) - page_offset, remaining_size);
-                const AddrType current_vaddr = (page_index << page_bits_) + page_offset;
-
-                auto pte = *GetPage(page_index >> page_bits_);
-
-                if (PageReadable(pte)) {
-                    std::memset(dest_buffer, 0, copy_amount);
-                    InvalidRead(current_vaddr, copy_amount);
+            auto dest = static_cast<u8 *>(dest_buffer);
+            ForEachSpan(src_addr, size, false, [this, &dest](const HostSpan &span) -> bool {
+                if (!span.valid) {
+                    std::memset(dest, 0, span.size);
+                    InvalidRead(span.vaddr, span.size);
                 } else {
-                    VAddr src_ptr = GetPageStart(pte) + page_offset;
-                    std::memcpy(dest_buffer, reinterpret_cast<const void *>(src_ptr),
-                                copy_amount);
-                    HostReadCallback(src_ptr, copy_amount);
+                    std::memcpy(dest, reinterpret_cast<const void *>(span.host), span.size);
+                    HostReadCallback(span.host, span.size);
                 }
-
-                page_index++;
-                page_offset = 0;
-                dest_buffer = static_cast<u8*>(dest_buffer) + copy_amount;
-                remaining_size -= copy_amount;
-            }
+                dest += span.size;
+                return true;
+            });
         }
 
         void WriteMemory(const AddrType dest_addr, const void* src_buffer, const std::size_t size) {
-            AddrType remaining_size = size;
-            AddrType page_index = dest_addr >> page_bits_;
-            AddrType page_offset = dest_addr & page_mask_;
-
-            while (remaining_size > 0) {
-                const std::size_t copy_amount =
-                        std::min(static_cast<std::size_t>(page_size_) - page_offset, remaining_size);
-                const AddrType current_vaddr = (page_index << page_bits_) + page_offset;
-
-                auto pte = *GetPage(current_vaddr);
+            auto src = static_cast<const u8 *>(src_buffer);
+            ForEachSpan(dest_addr, size, true, [this, &src](const HostSpan &span) -> bool {
+                if (!span.valid) {
+                    InvalidWrite(span.vaddr, span.size);
+                } else {
+                    std::memcpy(reinterpret_cast<void *>(span.host), src, span.size);
+                    HostWriteCallback(span.host, span.size);
+                }
+                src += span.size;
+                return true;
+            });
+        }
 
-                if (!PageWritable(pte)) {
-                    InvalidWrite(current_vaddr, copy_amount);
+        void FillMemory(const AddrType dest_addr, const u8 value, const std::size_t size) {
+            ForEachSpan(dest_addr, size, true, [this, value](const HostSpan &span) -> bool {
+                if (!span.valid) {
+                    InvalidWrite(span.vaddr, span.size);
                 } else {
-                    VAddr dest_ptr = GetPageStart(pte) + page_offset;
-                    std::memcpy(reinterpret_cast<void *>(dest_ptr), src_buffer, copy_amount);
-                    HostWriteCallback(dest_ptr, copy_amount);
+                    std::memset(reinterpret_cast<void *>(span.host), value, span.size);
+                    HostWriteCallback(span.host, span.size);
                 }
+                return true;
+            });
+        }
 
-                page_index++;
-                page_offset = 0;
-                src_buffer = static_cast<const u8*>(src_buffer) + copy_amount;
-                remaining_size -= copy_amount;
-            }
+        // memcmp of guest memory against buffer, unreadable memory never compares equal
+        int CompareMemory(const AddrType src_addr, const void *buffer, const std::size_t size) {
+            auto cmp = static_cast<const u8 *>(buffer);
+            int res = 0;
+            ForEachSpan(src_addr, size, false, [this, &cmp, &res](const HostSpan &span) -> bool {
+                if (!span.valid) {
+                    InvalidRead(span.vaddr, span.size);
+                    res = -1;
+                    return false;
+                }
+                res = std::memcmp(reinterpret_cast<const void *>(span.host), cmp, span.size);
+                cmp += span.size;
+                return res == 0;
+            });
+            return res;
         }
 
+        // single page accesses skip the span machinery
         template <typename T>
         T Read(const AddrType vaddr) {
             T t;
+            AddrType page_offset = vaddr & page_mask_;
+            if (page_offset + sizeof(T) <= page_size_) {
+                auto pte = GetPage(vaddr - page_offset);
+                if (pte && PageReadable(*pte)) {
+                    auto host = GetPageStart(*pte) + page_offset;
+                    std::memcpy(&t, reinterpret_cast<const void *>(host), sizeof(T));
+                    HostReadCallback(host, sizeof(T));
+                    return t;
+                }
+            }
             ReadMemory(vaddr, &t, sizeof(T));
             return t;
         }
 
         template <typename T>
         void Write(const AddrType vaddr, const T data) {
+            AddrType page_offset = vaddr & page_mask_;
+            if (page_offset + sizeof(T) <= page_size_) {
+                auto pte = GetPage(vaddr - page_offset);
+                if (pte && PageWritable(*pte)) {
+                    auto host = GetPageStart(*pte) + page_offset;
+                    std::memcpy(reinterpret_cast<void *>(host), &data, sizeof(T));
+                    HostWriteCallback(host, sizeof(T));
+                    return;
+                }
+            }
             WriteMemory(vaddr, &data, sizeof(T));
         }
 
@@ -316,12 +557,164 @@ namespace Memory {
         virtual void InvalidWrite(AddrType vaddr, std::size_t size) {};
 
     protected:
+
+        AddrType LevelIndex(AddrType vaddr, int level) const {
+            auto low = page_bits_ + pte_bits_ * (level_ - level - 1);
+            return BitRange<AddrType>(vaddr, low, low + pte_bits_ - 1);
+        }
+
+        AddrType PteIndex(AddrType vaddr) const {
+            return LevelIndex(vaddr, level_ - 1);
+        }
+
+        // shared tlb, or the tlb of the guest thread we are running on
+        TLB<AddrType, PTE> *HostTLB() {
+            if (tlb_) {
+                return tlb_.get();
+            }
+            return thread_tlb_.owner == this ? thread_tlb_.tlb : nullptr;
+        }
+
+        bool IsRootTable(FinalTable table) const {
+            return reinterpret_cast<VAddr>(table) == reinterpret_cast<VAddr>(pages_.data());
+        }
+
+        bool IsBlock(VAddr entry) const {
+            return (entry & block_flag_) != 0;
+        }
+
+        // page of vaddr inside the block, host pages of a block are contiguous
+        PTE BlockPage(VAddr block, AddrType vaddr) const {
+            auto pages_in_block = BitRange<AddrType>(vaddr, page_bits_, page_bits_ + pte_bits_ - 1);
+            return ToPte((block & ~block_flag_) + (pages_in_block << page_bits_));
+        }
+
+        static PTE ToPte(VAddr raw) {
+            PTE pte{};
+            std::memcpy(&pte, &raw, sizeof(PTE));
+            return pte;
+        }
+
+        static VAddr ToRaw(const PTE &pte) {
+            VAddr raw{0};
+            std::memcpy(&raw, &pte, sizeof(PTE));
+            return raw;
+        }
+
+        // block -> final table of the same pages, before part of it changes
+        void SplitBlock(VAddr &slot) {
+            auto block = slot & ~block_flag_;
+            auto final_table = static_cast<FinalTable>(table_arena_->Alloc());
+            for (AddrType i = 0; i < pte_size_; ++i) {
+                final_table[i] = ToPte(block + (i << page_bits_));
+            }
+            table_entries_[reinterpret_cast<VAddr>(final_table)] = pte_size_;
+            slot = reinterpret_cast<VAddr>(final_table);
+        }
+
+        std::optional<PTE> Translate(AddrType vaddr) {
+            auto table = reinterpret_cast<Table>(pages_.data());
+            for (int i = 0; i < level_ - 1; ++i) {
+                auto entry = table[LevelIndex(vaddr, i)];
+                if (!entry) {
+                    return {};
+                }
+                if (IsBlock(entry)) {
+                    return BlockPage(entry, vaddr);
+                }
+                table = reinterpret_cast<Table>(entry);
+            }
+            return reinterpret_cast<FinalTable>(table)[PteIndex(vaddr)];
+        }
+
+        // caller holds table_lock_ and shoots the range down afterwards
+        void RetireTable(VAddr table) {
+            table_entries_.erase(table);
+            retired_tables_.push_back(table);
+        }
+
+        template<typename Visit>
+        void ForEachFinalTable(AddrType vaddr, AddrType size, bool alloc, Visit &&visit) {
+            ForEachFinalTable(vaddr, size, alloc, visit, [](VAddr &, AddrType, AddrType) -> bool {
+                return false;
+            });
+        }
+
+        // visit(final_table, start, end) once per final table covering [vaddr, vaddr + size)
+        // missing levels are allocated if alloc, skipped otherwise
+        // visit returns true when the final table became empty, it is retired with its empty parents
+        // visit_slot(slot, start, end) sees the entry pointing to the final table first and returns true
+        // if it took care of the span, blocks it leaves alone are split into final tables
+        template<typename Visit, typename VisitSlot>
+        void ForEachFinalTable(AddrType vaddr, AddrType size, bool alloc, Visit &&visit, VisitSlot &&visit_slot) {
+            constexpr static int max_level = 3;
+            auto span = page_size_ << pte_bits_;
+            auto end = vaddr + size;
+            while (vaddr < end) {
+                auto span_end = std::min(AlignDown(vaddr, span) + span, end);
+                std::array<Table, max_level> path{};
+                auto table = reinterpret_cast<Table>(pages_.data());
+                int i = 0;
+                for (; i < level_ - 1; ++i) {
+                    path[i] = table;
+                    auto &next = table[LevelIndex(vaddr, i)];
+                    if (i == level_ - 2) {
+                        if (visit_slot(next, vaddr, span_end)) {
+                            break;
+                        }
+                        if (IsBlock(next)) {
+                            SplitBlock(next);
+                        }
+                    }
+                    if (!next) {
+                        if (!alloc) {
+                            break;
+                        }
+                        next = reinterpret_cast<VAddr>(table_arena_->Alloc());
+                        if (i > 0) {
+                            table_entries_[reinterpret_cast<VAddr>(table)]++;
+                        }
+                    }
+                    table = reinterpret_cast<Table>(next);
+                }
+                if (i == level_ - 1 && visit(reinterpret_cast<FinalTable>(table), vaddr, span_end)) {
+                    // reclaim empty tables bottom up, root stays
+                    for (int level = level_ - 2; level >= 0; --level) {
+                        auto child = path[level][LevelIndex(vaddr, level)];
+                        RetireTable(child);
+                        path[level][LevelIndex(vaddr, level)] = 0;
+                        if (level == 0 || --table_entries_[reinterpret_cast<VAddr>(path[level])] > 0) {
+                            break;
+                        }
+                    }
+                }
+                vaddr = span_end;
+            }
+        }
+
         const u8 addr_width_;
         u8 pte_bits_;
         std::size_t pte_size_;
         u8 level_;
         std::vector<Table *> pages_;
         SharedPtr<TLB<AddrType, PTE>> tlb_;
+        std::unique_ptr<TableArena> table_arena_;
+        // mapped entries of each non root table, empty tables go back to the arena
+        std::unordered_map<VAddr, u32> table_entries_;
+        // unlinked tables waiting for the shootdown ack, see ReleaseRetiredTables
+        std::vector<VAddr> retired_tables_;
+        std::mutex table_lock_;
+        const u8 tlb_bits_{16};
+        std::mutex thread_tlbs_lock_;
+        std::vector<TLB<AddrType, PTE> *> thread_tlbs_;
+        std::atomic<u64> tlb_generation_{0};
+        // set by the subclass if its pte has a bit which can mark block descriptors
+        VAddr block_flag_{0};
+        struct ThreadTLB {
+            const MMU *owner;
+            TLB<AddrType, PTE> *tlb;
+        };
+        static inline thread_local ThreadTLB thread_tlb_{};
     public:
         const u8 page_bits_;
         const AddrType page_size_;
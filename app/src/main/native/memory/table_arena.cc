@@ -0,0 +1,75 @@
+//
+// Created by SwiftGan on 2020/11/6.
+//
+
+#include <sys/mman.h>
+#include <cstring>
+#include "table_arena.h"
+
+using namespace Memory;
+
+constexpr static size_t huge_page_size = 2 * 1024 * 1024;
+
+TableArena::TableArena(size_t table_size) : table_size_(AlignUp(table_size, sizeof(VAddr))) {
+    chunk_size_ = AlignUp(std::max(table_size_, huge_page_size), huge_page_size);
+}
+
+TableArena::~TableArena() {
+    for (auto chunk : chunks_) {
+        munmap(reinterpret_cast<void *>(chunk), chunk_size_);
+    }
+}
+
+void *TableArena::Alloc() {
+    live_tables_++;
+    if (!free_tables_.empty()) {
+        auto table = free_tables_.back();
+        free_tables_.pop_back();
+        return table;
+    }
+    if (cursor_ + table_size_ > limit_) {
+        NewChunk();
+    }
+    auto table = reinterpret_cast<void *>(cursor_);
+    cursor_ += table_size_;
+    return table;
+}
+
+void TableArena::Free(void *table) {
+    assert(live_tables_ > 0);
+    live_tables_--;
+    if (table_size_ >= PAGE_SIZE && table_size_ % PAGE_SIZE == 0) {
+        // anonymous pages read back as zero after this
+        madvise(table, table_size_, MADV_DONTNEED);
+    } else {
+        std::memset(table, 0, table_size_);
+    }
+    free_tables_.push_back(table);
+}
+
+size_t TableArena::LiveTables() const {
+    return live_tables_;
+}
+
+void TableArena::NewChunk() {
+    // over reserve so that the chunk can be aligned to a huge page
+    auto reserve_size = chunk_size_ + huge_page_size;
+    auto reserve = mmap(nullptr, reserve_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(reserve != MAP_FAILED);
+    auto start = AlignUp(reinterpret_cast<VAddr>(reserve), huge_page_size);
+    auto head = start - reinterpret_cast<VAddr>(reserve);
+    if (head) {
+        munmap(reserve, head);
+    }
+    auto tail = reserve_size - head - chunk_size_;
+    if (tail) {
+        munmap(reinterpret_cast<void *>(start + chunk_size_), tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void *>(start), chunk_size_, MADV_HUGEPAGE);
+#endif
+    chunks_.push_back(start);
+    cursor_ = start;
+    limit_ = start + chunk_size_;
+}
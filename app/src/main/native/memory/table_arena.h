@@ -0,0 +1,39 @@
+//
+// Created by SwiftGan on 2020/11/6.
+//
+
+#pragma once
+
+#include <base/marcos.h>
+#include <vector>
+
+namespace Memory {
+
+    // fixed size page table storage, carved out of huge page advised mmap chunks
+    // tables always come back zeroed, freed tables give their memory back to the kernel
+    class TableArena : public BaseObject, NonCopyable {
+    public:
+        explicit TableArena(size_t table_size);
+
+        virtual ~TableArena();
+
+        void *Alloc();
+
+        void Free(void *table);
+
+        // tables handed out and not freed
+        size_t LiveTables() const;
+
+    private:
+        void NewChunk();
+
+        const size_t table_size_;
+        size_t chunk_size_;
+        std::vector<VAddr> chunks_;
+        std::vector<void *> free_tables_;
+        VAddr cursor_{0};
+        VAddr limit_{0};
+        size_t live_tables_{0};
+    };
+
+}
@@ -7,6 +7,7 @@
 // Translation Lookaside Buffer
 #include <base/marcos.h>
 #include <vector>
+#include <algorithm>
 
 namespace Memory {
 
@@ -31,12 +32,15 @@ namespace Memory {
             tlb_table_[index] = {vaddr >> page_bits_, pte};
         }
 
+        // PTE{} is a miss, an entry being shot down reads as one too
         PTE GetPage(AddrType vaddr) {
             assert(vaddr % (1 << page_bits_) == 0);
             auto index = BitRange<AddrType>(vaddr, page_bits_, page_bits_ + tlb_bits_ - 1);
             auto &tlb_entry = tlb_table_[index];
-            if (tlb_entry.page_index_ == vaddr >> page_bits_) {
-                return tlb_entry.pte_;
+            if (__atomic_load_n(&tlb_entry.page_index_, __ATOMIC_ACQUIRE) == vaddr >> page_bits_) {
+                PTE pte;
+                __atomic_load(&tlb_entry.pte_, &pte, __ATOMIC_ACQUIRE);
+                return pte;
             } else {
                 return {};
             }
@@ -45,7 +49,79 @@ namespace Memory {
         void ClearPageCache(AddrType vaddr) {
             assert(vaddr % (1 << page_bits_) == 0);
             auto index = BitRange<AddrType>(vaddr, page_bits_, page_bits_ + tlb_bits_ - 1);
-            tlb_table_[index] = {};
+            InvalidateEntry(tlb_table_[index]);
+        }
+
+        void Flush() {
+            for (auto &tlb_entry : tlb_table_) {
+                InvalidateEntry(tlb_entry);
+            }
+        }
+
+        // owner of a per thread tlb polls *flag, bit is posted when an entry was shot down.
+        // owner keeps UINT64_MAX in *running while none of its generated code runs
+        void SetShootdownFlag(u64 *flag, u64 bit, const u64 *running = nullptr) {
+            shootdown_flag_ = flag;
+            shootdown_bit_ = bit;
+            running_ = running;
+        }
+
+        // owner dropped its l1 since the last shootdown, or is not running code that could use it.
+        // a tlb without owner has nobody to ask, callers get no ack from it
+        bool ShootdownAcked() const {
+            if (!shootdown_flag_ || !(__atomic_load_n(shootdown_flag_, __ATOMIC_ACQUIRE) & shootdown_bit_)) {
+                return true;
+            }
+            return running_ && __atomic_load_n(running_, __ATOMIC_ACQUIRE) == UINT64_MAX;
+        }
+
+        // a smaller cache in front of this one, filled from it by the owner thread
+        // pages in it are shot down too, even if this tlb evicted them since
+        void SetL1(const TLBEntry<AddrType, PTE> *l1, u8 l1_bits) {
+            l1_ = l1;
+            l1_bits_ = l1_bits;
+        }
+
+        void ShootdownAll() {
+            Flush();
+            if (shootdown_flag_) {
+                __atomic_fetch_or(shootdown_flag_, shootdown_bit_, __ATOMIC_RELEASE);
+            }
+        }
+
+        // clear the page if cached here and notify the owner.
+        // an owner running code may be refilling the entry from the old pte right now,
+        // it is told even if the page is not cached, see DropStale
+        bool Shootdown(AddrType vaddr) {
+            assert(vaddr % (1 << page_bits_) == 0);
+            auto index = BitRange<AddrType>(vaddr, page_bits_, page_bits_ + tlb_bits_ - 1);
+            auto &tlb_entry = tlb_table_[index];
+            bool cached = tlb_entry.page_index_ == vaddr >> page_bits_;
+            bool in_l1 = l1_ && l1_[BitRange<AddrType>(vaddr, page_bits_, page_bits_ + l1_bits_ - 1)]
+                                        .page_index_ == vaddr >> page_bits_;
+            bool running = !running_ || __atomic_load_n(running_, __ATOMIC_ACQUIRE) != UINT64_MAX;
+            if (!cached && !in_l1 && !running) {
+                return false;
+            }
+            if (cached) {
+                InvalidateEntry(tlb_entry);
+            }
+            if (running) {
+                __atomic_store_n(&stale_, true, __ATOMIC_RELEASE);
+            }
+            // l1 belongs to the owner, it drops it when it sees the flag
+            if (shootdown_flag_) {
+                __atomic_fetch_or(shootdown_flag_, shootdown_bit_, __ATOMIC_RELEASE);
+            }
+            return true;
+        }
+
+        // owner side, on the shootdown flag: a refill that raced with a shootdown
+        // may have stored the old pte after it was cleared, the whole table is dropped then
+        void DropStale() {
+            if (__atomic_exchange_n(&stale_, false, __ATOMIC_ACQ_REL)) {
+                Flush();
+            }
         }
 
         VAddr TLBTablePtr() {
@@ -57,9 +133,23 @@ namespace Memory {
         }
 
     protected:
+        // index first: a walker racing with us sees another page or pte 0, both are a miss.
+        // walkers in generated code check the pte for 0 as well
+        static void InvalidateEntry(TLBEntry<AddrType, PTE> &tlb_entry) {
+            __atomic_store_n(&tlb_entry.page_index_, AddrType{}, __ATOMIC_RELEASE);
+            PTE empty{};
+            __atomic_store(&tlb_entry.pte_, &empty, __ATOMIC_RELEASE);
+        }
+
         const u8 tlb_bits_;
         const u8 page_bits_;
         std::vector<TLBEntry<AddrType, PTE>> tlb_table_;
+        u64 *shootdown_flag_{};
+        u64 shootdown_bit_{};
+        const TLBEntry<AddrType, PTE> *l1_{};
+        u8 l1_bits_{};
+        const u64 *running_{};
+        bool stale_{};
     };
 
 }
@@ -3,8 +3,16 @@
 //
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <base/log.h>
 #include "memory.h"
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 void *Platform::MapExecutableMemory(size_t size, VAddr addr) {
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
     if (addr != 0) {
@@ -18,3 +26,47 @@ void *Platform::MapExecutableMemory(size_t size, VAddr addr) {
 void Platform::UnMapExecutableMemory(VAddr addr, size_t size) {
     munmap(reinterpret_cast<void *>(addr), size);
 }
+
+static Platform::DualMapping MapRwxFallback(size_t size) {
+    auto rwx = Platform::MapExecutableMemory(size);
+    if (rwx == MAP_FAILED) {
+        LOGE("map code cache of size %zu failed", size);
+        return {0, 0};
+    }
+    return {reinterpret_cast<VAddr>(rwx), reinterpret_cast<VAddr>(rwx)};
+}
+
+Platform::DualMapping Platform::MapDualExecutableMemory(size_t size) {
+    // no memfd_create wrapper before api 30
+    int fd = static_cast<int>(syscall(__NR_memfd_create, "jit-cache", MFD_CLOEXEC));
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        LOGE("memfd unavailable, fallback to rwx code cache");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return MapRwxFallback(size);
+    }
+    auto rx = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    auto rw = rx != MAP_FAILED ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    // mappings keep the file alive
+    close(fd);
+    if (rx == MAP_FAILED || rw == MAP_FAILED) {
+        LOGE("dual map of memfd failed, fallback to rwx code cache");
+        if (rx != MAP_FAILED) {
+            munmap(rx, size);
+        }
+        return MapRwxFallback(size);
+    }
+    return {reinterpret_cast<VAddr>(rx), reinterpret_cast<VAddr>(rw)};
+}
+
+void Platform::UnMapDualExecutableMemory(const DualMapping &mapping, size_t size) {
+    munmap(reinterpret_cast<void *>(mapping.rx), size);
+    if (mapping.rw != mapping.rx) {
+        munmap(reinterpret_cast<void *>(mapping.rw), size);
+    }
+}
+
+void Platform::SealExecutableMemory(VAddr addr, size_t size) {
+    mprotect(reinterpret_cast<void *>(addr), size, PROT_READ | PROT_EXEC);
+}
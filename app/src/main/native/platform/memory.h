@@ -7,6 +7,20 @@
 #include "base/marcos.h"
 
 namespace Platform {
+
+    // same pages seen twice, written through rw, executed through rx
+    // rw == rx if the kernel can not give us a shared mapping, both 0 if nothing could be mapped
+    struct DualMapping {
+        VAddr rx;
+        VAddr rw;
+    };
+
     void *MapExecutableMemory(size_t size, VAddr addr = 0);
     void UnMapExecutableMemory(VAddr addr, size_t size);
+
+    DualMapping MapDualExecutableMemory(size_t size);
+    void UnMapDualExecutableMemory(const DualMapping &mapping, size_t size);
+
+    // drop write permission of code that will not be patched any more
+    void SealExecutableMemory(VAddr addr, size_t size);
 }
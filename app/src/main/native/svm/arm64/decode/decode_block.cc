@@ -0,0 +1,499 @@
+//
+// Created by SwiftGan on 2020/11/18.
+//
+
+#include "decode_block.h"
+
+using namespace Decode::A64;
+
+// 31 is zr unless the encoding says sp
+static constexpr u32 Reg(u32 code, bool may_sp = false) {
+    if (code == 31) {
+        return may_sp ? reg_mask_sp : 0;
+    }
+    return u32(1) << code;
+}
+
+static u32 Rd(const Instruction *instr, bool may_sp = false) {
+    return Reg(instr->ExtractBits(4, 0), may_sp);
+}
+
+static u32 Rn(const Instruction *instr, bool may_sp = false) {
+    return Reg(instr->ExtractBits(9, 5), may_sp);
+}
+
+static u32 Rm(const Instruction *instr) {
+    return Reg(instr->ExtractBits(20, 16));
+}
+
+// ra of 3 source, rt2 of pairs
+static u32 Ra(const Instruction *instr) {
+    return Reg(instr->ExtractBits(14, 10));
+}
+
+static u32 RegPair(u32 code) {
+    return Reg(code) | Reg(code + 1 > 31 ? 31 : code + 1);
+}
+
+BlockPreDecoder::BlockPreDecoder() {
+    decoder_.AppendVisitor(this);
+}
+
+void BlockPreDecoder::PreDecode(const Instruction *instr, PreDecoded &out) {
+    out = {};
+    out.raw = instr->GetInstructionBits();
+    out.host = reinterpret_cast<VAddr>(instr);
+    current_ = &out;
+    decoder_.Decode(instr);
+    current_ = nullptr;
+}
+
+void BlockPreDecoder::Liveness(std::vector<PreDecoded> &block) {
+    u32 live = reg_mask_all;
+    bool flags_live = true;
+    for (auto it = block.rbegin(); it != block.rend(); ++it) {
+        it->live_out = live;
+        if (flags_live) {
+            it->flags |= FlagsLiveOut;
+        }
+        live = (live & ~it->writes) | it->reads;
+        if (it->flags & FlagsUse) {
+            flags_live = true;
+        } else if (it->flags & FlagsDef) {
+            flags_live = false;
+        }
+    }
+}
+
+#define DEFINE(A) \
+void BlockPreDecoder::Visit##A(const Instruction *) {}
+VISITOR_LIST_NO_GPR(DEFINE)
+#undef DEFINE
+
+void BlockPreDecoder::VisitAddSubImmediate(const Instruction *instr) {
+    bool set_flags = instr->ExtractBit(29);
+    current_->reads = Rn(instr, true);
+    current_->writes = Rd(instr, !set_flags);
+    current_->flags = set_flags ? FlagsDef : 0;
+}
+
+void BlockPreDecoder::VisitAddSubShifted(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+    current_->flags = instr->ExtractBit(29) ? FlagsDef : 0;
+}
+
+void BlockPreDecoder::VisitAddSubExtended(const Instruction *instr) {
+    bool set_flags = instr->ExtractBit(29);
+    current_->reads = Rn(instr, true) | Rm(instr);
+    current_->writes = Rd(instr, !set_flags);
+    current_->flags = set_flags ? FlagsDef : 0;
+}
+
+void BlockPreDecoder::VisitAddSubWithCarry(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+    current_->flags = FlagsUse | (instr->ExtractBit(29) ? FlagsDef : 0);
+}
+
+void BlockPreDecoder::VisitLogicalImmediate(const Instruction *instr) {
+    // ands
+    bool set_flags = instr->ExtractBits(30, 29) == 3;
+    current_->reads = Rn(instr);
+    current_->writes = Rd(instr, !set_flags);
+    current_->flags = set_flags ? FlagsDef : 0;
+}
+
+void BlockPreDecoder::VisitLogicalShifted(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+    current_->flags = instr->ExtractBits(30, 29) == 3 ? FlagsDef : 0;
+}
+
+void BlockPreDecoder::VisitMoveWideImmediate(const Instruction *instr) {
+    current_->writes = Rd(instr);
+    // movk keeps the other halves
+    if (instr->ExtractBits(30, 29) == 3) {
+        current_->reads = Rd(instr);
+    }
+}
+
+void BlockPreDecoder::VisitBitfield(const Instruction *instr) {
+    current_->reads = Rn(instr);
+    current_->writes = Rd(instr);
+    // bfm inserts into rd
+    if (instr->ExtractBits(30, 29) == 1) {
+        current_->reads |= Rd(instr);
+    }
+}
+
+void BlockPreDecoder::VisitExtract(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+}
+
+void BlockPreDecoder::VisitPCRelAddressing(const Instruction *instr) {
+    current_->cls = InstrClass::PCRel;
+    current_->writes = Rd(instr);
+}
+
+void BlockPreDecoder::VisitConditionalCompareImmediate(const Instruction *instr) {
+    current_->reads = Rn(instr);
+    current_->flags = FlagsUse | FlagsDef;
+}
+
+void BlockPreDecoder::VisitConditionalCompareRegister(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->flags = FlagsUse | FlagsDef;
+}
+
+void BlockPreDecoder::VisitConditionalSelect(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+    current_->flags = FlagsUse;
+}
+
+void BlockPreDecoder::VisitDataProcessing1Source(const Instruction *instr) {
+    current_->reads = Rn(instr);
+    current_->writes = Rd(instr);
+}
+
+void BlockPreDecoder::VisitDataProcessing2Source(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr);
+    current_->writes = Rd(instr);
+}
+
+void BlockPreDecoder::VisitDataProcessing3Source(const Instruction *instr) {
+    current_->reads = Rn(instr) | Rm(instr) | Ra(instr);
+    current_->writes = Rd(instr);
+}
+
+void BlockPreDecoder::VisitEvaluateIntoFlags(const Instruction *instr) {
+    current_->reads = Rn(instr);
+    current_->flags = FlagsDef;
+}
+
+void BlockPreDecoder::VisitRotateRightIntoFlags(const Instruction *instr) {
+    current_->reads = Rn(instr);
+    current_->flags = FlagsDef;
+}
+
+void BlockPreDecoder::VisitFPCompare(const Instruction *instr) {
+    current_->flags = FlagsDef;
+}
+
+void BlockPreDecoder::VisitFPConditionalCompare(const Instruction *instr) {
+    current_->flags = FlagsUse | FlagsDef;
+}
+
+void BlockPreDecoder::VisitFPConditionalSelect(const Instruction *instr) {
+    current_->flags = FlagsUse;
+}
+
+// scvtf/ucvtf and fmov from general read rn, the rest write rd
+static void FPConvert(const Instruction *instr, PreDecoded &out) {
+    auto opcode = instr->ExtractBits(18, 16);
+    if (opcode == 2 || opcode == 3 || opcode == 7) {
+        out.reads = Rn(instr);
+    } else {
+        out.writes = Rd(instr);
+    }
+}
+
+void BlockPreDecoder::VisitFPFixedPointConvert(const Instruction *instr) {
+    FPConvert(instr, *current_);
+}
+
+void BlockPreDecoder::VisitFPIntegerConvert(const Instruction *instr) {
+    FPConvert(instr, *current_);
+}
+
+void BlockPreDecoder::VisitNEONCopy(const Instruction *instr) {
+    if (instr->ExtractBit(29)) {
+        // ins element
+        return;
+    }
+    switch (instr->ExtractBits(14, 11)) {
+        case 1:
+        case 3:
+            // dup/ins general
+            current_->reads = Rn(instr);
+            break;
+        case 5:
+        case 7:
+            // smov/umov
+            current_->writes = Rd(instr);
+            break;
+        default:
+            break;
+    }
+}
+
+void BlockPreDecoder::VisitCompareBranch(const Instruction *instr) {
+    current_->cls = InstrClass::Branch;
+    current_->reads = Rd(instr);
+    current_->flags = Terminator;
+}
+
+void BlockPreDecoder::VisitTestBranch(const Instruction *instr) {
+    current_->cls = InstrClass::Branch;
+    current_->reads = Rd(instr);
+    current_->flags = Terminator;
+}
+
+void BlockPreDecoder::VisitConditionalBranch(const Instruction *instr) {
+    current_->cls = InstrClass::Branch;
+    current_->flags = FlagsUse | Terminator;
+}
+
+void BlockPreDecoder::VisitUnconditionalBranch(const Instruction *instr) {
+    current_->cls = InstrClass::Branch;
+    // bl
+    current_->writes = instr->ExtractBit(31) ? Reg(30) : 0;
+    current_->flags = Terminator;
+}
+
+void BlockPreDecoder::VisitUnconditionalBranchToRegister(const Instruction *instr) {
+    current_->cls = InstrClass::BranchReg;
+    current_->reads = Rn(instr);
+    // blr and its pac forms
+    current_->writes = instr->ExtractBits(22, 21) == 1 ? Reg(30) : 0;
+    current_->flags = Terminator;
+}
+
+void BlockPreDecoder::VisitException(const Instruction *instr) {
+    // the host sees the whole context
+    current_->cls = InstrClass::Exception;
+    current_->reads = reg_mask_all;
+    current_->writes = reg_mask_all;
+    current_->flags = FlagsUse | FlagsDef | Terminator;
+}
+
+void BlockPreDecoder::VisitSystem(const Instruction *instr) {
+    current_->cls = InstrClass::System;
+    auto op0 = instr->ExtractBits(20, 19);
+    bool read = instr->ExtractBit(21);
+    if (op0 >= 2) {
+        // mrs/msr
+        if (read) {
+            current_->writes = Rd(instr);
+        } else {
+            current_->reads = Rd(instr);
+        }
+        if (instr->GetImmSystemRegister() == NZCV) {
+            current_->flags = read ? FlagsUse : FlagsDef;
+        }
+    } else if (op0 == 1) {
+        // sys/sysl, dc zva and friends
+        if (read) {
+            current_->writes = Rd(instr);
+        } else {
+            current_->reads = Rd(instr);
+            current_->mem = instr->ExtractBits(15, 12) == 7 ? MemAccess::Store : MemAccess::None;
+        }
+    } else if (instr->ExtractBits(15, 12) == 4) {
+        // pstate: cfinv, xaflag, axflag
+        current_->flags = FlagsUse | FlagsDef;
+    }
+}
+
+// single register forms, rm is read by the register offset form
+static void LoadStoreReg(const Instruction *instr, PreDecoded &out, bool write_back) {
+    bool simd = instr->ExtractBit(26);
+    auto opc = instr->ExtractBits(23, 22);
+    bool store = simd ? !(opc & 1) : opc == 0;
+    bool prefetch = !simd && instr->ExtractBits(31, 30) == 3 && opc == 2;
+    out.reads = Rn(instr, true);
+    if (write_back) {
+        out.writes = Rn(instr, true);
+    }
+    if (prefetch) {
+        out.mem = MemAccess::Prefetch;
+    } else if (store) {
+        out.mem = MemAccess::Store;
+        out.reads |= simd ? 0 : Rd(instr);
+    } else {
+        out.mem = MemAccess::Load;
+        out.writes |= simd ? 0 : Rd(instr);
+    }
+}
+
+void BlockPreDecoder::VisitLoadStoreUnsignedOffset(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitLoadStoreUnscaledOffset(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitLoadStoreRCpcUnscaledOffset(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitLoadStorePreIndex(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, true);
+}
+
+void BlockPreDecoder::VisitLoadStorePostIndex(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, true);
+}
+
+void BlockPreDecoder::VisitLoadStoreRegisterOffset(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    LoadStoreReg(instr, *current_, false);
+    current_->reads |= Rm(instr);
+}
+
+void BlockPreDecoder::VisitLoadStorePAC(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    current_->mem = MemAccess::Load;
+    current_->reads = Rn(instr, true);
+    current_->writes = Rd(instr) | (instr->ExtractBit(11) ? Rn(instr, true) : 0);
+}
+
+static void LoadStorePair(const Instruction *instr, PreDecoded &out, bool write_back) {
+    bool simd = instr->ExtractBit(26);
+    bool load = instr->ExtractBit(22);
+    out.reads = Rn(instr, true);
+    if (write_back) {
+        out.writes = Rn(instr, true);
+    }
+    auto transfer = simd ? 0 : Rd(instr) | Ra(instr);
+    if (load) {
+        out.mem = MemAccess::Load;
+        out.writes |= transfer;
+    } else {
+        out.mem = MemAccess::Store;
+        out.reads |= transfer;
+    }
+}
+
+void BlockPreDecoder::VisitLoadStorePairOffset(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStorePair;
+    LoadStorePair(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitLoadStorePairNonTemporal(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStorePair;
+    LoadStorePair(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitLoadStorePairPreIndex(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStorePair;
+    LoadStorePair(instr, *current_, true);
+}
+
+void BlockPreDecoder::VisitLoadStorePairPostIndex(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStorePair;
+    LoadStorePair(instr, *current_, true);
+}
+
+void BlockPreDecoder::VisitLoadLiteral(const Instruction *instr) {
+    current_->cls = InstrClass::LoadLiteral;
+    bool simd = instr->ExtractBit(26);
+    // prfm
+    if (!simd && instr->ExtractBits(31, 30) == 3) {
+        current_->mem = MemAccess::Prefetch;
+        return;
+    }
+    current_->mem = MemAccess::Load;
+    current_->writes = simd ? 0 : Rd(instr);
+}
+
+void BlockPreDecoder::VisitLoadStoreExclusive(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStoreExclusive;
+    bool o2 = instr->ExtractBit(23);
+    bool load = instr->ExtractBit(22);
+    bool o1 = instr->ExtractBit(21);
+    auto rs = instr->ExtractBits(20, 16);
+    auto rt = instr->ExtractBits(4, 0);
+    current_->reads = Rn(instr, true);
+    if (o1 && o2) {
+        // cas
+        current_->mem = MemAccess::Atomic;
+        current_->reads |= Reg(rs) | Reg(rt);
+        current_->writes = Reg(rs);
+        return;
+    }
+    if (o1 && instr->ExtractBits(31, 30) < 2) {
+        // casp
+        current_->mem = MemAccess::Atomic;
+        current_->reads |= RegPair(rs) | RegPair(rt);
+        current_->writes = RegPair(rs);
+        return;
+    }
+    // o1 = pair for the exclusives
+    auto transfer = Reg(rt) | (o1 ? Ra(instr) : 0);
+    if (load) {
+        current_->mem = MemAccess::Load;
+        current_->writes = transfer;
+    } else {
+        current_->mem = MemAccess::Store;
+        current_->reads |= transfer;
+        // status of stxr, stlr has none
+        current_->writes = o2 ? 0 : Reg(rs);
+    }
+}
+
+void BlockPreDecoder::VisitAtomicMemory(const Instruction *instr) {
+    current_->cls = InstrClass::LoadStore;
+    current_->mem = MemAccess::Atomic;
+    current_->reads = Rn(instr, true) | Rm(instr);
+    current_->writes = Rd(instr);
+}
+
+static void NEONLoadStore(const Instruction *instr, PreDecoded &out, bool post_index) {
+    out.cls = InstrClass::LoadStore;
+    out.mem = instr->ExtractBit(22) ? MemAccess::Load : MemAccess::Store;
+    out.reads = Rn(instr, true);
+    if (post_index) {
+        // rm = 31 is the immediate form
+        out.reads |= Rm(instr);
+        out.writes = Rn(instr, true);
+    }
+}
+
+void BlockPreDecoder::VisitNEONLoadStoreMultiStruct(const Instruction *instr) {
+    NEONLoadStore(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitNEONLoadStoreMultiStructPostIndex(const Instruction *instr) {
+    NEONLoadStore(instr, *current_, true);
+}
+
+void BlockPreDecoder::VisitNEONLoadStoreSingleStruct(const Instruction *instr) {
+    NEONLoadStore(instr, *current_, false);
+}
+
+void BlockPreDecoder::VisitNEONLoadStoreSingleStructPostIndex(const Instruction *instr) {
+    NEONLoadStore(instr, *current_, true);
+}
+
+static void Unknown(PreDecoded &out) {
+    out.cls = InstrClass::Unknown;
+    out.reads = reg_mask_all;
+    out.writes = reg_mask_all;
+    out.flags = FlagsUse | FlagsDef;
+}
+
+void BlockPreDecoder::VisitUnallocated(const Instruction *instr) {
+    Unknown(*current_);
+}
+
+void BlockPreDecoder::VisitUnimplemented(const Instruction *instr) {
+    if (IsLoadStoreUnprivileged(instr->GetInstructionBits())) {
+        current_->cls = InstrClass::LoadStore;
+        LoadStoreReg(instr, *current_, false);
+        return;
+    }
+    Unknown(*current_);
+}
+
+void BlockPreDecoder::VisitReserved(const Instruction *instr) {
+    Unknown(*current_);
+}
@@ -0,0 +1,230 @@
+//
+// Created by SwiftGan on 2020/11/18.
+//
+
+#pragma once
+
+#include <aarch64/decoder-aarch64.h>
+#include <base/marcos.h>
+#include <vector>
+
+// groups without general registers or flags
+#define VISITOR_LIST_NO_GPR(V)          \
+  V(Crypto2RegSHA)                      \
+  V(Crypto3RegSHA)                      \
+  V(CryptoAES)                          \
+  V(FPDataProcessing1Source)            \
+  V(FPDataProcessing2Source)            \
+  V(FPDataProcessing3Source)            \
+  V(FPImmediate)                        \
+  V(NEON2RegMisc)                       \
+  V(NEON2RegMiscFP16)                   \
+  V(NEON3Different)                     \
+  V(NEON3Same)                          \
+  V(NEON3SameExtra)                     \
+  V(NEON3SameFP16)                      \
+  V(NEONAcrossLanes)                    \
+  V(NEONByIndexedElement)               \
+  V(NEONExtract)                        \
+  V(NEONModifiedImmediate)              \
+  V(NEONPerm)                           \
+  V(NEONScalar2RegMisc)                 \
+  V(NEONScalar2RegMiscFP16)             \
+  V(NEONScalar3Diff)                    \
+  V(NEONScalar3Same)                    \
+  V(NEONScalar3SameExtra)               \
+  V(NEONScalar3SameFP16)                \
+  V(NEONScalarByIndexedElement)         \
+  V(NEONScalarCopy)                     \
+  V(NEONScalarPairwise)                 \
+  V(NEONScalarShiftImmediate)           \
+  V(NEONShiftImmediate)                 \
+  V(NEONTable)
+
+#define VISITOR_LIST_PRE_DECODE(V)      \
+  V(AddSubExtended)                     \
+  V(AddSubImmediate)                    \
+  V(AddSubShifted)                      \
+  V(AddSubWithCarry)                    \
+  V(AtomicMemory)                       \
+  V(Bitfield)                           \
+  V(CompareBranch)                      \
+  V(ConditionalBranch)                  \
+  V(ConditionalCompareImmediate)        \
+  V(ConditionalCompareRegister)         \
+  V(ConditionalSelect)                  \
+  V(DataProcessing1Source)              \
+  V(DataProcessing2Source)              \
+  V(DataProcessing3Source)              \
+  V(Exception)                          \
+  V(Extract)                            \
+  V(EvaluateIntoFlags)                  \
+  V(FPCompare)                          \
+  V(FPConditionalCompare)               \
+  V(FPConditionalSelect)                \
+  V(FPFixedPointConvert)                \
+  V(FPIntegerConvert)                   \
+  V(LoadLiteral)                        \
+  V(LoadStoreExclusive)                 \
+  V(LoadStorePAC)                       \
+  V(LoadStorePairNonTemporal)           \
+  V(LoadStorePairOffset)                \
+  V(LoadStorePairPostIndex)             \
+  V(LoadStorePairPreIndex)              \
+  V(LoadStorePostIndex)                 \
+  V(LoadStorePreIndex)                  \
+  V(LoadStoreRCpcUnscaledOffset)        \
+  V(LoadStoreRegisterOffset)            \
+  V(LoadStoreUnscaledOffset)            \
+  V(LoadStoreUnsignedOffset)            \
+  V(LogicalImmediate)                   \
+  V(LogicalShifted)                     \
+  V(MoveWideImmediate)                  \
+  V(NEONCopy)                           \
+  V(NEONLoadStoreMultiStruct)           \
+  V(NEONLoadStoreMultiStructPostIndex)  \
+  V(NEONLoadStoreSingleStruct)          \
+  V(NEONLoadStoreSingleStructPostIndex) \
+  V(PCRelAddressing)                    \
+  V(RotateRightIntoFlags)               \
+  V(System)                             \
+  V(TestBranch)                         \
+  V(UnconditionalBranch)                \
+  V(UnconditionalBranchToRegister)      \
+  V(Unallocated)                        \
+  V(Unimplemented)                      \
+  V(Reserved)
+
+namespace Decode::A64 {
+
+    using namespace vixl::aarch64;
+
+    // how the translator treats the instruction
+    enum class InstrClass : u8 {
+        // emitted as is
+        PassThrough,
+        Branch,
+        BranchReg,
+        Exception,
+        System,
+        LoadStore,
+        LoadStorePair,
+        LoadStoreExclusive,
+        LoadLiteral,
+        PCRel,
+        // not decodable, assume it touches everything
+        Unknown
+    };
+
+    enum class MemAccess : u8 {
+        None,
+        Load,
+        Store,
+        // read and write, cas/swp/ldadd
+        Atomic,
+        Prefetch
+    };
+
+    enum PreDecodeFlags : u8 {
+        FlagsUse    = 1 << 0,
+        FlagsDef    = 1 << 1,
+        // last instruction of the block
+        Terminator  = 1 << 2,
+        // a later instruction of the block or its successor may read nzcv
+        FlagsLiveOut = 1 << 3
+    };
+
+    // bit n = xn, bit 31 = sp, zr is never set
+    constexpr u32 reg_mask_sp = u32(1) << 31;
+    constexpr u32 reg_mask_all = ~u32(0);
+
+    struct PreDecoded {
+        u32 raw;
+        InstrClass cls;
+        MemAccess mem;
+        u8 flags;
+        u32 reads;
+        u32 writes;
+        // registers that may be read after this instruction
+        u32 live_out;
+        // host address the instruction was fetched from
+        VAddr host;
+    };
+
+    // ldtr/sttr and friends, vixl decodes them as unimplemented
+    constexpr bool IsLoadStoreUnprivileged(u32 bits) {
+        return (bits & 0x3f200c00) == 0x38000800;
+    }
+
+    // true if vixl would end up in a visitor outside VISITOR_LIST_THAT_INTEREST,
+    // the JIT then emits the instruction as is without walking the decode tree.
+    // false may still be a pass through, the decoder then decides
+    constexpr bool IsPassThrough(u32 bits) {
+        switch ((bits >> 25) & 0xf) {
+            case 0b0000:
+            case 0b0001:
+            case 0b0010:
+            case 0b0011:
+                // reserved, unallocated, sve
+                return true;
+            case 0b1000:
+            case 0b1001:
+                // data processing immediate, adr/adrp need the guest pc
+                return ((bits >> 24) & 0x1f) != 0b10000;
+            case 0b1010:
+            case 0b1011:
+                // branches, exceptions and system
+                return false;
+            case 0b0101:
+            case 0b1101:
+            case 0b0111:
+            case 0b1111:
+                // data processing register, simd and fp
+                return true;
+            default:
+                // loads and stores, every form translates the guest address on mmu guests
+                return false;
+        }
+    }
+
+    // one pass from the block start to its terminator, before any code is emitted
+    class BlockPreDecoder : public DecoderVisitor {
+    public:
+        BlockPreDecoder();
+
+        // fetch(pc) returns the host address of pc or 0, the scan stops there
+        template<typename Fetch>
+        size_t Scan(VAddr start, size_t max, std::vector<PreDecoded> &out, Fetch &&fetch) {
+            out.clear();
+            for (VAddr pc = start; out.size() < max; pc += 4) {
+                VAddr host = fetch(pc);
+                if (!host) {
+                    break;
+                }
+                auto &record = out.emplace_back();
+                PreDecode(reinterpret_cast<const Instruction *>(host), record);
+                if (record.flags & Terminator) {
+                    break;
+                }
+            }
+            Liveness(out);
+            return out.size();
+        }
+
+        void PreDecode(const Instruction *instr, PreDecoded &out);
+
+        // backward pass, everything is live at the block exit
+        static void Liveness(std::vector<PreDecoded> &block);
+
+#define DECLARE(A) \
+  void Visit##A(const Instruction* instr) override;
+        VISITOR_LIST_PRE_DECODE(DECLARE)
+        VISITOR_LIST_NO_GPR(DECLARE)
+#undef DECLARE
+
+    private:
+        Decoder decoder_;
+        PreDecoded *current_{};
+    };
+
+}
@@ -19,8 +19,14 @@ void VixlJitDecodeVisitor::PopContext() {
     jit_contexts_.pop();
 }
 
+// instr is the host copy of the guest code, pc relative targets are taken from the guest pc
+static VAddr PCOffsetTarget(ContextA64 context, const Instruction *instr) {
+    auto offset = reinterpret_cast<VAddr>(instr->GetImmPCOffsetTarget()) - reinterpret_cast<VAddr>(instr);
+    return context->PC() + offset;
+}
+
 void VixlJitDecodeVisitor::VisitCompareBranch(const Instruction *instr) {
-    VAddr target = (VAddr) instr->GetImmPCOffsetTarget();
+    VAddr target = PCOffsetTarget(Context(), instr);
     switch (instr->Mask(CompareBranchMask)) {
         case CBZ_w:
             BranchImm<Comp | CompW>(Context(), target, static_cast<u8>(instr->GetRt()));
@@ -40,18 +46,18 @@ void VixlJitDecodeVisitor::VisitCompareBranch(const Instruction *instr) {
 }
 
 void VixlJitDecodeVisitor::VisitConditionalBranch(const Instruction *instr) {
-    BranchImm(Context(), (u64) instr->GetImmPCOffsetTarget(), 0, instr->GetConditionBranch());
+    BranchImm(Context(), PCOffsetTarget(Context(), instr), 0, instr->GetConditionBranch());
 }
 
 void VixlJitDecodeVisitor::VisitTestBranch(const Instruction *instr) {
     switch (instr->Mask(TestBranchMask)) {
         case TBZ:
-            BranchImm<TestBit>(Context(), reinterpret_cast<VAddr>(instr->GetImmPCOffsetTarget()),
+            BranchImm<TestBit>(Context(), PCOffsetTarget(Context(), instr),
                                instr->Rt());
             break;
         case TBNZ:
             BranchImm<TestBit | Negate>(Context(),
-                                        reinterpret_cast<VAddr>(instr->GetImmPCOffsetTarget()),
+                                        PCOffsetTarget(Context(), instr),
                                         instr->Rt());
             break;
     }
@@ -60,9 +66,9 @@ void VixlJitDecodeVisitor::VisitTestBranch(const Instruction *instr) {
 void VixlJitDecodeVisitor::VisitUnconditionalBranch(const Instruction *instr) {
     switch (instr->Mask(UnconditionalBranchMask)) {
         case BL:
-            BranchImm<Link>(Context(), reinterpret_cast<VAddr>(instr->GetImmPCOffsetTarget()));
+            BranchImm<Link>(Context(), PCOffsetTarget(Context(), instr));
         case B:
-            BranchImm(Context(), reinterpret_cast<VAddr>(instr->GetImmPCOffsetTarget()));
+            BranchImm(Context(), PCOffsetTarget(Context(), instr));
             break;
         default:
             abort();
@@ -89,7 +95,7 @@ void VixlJitDecodeVisitor::VisitUnconditionalBranchToRegister(
 
     // Do not support now, go interpreter
     if (authenticate) {
-        Context()->Interrupt({InterruptHelp::ErrorInstr, reinterpret_cast<VAddr>(instr)});
+        Context()->Interrupt({InterruptHelp::ErrorInstr, Context()->PC()});
         return;
     }
 
@@ -154,12 +160,16 @@ void VixlJitDecodeVisitor::VisitException(const Instruction *instr) {
             Exception<Hvc>(Context(), static_cast<u16>(instr->GetImmException()));
             break;
         default:
-            Context()->Interrupt({InterruptHelp::ErrorInstr, (u64) instr});
+            Context()->Interrupt({InterruptHelp::ErrorInstr, Context()->PC()});
             break;
     }
 }
 
 void VixlJitDecodeVisitor::VisitSystem(const Instruction *instr) {
+    if (instr->Mask(SystemExclusiveMonitorFMask) == SystemExclusiveMonitorFixed) {
+        ClearExclusive(Context());
+        return;
+    }
     if (instr->Mask(SystemSysRegFMask) == SystemSysRegFixed) {
         switch (instr->Mask(SystemSysRegMask)) {
             case MRS:
@@ -211,6 +221,57 @@ void VixlJitDecodeVisitor::VisitLoadStorePairPreIndex(const Instruction *instr)
     }
 }
 
+void VixlJitDecodeVisitor::VisitLoadStorePairNonTemporal(const Instruction *instr) {
+    // ldnp/stnp, v bit tells the transfer registers
+    if (instr->ExtractBit(26)) {
+        LoadStorePair<Float>(Context(), instr->GetRt(), instr->GetRt2(), instr->GetRn());
+    } else {
+        LoadStorePair(Context(), instr->GetRt(), instr->GetRt2(), instr->GetRn());
+    }
+}
+
+void VixlJitDecodeVisitor::VisitLoadStoreExclusive(const Instruction *instr) {
+    Instructions::A64::AArch64Inst inst(instr->GetInstructionBits());
+    switch (instr->Mask(LoadStoreExclusiveMask)) {
+        case LDXRB_w:
+        case LDXRH_w:
+        case LDXR_w:
+        case LDXR_x:
+        case LDXP_w:
+        case LDXP_x:
+            LoadExclusive(Context(), inst);
+            break;
+        case LDAXRB_w:
+        case LDAXRH_w:
+        case LDAXR_w:
+        case LDAXR_x:
+        case LDAXP_w:
+        case LDAXP_x:
+            LoadExclusive<Acquire>(Context(), inst);
+            break;
+        case STXRB_w:
+        case STXRH_w:
+        case STXR_w:
+        case STXR_x:
+        case STXP_w:
+        case STXP_x:
+            StoreExclusive(Context(), inst);
+            break;
+        case STLXRB_w:
+        case STLXRH_w:
+        case STLXR_w:
+        case STLXR_x:
+        case STLXP_w:
+        case STLXP_x:
+            StoreExclusive<Release>(Context(), inst);
+            break;
+        default:
+            // ldar/stlr, lorelease variants and cas
+            LoadStoreOrdered(Context(), inst);
+            break;
+    }
+}
+
 void VixlJitDecodeVisitor::VisitLoadStorePostIndex(const Instruction *instr) {
     LoadStoreReg<WriteBack | PostIndex>(Context(), instr->GetRt(), instr->GetRn());
 }
@@ -223,11 +284,57 @@ void VixlJitDecodeVisitor::VisitLoadStoreUnsignedOffset(const Instruction *instr
     LoadStoreReg(Context(), instr->GetRt(), instr->GetRn());
 }
 
+void VixlJitDecodeVisitor::VisitLoadStoreUnscaledOffset(const Instruction *instr) {
+    LoadStoreReg(Context(), instr->GetRt(), instr->GetRn());
+}
+
+void VixlJitDecodeVisitor::VisitLoadStoreRCpcUnscaledOffset(const Instruction *instr) {
+    LoadStoreReg(Context(), instr->GetRt(), instr->GetRn());
+}
+
+void VixlJitDecodeVisitor::VisitLoadStoreRegisterOffset(const Instruction *instr) {
+    LoadStoreRegOffset(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()));
+}
+
+void VixlJitDecodeVisitor::VisitAtomicMemory(const Instruction *instr) {
+    LoadStoreAtomic(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()));
+}
+
+void VixlJitDecodeVisitor::VisitLoadStorePAC(const Instruction *instr) {
+    // ldraa/ldrab authenticate the guest pointer, there is no host form of it
+    if (Context()->MmuEnabled()) {
+        Context()->Interrupt({InterruptHelp::ErrorInstr, Context()->PC()});
+        return;
+    }
+    Context()->Assembler().Emit(instr->GetInstructionBits());
+}
+
+void VixlJitDecodeVisitor::VisitNEONLoadStoreMultiStruct(const Instruction *instr) {
+    NEONLoadStore(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()), false);
+}
+
+void VixlJitDecodeVisitor::VisitNEONLoadStoreMultiStructPostIndex(const Instruction *instr) {
+    NEONLoadStore(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()), false);
+}
+
+void VixlJitDecodeVisitor::VisitNEONLoadStoreSingleStruct(const Instruction *instr) {
+    NEONLoadStore(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()), true);
+}
+
+void VixlJitDecodeVisitor::VisitNEONLoadStoreSingleStructPostIndex(const Instruction *instr) {
+    NEONLoadStore(Context(), Instructions::A64::AArch64Inst(instr->GetInstructionBits()), true);
+}
+
 void VixlJitDecodeVisitor::VisitUnallocated(const Instruction *instr) {
     Context()->Assembler().Emit(instr->GetInstructionBits());
 }
 
 void VixlJitDecodeVisitor::VisitUnimplemented(const Instruction *instr) {
+    if (IsLoadStoreUnprivileged(instr->GetInstructionBits())) {
+        // ldtr/sttr, vixl has no visitor for them
+        LoadStoreReg(Context(), instr->GetRt(), instr->GetRn());
+        return;
+    }
     Context()->Assembler().Emit(instr->GetInstructionBits());
 }
 
@@ -8,17 +8,30 @@
 #include <svm/arm64/svm_jit_context.h>
 #include <stack>
 
+// every load/store group, guest addresses have to be translated on mmu guests.
+// ldtr/sttr come through VisitUnimplemented
 #define VISITOR_LIST_THAT_INTEREST(V)     \
+  V(AtomicMemory)                       \
   V(CompareBranch)                      \
   V(ConditionalBranch)                  \
   V(Exception)                          \
   V(LoadLiteral)                        \
+  V(LoadStoreExclusive)                 \
+  V(LoadStorePAC)                       \
+  V(LoadStorePairNonTemporal)           \
   V(LoadStorePairOffset)                \
   V(LoadStorePairPostIndex)             \
   V(LoadStorePairPreIndex)              \
   V(LoadStorePostIndex)                 \
   V(LoadStorePreIndex)                  \
+  V(LoadStoreRCpcUnscaledOffset)        \
+  V(LoadStoreRegisterOffset)            \
+  V(LoadStoreUnscaledOffset)            \
   V(LoadStoreUnsignedOffset)            \
+  V(NEONLoadStoreMultiStruct)           \
+  V(NEONLoadStoreMultiStructPostIndex)  \
+  V(NEONLoadStoreSingleStruct)          \
+  V(NEONLoadStoreSingleStructPostIndex) \
   V(PCRelAddressing)                    \
   V(System)                             \
   V(TestBranch)                         \
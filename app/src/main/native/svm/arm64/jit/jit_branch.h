@@ -54,7 +54,12 @@ namespace Jit::A64 {
         }
 
         __ Bind(branch);
-        context->Forward(target);
+        if (!(flags & Link) && context->InBlock(target)) {
+            // small loop, stay in translated code
+            context->Backward(target);
+        } else {
+            context->Forward(target);
+        }
     }
 
     template <unsigned flags = 0>
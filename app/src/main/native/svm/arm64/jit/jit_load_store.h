@@ -15,6 +15,46 @@ using namespace SVM::A64;
 namespace Jit::A64 {
 #define __ masm_.
 
+    // guest rn -> host address for mmu guests, must be constructed before the RegisterGuard
+    // so that guarded registers never alias the temps
+    class HostAddressGuard {
+    public:
+        explicit HostAddressGuard(ContextA64 context) : context_(context) {
+            if (context->MmuEnabled()) {
+                host_ = context->GetRegisterAlloc().AcquireTempX();
+                tmp_ = context->GetRegisterAlloc().AcquireTempX();
+            }
+        }
+
+        ~HostAddressGuard() {
+            if (host_.IsValid()) {
+                context_->GetRegisterAlloc().ReleaseTempX(tmp_);
+                context_->GetRegisterAlloc().ReleaseTempX(host_);
+            }
+        }
+
+        // offset: what the instruction adds to rn before the access
+        const Register &Translate(const Register &rn, s64 offset, bool write) {
+            if (!host_.IsValid()) {
+                return rn;
+            }
+            context_->HostAddress(host_, rn, tmp_, offset, write);
+            return host_;
+        }
+
+        // the instruction updated the host copy, redo it on the guest register
+        void WriteBack(const Register &rn, s64 offset) {
+            if (host_.IsValid()) {
+                context_->AddImmediate(rn, rn, offset);
+            }
+        }
+
+    private:
+        ContextA64 context_;
+        Register host_{NoReg};
+        Register tmp_{NoReg};
+    };
+
     template<bool align_page = false>
     void Addressing(ContextA64 context, u8 rd, s64 offset) {
 
@@ -38,35 +78,36 @@ namespace Jit::A64 {
         auto &reg_alloc = context->GetRegisterAlloc();
         VAddr addr = context->PC() + offset;
 
+        HostAddressGuard host_address(context);
         auto tmp = reg_alloc.AcquireTempX();
 
         __ Mov(tmp, addr);
-        context->LookupPageTable(tmp, addr);
+        const auto &host_addr = host_address.Translate(tmp, 0, false);
 
         if constexpr (flags & Float) {
             auto rt_v = context->GetVRegister(rt);
             if constexpr (sizeof(T) == 16) {
-                __ Ldr(rt_v.Q(), MemOperand(tmp));
+                __ Ldr(rt_v.Q(), MemOperand(host_addr));
             } else if constexpr (sizeof(T) == 8) {
-                __ Ldr(rt_v.D(), MemOperand(tmp));
+                __ Ldr(rt_v.D(), MemOperand(host_addr));
             } else if constexpr (sizeof(T) == 4) {
-                __ Ldr(rt_v.S(), MemOperand(tmp));
+                __ Ldr(rt_v.S(), MemOperand(host_addr));
             } else {
                 __ Emit(context->Instr().raw);
             }
         } else if constexpr (flags & Prfm) {
-            __ Prfm(PrefetchOperation(context->Instr().Rt), MemOperand(tmp));
+            __ Prfm(PrefetchOperation(context->Instr().Rt), MemOperand(host_addr));
         } else if constexpr (flags & LoadSigned) {
             RegisterGuard guard(context, {context->GetXRegister(rt)});
             guard.Dirty();
-            __ Ldrsw(guard.Target(), MemOperand(tmp));
+            __ Ldrsw(guard.Target(), MemOperand(host_addr));
         } else {
             RegisterGuard guard(context, {context->GetXRegister(rt)});
             guard.Dirty();
             if constexpr (sizeof(T) == 8) {
-                __ Ldr(guard.Target(), MemOperand(tmp));
+                __ Ldr(guard.Target(), MemOperand(host_addr));
             } else if constexpr (sizeof(T) == 4) {
-                __ Ldr(guard.Target().W(), MemOperand(tmp));
+                __ Ldr(guard.Target().W(), MemOperand(host_addr));
             } else {
                 __ Emit(context->Instr().raw);
             }
@@ -75,45 +116,209 @@ namespace Jit::A64 {
         reg_alloc.ReleaseTempX(tmp);
     }
 
+    // also ldur/stur, ldtr/sttr and the rcpc ldapur/stlur
     template<unsigned flags = 0, typename T = u64>
     void LoadStoreReg(ContextA64 context, u8 rt, u8 rn) {
-        RegisterGuard guard(context, {context->GetXRegister(rn, true), context->GetXRegister(rt)});
-
         auto instr = context->Instr();
+        // rt of a simd access is a v register
+        bool simd = ((instr.raw >> 26) & 1) != 0;
+        u32 opc = (instr.raw >> 22) & 3;
+        // rcpc forms are 011 at [29:27]
+        bool rcpc = ((instr.raw >> 27) & 7) != 7;
+        // rt of prfm/prfum is the prefetch operation
+        bool prefetch = !simd && !rcpc && instr.size == 3 && opc == 2;
+        bool load = simd ? (opc & 1) : opc != 0;
+
+        s64 offset;
+        s64 write_back_offset = 0;
+        if constexpr (flags & WriteBack) {
+            write_back_offset = SignExtend<s64, 9>(instr.imm9);
+            offset = (flags & Decode::A64::PostIndex) ? 0 : write_back_offset;
+        } else if (!rcpc && ((instr.raw >> 24) & 1)) {
+            u32 scale = (simd && (opc & 2)) ? 4 : instr.size;
+            offset = static_cast<s64>(instr.dp_imm) << scale;
+        } else {
+            // unscaled and unprivileged
+            offset = SignExtend<s64, 9>(instr.imm9);
+        }
+
+        HostAddressGuard host_address(context);
+        RegisterGuard guard(context, {context->GetXRegister(rn, true),
+                                      simd || prefetch ? NoReg : context->GetXRegister(rt)});
 
         if constexpr (flags & WriteBack) {
             guard.Dirty(0);
         }
 
-        // load
-        if (instr.L == 1) {
+        if (load && !prefetch) {
             guard.Dirty(1);
         }
 
-        instr.Rn = guard.Target(0).RealCode();
-        instr.Rt = guard.Target(0).RealCode();
+        instr.Rn = host_address.Translate(guard.Target(0), offset, !load).RealCode();
+        if (!simd && !prefetch) {
+            instr.Rt = guard.Target(1).RealCode();
+        }
 
         context->Assembler().Emit(instr.raw);
+
+        if constexpr (flags & WriteBack) {
+            host_address.WriteBack(guard.Target(0), write_back_offset);
+        }
     }
 
-    template<unsigned flags = 0, typename T = u64>
-    void LoadStorePair(ContextA64 context, u8 rt, u8 rt2, u8 rn) {
+    // [xn, xm{, extend {amount}}]: with an mmu the guest address is summed up first,
+    // the host instruction then is the unsigned offset form at offset 0
+    void LoadStoreRegOffset(ContextA64 context, Instructions::A64::AArch64Inst instr) {
+        auto &masm_ = context->Assembler();
+        auto &reg_alloc = context->GetRegisterAlloc();
+        bool simd = ((instr.raw >> 26) & 1) != 0;
+        u32 opc = (instr.raw >> 22) & 3;
+        bool prefetch = !simd && instr.size == 3 && opc == 2;
+        bool load = simd ? (opc & 1) : opc != 0;
+        u32 scale = (simd && (opc & 2)) ? 4 : instr.size;
+        auto extend = static_cast<Extend>(instr.option);
+        u32 amount = ((instr.raw >> 12) & 1) ? scale : 0;
+
+        HostAddressGuard host_address(context);
+        Register va = context->MmuEnabled() ? reg_alloc.AcquireTempX() : NoReg;
+        {
+            RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                          context->GetXRegister(instr.Rm),
+                                          simd || prefetch ? NoReg : context->GetXRegister(instr.Rt)});
+            if (load && !prefetch) {
+                guard.Dirty(2);
+            }
+            if (va.IsValid()) {
+                // uxtw and sxtw take wm
+                Register rm = guard.Target(1);
+                if (!(instr.option & 1)) {
+                    rm = rm.W();
+                }
+                __ Add(va, guard.Target(0), Operand(rm, extend, amount));
+                instr.raw = (instr.raw & ~((u32(3) << 24) | (u32(0xfff) << 10))) | (u32(1) << 24);
+                instr.Rn = host_address.Translate(va, 0, !load).RealCode();
+            } else {
+                instr.Rn = guard.Target(0).RealCode();
+                instr.Rm = guard.Target(1).RealCode();
+            }
+            if (!simd && !prefetch) {
+                instr.Rt = guard.Target(2).RealCode();
+            }
+            __ Emit(instr.raw);
+        }
+        if (va.IsValid()) {
+            reg_alloc.ReleaseTempX(va);
+        }
+    }
 
-        std::vector<Register> effect_regs;
+    // ldadd/swp and friends and ldapr, one host atomic on the host address
+    void LoadStoreAtomic(ContextA64 context, Instructions::A64::AArch64Inst instr) {
+        // o3 is only set by ldapr
+        bool load = ((instr.raw >> 15) & 1) != 0;
 
-        if constexpr (flags & Float) {
-            effect_regs = {context->GetXRegister(rn, true)};
-        } else {
-            effect_regs = {context->GetXRegister(rn, true), context->GetXRegister(rt), context->GetXRegister(rt2)};
-        }
+        HostAddressGuard host_address(context);
+        RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                      context->GetXRegister(instr.Rs),
+                                      context->GetXRegister(instr.Rt)});
+        guard.Dirty(2);
 
-        RegisterGuard guard(context, effect_regs);
+        instr.Rn = host_address.Translate(guard.Target(0), 0, !load).RealCode();
+        instr.Rs = guard.Target(1).RealCode();
+        instr.Rt = guard.Target(2).RealCode();
 
-        if constexpr (flags & WriteBack) {
+        context->Assembler().Emit(instr.raw);
+    }
+
+    // bytes ld1-4/st1-4 move, the immediate of their post index form
+    constexpr u32 NEONTransferSize(u32 raw, bool single) {
+        if (!single) {
+            u32 regs = 1;
+            switch ((raw >> 12) & 0xf) {
+                case 0b0000:
+                case 0b0010:
+                    regs = 4;
+                    break;
+                case 0b0100:
+                case 0b0110:
+                    regs = 3;
+                    break;
+                case 0b1000:
+                case 0b1010:
+                    regs = 2;
+                    break;
+                default:
+                    break;
+            }
+            return regs * (((raw >> 30) & 1) ? 16 : 8);
+        }
+        u32 opcode = (raw >> 13) & 7;
+        u32 size = (raw >> 10) & 3;
+        u32 selem = (((opcode & 1) << 1) | ((raw >> 21) & 1)) + 1;
+        u32 scale = opcode >> 1;
+        if (scale == 3) {
+            // ld1r-ld4r
+            scale = size;
+        } else if (scale == 2 && (size & 1)) {
+            scale = 3;
+        }
+        return selem << scale;
+    }
+
+    // ld1-4/st1-4, transfer registers are v registers and only the address is translated.
+    // with an mmu the host form has no post index, the guest rn is updated afterwards
+    void NEONLoadStore(ContextA64 context, Instructions::A64::AArch64Inst instr, bool single) {
+        auto &masm_ = context->Assembler();
+        bool post_index = ((instr.raw >> 23) & 1) != 0;
+        bool load = ((instr.raw >> 22) & 1) != 0;
+        bool imm_post_index = post_index && instr.Rm == 31;
+        u32 transfer_size = NEONTransferSize(instr.raw, single);
+
+        HostAddressGuard host_address(context);
+        RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                      post_index && !imm_post_index ? context->GetXRegister(instr.Rm) : NoReg});
+        if (post_index) {
             guard.Dirty(0);
         }
 
+        if (!context->MmuEnabled()) {
+            instr.Rn = guard.Target(0).RealCode();
+            if (post_index && !imm_post_index) {
+                instr.Rm = guard.Target(1).RealCode();
+            }
+            __ Emit(instr.raw);
+            return;
+        }
+
+        instr.Rn = host_address.Translate(guard.Target(0), 0, !load).RealCode();
+        instr.raw &= ~((u32(1) << 23) | (u32(0x1f) << 16));
+        __ Emit(instr.raw);
+
+        if (imm_post_index) {
+            host_address.WriteBack(guard.Target(0), transfer_size);
+        } else if (post_index) {
+            __ Add(guard.Target(0), guard.Target(0), guard.Target(1));
+        }
+    }
+
+    template<unsigned flags = 0, typename T = u64>
+    void LoadStorePair(ContextA64 context, u8 rt, u8 rt2, u8 rn) {
         auto instr = context->Instr();
+        u32 opc = instr.raw >> 30;
+        u32 elem_size = (flags & Float) ? (4U << opc) : ((opc & 2) ? 8 : 4);
+        s64 write_back_offset = SignExtend<s64, 7>(instr.imm7) * elem_size;
+        s64 offset = (flags & Decode::A64::PostIndex) ? 0 : write_back_offset;
+
+        // fp transfer registers are not guarded
+        constexpr bool guard_rt = !(flags & Float);
+
+        HostAddressGuard host_address(context);
+        RegisterGuard guard(context, {context->GetXRegister(rn, true),
+                                      guard_rt ? context->GetXRegister(rt) : NoReg,
+                                      guard_rt ? context->GetXRegister(rt2) : NoReg});
+
+        if constexpr (flags & WriteBack) {
+            guard.Dirty(0);
+        }
 
         // load
         if (instr.L == 1 && !(flags & Float)) {
@@ -121,7 +326,7 @@ namespace Jit::A64 {
             guard.Dirty(2);
         }
 
-        instr.Rn = guard.Target(0).RealCode();
+        instr.Rn = host_address.Translate(guard.Target(0), offset, instr.L == 0).RealCode();
 
         if constexpr (!(flags & Float)) {
             instr.Rt = guard.Target(1).RealCode();
@@ -129,8 +334,313 @@ namespace Jit::A64 {
         }
 
         context->Assembler().Emit(instr.raw);
+
+        if constexpr (flags & WriteBack) {
+            host_address.WriteBack(guard.Target(0), write_back_offset);
+        }
+    }
+
+
+    // ldar/stlr/cas, and exclusives of guests with a linear host address:
+    // the host instruction itself on the host address, the host monitor does the work
+    void LoadStoreOrdered(ContextA64 context, Instructions::A64::AArch64Inst instr) {
+        u32 size = instr.raw >> 30;
+        bool o2 = ((instr.raw >> 23) & 1) != 0;
+        bool load = ((instr.raw >> 22) & 1) != 0;
+        bool o1 = ((instr.raw >> 21) & 1) != 0;
+        // register pairs of casp can not be moved to temps, only rn is translated
+        bool casp = !o2 && o1 && size < 2;
+        bool cas = o2 && o1;
+        bool pair = !o2 && o1 && !casp;
+        // status of stxr/stxp, compare value of cas
+        bool use_rs = (!o2 && !load && !casp) || cas;
+
+        // casp reads and writes rs, rs + 1, rt, rt + 1 in place,
+        // keep the address temps off them
+        auto &reg_alloc = context->GetRegisterAlloc();
+        const Register *casp_regs[4]{};
+        bool casp_used[4]{};
+        if (casp) {
+            u8 codes[4]{static_cast<u8>(instr.Rs), static_cast<u8>(instr.Rs + 1),
+                        static_cast<u8>(instr.Rt), static_cast<u8>(instr.Rt + 1)};
+            for (int i = 0; i < 4; ++i) {
+                casp_regs[i] = &context->GetXRegister(codes[i]);
+                casp_used[i] = reg_alloc.InUsed(*casp_regs[i]);
+                reg_alloc.MarkInUsed(*casp_regs[i]);
+            }
+        }
+
+        {
+            HostAddressGuard host_address(context);
+            RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                          casp ? NoReg : context->GetXRegister(instr.Rt),
+                                          pair ? context->GetXRegister(instr.Rt2) : NoReg,
+                                          use_rs ? context->GetXRegister(instr.Rs) : NoReg});
+
+            if (load && !cas && !casp) {
+                guard.Dirty(1);
+                guard.Dirty(2);
+            }
+            if (use_rs) {
+                guard.Dirty(3);
+            }
+
+            instr.Rn = host_address.Translate(guard.Target(0), 0, !load || cas || casp).RealCode();
+            if (!casp) {
+                instr.Rt = guard.Target(1).RealCode();
+            }
+            if (pair) {
+                instr.Rt2 = guard.Target(2).RealCode();
+            }
+            if (use_rs) {
+                instr.Rs = guard.Target(3).RealCode();
+            }
+
+            context->Assembler().Emit(instr.raw);
+        }
+
+        if (casp) {
+            for (int i = 0; i < 4; ++i) {
+                reg_alloc.MarkInUsed(*casp_regs[i], casp_used[i]);
+            }
+        }
+    }
+
+    // page walks between ldxr and stxr would clear the host monitor, so ldxr only records
+    // address, global monitor tag and value in CPUContext::exclusive, see StoreExclusive
+    template<unsigned flags = 0>
+    void LoadExclusive(ContextA64 context, Instructions::A64::AArch64Inst instr) {
+        if (!context->EmulateExclusive()) {
+            LoadStoreOrdered(context, instr);
+            return;
+        }
+        auto &masm_ = context->Assembler();
+        auto &reg_alloc = context->GetRegisterAlloc();
+        auto ctx = reg_alloc.ContextPtr();
+        u32 size = instr.raw >> 30;
+        bool pair = ((instr.raw >> 21) & 1) != 0;
+
+        HostAddressGuard host_address(context);
+        auto va = reg_alloc.AcquireTempX();
+        auto tmp = reg_alloc.AcquireTempX();
+        {
+            RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                          context->GetXRegister(instr.Rt),
+                                          pair ? context->GetXRegister(instr.Rt2) : NoReg});
+            guard.Dirty(1);
+            guard.Dirty(2);
+
+            const auto &host = host_address.Translate(guard.Target(0), 0, false);
+            context->AddImmediate(va, guard.Target(0), 0);
+            __ Str(va, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.addr)));
+            context->ExclusiveEntry(va, va, tmp);
+            __ Str(va, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.tag_entry)));
+            // tag before value, a store exclusive in between is seen by the tag
+            __ Ldar(tmp, MemOperand(va));
+            __ Str(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.tag)));
+
+            const auto &rt = guard.Target(1);
+            if (pair && size == 3) {
+                __ Ldp(va, tmp, MemOperand(host));
+                __ Stp(va, tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.value)));
+                if (!rt.IsZero()) {
+                    __ Mov(rt, va);
+                }
+                if (!guard.Target(2).IsZero()) {
+                    __ Mov(guard.Target(2), tmp);
+                }
+            } else if (pair) {
+                // two words are compared as one doubleword
+                __ Ldr(tmp, MemOperand(host));
+                __ Str(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.value)));
+                if (!rt.IsZero()) {
+                    __ Mov(rt.W(), tmp.W());
+                }
+                if (!guard.Target(2).IsZero()) {
+                    __ Lsr(guard.Target(2), tmp, 32);
+                }
+            } else {
+                constexpr bool acquire = (flags & Acquire) != 0;
+                switch (size) {
+                    case 0:
+                        acquire ? __ Ldarb(tmp.W(), MemOperand(host)) : __ Ldrb(tmp.W(), MemOperand(host));
+                        break;
+                    case 1:
+                        acquire ? __ Ldarh(tmp.W(), MemOperand(host)) : __ Ldrh(tmp.W(), MemOperand(host));
+                        break;
+                    case 2:
+                        acquire ? __ Ldar(tmp.W(), MemOperand(host)) : __ Ldr(tmp.W(), MemOperand(host));
+                        break;
+                    default:
+                        acquire ? __ Ldar(tmp, MemOperand(host)) : __ Ldr(tmp, MemOperand(host));
+                        break;
+                }
+                __ Str(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.value)));
+                if (!rt.IsZero()) {
+                    __ Mov(rt, tmp);
+                }
+            }
+            if (pair && (flags & Acquire)) {
+                __ Dmb(InnerShareable, BarrierReads);
+            }
+        }
+        reg_alloc.ReleaseTempX(tmp);
+        reg_alloc.ReleaseTempX(va);
+    }
+
+    // stxr succeeds if the monitor is still on rn, no other core claimed the global monitor
+    // entry since ldxr, and memory still holds what ldxr read; both the claim and the
+    // compare and swap are host exclusive loops with no memory access inside
+    template<unsigned flags = 0>
+    void StoreExclusive(ContextA64 context, Instructions::A64::AArch64Inst instr) {
+        if (!context->EmulateExclusive()) {
+            LoadStoreOrdered(context, instr);
+            return;
+        }
+        auto &masm_ = context->Assembler();
+        auto &reg_alloc = context->GetRegisterAlloc();
+        auto &label_alloc = context->GetLabelAlloc();
+        auto ctx = reg_alloc.ContextPtr();
+        u32 size = instr.raw >> 30;
+        bool pair = ((instr.raw >> 21) & 1) != 0;
+        bool pair_x = pair && size == 3;
+        constexpr bool release = (flags & Release) != 0;
+        Label *retry_claim = label_alloc.AllocLabel();
+        Label *retry_swap = label_alloc.AllocLabel();
+        Label *fail_clrex = label_alloc.AllocLabel();
+        Label *fail = label_alloc.AllocLabel();
+        Label *end = label_alloc.AllocLabel();
+
+        HostAddressGuard host_address(context);
+        auto tmp = reg_alloc.AcquireTempX();
+        auto expected = reg_alloc.AcquireTempX();
+        auto old = reg_alloc.AcquireTempX();
+        auto status = reg_alloc.AcquireTempX();
+        Register old2 = pair_x ? reg_alloc.AcquireTempX() : NoReg;
+        {
+            RegisterGuard guard(context, {context->GetXRegister(instr.Rn, true),
+                                          context->GetXRegister(instr.Rs),
+                                          context->GetXRegister(instr.Rt),
+                                          pair ? context->GetXRegister(instr.Rt2) : NoReg});
+            guard.Dirty(1);
+
+            const auto &host = host_address.Translate(guard.Target(0), 0, true);
+            const auto &rs = guard.Target(1);
+            const auto &rt = guard.Target(2);
+
+            context->AddImmediate(tmp, guard.Target(0), 0);
+            __ Ldr(expected, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.addr)));
+            // guest flags live in host nzcv, no cmp
+            __ Sub(tmp, tmp, expected);
+            __ Cbnz(tmp, fail);
+
+            // claim the global monitor entry
+            __ Ldr(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.tag_entry)));
+            __ Ldr(expected, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.tag)));
+            __ Bind(retry_claim);
+            __ Ldaxr(old, MemOperand(tmp));
+            __ Sub(old, old, expected);
+            __ Cbnz(old, fail_clrex);
+            __ Add(old, expected, 1);
+            __ Stxr(status.W(), old, MemOperand(tmp));
+            __ Cbnz(status.W(), retry_claim);
+
+            // swap in the new value if nobody changed the old one
+            __ Ldr(expected, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.value)));
+            if (pair_x) {
+                __ Ldr(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.value) + 8));
+            }
+            __ Bind(retry_swap);
+            if (pair_x) {
+                const auto &rt2 = guard.Target(3);
+                __ Ldxp(old, old2, MemOperand(host));
+                __ Sub(old, old, expected);
+                __ Sub(old2, old2, tmp);
+                __ Orr(old, old, old2);
+                __ Cbnz(old, fail_clrex);
+                release ? __ Stlxp(status.W(), rt, rt2, MemOperand(host))
+                        : __ Stxp(status.W(), rt, rt2, MemOperand(host));
+            } else if (pair) {
+                __ Ldxr(old, MemOperand(host));
+                __ Sub(old, old, expected);
+                __ Cbnz(old, fail_clrex);
+                __ Mov(old.W(), rt.W());
+                __ Bfi(old, guard.Target(3), 32, 32);
+                release ? __ Stlxr(status.W(), old, MemOperand(host))
+                        : __ Stxr(status.W(), old, MemOperand(host));
+            } else {
+                switch (size) {
+                    case 0:
+                        __ Ldxrb(old.W(), MemOperand(host));
+                        break;
+                    case 1:
+                        __ Ldxrh(old.W(), MemOperand(host));
+                        break;
+                    case 2:
+                        __ Ldxr(old.W(), MemOperand(host));
+                        break;
+                    default:
+                        __ Ldxr(old, MemOperand(host));
+                        break;
+                }
+                __ Sub(old, old, expected);
+                __ Cbnz(old, fail_clrex);
+                switch (size) {
+                    case 0:
+                        release ? __ Stlxrb(status.W(), rt.W(), MemOperand(host))
+                                : __ Stxrb(status.W(), rt.W(), MemOperand(host));
+                        break;
+                    case 1:
+                        release ? __ Stlxrh(status.W(), rt.W(), MemOperand(host))
+                                : __ Stxrh(status.W(), rt.W(), MemOperand(host));
+                        break;
+                    case 2:
+                        release ? __ Stlxr(status.W(), rt.W(), MemOperand(host))
+                                : __ Stxr(status.W(), rt.W(), MemOperand(host));
+                        break;
+                    default:
+                        release ? __ Stlxr(status.W(), rt, MemOperand(host))
+                                : __ Stxr(status.W(), rt, MemOperand(host));
+                        break;
+                }
+            }
+            __ Cbnz(status.W(), retry_swap);
+            if (!rs.IsZero()) {
+                __ Mov(rs, 0);
+            }
+            __ B(end);
+            __ Bind(fail_clrex);
+            __ Clrex();
+            __ Bind(fail);
+            if (!rs.IsZero()) {
+                __ Mov(rs, 1);
+            }
+            __ Bind(end);
+            // the monitor is consumed either way
+            __ Mov(tmp, exclusive_none);
+            __ Str(tmp, MemOperand(ctx, OFFSET_OF(CPUContext, exclusive.addr)));
+        }
+        if (pair_x) {
+            reg_alloc.ReleaseTempX(old2);
+        }
+        reg_alloc.ReleaseTempX(status);
+        reg_alloc.ReleaseTempX(old);
+        reg_alloc.ReleaseTempX(expected);
+        reg_alloc.ReleaseTempX(tmp);
+    }
+
+    void ClearExclusive(ContextA64 context) {
+        auto &masm_ = context->Assembler();
+        if (!context->EmulateExclusive()) {
+            __ Clrex();
+            return;
+        }
+        auto &reg_alloc = context->GetRegisterAlloc();
+        auto tmp = reg_alloc.AcquireTempX();
+        __ Mov(tmp, exclusive_none);
+        __ Str(tmp, MemOperand(reg_alloc.ContextPtr(), OFFSET_OF(CPUContext, exclusive.addr)));
+        reg_alloc.ReleaseTempX(tmp);
     }
 
 #undef __
 }
-
@@ -4,6 +4,8 @@
 
 #include "svm_arm64.h"
 #include "block/code_find_table.h"
+#include <sys/mman.h>
+#include <base/log.h>
 
 using namespace SVM::A64;
 using namespace Jit;
@@ -14,7 +16,9 @@ Instance::Instance() {
             .context_reg = 30, // lr
             .forward_reg = 16,
             .protect_code = true,
-            .use_host_clock = true
+            .use_host_clock = true,
+            .tier_up_threshold = 1024,
+            .profile_l1 = false
     };
     mmu_config_ = {
             .enable = false,
@@ -22,7 +26,8 @@ Instance::Instance() {
             .page_bits = 12,
             .readable_bit = 0,
             .writable_bit = 1,
-            .executable_bit = 2
+            .executable_bit = 2,
+            .fastmem = true
     };
 }
 
@@ -35,7 +40,26 @@ void Instance::Initialize() {
     jit_manager_ = SharedPtr<JitManager>(new JitManager(SharedFrom(this)));
     jit_manager_->Initialize();
     if (mmu_config_.enable) {
-        mmu_ = SharedPtr<A64MMU>(new A64MMU(mmu_config_.addr_width, mmu_config_.page_bits));
+        mmu_ = SharedPtr<A64MMU>(new A64MMU(mmu_config_.page_bits, mmu_config_.addr_width, true));
+        if (mmu_config_.fastmem) {
+            fastmem_ = SharedPtr<FastMemory>(new FastMemory(mmu_config_.addr_width, mmu_config_.page_bits));
+            if (fastmem_->Valid()) {
+                fastmem_->SetFaultCallback([this](VAddr vaddr, size_t size, bool write, void *data) -> bool {
+                    return FastMemFault(vaddr, size, write, data);
+                });
+            } else {
+                LOGE("Fastmem unavailable, use page table");
+                fastmem_ = nullptr;
+            }
+        }
+        if (!fastmem_ && mmu_->GetLevel() > 1) {
+            block_stubs_ = SharedPtr<BlockStubs>(new BlockStubs(SharedFrom(this)));
+            global_stubs_->SetPageLookup(block_stubs_->GetPageLookup());
+        }
+        if (!fastmem_) {
+            // page walks between ldxr and stxr would break host exclusives
+            exclusive_monitor_ = SharedPtr<ExclusiveMonitor>(new ExclusiveMonitor());
+        }
     }
     isolate_cache_blocks_.push_back(AllocCacheBlock(BLOCK_SIZE_A64));
 }
@@ -72,6 +96,142 @@ const SharedPtr<JitManager> &Instance::GetJitManager() const {
     return jit_manager_;
 }
 
+const SharedPtr<Memory::FastMemory> &Instance::GetFastMem() const {
+    return fastmem_;
+}
+
+const SharedPtr<Memory::ExclusiveMonitor> &Instance::GetExclusiveMonitor() const {
+    return exclusive_monitor_;
+}
+
+// spec pages stay inaccessible in the mirror so that the access faults into the hooks
+static void FastMemAccess(u32 attrs, bool &readable, bool &writable) {
+    readable = (attrs & PageAttrs::Read) && !(attrs & PageAttrs::ReadSpec);
+    writable = (attrs & PageAttrs::Write) && !(attrs & PageAttrs::WriteSpec);
+}
+
+VAddr Instance::MapGuestMemory(VAddr vaddr, size_t size, u32 attrs) {
+    assert(mmu_);
+    auto page_size = mmu_->page_size_;
+    assert(vaddr % page_size == 0);
+    size = AlignUp(size, page_size);
+    VAddr host;
+    if (fastmem_) {
+        bool readable, writable;
+        FastMemAccess(attrs, readable, writable);
+        host = fastmem_->Map(vaddr, size, readable, writable);
+    } else {
+        host = reinterpret_cast<VAddr>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        assert(reinterpret_cast<void *>(host) != MAP_FAILED);
+        if (mmu_->BlockSize() && size >= mmu_->BlockSize()) {
+            madvise(reinterpret_cast<void *>(host), size, MADV_HUGEPAGE);
+        }
+    }
+    // host range is contiguous, aligned spans go in as blocks
+    PTE first{};
+    first.index_ = host >> mmu_->page_bits_;
+    first.attrs_ = attrs;
+    mmu_->MapLinear(vaddr, size, first);
+    return host;
+}
+
+bool Instance::FastMemFault(VAddr vaddr, size_t size, bool write, void *data) {
+    if (mmu_->CallMemoryHooks(vaddr, size, write, data)) {
+        return true;
+    }
+    auto pte = mmu_->GetPage(AlignDown(vaddr, mmu_->page_size_));
+    if (pte && (write ? mmu_->PageWritable(*pte) : mmu_->PageReadable(*pte))) {
+        // hooks only watched, do the access behind the protection
+        return fastmem_->ForceAccess(vaddr, data, size, write);
+    }
+    if (write) {
+        mmu_->InvalidWrite(vaddr, size);
+    } else {
+        mmu_->InvalidRead(vaddr, size);
+    }
+    return true;
+}
+
+void Instance::SyncFastMem(VAddr vaddr, size_t size) {
+    if (!fastmem_) {
+        return;
+    }
+    auto page_size = mmu_->page_size_;
+    for (VAddr page = vaddr; page < vaddr + size; page += page_size) {
+        auto pte = mmu_->GetPage(page);
+        if (!pte || *pte == PTE{}) {
+            continue;
+        }
+        bool readable, writable;
+        FastMemAccess(pte->attrs_, readable, writable);
+        fastmem_->Protect(page, page_size, readable, writable);
+    }
+}
+
+u32 Instance::AddMemoryHook(VAddr vaddr, size_t size, bool read, bool write, const MemoryHook &hook) {
+    assert(mmu_);
+    auto id = mmu_->AddMemoryHook(vaddr, size, read, write, hook);
+    auto start = AlignDown(vaddr, mmu_->page_size_);
+    SyncFastMem(start, AlignUp(vaddr + size, mmu_->page_size_) - start);
+    return id;
+}
+
+void Instance::RemoveMemoryHook(u32 id) {
+    assert(mmu_);
+    auto range = mmu_->RemoveMemoryHook(id);
+    SyncFastMem(range.first, range.second);
+}
+
+void Instance::ProtectGuestMemory(VAddr vaddr, size_t size, u32 attrs) {
+    assert(mmu_);
+    size = AlignUp(size, mmu_->page_size_);
+    mmu_->ProtectRange(vaddr, size, [attrs](PTE &pte) {
+        // hooks own the spec bits
+        pte.attrs_ = attrs | (pte.attrs_ & (PageAttrs::ReadSpec | PageAttrs::WriteSpec));
+    });
+    SyncFastMem(vaddr, size);
+}
+
+void Instance::UnmapGuestMemory(VAddr vaddr, size_t size) {
+    assert(mmu_);
+    auto page_size = mmu_->page_size_;
+    size = AlignUp(size, page_size);
+    std::vector<std::pair<VAddr, size_t>> host_pages;
+    if (fastmem_) {
+        fastmem_->Unmap(vaddr, size);
+    } else {
+        // host pages were mapped by MapGuestMemory
+        for (VAddr offset = 0; offset < size; offset += page_size) {
+            auto pte = mmu_->GetPage(vaddr + offset);
+            if (pte && *pte != PTE{}) {
+                host_pages.emplace_back(mmu_->GetPageStart(*pte), page_size);
+            }
+        }
+    }
+    // shoots the range down, other threads may still hold it in their tlb or l1 until they ack
+    mmu_->UnmapRange(vaddr, size);
+    if (!host_pages.empty()) {
+        std::lock_guard guard(unmapped_lock_);
+        unmapped_host_.insert(unmapped_host_.end(), host_pages.begin(), host_pages.end());
+    }
+    ReleaseUnmappedMemory();
+}
+
+void Instance::ReleaseUnmappedMemory() {
+    // page tables unlinked by the unmap wait for the same ack
+    mmu_->ReleaseRetiredTables();
+    std::lock_guard guard(unmapped_lock_);
+    // pages queued so far were shot down before, a full ack covers all of them
+    if (unmapped_host_.empty() || !mmu_->ShootdownAcked()) {
+        return;
+    }
+    for (auto &[host, size] : unmapped_host_) {
+        munmap(reinterpret_cast<void *>(host), size);
+    }
+    unmapped_host_.clear();
+}
+
 void Instance::RegisterCodeSet(const std::shared_ptr<Jit::CodeSet> &code_set) {
     std::unique_lock guard(code_set_lock_);
     auto code_start = code_set->CodeSegment().addr;
@@ -110,18 +270,27 @@ CodeBlock *Instance::PeekCacheBlock(VAddr pc) {
     return it->second;
 }
 
+CodeBlock *Instance::SpareCacheBlock(CodeBlock *full) {
+    std::unique_lock guard(code_set_lock_);
+    for (auto block : isolate_cache_blocks_) {
+        if (block != full && !block->Full()) {
+            return block;
+        }
+    }
+    auto block = AllocCacheBlock(BLOCK_SIZE_A64);
+    isolate_cache_blocks_.push_back(block);
+    return block;
+}
+
 void Instance::ProtectCodeSegment(VAddr start, VAddr end) {
     //TODO signal handler
 }
 
 bool Instance::Executable(VAddr vaddr) {
     if (mmu_) {
-        auto pte = mmu_->GetPage(vaddr & mmu_->page_mask_);
-        if (pte) {
-            return true;
-        } else {
-            return false;
-        }
+        // same check as the translator fetch, see JitContext::FetchInstr
+        auto pte = mmu_->GetPage(vaddr & ~mmu_->page_mask_);
+        return pte && mmu_->PageExecutable(*pte);
     } else {
         return vaddr > PAGE_SIZE;
     }
@@ -5,7 +5,10 @@
 
 #include <base/marcos.h>
 #include "svm_global_stubs.h"
+#include "svm_block_stubs.h"
 #include "svm_mmu.h"
+#include "memory/fastmem.h"
+#include "memory/exclusive_monitor.h"
 #include "svm_jit_manager.h"
 #include "block/host_code_block.h"
 #include "block/code_set.h"
@@ -27,6 +30,10 @@ namespace SVM::A64 {
         u8 jit_thread_count;
         bool protect_code;
         bool use_host_clock;
+        // block entries before recompiling in optimized tier (ir backend), 0 = no tier up
+        u16 tier_up_threshold;
+        // count l1 dcache hits per block, see JitManager::DumpL1Stats
+        bool profile_l1;
     };
 
     struct MmuConfig {
@@ -36,6 +43,8 @@ namespace SVM::A64 {
         u8 readable_bit;
         u8 writable_bit;
         u8 executable_bit;
+        // mirror guest space into one host reservation, falls back to page table walk
+        bool fastmem;
     };
 
     class Instance : public BaseObject {
@@ -59,6 +68,28 @@ namespace SVM::A64 {
 
         const SharedPtr<JitManager> &GetJitManager() const;
 
+        // null if fastmem is off or the reservation failed
+        const SharedPtr<Memory::FastMemory> &GetFastMem() const;
+
+        // null if guest exclusives run natively on the host address
+        const SharedPtr<Memory::ExclusiveMonitor> &GetExclusiveMonitor() const;
+
+        // back [vaddr, vaddr + size) with fresh host memory, returns host address of vaddr
+        VAddr MapGuestMemory(VAddr vaddr, size_t size, u32 attrs);
+
+        void ProtectGuestMemory(VAddr vaddr, size_t size, u32 attrs);
+
+        // host pages are released once every guest thread dropped its tlb copies, see ReleaseUnmappedMemory
+        void UnmapGuestMemory(VAddr vaddr, size_t size);
+
+        // host pages of unmapped guest memory no guest thread can reach any more
+        void ReleaseUnmappedMemory();
+
+        // mmio callbacks and watchpoints, page granular in the page table
+        u32 AddMemoryHook(VAddr vaddr, size_t size, bool read, bool write, const MemoryHook &hook);
+
+        void RemoveMemoryHook(u32 id);
+
         CodeBlock *AllocCacheBlock(u32 size);
 
         void RegisterCodeSet(const std::shared_ptr<Jit::CodeSet> &code_set);
@@ -67,18 +98,29 @@ namespace SVM::A64 {
 
         CodeBlock *PeekCacheBlock(VAddr pc);
 
+        // an isolated block with room left other than full, a new one if there is none
+        CodeBlock *SpareCacheBlock(CodeBlock *full);
+
     private:
 
         bool Executable(VAddr vaddr);
 
         void ProtectCodeSegment(VAddr start, VAddr end);
 
+        bool FastMemFault(VAddr vaddr, size_t size, bool write, void *data);
+
+        // mirror protection follows the page table attrs
+        void SyncFastMem(VAddr vaddr, size_t size);
+
         JitConfig jit_config_;
         MmuConfig mmu_config_;
         SharedPtr<Jit::FindTable<VAddr>> code_find_table_;
         SharedPtr<GlobalStubs> global_stubs_;
         SharedPtr<JitManager> jit_manager_;
         SharedPtr<A64MMU> mmu_;
+        SharedPtr<Memory::FastMemory> fastmem_;
+        SharedPtr<Memory::ExclusiveMonitor> exclusive_monitor_;
+        SharedPtr<BlockStubs> block_stubs_;
 
         std::shared_mutex code_set_lock_;
         std::list<std::shared_ptr<Jit::CodeSet>> code_sets_;
@@ -88,6 +130,10 @@ namespace SVM::A64 {
         using IntervalCache = boost::icl::interval_map<VAddr, CodeBlock*>;
         using IntervalType = typename IntervalCache::interval_type;
         IntervalCache cache_blocks_addresses_;
+
+        std::mutex unmapped_lock_;
+        // host address, size
+        std::vector<std::pair<VAddr, size_t>> unmapped_host_;
     };
 
     class Core : public BaseObject {
@@ -2,6 +2,8 @@
 // Created by SwiftGan on 2020/8/22.
 //
 
+#include <asm/arm64/cpu_arm64.h>
+#include <platform/memory.h>
 #include "svm_block_stubs.h"
 #include "svm_arm64.h"
 
@@ -10,17 +12,96 @@
 using namespace CPU::A64;
 using namespace SVM::A64;
 
+constexpr static size_t block_stub_memory_size = PAGE_SIZE;
+
 BlockStubs::BlockStubs(const SharedPtr<Instance> &instance) : instance_{instance}, context_reg_{
 XRegister::GetXRegFromCode(instance->GetJitConfig().context_reg)}, forward_reg_{
 XRegister::GetXRegFromCode(instance->GetJitConfig().forward_reg)} {
+    code_memory_ = reinterpret_cast<VAddr>(Platform::MapExecutableMemory(block_stub_memory_size));
+    page_lookup_ = code_memory_;
     BuildPageLookup();
+    Platform::SealExecutableMemory(code_memory_, block_stub_memory_size);
+}
+
+BlockStubs::~BlockStubs() {
+    Platform::UnMapExecutableMemory(code_memory_, block_stub_memory_size);
+}
+
+VAddr BlockStubs::GetPageLookup() const {
+    return page_lookup_;
+}
 
+void BlockStubs::EmitPageWalk(MacroAssembler &masm_, A64MMU *mmu, const Register &context,
+                              const Register &pte, const Register &va, const Register &tmp,
+                              const Register &tlb_entry) {
+    Label not_mapped;
+    Label block;
+    Label refill;
+    Label end;
+    auto level = mmu->GetLevel();
+    auto pte_bits = mmu->GetPteBits();
+    auto page_bits = mmu->GetPageBits();
+    bool has_block = mmu->BlockSize() != 0;
+    __ Ldr(pte, MemOperand(context, OFFSET_CTX_A64_PAGE_TABLE));
+    for (int i = 0; i < level; ++i) {
+        __ Ubfx(tmp, va, page_bits + pte_bits * (level - i - 1), pte_bits);
+        __ Ldr(pte, MemOperand(pte, tmp, LSL, 3));
+        if (i < level - 1) {
+            // next level table not allocated
+            __ Cbz(pte, &not_mapped);
+        }
+        if (has_block && i == level - 2) {
+            __ Tbnz(pte, BLOCK_BITS, &block);
+        }
+    }
+    __ Cbz(pte, &end);
+    __ Bind(&refill);
+    // tlb entry = {page index, pte}
+    __ Lsr(tmp, va, page_bits);
+    __ Stp(tmp, pte, MemOperand(tlb_entry));
+    __ B(&end);
+    if (has_block) {
+        // pte of the 4K page inside the block
+        __ Bind(&block);
+        __ Bic(pte, pte, PageAttrs::Block);
+        __ Ubfx(tmp, va, page_bits, pte_bits);
+        __ Add(pte, pte, Operand(tmp, LSL, page_bits));
+        __ B(&refill);
+    }
+    __ Bind(&not_mapped);
+    __ Mov(pte, 0);
+    __ Bind(&end);
 }
 
 void BlockStubs::BuildPageLookup() {
     MacroAssembler masm_;
+    auto mmu = instance_->GetMmu().get();
+    auto scratch = OFFSET_OF(CPUContext, page_lookup_scratch);
 
-    if (context_reg_.RealCode() == lr.RealCode()) {
-    }
+    // guest registers are live here, spill to our own slots
+    __ Stp(x0, x1, MemOperand(context_reg_, scratch));
+    __ Stp(x2, x3, MemOperand(context_reg_, scratch + 16));
+
+    __ Ldr(x0, MemOperand(context_reg_, OFFSET_CTX_A64_QUERY_PAGE));
+    // x3 = tlb entry of va
+    __ Ubfx(x3, x0, mmu->GetPageBits(), mmu->TLBBits());
+    __ Ldr(x1, MemOperand(context_reg_, OFFSET_CTX_A64_TLB));
+    __ Add(x3, x1, Operand(x3, LSL, 4));
+    EmitPageWalk(masm_, mmu, context_reg_, x1, x0, x2, x3);
+    __ Str(x1, MemOperand(context_reg_, OFFSET_OF(CPUContext, query_pte)));
+
+    __ Ldp(x0, x1, MemOperand(context_reg_, scratch));
+    __ Ldp(x2, x3, MemOperand(context_reg_, scratch + 16));
+    __ Br(forward_reg_);
+
+    __ FinalizeCode();
 
+    auto stub_size = __ GetBuffer()->GetSizeInBytes();
+    assert(stub_size <= block_stub_memory_size);
+    VAddr buffer_start = page_lookup_;
+    VAddr tmp_code_start = __ GetBuffer()->GetStartAddress<VAddr>();
+    std::memcpy(reinterpret_cast<void *>(buffer_start),
+                reinterpret_cast<const void *>(tmp_code_start), stub_size);
+    __builtin___clear_cache(reinterpret_cast<char *>(buffer_start),
+                            reinterpret_cast<char *>(buffer_start + stub_size));
 }
@@ -4,31 +4,40 @@
 
 #pragma once
 
-#pragma once
-
 #include <base/marcos.h>
 #include <aarch64/macro-assembler-aarch64.h>
+#include "svm_mmu.h"
 
 using namespace vixl::aarch64;
 
-namespace CPU::A64 {
-    struct CPUContext;
-}
-
 namespace SVM::A64 {
 
     class Instance;
 
-    class BlockStubs : public BaseObject {
+    class BlockStubs : public BaseObject, NonCopyable {
     public:
         BlockStubs(const SharedPtr<Instance> &instance);
 
+        virtual ~BlockStubs();
+
+        // in: va in CPUContext::forward(query page), return address in forward reg
+        // out: pte in CPUContext::query_pte, 0 if not mapped, tlb refilled
+        VAddr GetPageLookup() const;
+
+        // walk all levels of the page table and refill tlb_entry
+        // pte = 0 and tlb untouched if any level is missing
+        static void EmitPageWalk(MacroAssembler &masm_, A64MMU *mmu, const Register &context,
+                                 const Register &pte, const Register &va, const Register &tmp,
+                                 const Register &tlb_entry);
+
     private:
         void BuildPageLookup();
 
         SharedPtr <Instance> instance_;
         const Register &context_reg_;
         const Register &forward_reg_;
+        VAddr code_memory_;
+        VAddr page_lookup_;
     };
 
 
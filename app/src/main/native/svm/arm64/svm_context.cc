@@ -142,7 +142,11 @@ void Context::SetCurPc(VAddr cur_pc) {
 }
 
 void Context::SetSuspendFlag(bool suspend) {
-    context_.suspend_flag = suspend ? 1 : 0;
+    if (suspend) {
+        __atomic_fetch_or(&context_.suspend_flag, SuspendFlag::SuspendRequest, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(&context_.suspend_flag, ~u64(SuspendFlag::SuspendRequest), __ATOMIC_RELEASE);
+    }
 }
 
 void Context::Emit(u32 instr) {
@@ -630,7 +634,7 @@ ContextWithMemTrace::ContextWithMemTrace(SharedPtr<A64MMU> mmu) : Context(TMP1,
     // Need keep CTX_REG, so rewrite all instructions used CTX_REG
     page_bits_ = mmu->GetPageBits();
     address_bits_unused_ = mmu->GetUnusedBits();
-    tlb_bits_ = mmu->Tbl()->TLBBits();
+    tlb_bits_ = mmu->TLBBits();
     context_.tlb = mmu->Tbl()->TLBTablePtr();
     context_.page_table = mmu->TopPageTable();
 }
@@ -668,6 +672,7 @@ void ContextWithMemTrace::LookupTLB(u8 reg_addr) {
     auto rt = XRegister::GetXRegFromCode(reg_addr);
     auto wrap = [this, rt](std::array<Register, 3> tmp) -> void {
         auto *label_hit = Label();
+        auto *label_miss = Label();
         auto *label_end = Label();
         auto *label_lookup_page_table = cursor_.label_holder_->GetPageLookupLabel();
         auto tmp1 = tmp[0];
@@ -683,8 +688,12 @@ void ContextWithMemTrace::LookupTLB(u8 reg_addr) {
         __ Ldr(tmp3, MemOperand(tmp1));
         __ Lsr(tmp2, rt, page_bits_);
         __ Sub(tmp3, tmp3, tmp2);
-        __ Cbz(tmp3, label_hit);
+        __ Cbnz(tmp3, label_miss);
+        // pte 0 is an entry being shot down
+        __ Ldr(tmp3, MemOperand(tmp1, 8));
+        __ Cbnz(tmp3, label_hit);
         // miss cache
+        __ Bind(label_miss);
         __ Str(tmp2, MemOperand(reg_ctx_, OFFSET_CTX_A64_QUERY_PAGE));
         PopX<3>(tmp);
         PushX(LR);
@@ -695,7 +704,7 @@ void ContextWithMemTrace::LookupTLB(u8 reg_addr) {
         __ B(label_end);
         // hit, load pte
         __ Bind(label_hit);
-        __ Ldr(rt, MemOperand(tmp1, 8));
+        __ Mov(rt, tmp3);
         __ Bind(label_end);
     };
     WrapContext<3>(wrap, {rt});
@@ -20,7 +20,18 @@ constexpr static size_t stub_memory_size = PAGE_SIZE;
 
 CPUContext *GlobalStubs::InterruptStub(CPUContext *context) {
     auto thread_ctx = reinterpret_cast<EmuThreadContext *>(context->context_ptr);
-    thread_ctx->Interrupt(context->interrupt);
+    // back in the host, the stub resumes through code_cache and not in the block it left
+    thread_ctx->EnterCode();
+    if (context->interrupt.reason == InterruptHelp::MemorySpec) {
+        thread_ctx->HandleMemorySpec();
+    } else if (context->interrupt.reason == InterruptHelp::ErrorInstr && thread_ctx->InterpretBlock()) {
+        // the jit could not take it, the interpreter ran the block
+    } else {
+        thread_ctx->Interrupt(context->interrupt);
+    }
+    // the handler may have unmapped memory, do not resume with a stale l1
+    thread_ctx->CheckShootdown();
+    thread_ctx->CheckTierUp();
     thread_ctx->LookupJitCache();
     if (!context->code_cache) {
         thread_ctx->Fallback();
@@ -30,6 +41,8 @@ CPUContext *GlobalStubs::InterruptStub(CPUContext *context) {
 
 CPUContext *GlobalStubs::JitCacheMissStub(CPUContext *context) {
     auto thread_ctx = reinterpret_cast<EmuThreadContext *>(context->context_ptr);
+    thread_ctx->EnterCode();
+    thread_ctx->CheckTierUp();
     thread_ctx->LookupJitCache();
     if (!context->code_cache) {
         thread_ctx->Fallback();
@@ -58,6 +71,8 @@ GlobalStubs::GlobalStubs(SharedPtr<Instance> instance) : instance_{instance}, co
     BuildReturnToHostStub();
     BuildHostToGuestStub();
     BuildForwardCodeCache();
+    // stubs never change after build
+    Platform::SealExecutableMemory(code_memory_, stub_memory_size);
 }
 
 GlobalStubs::~GlobalStubs() {
@@ -472,6 +487,9 @@ void GlobalStubs::BuildReturnToHostStub() {
     // save guest context
     FullSaveGuestContext(masm_, tmp);
 
+    // another guest thread may run on this host thread next, drop its host monitor
+    __ Clrex();
+
     // load host sp
     __ Ldr(tmp, MemOperand(context_reg_, OFFSET_CTX_A64_HOST_SP));
     __ Mov(sp, tmp);
@@ -493,6 +511,14 @@ void GlobalStubs::BuildReturnToHostStub() {
                             reinterpret_cast<char *>(buffer_start + stub_size));
 }
 
+const u32 GlobalStubs::PageLookupOffset() {
+    return OFFSET_OF(GlobalStubs, page_lookup_);
+}
+
+void GlobalStubs::SetPageLookup(VAddr page_lookup) {
+    page_lookup_ = page_lookup;
+}
+
 const u32 GlobalStubs::FullInterruptOffset() {
     return OFFSET_OF(GlobalStubs, full_interrupt_);
 }
@@ -29,10 +29,14 @@ namespace SVM::A64 {
         VAddr GetReturnToHost() const;
         VAddr GetAbiInterrupt() const;
 
+        // built by BlockStubs when the page table needs a walk
+        void SetPageLookup(VAddr page_lookup);
+
         static const u32 FullInterruptOffset();
         static const u32 ForwardCodeCacheOffset();
         static const u32 ReturnToHostOffset();
         static const u32 ABIInterruptOffset();
+        static const u32 PageLookupOffset();
 
         void RunCode(CPU::A64::CPUContext *context);
 
@@ -64,6 +68,7 @@ namespace SVM::A64 {
         VAddr full_interrupt_;
         VAddr abi_interrupt_;
         VAddr forward_code_cache_;
+        VAddr page_lookup_{};
     };
 
 }
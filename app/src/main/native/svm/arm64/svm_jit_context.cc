@@ -5,6 +5,7 @@
 #include <base/log.h>
 #include "svm_jit_context.h"
 #include "svm_arm64.h"
+#include "svm_block_stubs.h"
 
 using namespace SVM::A64;
 using namespace Jit;
@@ -33,12 +34,14 @@ const Register &RegisterAllocator::AcquireTempX() {
             auto &res = context_->GetXRegister(i, true);
             context_->Push(res);
             MarkInUsed(res);
+            temps_[i] = true;
             return res;
         }
     }
 }
 
 void RegisterAllocator::ReleaseTempX(const Register &x) {
+    temps_[x.RealCode()] = false;
     MarkInUsed(x, false);
     context_->Pop(x);
 }
@@ -49,6 +52,10 @@ void RegisterAllocator::MarkInUsed(const Register &x, bool in_used) {
     in_used_[x.RealCode()] = in_used;
 }
 
+bool RegisterAllocator::IsTemp(const Register &x) {
+    return !x.IsZero() && temps_[x.RealCode()];
+}
+
 bool RegisterAllocator::InUsed(const Register &x) {
     if (x.IsZero())
         return false;
@@ -57,30 +64,42 @@ bool RegisterAllocator::InUsed(const Register &x) {
 
 void RegisterAllocator::Initialize(JitContext *context) {
     context_ = context;
+    std::fill(std::begin(in_used_), std::end(in_used_), false);
+    std::fill(std::begin(temps_), std::end(temps_), false);
+    context_ptr_ = NoReg;
     ContextPtr();
 }
 
 LabelAllocator::LabelAllocator(MacroAssembler &masm) : masm_(masm) {}
 
 LabelAllocator::~LabelAllocator() {
-    for (auto label : labels_) {
-        delete label;
+    Reset();
+}
+
+void LabelAllocator::Reset() {
+    for (auto node = labels_; node; node = node->next) {
+        node->label.~Label();
     }
+    labels_ = nullptr;
+    labels_outstanding_ = nullptr;
+    dest_buffer_start_ = 0;
+    arena_.Reset();
 }
 
 void LabelAllocator::SetDestBuffer(VAddr addr) {
     dest_buffer_start_ = addr;
     assert(dest_buffer_start_);
-    for (auto label : labels_outstanding_) {
-        ptrdiff_t offset = label.target - dest_buffer_start_;
-        __ BindToOffset(label.label, offset);
+    for (auto label = labels_outstanding_; label; label = label->next) {
+        ptrdiff_t offset = label->target - dest_buffer_start_;
+        __ BindToOffset(label->label, offset);
     }
 }
 
 Label *LabelAllocator::AllocLabel() {
-    auto label = new Label();
-    labels_.push_back(label);
-    return label;
+    auto node = arena_.New<LabelNode>();
+    node->next = labels_;
+    labels_ = node;
+    return &node->label;
 }
 
 Label *LabelAllocator::GetDispatcherLabel() {
@@ -115,10 +134,14 @@ void LabelAllocator::BindMapAddress(VAddr addr) {
 
 Label *LabelAllocator::AllocOutstanding(VAddr target) {
     auto label = AllocLabel();
-    labels_outstanding_.push_back({target, label});
+    labels_outstanding_ = arena_.New<Outstanding>(Outstanding{target, label, labels_outstanding_});
     return label;
 }
 
+u64 LabelAllocator::MallocCount() const {
+    return arena_.MallocCount();
+}
+
 
 JitContext::JitContext(Instance &instance) : instance_{instance}, reg_ctx_{
         XRegister::GetXRegFromCode(instance.GetJitConfig().context_reg)}, reg_forward_{
@@ -127,14 +150,71 @@ JitContext::JitContext(Instance &instance) : instance_{instance}, reg_ctx_{
     if (mmu_) {
         page_bits_ = mmu_->GetPageBits();
         address_bits_unused_ = mmu_->GetUnusedBits();
-        tlb_bits_ = mmu_->Tbl()->TLBBits();
+        tlb_bits_ = mmu_->TLBBits();
+        fastmem_ = instance.GetFastMem() != nullptr;
+        profile_l1_ = instance.GetJitConfig().profile_l1;
     }
+    auto &monitor = instance.GetExclusiveMonitor();
+    if (monitor) {
+        emulate_exclusive_ = true;
+        exclusive_table_bits_ = monitor->TableBits();
+    }
+    pre_decoded_.reserve(max_pre_decode);
+    instr_offsets_.reserve(max_pre_decode);
 }
 
 void JitContext::SetPC(VAddr pc) {
     pc_ = pc;
 }
 
+void JitContext::BeginInstr(VAddr pc) {
+    SetPC(pc);
+    if (pc - block_start_ == instr_offsets_.size() << 2) {
+        instr_offsets_.push_back(static_cast<u32>(BlockCacheSize()));
+    }
+}
+
+u32 JitContext::EmitPassThroughRun(VAddr pc) {
+    auto host = FetchInstr(pc);
+    if (!host) {
+        return 0;
+    }
+    // host side is contiguous up to the end of the guest page
+    auto page_end = mmu_ ? (pc | mmu_->page_mask_) + 1 : AlignUp(pc + 1, PAGE_SIZE);
+    auto remaining = __ GetBuffer()->GetRemainingBytes();
+    if (remaining <= code_space_margin) {
+        return 0;
+    }
+    auto space = (remaining - code_space_margin) / kInstructionSize;
+    auto max = std::min<VAddr>((page_end - pc) / 4, space);
+    auto words = reinterpret_cast<const u32 *>(host);
+    u32 count = 0;
+    while (count < max) {
+        auto pre_decoded = PreDecodedAt(pc + count * 4);
+        bool pass_through = pre_decoded ? pre_decoded->cls == Decode::A64::InstrClass::PassThrough ||
+                                          pre_decoded->cls == Decode::A64::InstrClass::Unknown
+                                        : Decode::A64::IsPassThrough(words[count]);
+        if (!pass_through) {
+            break;
+        }
+        count++;
+    }
+    if (!count) {
+        return 0;
+    }
+    SetPC(pc + (count - 1) * 4);
+    // pools are checked once for the whole run, before the offsets are taken
+    vixl::ExactAssemblyScope scope(&masm_, count * kInstructionSize);
+    auto offset = static_cast<u32>(BlockCacheSize());
+    for (u32 i = 0; i < count; ++i) {
+        if (pc + i * 4 - block_start_ == instr_offsets_.size() << 2) {
+            instr_offsets_.push_back(offset + i * kInstructionSize);
+        }
+    }
+    __ GetBuffer()->EmitData(words, count * kInstructionSize);
+    return count;
+}
+
 const VRegister &JitContext::GetVRegister(u8 code) {
     return VRegister::GetVRegFromCode(code);
 }
@@ -343,15 +423,60 @@ void JitContext::Forward(const Register &target) {
     __ Br(reg_forward_);
 }
 
-void JitContext::AddTicks(u64 ticks, Register tmp) {
-    constexpr static u64 max_imm_add = (u64(1) << 12) - 1;
-    assert(ticks <= max_imm_add);
+void JitContext::Forward(const MemOperand &target) {
+    Push(reg_forward_);
+    __ Ldr(reg_forward_, target);
+    __ Str(reg_forward_, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_PC));
+    CheckTicks();
+    LoadGlobalStub(reg_forward_, GlobalStubs::ForwardCodeCacheOffset());
+    __ Br(reg_forward_);
+}
+
+void JitContext::Backward(VAddr addr) {
+    assert(InBlock(addr));
+    Push(reg_forward_);
+    __ Mov(reg_forward_, addr);
+    __ Str(reg_forward_, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_PC));
+    // Terminal added the ticks of the whole block, the next iteration does not run
+    // the part before the loop head again, take it back so each one counts its body only
+    auto prefix_ticks = (addr - block_start_) >> 2;
+    if (prefix_ticks) {
+        AddTicks(-s64(prefix_ticks), reg_forward_);
+    }
+    // one budget check per iteration
+    CheckTicks();
+    Pop(reg_forward_);
+    Label *loop_head = label_allocator_.AllocLabel();
+    __ BindToOffset(loop_head, instr_offsets_[(addr - block_start_) >> 2]);
+    __ B(loop_head);
+}
+
+bool JitContext::CodeSpaceLow() {
+    return __ GetBuffer()->GetRemainingBytes() < code_space_margin;
+}
+
+void JitContext::SplitBlock() {
+    Terminal();
+    Forward(PC() + 4);
+}
+
+bool JitContext::InBlock(VAddr addr) const {
+    if (addr < block_start_ || addr > pc_ || addr % 4 != 0) {
+        return false;
+    }
+    return ((addr - block_start_) >> 2) < instr_offsets_.size();
+}
+
+void JitContext::AddTicks(s64 ticks, Register tmp) {
+    constexpr static s64 max_imm_add = (s64(1) << 12) - 1;
+    assert(ticks <= max_imm_add && ticks >= -max_imm_add);
     bool need_restore{false};
     if (!tmp.IsValid()) {
         tmp = register_alloc_.AcquireTempX();
         need_restore = true;
     }
     __ Ldr(tmp, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, ticks_now)));
+    // add / sub of an immediate, host flags are not touched
     __ Add(tmp, tmp, ticks);
     __ Str(tmp, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, ticks_now)));
     if (need_restore) {
@@ -361,15 +486,22 @@ void JitContext::AddTicks(u64 ticks, Register tmp) {
 
 void JitContext::CheckTicks() {
     Label *continue_label = label_allocator_.AllocLabel();
+    Label *return_host = label_allocator_.AllocLabel();
     auto tmp1 = reg_forward_;
+    // suspend request or tlb shootdown
+    __ Ldr(tmp1, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_SUSPEND_ADDR));
+    __ Cbnz(tmp1, return_host);
     auto tmp2 = register_alloc_.AcquireTempX();
     __ Ldr(tmp1, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, ticks_now)));
     __ Ldr(tmp2, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, ticks_max)));
-    __ Cmp(tmp2, tmp1);
+    // guest NZCV lives in host flags, so no Cmp here.
+    // budget left is max - now, used up if 0 or negative, ticks never drift 2^63 apart
+    __ Sub(tmp1, tmp2, tmp1);
     register_alloc_.ReleaseTempX(tmp2);
-    __ Cset(tmp1.W(), Condition::ls);
-    __ Tbz(tmp1.W(), 0, continue_label);
+    __ Cbz(tmp1, return_host);
+    __ Tbz(tmp1, 63, continue_label);
     // Return Host
+    __ Bind(return_host);
     LoadGlobalStub(reg_forward_, GlobalStubs::ReturnToHostOffset());
     __ Br(reg_forward_);
     __ Bind(continue_label);
@@ -404,14 +536,67 @@ LabelAllocator &JitContext::GetLabelAlloc() {
 void JitContext::BeginBlock(VAddr pc) {
     terminal = false;
     current_block_ticks_ = 0;
+    block_start_ = pc;
+    fetch_page_ = ~VAddr(0);
+    fetch_host_ = 0;
+    code_page_count_ = 0;
+    pre_decoded_.clear();
+    instr_offsets_.clear();
+    label_allocator_.Reset();
+    // emit in place, through the writable view of the reserved code buffer
+    assert(current_cache_entry_);
+    auto &entry_data = current_cache_entry_->Data();
+    auto code_block = entry_data.code_block;
+    code_reserved_ = max_block_code_size;
+    auto buffer_start = code_block->ReserveCodeBuffer(code_block->GetBuffer(entry_data.id_in_block),
+                                                      code_reserved_, min_block_code_size);
+    while (!buffer_start) {
+        // code block used up
+        instance_.GetJitManager()->MoveCacheAllocation(current_cache_entry_);
+        code_block = entry_data.code_block;
+        code_reserved_ = max_block_code_size;
+        buffer_start = code_block->ReserveCodeBuffer(code_block->GetBuffer(entry_data.id_in_block),
+                                                     code_reserved_, min_block_code_size);
+    }
+    // same assembler for every block, only its buffer moves
+    masm_.GetBuffer()->Reset(reinterpret_cast<vixl::byte *>(code_block->ToWritable(buffer_start)),
+                             code_reserved_);
+    masm_.Reset();
     register_alloc_.Initialize(this);
     SetPC(pc);
+    if (tier_ == JitTier::Baseline) {
+        CountExecute();
+    }
     Pop(reg_forward_);
 }
 
+void JitContext::CountExecute() {
+    auto threshold = instance_.GetJitConfig().tier_up_threshold;
+    if (!threshold || !current_cache_entry_ || current_cache_entry_->Data().ir_rejected) {
+        return;
+    }
+    auto &entry_data = current_cache_entry_->Data();
+    static_assert(sizeof(entry_data.exec_count) == sizeof(u32));
+    Label *not_hot = label_allocator_.AllocLabel();
+    // forward reg is free at block entry, guest value still in context
+    auto tmp = register_alloc_.AcquireTempX();
+    __ Mov(reg_forward_, reinterpret_cast<VAddr>(&entry_data.exec_count));
+    __ Ldr(tmp.W(), MemOperand(reg_forward_));
+    __ Add(tmp.W(), tmp.W(), 1);
+    __ Str(tmp.W(), MemOperand(reg_forward_));
+    // guest NZCV lives in host flags, so no Cmp here
+    __ Mov(reg_forward_, threshold);
+    __ Sub(tmp.W(), tmp.W(), reg_forward_.W());
+    __ Cbnz(tmp.W(), not_hot);
+    // post to host, picked up at next host transition
+    __ Mov(reg_forward_, reinterpret_cast<VAddr>(current_cache_entry_));
+    __ Str(reg_forward_, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, tier_up_entry)));
+    __ Bind(not_hot);
+    register_alloc_.ReleaseTempX(tmp);
+}
+
 void JitContext::EndBlock() {
     assert(current_cache_entry_);
-    auto jit_block_size = BlockCacheSize();
     auto &entry_data = current_cache_entry_->Data();
     auto buffer = entry_data.code_block->GetBuffer(entry_data.id_in_block);
     assert(buffer);
@@ -420,21 +605,93 @@ void JitContext::EndBlock() {
     label_allocator_.SetDestBuffer(buffer_start);
     __ FinalizeCode();
 
-    std::memcpy(reinterpret_cast<void *>(buffer_start), __ GetBuffer()->GetStartAddress<void *>(),
-                jit_block_size);
+    // pools may be emitted by FinalizeCode
+    auto jit_block_size = static_cast<u32>(BlockCacheSize());
+    entry_data.code_block->CommitCodeBuffer(buffer, jit_block_size, code_reserved_);
     __sync_synchronize();
     ClearCachePlatform(buffer_start, jit_block_size);
 
+    entry_data.code_page = mmu_ ? block_start_ & ~mmu_->page_mask_ : AlignDown(block_start_, PAGE_SIZE);
+    entry_data.code_page_count = mmu_ ? code_page_count_ :
+                                 static_cast<u16>((AlignUp(pc_ + 4, PAGE_SIZE) - entry_data.code_page) >> PAGE_BITS);
     entry_data.ready = true;
     current_cache_entry_ = nullptr;
 }
 
+void JitContext::AbortBlock() {
+    assert(current_cache_entry_);
+    auto &entry_data = current_cache_entry_->Data();
+    auto buffer = entry_data.code_block->GetBuffer(entry_data.id_in_block);
+    __ FinalizeCode();
+    entry_data.code_block->CommitCodeBuffer(buffer, 0, code_reserved_);
+}
+
 Instructions::A64::AArch64Inst JitContext::Instr() {
-    if (mmu_) {
-        mmu_->Read<Instructions::A64::AArch64Inst>(pc_);
-    } else {
-        return *reinterpret_cast<Instructions::A64::AArch64Inst *>(pc_);
+    assert(instr_host_);
+    return *reinterpret_cast<Instructions::A64::AArch64Inst *>(instr_host_);
+}
+
+VAddr JitContext::FetchInstr(VAddr pc) {
+    if (!mmu_) {
+        instr_host_ = pc;
+        return instr_host_;
+    }
+    // one walk per guest code page, not per instruction
+    auto page = pc & ~mmu_->page_mask_;
+    auto pre_decoded = PreDecodedAt(pc);
+    if (page != fetch_page_) {
+        fetch_page_ = page;
+        code_page_count_++;
+        if (pre_decoded) {
+            // resolved by the scan
+            fetch_host_ = pre_decoded->host - (pc - page);
+        } else {
+            auto pte = mmu_->GetPage(page);
+            fetch_host_ = pte && mmu_->PageExecutable(*pte) ? mmu_->GetPageStart(*pte) : 0;
+        }
+    }
+    instr_host_ = fetch_host_ ? fetch_host_ + (pc - page) : 0;
+    return instr_host_;
+}
+
+size_t JitContext::PreDecode(VAddr start) {
+    assert(start == block_start_);
+    if (!mmu_) {
+        return pre_decoder_.Scan(start, max_pre_decode, pre_decoded_, [](VAddr pc) {
+            return pc;
+        });
     }
+    // own page cache, pages are counted when the emitter gets there
+    VAddr page_cached{~VAddr(0)};
+    VAddr host_cached{};
+    auto page_mask = mmu_->page_mask_;
+    return pre_decoder_.Scan(start, max_pre_decode, pre_decoded_, [&](VAddr pc) -> VAddr {
+        auto page = pc & ~page_mask;
+        if (page != page_cached) {
+            page_cached = page;
+            auto pte = mmu_->GetPage(page);
+            host_cached = pte && mmu_->PageExecutable(*pte) ? mmu_->GetPageStart(*pte) : 0;
+        }
+        return host_cached ? host_cached + (pc - page) : 0;
+    });
+}
+
+const std::vector<Decode::A64::PreDecoded> &JitContext::PreDecodedBlock() const {
+    return pre_decoded_;
+}
+
+const Decode::A64::PreDecoded *JitContext::PreDecodedAt(VAddr pc) const {
+    auto index = (pc - block_start_) >> 2;
+    if (pc < block_start_ || index >= pre_decoded_.size()) {
+        return nullptr;
+    }
+    return &pre_decoded_[index];
+}
+
+void JitContext::FetchFatal() {
+    // only taken if the guest really runs into the page
+    Terminal();
+    TrapMemoryAccess(InterruptHelp::PageFatal, VirtualAddress(pc_));
 }
 
 void JitContext::Interrupt(const InterruptHelp &interrupt) {
@@ -458,8 +715,12 @@ void JitContext::SetCacheEntry(JitCacheEntry *entry) {
     current_cache_entry_ = entry;
 }
 
-void JitContext::Tick() {
-    current_block_ticks_++;
+void JitContext::SetTier(JitTier tier) {
+    tier_ = tier;
+}
+
+void JitContext::Tick(u32 count) {
+    current_block_ticks_ += count;
 }
 
 size_t JitContext::BlockCacheSize() {
@@ -498,28 +759,186 @@ void JitContext::LookupPageTable(const Register &rt, const VirtualAddress &va, b
             register_alloc_.ReleaseTempX(tmp2);
         }
     } else {
-        // multi level
+        // multi level: probe tlb, walk the table on miss and refill the tlb entry
         Label *label_miss = label_allocator_.AllocLabel();
-        LookupTLB(rt, va, label_miss);
-        __ B(label_end);
-        // look up page table
+        Label *label_walked = label_allocator_.AllocLabel();
+        // rt/va may already be temps of the caller, keep their state
+        bool rt_used = register_alloc_.InUsed(rt);
+        register_alloc_.MarkInUsed(rt);
+        auto va_reg = va.ConstAddress() ? register_alloc_.AcquireTempX() : va.VARegister();
         if (va.ConstAddress()) {
-
+            __ Mov(va_reg, va.Address());
+            __ Str(va_reg, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_QUERY_PAGE));
+        }
+        bool va_used = register_alloc_.InUsed(va_reg);
+        register_alloc_.MarkInUsed(va_reg);
+        auto tmp1 = register_alloc_.AcquireTempX();
+        auto tmp2 = register_alloc_.AcquireTempX();
+        __ Lsr(tmp1, va_reg, page_bits_);
+        __ Ubfx(tmp2, va_reg, page_bits_, tlb_bits_);
+        __ Ldr(rt, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_TLB));
+        __ Add(tmp2, rt, Operand(tmp2, LSL, 4));
+        __ Ldr(rt, MemOperand(tmp2));
+        __ Sub(rt, rt, tmp1);
+        __ Cbnz(rt, label_miss);
+        __ Ldr(rt, MemOperand(tmp2, 8));
+        // entry being shot down
+        __ Cbz(rt, label_miss);
+        __ B(label_walked);
+        __ Bind(label_miss);
+        if (tier_ == JitTier::Optimized) {
+            BlockStubs::EmitPageWalk(masm_, mmu_, register_alloc_.ContextPtr(), rt, va_reg, tmp1, tmp2);
+        } else {
+            // keep baseline blocks small, share one walker
+            Label *label_ret = label_allocator_.AllocLabel();
+            Push(reg_forward_);
+            LoadGlobalStub(rt, GlobalStubs::PageLookupOffset());
+            __ Adr(reg_forward_, label_ret);
+            __ Br(rt);
+            __ Bind(label_ret);
+            __ Ldr(rt, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, query_pte)));
+            Pop(reg_forward_);
+        }
+        __ Bind(label_walked);
+        register_alloc_.ReleaseTempX(tmp1);
+        register_alloc_.ReleaseTempX(tmp2);
+        if (va.ConstAddress()) {
+            register_alloc_.ReleaseTempX(va_reg);
+        } else {
+            register_alloc_.MarkInUsed(va_reg, va_used);
         }
+        register_alloc_.MarkInUsed(rt, rt_used);
     }
-    __ Tbnz(rt, write ? mmu_config.writable_bit : mmu_config.readable_bit, label_end);
-    Push(rt);
+    Label *label_fatal = label_allocator_.AllocLabel();
+    __ Tbz(rt, write ? mmu_config.writable_bit : mmu_config.readable_bit, label_fatal);
+    // pages without hooks pay this one branch
+    __ Tbz(rt, write ? WRITE_SPEC_BITS : READ_SPEC_BITS, label_end);
+    TrapMemoryAccess(InterruptHelp::MemorySpec, va);
+    __ Bind(label_fatal);
+    TrapMemoryAccess(InterruptHelp::PageFatal, va);
+    __ Bind(label_end);
+}
+
+void JitContext::TrapMemoryAccess(InterruptHelp::Reason reason, const VirtualAddress &va) {
+    auto reg_ctx = register_alloc_.ContextPtr();
     Push(reg_forward_);
-    __ Mov(reg_forward_, InterruptHelp::PageFatal);
-    __ Str(reg_forward_, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, interrupt.reason)));
+    for (u8 i = 0; i < 31; ++i) {
+        auto &reg = GetXRegister(i);
+        if (register_alloc_.IsTemp(reg) && !reg.Is(reg_forward_)) {
+            __ Ldr(reg, MemOperand(reg_ctx, 8 * i));
+        }
+    }
+    __ Mov(reg_forward_, reason);
+    __ Str(reg_forward_, MemOperand(reg_ctx, OFFSET_OF(CPUContext, interrupt.reason)));
     if (va.ConstAddress()) {
         __ Mov(reg_forward_, va.Address());
-        __ Str(reg_forward_, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_QUERY_PAGE));
+    } else {
+        __ Ldr(reg_forward_, MemOperand(reg_ctx, OFFSET_CTX_A64_QUERY_PAGE));
     }
+    __ Str(reg_forward_, MemOperand(reg_ctx, OFFSET_OF(CPUContext, interrupt.fatal_addr)));
+    // the host resumes from pc, this path never comes back
+    __ Mov(reg_forward_, pc_);
+    __ Str(reg_forward_, MemOperand(reg_ctx, OFFSET_CTX_A64_PC));
     LoadGlobalStub(reg_forward_, GlobalStubs::FullInterruptOffset());
     __ Br(reg_forward_);
-    Pop(reg_forward_);
-    __ Bind(label_end);
+}
+
+bool JitContext::MmuEnabled() const {
+    return mmu_ != nullptr;
+}
+
+bool JitContext::FastMem() const {
+    return fastmem_;
+}
+
+void JitContext::HostAddress(const Register &host, const Register &va, const Register &tmp,
+                             s64 offset, bool write) {
+    assert(mmu_);
+    if (fastmem_) {
+        // holes and spec pages fault, see FastMemory::HandleFault
+        __ Ldr(tmp, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, fastmem_base)));
+        __ Add(host, va, tmp);
+        return;
+    }
+    // translate the effective address, page crossing offsets are not a problem then
+    AddImmediate(tmp, va, offset);
+    if (va.IsSP() && mmu_->GetLevel() > 1) {
+        // stack pages go through the per thread l1 first
+        Label *label_miss = label_allocator_.AllocLabel();
+        Label *label_hit = label_allocator_.AllocLabel();
+        const auto &mmu_config = instance_.GetMmuConfig();
+        bool host_used = register_alloc_.InUsed(host);
+        register_alloc_.MarkInUsed(host);
+        auto l1_tmp = register_alloc_.AcquireTempX();
+        auto count_tmp = profile_l1_ ? register_alloc_.AcquireTempX() : l1_tmp;
+        LookupL1(host, VirtualAddress(tmp), l1_tmp, label_miss);
+        // filled by the other direction maybe, recheck
+        __ Tbz(host, write ? mmu_config.writable_bit : mmu_config.readable_bit, label_miss);
+        __ Tbnz(host, write ? WRITE_SPEC_BITS : READ_SPEC_BITS, label_miss);
+        if (profile_l1_) {
+            CountL1(true, l1_tmp, count_tmp);
+        }
+        __ B(label_hit);
+        __ Bind(label_miss);
+        LookupPageTable(host, VirtualAddress(tmp), write);
+        FillL1(host, tmp, l1_tmp);
+        if (profile_l1_) {
+            CountL1(false, l1_tmp, count_tmp);
+        }
+        __ Bind(label_hit);
+        if (profile_l1_) {
+            register_alloc_.ReleaseTempX(count_tmp);
+        }
+        register_alloc_.ReleaseTempX(l1_tmp);
+        register_alloc_.MarkInUsed(host, host_used);
+    } else {
+        LookupPageTable(host, VirtualAddress(tmp), write);
+    }
+    __ Bfxil(host, tmp, 0, page_bits_);
+    AddImmediate(host, host, -offset);
+}
+
+bool JitContext::EmulateExclusive() const {
+    return emulate_exclusive_;
+}
+
+void JitContext::ExclusiveEntry(const Register &entry, const Register &va, const Register &tmp) {
+    assert(emulate_exclusive_);
+    // same hash as ExclusiveMonitor::Index
+    __ Lsr(entry, va, ExclusiveMonitor::granule_bits);
+    __ Eor(entry, entry, Operand(entry, LSR, exclusive_table_bits_));
+    __ And(entry, entry, (VAddr(1) << exclusive_table_bits_) - 1);
+    __ Ldr(tmp, MemOperand(register_alloc_.ContextPtr(), OFFSET_OF(CPUContext, exclusive_table)));
+    __ Add(entry, tmp, Operand(entry, LSL, 3));
+}
+
+void JitContext::AddImmediate(const Register &rd, const Register &rn, s64 imm) {
+    if (imm == 0) {
+        if (!rd.Is(rn)) {
+            __ Mov(rd, rn);
+        }
+        return;
+    }
+    u64 abs_imm = static_cast<u64>(imm < 0 ? -imm : imm);
+    assert(abs_imm < (u64(1) << 24));
+    u64 low = abs_imm & 0xfff;
+    u64 high = abs_imm & 0xfff000;
+    const Register *src = &rn;
+    if (low) {
+        if (imm < 0) {
+            __ Sub(rd, *src, low);
+        } else {
+            __ Add(rd, *src, low);
+        }
+        src = &rd;
+    }
+    if (high) {
+        if (imm < 0) {
+            __ Sub(rd, *src, high);
+        } else {
+            __ Add(rd, *src, high);
+        }
+    }
 }
 
 void JitContext::LookupTLB(const Register &rt, const VirtualAddress &va, Label *miss_cache) {
@@ -540,17 +959,20 @@ void JitContext::LookupTLB(const Register &rt, const VirtualAddress &va, Label *
         __ Sub(tmp1, tmp1, Operand(va.VARegister(), LSR, page_bits_));
         __ Cbnz(tmp1, miss_cache);
         __ Ldr(rt, MemOperand(tmp2, 8));
+        // entry being shot down
+        __ Cbz(rt, miss_cache);
         register_alloc_.MarkInUsed(va.VARegister(), false);
         // miss cache
     } else {
         __ Ldr(tmp1, MemOperand(register_alloc_.ContextPtr(), OFFSET_CTX_A64_TLB));
-        __ Mov(tmp2, BitRange<VAddr>(va.Address(), page_bits_, tlb_bits_) << 4);
+        __ Mov(tmp2, BitRange<VAddr>(va.Address(), page_bits_, page_bits_ + tlb_bits_ - 1) << 4);
         __ Add(tmp2, tmp1, tmp2);
         __ Ldr(tmp1, MemOperand(tmp2));
         __ Mov(rt, va.Address() >> page_bits_);
         __ Sub(tmp1, rt, tmp1);
         __ Cbnz(tmp1, miss_cache);
         __ Ldr(rt, MemOperand(tmp2, 8));
+        __ Cbz(rt, miss_cache);
         // miss cache
     }
     register_alloc_.ReleaseTempX(tmp1);
@@ -613,35 +1035,62 @@ void JitContext::ABICall(const ABICallHelp::Reason call, const Register &xt) {
 
 void JitContext::LookupL1(const Register &rt, const VirtualAddress &va, const Register &tmp, Label *miss_cache) {
     if (!va.ConstAddress()) {
-        register_alloc_.MarkInUsed(va.VARegister());
-
-        __ Lsr(tmp, va.VARegister(), mmu_->page_bits_);
-        __ Bfc(tmp,l1_page_bits, sizeof(VAddr) * 8 - l1_page_bits);
+        __ Lsr(tmp, va.VARegister(), page_bits_);
+        __ Bfc(tmp, l1_page_bits, sizeof(VAddr) * 8 - l1_page_bits);
 
         __ Add(tmp, register_alloc_.ContextPtr(), Operand(tmp, LSL, 4));
         __ Ldr(rt, MemOperand(tmp, OFFSET_OF(CPUContext, l1_dcache)));
         __ Sub(rt, rt, Operand(va.VARegister(), LSR, page_bits_));
         __ Cbnz(rt, miss_cache);
-        __ Ldr(rt, MemOperand(tmp, 8));
-
-        register_alloc_.MarkInUsed(va.VARegister(), false);
+        __ Ldr(rt, MemOperand(tmp, OFFSET_OF(CPUContext, l1_dcache) + 8));
     } else {
-        // TODO
-        abort();
+        // slot is known now, no index math
+        auto slot = OFFSET_OF(CPUContext, l1_dcache) +
+                    BitRange<VAddr>(va.Address(), page_bits_, page_bits_ + l1_page_bits - 1) * 16;
+        __ Ldr(rt, MemOperand(register_alloc_.ContextPtr(), slot));
+        __ Mov(tmp, va.Address() >> page_bits_);
+        __ Sub(rt, rt, tmp);
+        __ Cbnz(rt, miss_cache);
+        __ Ldr(rt, MemOperand(register_alloc_.ContextPtr(), slot + 8));
     }
 }
 
+void JitContext::FillL1(const Register &pte, const Register &va, const Register &tmp) {
+    __ Lsr(tmp, va, page_bits_);
+    __ Bfc(tmp, l1_page_bits, sizeof(VAddr) * 8 - l1_page_bits);
+    __ Add(tmp, register_alloc_.ContextPtr(), Operand(tmp, LSL, 4));
+    __ Str(pte, MemOperand(tmp, OFFSET_OF(CPUContext, l1_dcache) + 8));
+    __ Lsr(pte, va, page_bits_);
+    __ Str(pte, MemOperand(tmp, OFFSET_OF(CPUContext, l1_dcache)));
+    __ Ldr(pte, MemOperand(tmp, OFFSET_OF(CPUContext, l1_dcache) + 8));
+}
+
+void JitContext::CountL1(bool hit, const Register &tmp1, const Register &tmp2) {
+    assert(current_cache_entry_);
+    auto &entry_data = current_cache_entry_->Data();
+    auto counter = reinterpret_cast<VAddr>(hit ? &entry_data.l1_hits : &entry_data.l1_misses);
+    // racy between threads, good enough for a profile
+    __ Mov(tmp1, counter);
+    __ Ldr(tmp2.W(), MemOperand(tmp1));
+    __ Add(tmp2.W(), tmp2.W(), 1);
+    __ Str(tmp2.W(), MemOperand(tmp1));
+}
+
 JitContext::~JitContext() {
-    assert(terminal);
+    // pooled contexts die with their thread, never in the middle of a block
+    assert(!current_cache_entry_);
 }
 
-RegisterGuard::RegisterGuard(const ContextA64 &context, const std::vector<Register> &targets)
-        : context_(context), targets_(std::move(targets)) {
+RegisterGuard::RegisterGuard(const ContextA64 &context, std::initializer_list<Register> targets)
+        : context_(context) {
     auto &reg_allocator = context->GetRegisterAlloc();
     std::fill(tmp_peeks_.begin(), tmp_peeks_.end(), -1);
-    Resize(targets_.size());
-    for (int i = 0; i < targets_.size(); ++i) {
-        if (targets_[i].IsZero()) {
+    assert(targets.size() <= max_targets);
+    for (auto &target : targets) {
+        targets_[target_count_++] = target;
+    }
+    for (int i = 0; i < target_count_; ++i) {
+        if (!targets_[i].IsValid() || targets_[i].IsZero()) {
             continue;
         }
         int peeked_tmp = tmp_peeks_[targets_[i].RealCode()];
@@ -663,7 +1112,7 @@ RegisterGuard::RegisterGuard(const ContextA64 &context, const std::vector<Regist
 
 RegisterGuard::~RegisterGuard() {
     auto &reg_allocator = context_->GetRegisterAlloc();
-    for (int i = 0; i < targets_.size(); ++i) {
+    for (int i = 0; i < target_count_; ++i) {
         if (use_tmp_[i] && tmp_peeks_[targets_[i].RealCode()] == i) {
             // if dirty, need write back
             if (dirty_[i]) {
@@ -690,11 +1139,5 @@ const Register &RegisterGuard::Target(int pos) const {
     }
 }
 
-void RegisterGuard::Resize(int size) {
-    tmps_.resize(size);
-    use_tmp_.resize(size);
-    dirty_.resize(size);
-}
-
 #undef __
 
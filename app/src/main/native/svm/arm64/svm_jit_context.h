@@ -7,11 +7,13 @@
 #include <aarch64/macro-assembler-aarch64.h>
 #include "asm/arm64/cpu_arm64.h"
 #include <base/marcos.h>
+#include <base/arena.h>
 #include <asm/arm64/instruction_fields.h>
 #include "block/code_find_table.h"
 #include "svm_mmu.h"
 #include "block/host_code_block.h"
 #include "svm_jit_manager.h"
+#include "decode/decode_block.h"
 
 using namespace Jit::A64;
 using namespace CPU::A64;
@@ -47,10 +49,14 @@ namespace Jit::A64 {
 
         bool InUsed(const Register &x);
 
+        // acquired by AcquireTempX, guest value is in the context
+        bool IsTemp(const Register &x);
+
         void Initialize(JitContext *context);
 
     private:
         bool in_used_[32]{false};
+        bool temps_[32]{false};
         JitContext *context_;
         Register context_ptr_ = NoReg;
     };
@@ -62,6 +68,9 @@ namespace Jit::A64 {
 
         ~LabelAllocator();
 
+        // drop all labels of the last block, arena memory is reused
+        void Reset();
+
         void SetDestBuffer(VAddr addr);
 
         Label *AllocLabel();
@@ -80,20 +89,29 @@ namespace Jit::A64 {
 
         void BindMapAddress(VAddr addr);
 
+        u64 MallocCount() const;
+
     private:
 
+        struct LabelNode {
+            Label label;
+            LabelNode *next;
+        };
+
         struct Outstanding {
             VAddr target;
             Label *label;
+            Outstanding *next;
         };
 
-        VAddr dest_buffer_start_;
+        VAddr dest_buffer_start_{};
         MacroAssembler &masm_;
-        std::list<Label *> labels_;
-        std::list<Outstanding> labels_outstanding_;
-        Label *dispatcher_label_;
-        Label *page_lookup_label_;
-        Label *map_address_label_;
+        Utils::BumpArena arena_;
+        LabelNode *labels_{};
+        Outstanding *labels_outstanding_{};
+        Label *dispatcher_label_{};
+        Label *page_lookup_label_{};
+        Label *map_address_label_{};
     };
 
     class VirtualAddress final {
@@ -122,6 +140,15 @@ namespace Jit::A64 {
 
     class JitContext : public NonCopyable {
     public:
+        // host code of one block is emitted into a reservation of this size
+        constexpr static u32 max_block_code_size = 64 * 1024;
+        // worst case host code of a single guest instruction plus block exit
+        constexpr static u32 code_space_margin = 2 * 1024;
+        // smaller reservations are refused, the block moves to a spare code block
+        constexpr static u32 min_block_code_size = 2 * code_space_margin;
+        // longer blocks fall back to fetching instruction by instruction
+        constexpr static u32 max_pre_decode = 1024;
+
         JitContext(SVM::A64::Instance &instance);
 
         virtual ~JitContext();
@@ -136,7 +163,13 @@ namespace Jit::A64 {
 
         void SetPC(VAddr pc);
 
-        void Tick();
+        void BeginInstr(VAddr pc);
+
+        // copy the run of pass through instructions starting at pc in one go,
+        // returns its length, 0 if pc has to go through the decoder
+        u32 EmitPassThroughRun(VAddr pc);
+
+        void Tick(u32 count = 1);
 
         void Set(const Register &x, u64 value);
 
@@ -164,6 +197,20 @@ namespace Jit::A64 {
 
         void Forward(const Register &target);
 
+        // target in memory, guest registers are all back in place already
+        void Forward(const MemOperand &target);
+
+        // branch back to an instruction already translated in this block
+        void Backward(VAddr addr);
+
+        bool InBlock(VAddr addr) const;
+
+        // reserved code buffer almost used up
+        bool CodeSpaceLow();
+
+        // end block after current instruction, chain to the next one
+        void SplitBlock();
+
         void Interrupt(const InterruptHelp &interrupt);
 
         void ABICall(const ABICallHelp &call);
@@ -172,12 +219,35 @@ namespace Jit::A64 {
 
         void LookupPageTable(const Register &rt, const VirtualAddress &va, bool write = false);
 
+        bool MmuEnabled() const;
+
+        bool FastMem() const;
+
+        // host = host address of (va + offset) - offset, so the memory instruction can keep its own offset
+        // fastmem: fastmem base + va, else page table walk of the effective address
+        void HostAddress(const Register &host, const Register &va, const Register &tmp,
+                         s64 offset, bool write);
+
+        // guest addresses go through page walks, exclusives can not use the host monitor
+        bool EmulateExclusive() const;
+
+        // entry = host address of the global monitor entry of va
+        void ExclusiveEntry(const Register &entry, const Register &va, const Register &tmp);
+
+        // rd = rn + imm without the macro assembler scratch registers, |imm| < 2^24
+        void AddImmediate(const Register &rd, const Register &rn, s64 imm);
+
         void BeginBlock(VAddr start);
 
         void SetCacheEntry(JitCacheEntry *entry);
 
+        void SetTier(JitTier tier);
+
         void EndBlock();
 
+        // drop what was emitted since BeginBlock, the reservation goes back to the code block
+        void AbortBlock();
+
         VAddr PC() const;
 
         bool Termed() const;
@@ -186,6 +256,21 @@ namespace Jit::A64 {
 
         virtual Instructions::A64::AArch64Inst Instr();
 
+        // host address of the guest instruction at pc, 0 if its page can not be executed
+        // the page is resolved once per crossing, Instr() reads from here
+        VAddr FetchInstr(VAddr pc);
+
+        // pc can not be fetched, end the block with a page fault at pc
+        void FetchFatal();
+
+        // scan the block from start to its terminator before emitting it
+        size_t PreDecode(VAddr start);
+
+        const std::vector<Decode::A64::PreDecoded> &PreDecodedBlock() const;
+
+        // record of pc, null past the scanned range
+        const Decode::A64::PreDecoded *PreDecodedAt(VAddr pc) const;
+
         MacroAssembler &Assembler();
 
         RegisterAllocator &GetRegisterAlloc();
@@ -195,10 +280,15 @@ namespace Jit::A64 {
     private:
         void MarkBlockEnd(Register tmp = NoReg);
 
-        void AddTicks(u64 ticks, Register tmp = NoReg);
+        void AddTicks(s64 ticks, Register tmp = NoReg);
 
         void LoadGlobalStub(const Register &target, u32 stub_offset);
 
+        // hand the access at pc to the host, temps are reloaded with their guest values first
+        void TrapMemoryAccess(InterruptHelp::Reason reason, const VirtualAddress &va);
+
+        void CountExecute();
+
         Instance &instance_;
         const Register &reg_ctx_;
         const Register &reg_forward_;
@@ -206,27 +296,50 @@ namespace Jit::A64 {
         RegisterAllocator register_alloc_;
         LabelAllocator label_allocator_{masm_};
         VAddr pc_{};
+        VAddr block_start_{};
+        // translator fetch
+        VAddr instr_host_{};
+        VAddr fetch_page_{~VAddr(0)};
+        VAddr fetch_host_{};
+        u16 code_page_count_{};
+        Decode::A64::BlockPreDecoder pre_decoder_;
+        std::vector<Decode::A64::PreDecoded> pre_decoded_;
+        u32 code_reserved_{};
+        // host code offset of each guest instruction in this block
+        std::vector<u32> instr_offsets_;
         u32 current_block_ticks_{1};
         bool terminal{false};
         JitCacheEntry *current_cache_entry_{};
+        JitTier tier_{JitTier::Baseline};
 
         // mmu
         void LookupTLB(const Register &rt, const VirtualAddress &va, Label *miss_cache);
         // lookup l1 cache
         void LookupL1(const Register &rt, const VirtualAddress &va, const Register &tmp, Label *miss_cache);
+        // put the pte of va into its l1 slot, pte is kept
+        void FillL1(const Register &pte, const Register &va, const Register &tmp);
+        // bump the l1 counters of the current block
+        void CountL1(bool hit, const Register &tmp1, const Register &tmp2);
 
         u8 address_bits_unused_{};
         u8 page_bits_{};
         u8 tlb_bits_{};
         A64MMU *mmu_{};
+        bool fastmem_{false};
+        bool emulate_exclusive_{false};
+        u8 exclusive_table_bits_{};
+        bool profile_l1_{false};
     };
 
     using ContextA64 = JitContext *;
 
     class RegisterGuard {
     public:
+        // no instruction touches more than rn, rt, rt2, rs
+        constexpr static int max_targets = 4;
 
-        RegisterGuard(const ContextA64 &context, const std::vector<Register> &targets);
+        // invalid (NoReg) targets are skipped
+        RegisterGuard(const ContextA64 &context, std::initializer_list<Register> targets);
 
         ~RegisterGuard();
 
@@ -236,14 +349,13 @@ namespace Jit::A64 {
 
     private:
 
-        void Resize(int reg_count);
-
         ContextA64 context_;
-        std::vector<Register> targets_;
-        std::vector<Register> tmps_;
-        std::vector<bool> use_tmp_{false};
-        std::vector<bool> dirty_{false};
-        std::array<int, 32> tmp_peeks_;
+        int target_count_{0};
+        std::array<Register, max_targets> targets_;
+        std::array<Register, max_targets> tmps_;
+        std::array<bool, max_targets> use_tmp_{};
+        std::array<bool, max_targets> dirty_{};
+        std::array<std::int8_t, 32> tmp_peeks_;
     };
 
 }
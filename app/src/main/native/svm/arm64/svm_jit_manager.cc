@@ -2,12 +2,24 @@
 // Created by SwiftGan on 2020/8/23.
 //
 
+#include <algorithm>
 #include <base/log.h>
 #include "svm_jit_manager.h"
 #include "svm_thread.h"
+#include "backend/arm64/ir_backend_a64.h"
 
 using namespace Jit::A64;
 
+// a code reservation of this thread is open, see JitContext::BeginBlock
+static thread_local u32 block_open_{0};
+
+struct PendingJit {
+    JitCacheEntry *entry;
+    int nest;
+};
+
+static thread_local std::vector<PendingJit> pending_jits_;
+
 JitManager::JitManager(const SharedPtr<Instance> &instance) : instance_(instance), queue_{0x1000} {
     jit_cache_ = SharedPtr<JitCacheA64>(new JitCacheA64(0x10000, 0x1000));
 }
@@ -26,7 +38,24 @@ const SharedPtr<Instance> &JitManager::GetInstance() const {
 
 void JitManager::CommitJit(JitCacheEntry *entry) {
     EmplaceCacheAllocation(entry);
-    queue_.push(entry);
+    queue_.push({entry, JitTier::Baseline});
+}
+
+bool JitManager::CommitOptimize(JitCacheEntry *entry) {
+    if (!entry || entry->Data().tier != JitTier::Baseline || entry->Data().ir_rejected) {
+        return true;
+    }
+    if (jit_threads_.empty()) {
+        // nobody pops the queue, the guest thread is outside generated code here
+        {
+            SpinLockGuard guard(entry->Data().jit_lock);
+            OptimizeUnsafe(entry);
+        }
+        JitPending();
+        return true;
+    }
+    // never block the guest thread on a full queue
+    return queue_.try_push({entry, JitTier::Optimized});
 }
 
 void JitManager::JitNow(JitCacheEntry *entry) {
@@ -40,9 +69,16 @@ void JitManager::JitNow(JitCacheEntry *entry) {
 }
 
 void JitManager::JitFromQueue() {
-    JitCacheEntry *entry{};
-    queue_.pop(entry);
-    if (entry && !entry->Data().ready) {
+    JitRequest request{};
+    queue_.pop(request);
+    auto entry = request.entry;
+    if (!entry) {
+        return;
+    }
+    if (request.tier == JitTier::Optimized) {
+        SpinLockGuard guard(entry->Data().jit_lock);
+        OptimizeUnsafe(entry);
+    } else if (!entry->Data().ready) {
         SpinLockGuard guard(entry->Data().jit_lock);
         if (entry->Data().ready) {
             return;
@@ -53,33 +89,172 @@ void JitManager::JitFromQueue() {
 }
 
 void JitManager::JitUnsafe(JitCacheEntry *entry) {
-    const auto &thread_context = ThreadContext::Current();
-    auto pc = entry->addr_start;
-    // peek code block
-    auto &code_block = entry->Data().code_block;
-
     EmplaceCacheAllocation(entry);
-    auto buffer = code_block->GetBuffer(entry->Data().id_in_block);
-    JitContext jit_context(*instance_);
-    jit_context.SetCacheEntry(entry);
-    thread_context->PushJitContext(&jit_context);
-    jit_context.BeginBlock(entry->addr_start);
-    while (thread_context->JitInstr(pc)) {
-        pc += 4;
-        jit_context.Tick();
-    }
-    thread_context->PopJitContext();
-    entry->addr_end = pc + 4;
-    auto cache_size = jit_context.BlockCacheSize();
-    code_block->FlushCodeBuffer(buffer, cache_size);
-    jit_context.EndBlock();
+    Translate(entry, JitTier::Baseline);
     entry->Data().ready = true;
     jit_cache_->Flush(entry);
-    code_block->GenDispatcher(buffer);
+}
+
+void JitManager::OptimizeUnsafe(JitCacheEntry *entry) {
+    auto &data = entry->Data();
+    // baseline not finished yet, already optimized or the ir backend can not take it
+    if (!data.ready || data.tier != JitTier::Baseline || data.ir_rejected) {
+        return;
+    }
+    data.tier = JitTier::Optimized;
+    // new code goes to a fresh buffer offset, old code keeps running
+    // until the dispatcher slot is swapped in Translate
+    auto old_block = data.code_block;
+    auto old_buffer = old_block->GetBuffer(data.id_in_block);
+    u32 old_offset = old_buffer->offset_;
+    u32 old_size = AlignUp<u32>(old_buffer->size_, 2);
+    if (!Translate(entry, JitTier::Optimized)) {
+        data.tier = JitTier::Baseline;
+        data.ir_rejected = true;
+        return;
+    }
+    if (data.code_block != old_block) {
+        // moved to a spare code block, the old slot must not lead to the baseline code any more
+        old_block->ResetDispatcher(old_buffer);
+    }
+    RetireCode(old_block, old_offset, old_size);
+}
+
+void JitManager::RetireCode(CodeBlock *code_block, u32 offset, u32 size) {
+    // slot already points away, threads entering generated code from now on can not reach it
+    auto epoch = code_epoch_.fetch_add(1);
+    SpinLockGuard guard(retired_lock_);
+    retired_code_.push_back({code_block, offset, size, epoch});
+    retired_count_.store(static_cast<u32>(retired_code_.size()), std::memory_order_relaxed);
+}
+
+void JitManager::ReclaimCode() {
+    if (!retired_count_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    u64 oldest{UINT64_MAX};
+    {
+        SpinLockGuard guard(code_runners_lock_);
+        for (auto running : code_runners_) {
+            oldest = std::min(oldest, __atomic_load_n(running, __ATOMIC_SEQ_CST));
+        }
+    }
+    SpinLockGuard guard(retired_lock_);
+    auto end = std::remove_if(retired_code_.begin(), retired_code_.end(), [oldest](const RetiredCode &retired) {
+        // every guest thread left generated code after it was retired
+        if (retired.epoch >= oldest) {
+            return false;
+        }
+        retired.code_block->FreeCodeRange(retired.offset, retired.size);
+        return true;
+    });
+    retired_code_.erase(end, retired_code_.end());
+    retired_count_.store(static_cast<u32>(retired_code_.size()), std::memory_order_relaxed);
+}
+
+void JitManager::AddCodeRunner(u64 *running_epoch) {
+    SpinLockGuard guard(code_runners_lock_);
+    code_runners_.push_back(running_epoch);
+}
+
+void JitManager::RemoveCodeRunner(u64 *running_epoch) {
+    SpinLockGuard guard(code_runners_lock_);
+    code_runners_.erase(std::remove(code_runners_.begin(), code_runners_.end(), running_epoch),
+                        code_runners_.end());
+}
+
+u64 JitManager::CodeEpoch() const {
+    return code_epoch_.load();
+}
+
+bool JitManager::Translate(JitCacheEntry *entry, JitTier tier) {
+    const auto &thread_context = ThreadContext::Current();
+    auto pc = entry->addr_start;
+    auto jit_context = thread_context->AcquireJitContext();
+    auto malloc_count = jit_context->GetLabelAlloc().MallocCount();
+    jit_context->SetCacheEntry(entry);
+    jit_context->SetTier(tier);
+    VAddr end{0};
+    block_open_++;
+    if (tier == JitTier::Optimized) {
+        // ends the block itself, 0 if the ir backend can not take it
+        auto &ir_backend = thread_context->IRBackend();
+        auto rejected = ir_backend.Rejected();
+        end = ir_backend.Translate(*jit_context, entry->addr_start);
+        if (ir_backend.Rejected() != rejected) {
+            // no code reserved, the baseline code stays where it is
+            block_open_--;
+            thread_context->ReleaseJitContext();
+            return false;
+        }
+    }
+    if (end) {
+        stats_.ir_blocks++;
+    } else {
+        auto heap_allocs = ThreadHeapAllocs();
+        jit_context->BeginBlock(entry->addr_start);
+        jit_context->PreDecode(entry->addr_start);
+        while (true) {
+            auto run = jit_context->EmitPassThroughRun(pc);
+            if (run) {
+                // pc is the last instruction of the run
+                pc += (run - 1) * 4;
+            } else if (!thread_context->JitInstr(pc)) {
+                break;
+            }
+            jit_context->Tick(run ? run : 1);
+            if (jit_context->CodeSpaceLow()) {
+                jit_context->SplitBlock();
+                break;
+            }
+            pc += 4;
+        }
+        end = pc + 4;
+        jit_context->EndBlock();
+        stats_.heap_allocs += ThreadHeapAllocs() - heap_allocs;
+    }
+    block_open_--;
+    entry->addr_end = end;
+    // BeginBlock may have moved the entry to a spare code block
+    auto code_block = entry->Data().code_block;
+    code_block->GenDispatcher(code_block->GetBuffer(entry->Data().id_in_block));
+    stats_.blocks++;
+    stats_.arena_mallocs += jit_context->GetLabelAlloc().MallocCount() - malloc_count;
+    thread_context->ReleaseJitContext();
+    if (instance_->GetJitConfig().profile_l1 && tier == JitTier::Baseline) {
+        SpinLockGuard guard(profiled_lock_);
+        profiled_blocks_.push_back(entry);
+    }
+    return true;
+}
+
+void JitManager::DumpL1Stats() {
+    SpinLockGuard guard(profiled_lock_);
+    u64 total_hits{0}, total_misses{0};
+    for (auto entry : profiled_blocks_) {
+        auto &data = entry->Data();
+        u64 accesses = u64(data.l1_hits) + data.l1_misses;
+        if (!accesses) {
+            continue;
+        }
+        total_hits += data.l1_hits;
+        total_misses += data.l1_misses;
+        LOGD("L1: block 0x%llx hits %u misses %u rate %.1f%%", static_cast<unsigned long long>(entry->addr_start),
+             data.l1_hits, data.l1_misses, data.l1_hits * 100.0 / accesses);
+    }
+    if (total_hits + total_misses) {
+        LOGD("L1: total hits %llu misses %llu rate %.1f%%", static_cast<unsigned long long>(total_hits),
+             static_cast<unsigned long long>(total_misses), total_hits * 100.0 / (total_hits + total_misses));
+    }
+}
+
+const JitStats &JitManager::Stats() const {
+    return stats_;
 }
 
 JitCacheEntry *JitManager::EmplaceJit(VAddr addr) {
     auto entry = jit_cache_->Emplace(addr);
+    bool jitted{false};
     if (entry && !entry->Data().ready) {
         auto &jit_lock = entry->Data().jit_lock;
         if (jit_lock.LockedBySelf())
@@ -88,38 +263,75 @@ JitCacheEntry *JitManager::EmplaceJit(VAddr addr) {
         if (entry->Data().ready) {
             return entry;
         }
-        // do jit now
-        JitNestGuard nest_guard;
         bool is_emu_thread = ThreadContext::Current()->Type() == EmuThreadType;
-        if (!is_emu_thread || JitNestGuard::CurrentNest() > 8) {
+        if (!is_emu_thread || JitNestGuard::CurrentNest() >= 8) {
             CommitJit(entry);
+        } else if (block_open_) {
+            // nested reservations would strand the unused tail of ours, jit it after EndBlock.
+            // its dispatcher slot goes to the lookup stub until then
+            EmplaceCacheAllocation(entry);
+            pending_jits_.push_back({entry, JitNestGuard::CurrentNest() + 1});
         } else {
+            // do jit now
             JitUnsafe(entry);
+            jitted = true;
         }
     }
+    if (jitted) {
+        JitPending();
+    }
     return entry;
 }
 
+void JitManager::JitPending() {
+    while (!pending_jits_.empty()) {
+        auto pending = pending_jits_.back();
+        pending_jits_.pop_back();
+        JitNestGuard nest_guard(pending.nest);
+        JitNow(pending.entry);
+    }
+}
+
 void JitManager::EmplaceCacheAllocation(JitCacheEntry *entry) {
-    auto &code_block = entry->Data().code_block;
-    if (!code_block) {
-        code_block = instance_->PeekCacheBlock(entry->addr_start);
+    auto &data = entry->Data();
+    if (!data.code_block) {
+        data.code_block = instance_->PeekCacheBlock(entry->addr_start);
     }
-    if (!entry->Data().id_in_block) {
-        auto buffer = code_block->AllocCodeBuffer(entry->addr_start);
-        entry->Data().id_in_block = buffer->id_;
-        cache_find_table_->FillCodeAddress(entry->addr_start, code_block->GetDispatcherAddr(buffer));
+    if (!data.id_in_block) {
+        auto buffer = data.code_block ? data.code_block->AllocCodeBuffer(entry->addr_start) : nullptr;
+        while (!buffer) {
+            // out of buffer ids or space
+            data.code_block = instance_->SpareCacheBlock(data.code_block);
+            buffer = data.code_block->AllocCodeBuffer(entry->addr_start);
+        }
+        __atomic_store_n(&data.id_in_block, buffer->id_, __ATOMIC_RELEASE);
+        cache_find_table_->FillCodeAddress(entry->addr_start, data.code_block->GetDispatcherAddr(buffer));
+    }
+}
+
+void JitManager::MoveCacheAllocation(JitCacheEntry *entry) {
+    auto &data = entry->Data();
+    auto spare = data.code_block;
+    Buffer *buffer{};
+    while (!buffer) {
+        spare = instance_->SpareCacheBlock(spare);
+        buffer = spare->AllocCodeBuffer(entry->addr_start);
     }
+    // GetStub gives 0 until both fields are the new pair
+    __atomic_store_n(&data.code_block, static_cast<CodeBlock *>(nullptr), __ATOMIC_RELAXED);
+    __atomic_store_n(&data.id_in_block, buffer->id_, __ATOMIC_RELEASE);
+    __atomic_store_n(&data.code_block, spare, __ATOMIC_RELEASE);
+    cache_find_table_->FillCodeAddress(entry->addr_start, spare->GetDispatcherAddr(buffer));
 }
 
 static thread_local int jit_nested_{0};
 
-JitNestGuard::JitNestGuard() {
-    jit_nested_++;
+JitNestGuard::JitNestGuard(int nest) : outer_(jit_nested_) {
+    jit_nested_ = nest;
 }
 
 JitNestGuard::~JitNestGuard() {
-    jit_nested_--;
+    jit_nested_ = outer_;
 }
 
 int JitNestGuard::CurrentNest() {
@@ -9,6 +9,7 @@
 #include <block/code_cache.h>
 #include <block/host_code_block.h>
 #include <list>
+#include <vector>
 #include <block/code_find_table.h>
 
 namespace SVM::A64 {
@@ -22,32 +23,74 @@ namespace Jit::A64 {
 
     constexpr static size_t page_bits = 12;
 
+    enum class JitTier : u8 {
+        // fast translation, carries the execution counter
+        Baseline,
+        // recompiled once the block became hot
+        Optimized
+    };
+
     class JitCacheBlock : NonCopyable {
     public:
         JitCacheBlock() = default;
         JitCacheBlock(CodeBlock *codeBlock);
         ~JitCacheBlock() = default;
 
-        constexpr VAddr GetStub() const {
-            if (!code_block || !id_in_block) {
+        // both fields change when the block moves to a spare code block, see JitManager::MoveCacheAllocation.
+        // code_block is cleared while id_in_block changes, a reader seeing it unchanged around id_in_block got a pair
+        VAddr GetStub() const {
+            auto block = __atomic_load_n(&code_block, __ATOMIC_ACQUIRE);
+            auto id = __atomic_load_n(&id_in_block, __ATOMIC_ACQUIRE);
+            if (!block || !id || __atomic_load_n(&code_block, __ATOMIC_ACQUIRE) != block) {
                 return 0;
             }
-            auto buffer = code_block->GetBuffer(id_in_block);
-            if (buffer) {
-                return code_block->GetDispatcherAddr(buffer);
-            }
-            return 0;
+            return block->GetDispatcherAddr(block->GetBuffer(id));
         }
 
         CodeBlock *code_block{nullptr};
         u16 id_in_block{0};
         bool ready{false};
+        JitTier tier{JitTier::Baseline};
+        // bumped by generated code on every block entry while in baseline tier,
+        // a plain load / add / store there, so relaxed on this side too
+        std::atomic<u32> exec_count{0};
+        // the ir backend can not take this block, it stays baseline and is not counted any more
+        bool ir_rejected{false};
+        // sp relative accesses of this block, only counted with JitConfig::profile_l1
+        u32 l1_hits{0};
+        u32 l1_misses{0};
+        // guest code pages [code_page, + code_page_count) the block was fetched from
+        VAddr code_page{0};
+        u16 code_page_count{0};
         SpinMutex jit_lock;
     };
 
     using JitCacheA64 = Jit::JitCache<JitCacheBlock, page_bits>;
     using JitCacheEntry = JitCacheA64::Entry;
 
+    struct JitRequest {
+        JitCacheEntry *entry;
+        JitTier tier;
+    };
+
+    // baseline code replaced by the optimizer, offset and size in instructions
+    struct RetiredCode {
+        CodeBlock *code_block;
+        u32 offset;
+        u32 size;
+        u64 epoch;
+    };
+
+    struct JitStats {
+        std::atomic<u64> blocks{0};
+        // malloc calls made by label arenas while translating
+        std::atomic<u64> arena_mallocs{0};
+        // operator new calls between BeginBlock and EndBlock, see ThreadHeapAllocs
+        std::atomic<u64> heap_allocs{0};
+        // optimized blocks the ir backend emitted, the rest went through the decoder again
+        std::atomic<u64> ir_blocks{0};
+    };
+
     class JitManager : public BaseObject {
     public:
         JitManager(const SharedPtr<Instance> &instance);
@@ -60,28 +103,66 @@ namespace Jit::A64 {
 
         void CommitJit(JitCacheEntry *entry);
 
+        // false if the queue is full, the caller asks again later
+        bool CommitOptimize(JitCacheEntry *entry);
+
         void JitNow(JitCacheEntry *entry);
 
         void JitFromQueue();
 
+        // code block of entry has no room for a reservation, give it a buffer in a spare one
+        void MoveCacheAllocation(JitCacheEntry *entry);
+
+        // guest threads publish the code epoch they entered generated code at, UINT64_MAX while outside
+        void AddCodeRunner(u64 *running_epoch);
+        void RemoveCodeRunner(u64 *running_epoch);
+        u64 CodeEpoch() const;
+
+        // free retired code no guest thread can still be running
+        void ReclaimCode();
+
+        const JitStats &Stats() const;
+
+        // log l1 dcache hit rate of every profiled block
+        void DumpL1Stats();
+
     private:
 
         void JitUnsafe(JitCacheEntry *entry);
+        void OptimizeUnsafe(JitCacheEntry *entry);
+        // false if the optimized tier was rejected by the ir backend, nothing changed then
+        bool Translate(JitCacheEntry *entry, JitTier tier);
         void EmplaceCacheAllocation(JitCacheEntry *entry);
+        // targets met while a code reservation of this thread was open
+        void JitPending();
+        void RetireCode(CodeBlock *code_block, u32 offset, u32 size);
 
         SharedPtr<Instance> instance_;
         SharedPtr<JitCacheA64> jit_cache_;
         SharedPtr<FindTable<VAddr>> cache_find_table_;
-        rigtorp::MPMCQueue<JitCacheEntry *> queue_;
+        rigtorp::MPMCQueue<JitRequest> queue_;
         std::list<SharedPtr<JitThread>> jit_threads_;
+        JitStats stats_;
+        SpinMutex profiled_lock_;
+        std::vector<JitCacheEntry *> profiled_blocks_;
+        std::atomic<u64> code_epoch_{0};
+        SpinMutex code_runners_lock_;
+        std::vector<u64 *> code_runners_;
+        SpinMutex retired_lock_;
+        std::vector<RetiredCode> retired_code_;
+        std::atomic<u32> retired_count_{0};
     };
 
     class JitNestGuard {
     public:
-        JitNestGuard();
+        // blocks translated in this scope are at nest level nest
+        explicit JitNestGuard(int nest);
         ~JitNestGuard();
 
         static int CurrentNest();
+
+    private:
+        int outer_;
     };
 
 }
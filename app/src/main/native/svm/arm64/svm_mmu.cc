@@ -7,7 +7,12 @@
 using namespace SVM::A64;
 
 A64MMU::A64MMU(u8 page_bits, u8 addr_with, bool tlb_per_thread) : MMU(
-        page_bits, addr_with, tlb_per_thread) {}
+        page_bits, addr_with, tlb_per_thread) {
+    // block pages are found by adding to index_, which only lines up with the page number here
+    if (page_bits == PAGE_BITS) {
+        block_flag_ = PageAttrs::Block;
+    }
+}
 
 VAddr A64MMU::GetPageStart(PTE &pte) {
     return pte.index_ << page_bits_;
@@ -21,6 +26,10 @@ bool A64MMU::PageWritable(PTE &pte) {
     return static_cast<bool>(pte.attrs_ & PageAttrs::Write);
 }
 
+bool A64MMU::PageExecutable(PTE &pte) {
+    return static_cast<bool>(pte.attrs_ & PageAttrs::Execute);
+}
+
 void A64MMU::HostReadCallback(VAddr host_addr, std::size_t size) {
 }
 
@@ -33,3 +42,65 @@ void A64MMU::InvalidRead(VAddr vaddr, std::size_t size) {
 void A64MMU::InvalidWrite(VAddr vaddr, std::size_t size) {
     abort();
 }
+
+u32 A64MMU::AddMemoryHook(VAddr vaddr, VAddr size, bool read, bool write, const MemoryHook &hook) {
+    u32 id;
+    {
+        std::unique_lock guard(hooks_lock_);
+        id = next_hook_id_++;
+        hooks_.push_back({id, vaddr, vaddr + size, read, write, hook});
+    }
+    UpdateSpecBits(AlignDown(vaddr, page_size_), AlignUp(vaddr + size, page_size_));
+    return id;
+}
+
+std::pair<VAddr, VAddr> A64MMU::RemoveMemoryHook(u32 id) {
+    VAddr start, end;
+    {
+        std::unique_lock guard(hooks_lock_);
+        auto it = std::find_if(hooks_.begin(), hooks_.end(), [id](const HookEntry &entry) {
+            return entry.id == id;
+        });
+        if (it == hooks_.end()) {
+            return {0, 0};
+        }
+        start = AlignDown(it->start, page_size_);
+        end = AlignUp(it->end, page_size_);
+        hooks_.erase(it);
+    }
+    UpdateSpecBits(start, end);
+    return {start, end - start};
+}
+
+bool A64MMU::CallMemoryHooks(VAddr vaddr, std::size_t size, bool write, void *data) {
+    std::shared_lock guard(hooks_lock_);
+    bool handled = false;
+    for (auto &entry : hooks_) {
+        if ((write ? entry.write : entry.read) && vaddr < entry.end && vaddr + size > entry.start) {
+            handled |= entry.hook(vaddr, size, write, data);
+        }
+    }
+    return handled;
+}
+
+void A64MMU::UpdateSpecBits(VAddr page_start, VAddr page_end) {
+    std::shared_lock guard(hooks_lock_);
+    // pages may be shared with other hooks, recompute from all of them and write once
+    ProtectRange(page_start, page_end - page_start, [&](PTE &pte, VAddr start, VAddr end) -> bool {
+        u32 bits = 0;
+        for (auto &entry : hooks_) {
+            auto hook_start = AlignDown(entry.start, page_size_);
+            auto hook_end = AlignUp(entry.end, page_size_);
+            if (hook_end <= start || hook_start >= end) {
+                continue;
+            }
+            if (hook_start > start || hook_end < end) {
+                // hook covers part of a block
+                return false;
+            }
+            bits |= (entry.read ? PageAttrs::ReadSpec : 0) | (entry.write ? PageAttrs::WriteSpec : 0);
+        }
+        pte.attrs_ = (pte.attrs_ & ~(PageAttrs::ReadSpec | PageAttrs::WriteSpec)) | bits;
+        return true;
+    });
+}
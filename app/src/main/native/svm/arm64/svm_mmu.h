@@ -6,6 +6,8 @@
 
 #include <base/marcos.h>
 #include "memory/mmu.h"
+#include <functional>
+#include <shared_mutex>
 
 using namespace Memory;
 
@@ -14,13 +16,16 @@ namespace SVM::A64 {
 #define PAGE_BITS 12
 #define WRITE_SPEC_BITS 3
 #define READ_SPEC_BITS 4
+#define BLOCK_BITS 5
 
     enum PageAttrs {
         Read        = 1 << 0,
         Write       = 1 << 1,
         Execute     = 1 << 2,
         WriteSpec   = 1 << WRITE_SPEC_BITS,
-        ReadSpec    = 1 << READ_SPEC_BITS
+        ReadSpec    = 1 << READ_SPEC_BITS,
+        // root entry maps a whole final table span of contiguous host pages, never cached in a TLB
+        Block       = 1 << BLOCK_BITS
     };
 
     union PTE {
@@ -28,9 +33,10 @@ namespace SVM::A64 {
            target_ = 0;
         }
         VAddr target_;
+        // host page | attrs, attr bits are tested directly by generated code
         struct {
-            VAddr attrs_:sizeof(VAddr) * 8 - PAGE_BITS;
-            VAddr index_:PAGE_BITS;
+            VAddr attrs_:PAGE_BITS;
+            VAddr index_:sizeof(VAddr) * 8 - PAGE_BITS;
         };
         bool operator==(const PTE& rhs) const {
             return rhs.target_ == target_;
@@ -40,15 +46,31 @@ namespace SVM::A64 {
         }
     };
 
+    // data: value being stored, or buffer to fill for a load
+    // return true if the hook performed the access, false to let it hit memory (watchpoint)
+    using MemoryHook = std::function<bool(VAddr vaddr, std::size_t size, bool write, void *data)>;
+
     class A64MMU : public MMU<VAddr, PTE> {
     public:
         A64MMU(u8 page_bits, u8 addr_with, bool tlb_per_thread = false);
+
+        // marks the pages of the range ReadSpec/WriteSpec, returns id for RemoveMemoryHook
+        u32 AddMemoryHook(VAddr vaddr, VAddr size, bool read, bool write, const MemoryHook &hook);
+
+        // returns the page range whose spec bits were recomputed, size 0 if id unknown
+        std::pair<VAddr, VAddr> RemoveMemoryHook(u32 id);
+
+        // called on spec page accesses, true if any hook performed the access
+        bool CallMemoryHooks(VAddr vaddr, std::size_t size, bool write, void *data);
+
         VAddr GetPageStart(PTE &pte) override;
 
         bool PageReadable(PTE &pte) override;
 
         bool PageWritable(PTE &pte) override;
 
+        bool PageExecutable(PTE &pte);
+
         void HostReadCallback(VAddr host_addr, std::size_t size) override;
 
         void HostWriteCallback(VAddr host_addr, std::size_t size) override;
@@ -56,6 +78,22 @@ namespace SVM::A64 {
         void InvalidRead(VAddr vaddr, std::size_t size) override;
 
         void InvalidWrite(VAddr vaddr, std::size_t size) override;
+
+    private:
+        struct HookEntry {
+            u32 id;
+            VAddr start;
+            VAddr end;
+            bool read;
+            bool write;
+            MemoryHook hook;
+        };
+
+        void UpdateSpecBits(VAddr page_start, VAddr page_end);
+
+        std::shared_mutex hooks_lock_;
+        std::vector<HookEntry> hooks_;
+        u32 next_hook_id_{1};
     };
 
 
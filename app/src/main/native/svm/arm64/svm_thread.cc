@@ -7,6 +7,10 @@
 #include <memory>
 #include "decode/decode_vixl.h"
 #include "svm_jit_manager.h"
+#include "frontend/arm64/ir_lifter_a64.h"
+#include "frontend/arm64/pass_a64.h"
+#include "backend/ir/interpreter_ir.h"
+#include "backend/arm64/ir_backend_a64.h"
 
 using namespace Jit::A64;
 using namespace Decode::A64;
@@ -20,6 +24,8 @@ ThreadContext::ThreadContext(const SharedPtr<Instance> &instance) : instance_(in
     jit_decode_->AppendVisitor(jit_visitor_.get());
 }
 
+ThreadContext::~ThreadContext() = default;
+
 const SharedPtr<ThreadContext> &ThreadContext::Current() {
     return current_context_;
 }
@@ -35,12 +41,24 @@ const ContextA64 ThreadContext::GetJitContext() const {
 
 bool ThreadContext::JitInstr(VAddr addr) {
     auto context = jit_visitor_->Context();
-    context->SetPC(addr);
-    jit_decode_->Decode(reinterpret_cast<Instruction*>(addr));
+    context->BeginInstr(addr);
+    auto host = context->FetchInstr(addr);
+    if (!host) {
+        context->FetchFatal();
+        return false;
+    }
+    jit_decode_->Decode(reinterpret_cast<vixl::aarch64::Instruction*>(host));
     return !context->Termed();
 }
 
 
+Backend::A64::IRBackendA64 &ThreadContext::IRBackend() {
+    if (!ir_backend_) {
+        ir_backend_ = std::make_unique<Backend::A64::IRBackendA64>(*instance_);
+    }
+    return *ir_backend_;
+}
+
 void ThreadContext::PushJitContext(ContextA64 context) {
     jit_visitor_->PushContext(context);
 }
@@ -49,6 +67,21 @@ void ThreadContext::PopJitContext() {
     jit_visitor_->PopContext();
 }
 
+ContextA64 ThreadContext::AcquireJitContext() {
+    if (jit_context_depth_ == jit_context_pool_.size()) {
+        jit_context_pool_.emplace_back(std::make_unique<JitContext>(*instance_));
+    }
+    auto context = jit_context_pool_[jit_context_depth_++].get();
+    PushJitContext(context);
+    return context;
+}
+
+void ThreadContext::ReleaseJitContext() {
+    assert(jit_context_depth_ > 0);
+    PopJitContext();
+    jit_context_depth_--;
+}
+
 const SharedPtr<Instance> &ThreadContext::GetInstance() const {
     return instance_;
 }
@@ -62,15 +95,120 @@ EmuThreadContext::EmuThreadContext(const SharedPtr<Instance> &instance) : Thread
     auto mmu_ = instance->GetMmu();
     if (mmu_) {
         cpu_context_.page_table = mmu_->TopPageTable();
-        cpu_context_.tlb = mmu_->Tbl()->TLBTablePtr();
+        if (mmu_->Tbl()) {
+            cpu_context_.tlb = mmu_->Tbl()->TLBTablePtr();
+        } else {
+            tlb_ = mmu_->CreateThreadTLB();
+            tlb_->SetShootdownFlag(&cpu_context_.suspend_flag, SuspendFlag::TLBShootdown, &code_epoch_);
+            // same {page index, pte} layout
+            tlb_->SetL1(reinterpret_cast<const Memory::TLBEntry<VAddr, PTE> *>(cpu_context_.l1_dcache.data()),
+                        l1_page_bits);
+            cpu_context_.tlb = tlb_->TLBTablePtr();
+        }
+    }
+    if (instance->GetFastMem()) {
+        cpu_context_.fastmem_base = instance->GetFastMem()->Base();
+    }
+    if (instance->GetExclusiveMonitor()) {
+        cpu_context_.exclusive_table = instance->GetExclusiveMonitor()->TablePtr();
+    }
+    cpu_context_.exclusive.addr = exclusive_none;
+    instance->GetJitManager()->AddCodeRunner(&code_epoch_);
+}
+
+EmuThreadContext::~EmuThreadContext() {
+    instance_->GetJitManager()->RemoveCodeRunner(&code_epoch_);
+    if (tlb_) {
+        instance_->GetMmu()->SetThreadTLB(nullptr);
+        instance_->GetMmu()->DestroyThreadTLB(tlb_);
     }
 }
 
 void EmuThreadContext::Run(size_t ticks) {
     cpu_context_.ticks_max += ticks;
+    if (tlb_) {
+        instance_->GetMmu()->SetThreadTLB(tlb_.get());
+    }
+    CheckShootdown();
     LookupJitCache();
-    __sync_synchronize();
+    EnterCode();
     instance_->GetGlobalStubs()->RunCode(&cpu_context_);
+    LeaveCode();
+    CheckShootdown();
+    CheckTierUp();
+}
+
+void EmuThreadContext::RunInterpreter(size_t ticks) {
+    cpu_context_.ticks_max += ticks;
+    if (tlb_) {
+        instance_->GetMmu()->SetThreadTLB(tlb_.get());
+    }
+    CheckShootdown();
+    while (cpu_context_.ticks_now < cpu_context_.ticks_max &&
+           !(__atomic_load_n(&cpu_context_.suspend_flag, __ATOMIC_ACQUIRE) & SuspendFlag::SuspendRequest)) {
+        if (!InterpretBlock()) {
+            cpu_context_.interrupt.reason = InterruptHelp::ErrorInstr;
+            Interrupt(cpu_context_.interrupt);
+        }
+        CheckShootdown();
+    }
+}
+
+bool EmuThreadContext::InterpretBlock() {
+    auto program = IRProgram(cpu_context_.pc);
+    if (!program) {
+        return false;
+    }
+    if (!interpreter_->Run(*program)) {
+        Interrupt(cpu_context_.interrupt);
+    }
+    return true;
+}
+
+void EmuThreadContext::ClearIRCache() {
+    ir_cache_.clear();
+}
+
+void EmuThreadContext::DumpIRPassStats() {
+    if (ir_passes_) {
+        ir_passes_->DumpStats();
+    }
+}
+
+Backend::IR::ProgramIR *EmuThreadContext::IRProgram(VAddr pc) {
+    auto it = ir_cache_.find(pc);
+    if (it != ir_cache_.end()) {
+        return it->second.get();
+    }
+    auto mmu = instance_->GetMmu().get();
+    if (!interpreter_) {
+        interpreter_ = std::make_unique<Backend::IR::InterpreterIR>(&cpu_context_, mmu,
+                                                                    instance_->GetExclusiveMonitor().get());
+        ir_lifter_ = std::make_unique<Instructions::A64::IRLifterA64>();
+        // forwarded registers give the folder constants, both leave dead values behind
+        ir_passes_ = std::make_unique<Jit::IR::PassManagerIR>();
+        ir_passes_->Add(std::make_unique<Instructions::A64::ContextForwardPassA64>());
+        ir_passes_->Add(std::make_unique<Jit::IR::ConstantFoldPass>());
+        ir_passes_->Add(std::make_unique<Jit::IR::DeadCodePass>());
+    }
+    std::unique_ptr<Backend::IR::ProgramIR> program;
+    {
+        Jit::IR::CodeBlock block{pc};
+        bool lifted = ir_lifter_->Lift(block, [mmu](VAddr va) -> VAddr {
+            if (!mmu) {
+                return va;
+            }
+            auto pte = mmu->GetPage(va & ~mmu->page_mask_);
+            return pte && mmu->PageExecutable(*pte) ? mmu->GetPageStart(*pte) + (va & mmu->page_mask_) : 0;
+        });
+        if (lifted) {
+            ir_passes_->Run(block);
+            program = interpreter_->Compile(block);
+        }
+    }
+    // the ir is only needed until compiled
+    Instructions::IR::InstrIRArena::Current().Reset();
+    return ir_cache_.emplace(pc, std::move(program)).first->second.get();
 }
 
 ThreadType EmuThreadContext::Type() {
@@ -81,6 +219,235 @@ CPUContext *EmuThreadContext::GetCpuContext() {
     return &cpu_context_;
 }
 
+void EmuThreadContext::CheckTierUp() {
+    auto entry = reinterpret_cast<JitCacheEntry *>(cpu_context_.tier_up_entry);
+    // queue full, ask again on the next poll
+    if (entry && instance_->GetJitManager()->CommitOptimize(entry)) {
+        cpu_context_.tier_up_entry = 0;
+    }
+}
+
+void EmuThreadContext::EnterCode() {
+    __atomic_store_n(&code_epoch_, instance_->GetJitManager()->CodeEpoch(), __ATOMIC_SEQ_CST);
+    // the epoch is visible before any dispatcher slot is read
+    __sync_synchronize();
+}
+
+void EmuThreadContext::LeaveCode() {
+    __atomic_store_n(&code_epoch_, UINT64_MAX, __ATOMIC_RELEASE);
+    instance_->GetJitManager()->ReclaimCode();
+}
+
+void EmuThreadContext::CheckShootdown() {
+    auto flags = __atomic_fetch_and(&cpu_context_.suspend_flag, ~u64(SuspendFlag::TLBShootdown),
+                                    __ATOMIC_ACQUIRE);
+    if (flags & SuspendFlag::TLBShootdown) {
+        // tlb entries were cleared by the shooter, l1 dcache is private to us
+        cpu_context_.l1_dcache.fill({});
+        if (tlb_) {
+            tlb_->DropStale();
+        }
+        // we may have been the last one holding unmapped host pages
+        instance_->ReleaseUnmappedMemory();
+    }
+}
+
+void EmuThreadContext::HandleMemorySpec() {
+    auto &mmu = instance_->GetMmu();
+    auto va = cpu_context_.interrupt.fatal_addr;
+    // the block was fetched through the mmu too
+    auto instr = mmu->Read<u32>(cpu_context_.pc);
+    // x0 - x30 are laid out in order, 31 is sp as base and zr as transfer register
+    auto regs = reinterpret_cast<u64 *>(cpu_context_.cpu_registers);
+    u64 zr{0};
+    auto transfer_reg = [&](u8 code) -> u64 & {
+        zr = 0;
+        return code == 31 ? zr : regs[code];
+    };
+    if ((instr & 0x3f000000) == 0x08000000) {
+        HandleOrderedSpec(instr);
+        return;
+    }
+    u8 rt = static_cast<u8>(instr & 0x1f);
+    u8 rn = static_cast<u8>((instr >> 5) & 0x1f);
+    u8 rt2 = static_cast<u8>((instr >> 10) & 0x1f);
+    bool pair = ((instr >> 27) & 0b111) == 0b101;
+    bool simd = ((instr >> 26) & 1) != 0;
+    bool load;
+    bool sign_extend = false;
+    bool to_w = false;
+    bool write_back;
+    u32 elem_size;
+    s64 offset;
+    if (pair) {
+        u32 opc = instr >> 30;
+        load = ((instr >> 22) & 1) != 0;
+        elem_size = simd ? (4U << opc) : ((opc & 2) ? 8 : 4);
+        // ldpsw
+        sign_extend = !simd && opc == 1;
+        write_back = ((instr >> 23) & 1) != 0;
+        offset = SignExtendX<s64>(7, (instr >> 15) & 0x7f) * elem_size;
+    } else {
+        u32 size = instr >> 30;
+        u32 opc = (instr >> 22) & 3;
+        if (simd) {
+            load = (opc & 1) != 0;
+            elem_size = (opc & 2) ? 16 : (1U << size);
+        } else {
+            if (size == 3 && opc == 2) {
+                // prfm
+                cpu_context_.pc += 4;
+                return;
+            }
+            load = opc != 0;
+            sign_extend = opc >= 2;
+            to_w = opc == 3;
+            elem_size = 1U << size;
+        }
+        write_back = !((instr >> 24) & 1) && !((instr >> 21) & 1) && ((instr >> 10) & 1);
+        offset = SignExtendX<s64>(9, (instr >> 12) & 0x1ff);
+    }
+    u32 count = pair ? 2 : 1;
+    u8 transfer[2] = {rt, rt2};
+    vixl::byte data[32]{};
+    if (!load) {
+        for (u32 i = 0; i < count; ++i) {
+            if (simd) {
+                std::memcpy(data + i * elem_size, cpu_context_.vector_registers[transfer[i]].B, elem_size);
+            } else {
+                std::memcpy(data + i * elem_size, &transfer_reg(transfer[i]), elem_size);
+            }
+        }
+        if (!mmu->CallMemoryHooks(va, elem_size * count, true, data)) {
+            mmu->WriteMemory(va, data, elem_size * count);
+        }
+    } else {
+        if (!mmu->CallMemoryHooks(va, elem_size * count, false, data)) {
+            mmu->ReadMemory(va, data, elem_size * count);
+        }
+        for (u32 i = 0; i < count; ++i) {
+            if (simd) {
+                auto &vreg = cpu_context_.vector_registers[transfer[i]];
+                std::memset(vreg.B, 0, sizeof(vreg.B));
+                std::memcpy(vreg.B, data + i * elem_size, elem_size);
+                continue;
+            }
+            u64 value{0};
+            std::memcpy(&value, data + i * elem_size, elem_size);
+            if (sign_extend && elem_size < 8) {
+                value = static_cast<u64>(SignExtendX<s64>(elem_size * 8, value));
+            }
+            if (to_w) {
+                value &= UINT32_MAX;
+            }
+            transfer_reg(transfer[i]) = value;
+        }
+    }
+    if (write_back) {
+        (rn == 31 ? cpu_context_.sp : regs[rn]) += offset;
+    }
+    cpu_context_.pc += 4;
+}
+
+void EmuThreadContext::HandleOrderedSpec(u32 instr) {
+    auto &mmu = instance_->GetMmu();
+    auto &monitor = instance_->GetExclusiveMonitor();
+    auto va = cpu_context_.interrupt.fatal_addr;
+    auto regs = reinterpret_cast<u64 *>(cpu_context_.cpu_registers);
+    auto access = [&](void *data, size_t size, bool write) {
+        if (mmu->CallMemoryHooks(va, size, write, data)) {
+            return;
+        }
+        if (write) {
+            mmu->WriteMemory(va, data, size);
+        } else {
+            mmu->ReadMemory(va, data, size);
+        }
+    };
+    auto reg = [&](u8 code) -> u64 {
+        return code == 31 ? 0 : regs[code];
+    };
+    u8 rt = static_cast<u8>(instr & 0x1f);
+    u8 rt2 = static_cast<u8>((instr >> 10) & 0x1f);
+    u8 rs = static_cast<u8>((instr >> 16) & 0x1f);
+    u32 size = instr >> 30;
+    bool o2 = ((instr >> 23) & 1) != 0;
+    bool load = ((instr >> 22) & 1) != 0;
+    bool o1 = ((instr >> 21) & 1) != 0;
+    bool casp = o1 && !o2 && size < 2;
+    bool pair = o1 && !o2;
+    u32 elem_size = casp ? (4U << size) : (pair ? (4U << (size & 1)) : (1U << size));
+    u32 count = pair ? 2 : 1;
+    u64 mask = elem_size == 8 ? ~u64(0) : (u64(1) << (elem_size * 8)) - 1;
+    u64 data[2]{};
+    if (o1 && (o2 || casp)) {
+        // cas/casp, rs and rt are register pairs for casp
+        access(data, elem_size * count, false);
+        if (elem_size == 4 && casp) {
+            data[1] = data[0] >> 32;
+            data[0] &= mask;
+        }
+        bool equal = true;
+        for (u32 i = 0; i < count; ++i) {
+            equal = equal && data[i] == (reg(rs + i) & mask);
+        }
+        if (equal) {
+            u64 value[2]{reg(rt), casp ? reg(rt + 1) : 0};
+            if (elem_size == 4 && casp) {
+                value[0] = (value[0] & mask) | (value[1] << 32);
+            }
+            access(value, elem_size * count, true);
+        }
+        for (u32 i = 0; i < count; ++i) {
+            if (rs + i != 31) {
+                regs[rs + i] = data[i];
+            }
+        }
+        cpu_context_.pc += 4;
+        return;
+    }
+    // ldxr/stxr keep the same monitor as the generated code, ldar/stlr are plain accesses here
+    bool exclusive = !o2;
+    u8 transfer[2] = {rt, rt2};
+    if (load) {
+        if (exclusive) {
+            cpu_context_.exclusive.addr = va;
+            cpu_context_.exclusive.tag_entry = reinterpret_cast<VAddr>(&monitor->Entry(va));
+            cpu_context_.exclusive.tag = monitor->Load(va);
+        }
+        access(data, elem_size * count, false);
+        if (exclusive) {
+            std::memcpy(cpu_context_.exclusive.value, data, sizeof(data));
+        }
+        auto bytes = reinterpret_cast<u8 *>(data);
+        for (u32 i = 0; i < count; ++i) {
+            u64 value{0};
+            std::memcpy(&value, bytes + i * elem_size, elem_size);
+            if (transfer[i] != 31) {
+                regs[transfer[i]] = value;
+            }
+        }
+    } else {
+        bool success = true;
+        if (exclusive) {
+            success = cpu_context_.exclusive.addr == va && monitor->Claim(va, cpu_context_.exclusive.tag);
+            cpu_context_.exclusive.addr = exclusive_none;
+        }
+        if (success) {
+            auto bytes = reinterpret_cast<u8 *>(data);
+            for (u32 i = 0; i < count; ++i) {
+                u64 value = reg(transfer[i]);
+                std::memcpy(bytes + i * elem_size, &value, elem_size);
+            }
+            access(data, elem_size * count, true);
+        }
+        if (exclusive && rs != 31) {
+            regs[rs] = success ? 0 : 1;
+        }
+    }
+    cpu_context_.pc += 4;
+}
+
 void EmuThreadContext::LookupJitCache() {
     auto jit_cache = instance_->FindAndJit(cpu_context_.pc);
     if (jit_cache && jit_cache->Data().GetStub()) {
@@ -9,6 +9,7 @@
 #include "svm_arm64.h"
 #include <thread>
 #include <stack>
+#include <unordered_map>
 
 namespace Decode::A64 {
     class VixlJitDecodeVisitor;
@@ -18,6 +19,23 @@ namespace Jit::A64 {
     class JitManager;
 }
 
+namespace Instructions::A64 {
+    class IRLifterA64;
+}
+
+namespace Jit::IR {
+    class PassManagerIR;
+}
+
+namespace Backend::IR {
+    class InterpreterIR;
+    struct ProgramIR;
+}
+
+namespace Backend::A64 {
+    class IRBackendA64;
+}
+
 namespace SVM::A64 {
 
     constexpr size_t default_jit_run_ticks = 0x1000;
@@ -31,6 +49,8 @@ namespace SVM::A64 {
     public:
         ThreadContext(const SharedPtr<Instance> &instance);
 
+        virtual ~ThreadContext();
+
         const static SharedPtr<ThreadContext> &Current();
 
         const SharedPtr<Instance> &GetInstance() const;
@@ -47,23 +67,64 @@ namespace SVM::A64 {
 
         void PopJitContext();
 
+        // pooled per nest level, pushed as current jit context
+        ContextA64 AcquireJitContext();
+
+        void ReleaseJitContext();
+
         // if false : end of block
         bool JitInstr(VAddr addr);
 
+        // optimized tier of the blocks this thread translates
+        Backend::A64::IRBackendA64 &IRBackend();
+
     protected:
         SharedPtr<Instance> instance_;
         std::shared_ptr<Decode::A64::VixlJitDecodeVisitor> jit_visitor_;
         std::shared_ptr<vixl::aarch64::Decoder> jit_decode_;
+        std::vector<std::unique_ptr<JitContext>> jit_context_pool_;
+        size_t jit_context_depth_{0};
+        std::unique_ptr<Backend::A64::IRBackendA64> ir_backend_;
     };
 
     class EmuThreadContext : public ThreadContext {
     public:
         EmuThreadContext(const SharedPtr<Instance> &instance);
 
+        virtual ~EmuThreadContext();
+
         void Run(size_t ticks = default_jit_run_ticks);
 
         void LookupJitCache();
 
+        void CheckTierUp();
+
+        void CheckShootdown();
+
+        // this thread is outside generated code, code retired before now may be freed
+        void EnterCode();
+
+        // generated code returned to the host
+        void LeaveCode();
+
+        // load/store at pc hit a spec page, run it on the host through the memory hooks
+        void HandleMemorySpec();
+
+        // exclusives, acquire/release and cas on a spec page
+        void HandleOrderedSpec(u32 instr);
+
+        // portable tier, runs the thread in the ir interpreter instead of generated code
+        void RunInterpreter(size_t ticks = default_jit_run_ticks);
+
+        // block at pc through the ir interpreter, false if the context interrupt is not handled
+        bool InterpretBlock();
+
+        // code was modified
+        void ClearIRCache();
+
+        // what the ir passes took out of the blocks interpreted so far
+        void DumpIRPassStats();
+
         CPUContext *GetCpuContext();
 
         ThreadType Type() override;
@@ -77,8 +138,19 @@ namespace SVM::A64 {
 
         virtual u64 GetClockTicks() { return 0; };
 
+    private:
+        Backend::IR::ProgramIR *IRProgram(VAddr pc);
+
     protected:
         std::vector<u8> interrupt_stack_;
+        SharedPtr<Memory::TLB<VAddr, PTE>> tlb_;
+        std::unique_ptr<Instructions::A64::IRLifterA64> ir_lifter_;
+        std::unique_ptr<Jit::IR::PassManagerIR> ir_passes_;
+        std::unique_ptr<Backend::IR::InterpreterIR> interpreter_;
+        // null for blocks the interpreter can not run
+        std::unordered_map<VAddr, std::unique_ptr<Backend::IR::ProgramIR>> ir_cache_;
+        // code epoch this thread entered generated code at, see JitManager::ReclaimCode
+        u64 code_epoch_{UINT64_MAX};
         alignas(8)
         CPUContext cpu_context_{};
     };
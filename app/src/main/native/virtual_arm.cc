@@ -4,17 +4,44 @@
 
 #include <jni.h>
 #include <dlfcn.h>
+#include <link.h>
+#include <chrono>
+#include <thread>
 #include <base/log.h>
 #include <platform/memory.h>
 #include "virtual_arm.h"
+#include "asm/arm64/instruction_decode.h"
+#include "frontend/ir/block_ir.h"
 
 #include "svm/arm64/svm_arm64.h"
 #include "svm/arm64/svm_thread.h"
+#include "frontend/arm64/ir_lifter_a64.h"
+#include "frontend/arm64/pass_a64.h"
 #include "loader/nro.h"
 
 #define __ masm_.
 static MacroAssembler masm_;
 
+// every operator new of the process, benches read it around what they measure
+static std::atomic<u64> heap_allocs{0};
+
+void *operator new(size_t size) {
+    heap_allocs.fetch_add(1, std::memory_order_relaxed);
+    ThreadHeapAllocs()++;
+    if (auto ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
 void PlatformSignalHandler(int signum, siginfo_t *siginfo, ucontext_t *uc) {
     if (signum != SIGILL) {
         abort();
@@ -24,7 +51,7 @@ void PlatformSignalHandler(int signum, siginfo_t *siginfo, ucontext_t *uc) {
     for (int i = -8; i < 9; ++i) {
         std::ostringstream string;
         PrintDisassembler disassembler(string);
-        disassembler.Disassemble(reinterpret_cast<const Instruction *>(context->pc + (i * 4)));
+        disassembler.Disassemble(reinterpret_cast<const vixl::aarch64::Instruction *>(context->pc + (i * 4)));
         LOGE((i == 0) ?  "Error Instr: %s" : "Instr: %s" , disassembler.GetOutput());
     }
     abort();
@@ -97,6 +124,528 @@ void RunDemo() {
     LOGE("RunTicks %llu", context->GetCpuContext()->ticks_now);
 }
 
+// many small independent blocks, measures the translator only
+void *TranslateBenchCode(int blocks) {
+    __ Reset();
+    __ SetStackPointer(sp);
+    for (int i = 0; i < blocks; ++i) {
+        Label skip;
+        __ Add(x0, x0, 1);
+        __ Ldr(x1, MemOperand(sp, 16));
+        __ Str(x1, MemOperand(sp, 32));
+        __ Cbz(x0, &skip);
+        __ Sub(x2, x2, x0);
+        __ Bind(&skip);
+        __ Ret();
+    }
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+// integer and fp data processing, all of it is emitted as is
+void *ArithBenchCode(int blocks) {
+    __ Reset();
+    __ SetStackPointer(sp);
+    for (int i = 0; i < blocks; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            __ Add(x0, x0, x1);
+            __ Eor(x2, x2, Operand(x0, LSL, 3));
+            __ Madd(x3, x2, x1, x3);
+            __ Ubfx(x4, x3, 8, 16);
+            __ Fadd(d0, d0, d1);
+            __ Fmul(d2, d0, d1);
+        }
+        __ Ret();
+    }
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+static void TranslateBlocks(const char *name, VAddr code, int block_count, size_t block_size) {
+    auto svm = SharedPtr<Instance>(new Instance());
+    svm->Initialize();
+    auto context = SharedPtr<MyEmuThread>(new MyEmuThread(svm));
+    context->RegisterCurrent();
+    auto &jit_manager = svm->GetJitManager();
+    // first block sets up the jit context of this thread
+    jit_manager->EmplaceJit(code);
+    auto allocs_begin = heap_allocs.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i < block_count; ++i) {
+        jit_manager->EmplaceJit(code + i * block_size);
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    auto allocs = heap_allocs.load() - allocs_begin;
+    auto &stats = jit_manager->Stats();
+    LOGE("%s: %llu blocks in %lld us, %lld blocks/s, arena mallocs %llu, heap allocs %llu (%.2f per block), "
+         "%llu of them inside BeginBlock - EndBlock", name,
+         stats.blocks.load(), cost, cost ? stats.blocks.load() * 1000000 / cost : 0,
+         stats.arena_mallocs.load(), static_cast<unsigned long long>(allocs), double(allocs) / (block_count - 1),
+         static_cast<unsigned long long>(stats.heap_allocs.load()));
+}
+
+void RunTranslateBench() {
+    constexpr int block_count = 4096;
+    auto code = reinterpret_cast<VAddr>(TranslateBenchCode(block_count));
+    // every block is the same length
+    TranslateBlocks("Translate", code, block_count, __ GetBuffer()->GetSizeInBytes() / block_count);
+}
+
+void RunArithTranslateBench() {
+    constexpr int block_count = 4096;
+    TranslateBlocks("Translate arith", reinterpret_cast<VAddr>(ArithBenchCode(block_count)), block_count, 25 * 4);
+}
+
+// every encoding of the table with its don't care bits clear, set and scrambled,
+// the linear walk is the reference the compiled table has to agree with
+static void CheckDecodeTable() {
+    using namespace Instructions::A64;
+    u32 seed = 0x9e3779b9;
+    size_t checked{0}, mismatch{0};
+    for (auto &[opcode, info] : InstructionTableA64::Get().GetInstrTable()) {
+        auto [mask, value] = info.mask_pair_;
+        if (!mask) {
+            continue;
+        }
+        for (int i = 0; i < 16; ++i) {
+            InstrA64 dont_care = i == 0 ? 0 : i == 1 ? ~mask : (seed = seed * 1664525 + 1013904223) & ~mask;
+            auto bits = value | dont_care;
+            auto table = DefaultDecoder::DecodeOpCode(bits);
+            auto linear = DefaultDecoder::DecodeOpCodeLinear(bits);
+            checked++;
+            if (table != linear) {
+                if (!mismatch) {
+                    LOGE("Decode check: %08x of %s, table %d linear %d", bits, info.name_.c_str(),
+                         static_cast<int>(table), static_cast<int>(linear));
+                }
+                mismatch++;
+            }
+        }
+    }
+    LOGE("Decode check: %zu encodings, table and linear differ on %zu", checked, mismatch);
+}
+
+// opcode decode of the instructions table, linear map walk vs compiled table vs vixl decoder
+void RunDecodeBench() {
+    using namespace Instructions::A64;
+    constexpr int block_count = 4096;
+    constexpr int rounds = 16;
+    auto code = reinterpret_cast<const u32 *>(TranslateBenchCode(block_count));
+    auto count = static_cast<size_t>(__ GetBuffer()->GetSizeInBytes()) / 4;
+    auto bench = [&](const char *name, auto &&decode) {
+        u64 sum{0};
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (size_t i = 0; i < count; ++i) {
+                sum += decode(code + i);
+            }
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        LOGE("Decode %s: %zu instrs in %lld us, %lld instrs/s (%llu)", name, count * rounds, cost,
+             cost ? count * rounds * 1000000 / cost : 0, sum);
+    };
+    // table has to be built before timing the linear walk
+    InstructionTableA64::Get();
+    bench("linear", [](const u32 *instr) {
+        return static_cast<u64>(DefaultDecoder::DecodeOpCodeLinear(*instr));
+    });
+    bench("table", [](const u32 *instr) {
+        return static_cast<u64>(DefaultDecoder::DecodeOpCode(*instr));
+    });
+    vixl::aarch64::Decoder vixl_decoder;
+    bench("vixl", [&vixl_decoder](const u32 *instr) {
+        vixl_decoder.Decode(reinterpret_cast<const vixl::aarch64::Instruction *>(instr));
+        return u64(1);
+    });
+    size_t mismatch{0};
+    for (size_t i = 0; i < count; ++i) {
+        mismatch += DefaultDecoder::DecodeOpCode(code[i]) != DefaultDecoder::DecodeOpCodeLinear(code[i]);
+    }
+    LOGE("Decode: table and linear differ on %zu instrs", mismatch);
+    CheckDecodeTable();
+}
+
+// visits every instruction of the table, counts only
+struct CountVisitor : public Instructions::A64::BaseVisitor {
+    using instruction_return_type = void;
+    u64 visited{0};
+
+#define Type(...)
+#define FIELD1(f1) u32 f1
+#define FIELD2(f1, f2) u32 f1, u32 f2
+#define FIELD3(f1, f2, f3) u32 f1, u32 f2, u32 f3
+#define FIELD4(f1, f2, f3, f4) u32 f1, u32 f2, u32 f3, u32 f4
+#define INST(code, name, fields, ...) \
+    void code(fields) { visited++; }
+
+#include "asm/arm64/instructions_table_all.inl"
+
+#undef FIELD1
+#undef FIELD2
+#undef FIELD3
+#undef FIELD4
+#undef INST
+#undef Type
+};
+
+// decode + visit over the executable segment of this library
+void RunVisitBench() {
+    using namespace Instructions::A64;
+    Dl_info info{};
+    if (!dladdr(reinterpret_cast<void *>(&RunVisitBench), &info)) {
+        return;
+    }
+    auto base = reinterpret_cast<VAddr>(info.dli_fbase);
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr *>(base);
+    auto phdr = reinterpret_cast<const Elf64_Phdr *>(base + ehdr->e_phoff);
+    const u32 *code{};
+    size_t count{0};
+    for (int i = 0; i < ehdr->e_phnum; ++i) {
+        if (phdr[i].p_type == PT_LOAD && (phdr[i].p_flags & PF_X)) {
+            code = reinterpret_cast<const u32 *>(base + phdr[i].p_vaddr);
+            count = phdr[i].p_filesz / 4;
+            break;
+        }
+    }
+    CountVisitor visitor;
+    Instructions::A64::Dispatcher<CountVisitor> dispatcher(visitor);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        AArch64Inst inst(code[i]);
+        auto opcode = DefaultDecoder::DecodeOpCode(inst.raw);
+        if (opcode != OpcodeA64::INVALID) {
+            dispatcher.Call(opcode, inst);
+        }
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    LOGE("Visit: %zu instrs, %llu visited in %lld us, %lld instrs/s", count, visitor.visited, cost,
+         cost ? count * 1000000 / cost : 0);
+}
+
+// guest code lifted to ir on 1 - 8 threads, every block is built in the arena of its thread
+void RunIRPoolBench() {
+    using namespace Instructions::IR;
+    constexpr int block_count = 4096;
+    auto code_start = reinterpret_cast<VAddr>(TranslateBenchCode(block_count));
+    auto code_end = code_start + __ GetBuffer()->GetSizeInBytes();
+    auto &pool = InstrIRPool::Get();
+    for (int thread_count = 1; thread_count <= 8; thread_count <<= 1) {
+        auto mallocs = pool.ChunkMallocs();
+        std::atomic<u64> blocks{0}, guest_instrs{0}, allocs{0};
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < thread_count; ++i) {
+            threads.emplace_back([&]() {
+                auto &arena = InstrIRArena::Current();
+                Instructions::A64::IRLifterA64 lifter;
+                u64 lifted{0}, instrs{0};
+                for (VAddr pc = code_start; pc < code_end;) {
+                    {
+                        Jit::IR::CodeBlock block{pc};
+                        if (lifter.Lift(block, [code_end](VAddr va) -> VAddr { return va < code_end ? va : 0; })) {
+                            lifted++;
+                            instrs += block.GuestInstrCount();
+                            pc += block.GuestInstrCount() * 4;
+                        } else {
+                            pc += 4;
+                        }
+                    }
+                    arena.Reset();
+                }
+                blocks += lifted;
+                guest_instrs += instrs;
+                allocs += arena.AllocCount();
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        LOGE("IR lift: %d threads, %llu blocks in %lld us, %lld blocks/s, %lld guest instrs/s, %llu ir instrs, "
+             "%llu chunk mallocs, %llu reuses", thread_count, static_cast<unsigned long long>(blocks.load()),
+             static_cast<long long>(cost), static_cast<long long>(cost ? blocks.load() * 1000000 / cost : 0),
+             static_cast<long long>(cost ? guest_instrs.load() * 1000000 / cost : 0),
+             static_cast<unsigned long long>(allocs.load()),
+             static_cast<unsigned long long>(pool.ChunkMallocs() - mallocs),
+             static_cast<unsigned long long>(pool.ChunkReuses()));
+    }
+}
+
+// x0: counter, x1 - x3 scratch
+void *AtomicIncBenchCode() {
+    Label loop;
+    __ Reset();
+    __ SetStackPointer(sp);
+    __ Bind(&loop);
+    __ Ldaxr(x1, MemOperand(x0));
+    __ Add(x1, x1, 1);
+    __ Stlxr(w2, x1, MemOperand(x0));
+    __ Cbnz(w2, &loop);
+    __ B(&loop);
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+// x0: lock word, x3: counter guarded by the lock, x4 = 1
+void *SpinLockBenchCode() {
+    Label acquire;
+    __ Reset();
+    __ SetStackPointer(sp);
+    __ Bind(&acquire);
+    __ Ldaxr(w1, MemOperand(x0));
+    __ Cbnz(w1, &acquire);
+    __ Stxr(w2, w4, MemOperand(x0));
+    __ Cbnz(w2, &acquire);
+    __ Ldr(x5, MemOperand(x3));
+    __ Add(x5, x5, 1);
+    __ Str(x5, MemOperand(x3));
+    __ Stlr(wzr, MemOperand(x0));
+    __ B(&acquire);
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+// frame push/pop loop, every access is sp relative
+void *StackBenchCode() {
+    Label loop;
+    __ Reset();
+    __ SetStackPointer(sp);
+    __ Bind(&loop);
+    __ Stp(x29, x30, MemOperand(sp, -32, PreIndex));
+    __ Str(x0, MemOperand(sp, 16));
+    __ Ldr(x1, MemOperand(sp, 16));
+    __ Add(x0, x1, 1);
+    __ Ldp(x29, x30, MemOperand(sp, 32, PostIndex));
+    __ B(&loop);
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+// sp relative accesses of a page table guest, l1 dcache hit rate is logged per block
+void RunStackBench() {
+    constexpr size_t run_ticks = 0x100000;
+    constexpr VAddr stack_vaddr = 0x100000000;
+    JitConfig jit_config{};
+    jit_config.context_reg = 30;
+    jit_config.forward_reg = 16;
+    jit_config.jit_thread_count = 2;
+    jit_config.use_host_clock = true;
+    jit_config.profile_l1 = true;
+    MmuConfig mmu_config{};
+    mmu_config.enable = true;
+    mmu_config.addr_width = 48;
+    mmu_config.page_bits = 12;
+    mmu_config.readable_bit = 0;
+    mmu_config.writable_bit = 1;
+    mmu_config.executable_bit = 2;
+    mmu_config.fastmem = false;
+    auto svm = SharedPtr<Instance>(new Instance(jit_config, mmu_config));
+    svm->Initialize();
+    auto code = reinterpret_cast<VAddr>(StackBenchCode());
+    auto code_page = AlignDown(code, PAGE_SIZE);
+    PTE code_pte{};
+    code_pte.index_ = code_page >> PAGE_BITS;
+    code_pte.attrs_ = PageAttrs::Read | PageAttrs::Execute;
+    svm->GetMmu()->MapLinear(code_page, 2 * PAGE_SIZE, code_pte);
+    svm->MapGuestMemory(stack_vaddr, 16 * PAGE_SIZE, PageAttrs::Read | PageAttrs::Write);
+    auto context = SharedPtr<MyEmuThread>(new MyEmuThread(svm));
+    context->RegisterCurrent();
+    auto cpu = context->GetCpuContext();
+    cpu->pc = code;
+    cpu->sp = stack_vaddr + 16 * PAGE_SIZE;
+    auto start = std::chrono::steady_clock::now();
+    context->Run(run_ticks);
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    LOGE("Stack bench: %llu frames in %lld us", cpu->cpu_registers[0].X, cost);
+    svm->GetJitManager()->DumpL1Stats();
+}
+
+// guest exclusives on 1 - 8 emulated cores, host monitor without mmu, emulated monitor with page table
+void RunExclusiveBench(bool page_table) {
+    constexpr size_t run_ticks = 0x100000;
+    constexpr VAddr data_vaddr = 0x100000000;
+    JitConfig jit_config{};
+    jit_config.context_reg = 30;
+    jit_config.forward_reg = 16;
+    jit_config.jit_thread_count = 2;
+    jit_config.use_host_clock = true;
+    MmuConfig mmu_config{};
+    mmu_config.enable = page_table;
+    mmu_config.addr_width = 48;
+    mmu_config.page_bits = 12;
+    mmu_config.readable_bit = 0;
+    mmu_config.writable_bit = 1;
+    mmu_config.executable_bit = 2;
+    mmu_config.fastmem = false;
+    for (int spin_lock = 0; spin_lock < 2; ++spin_lock) {
+        for (int cores = 1; cores <= 8; cores <<= 1) {
+            auto svm = SharedPtr<Instance>(new Instance(jit_config, mmu_config));
+            svm->Initialize();
+            auto code = reinterpret_cast<VAddr>(spin_lock ? SpinLockBenchCode() : AtomicIncBenchCode());
+            VAddr data_host;
+            VAddr data_guest;
+            if (page_table) {
+                // code is identity mapped, data goes through the page table
+                auto code_page = AlignDown(code, PAGE_SIZE);
+                PTE code_pte{};
+                code_pte.index_ = code_page >> PAGE_BITS;
+                code_pte.attrs_ = PageAttrs::Read | PageAttrs::Execute;
+                svm->GetMmu()->MapLinear(code_page, 2 * PAGE_SIZE, code_pte);
+                data_host = svm->MapGuestMemory(data_vaddr, PAGE_SIZE, PageAttrs::Read | PageAttrs::Write);
+                data_guest = data_vaddr;
+            } else {
+                data_host = reinterpret_cast<VAddr>(calloc(1, PAGE_SIZE));
+                data_guest = data_host;
+            }
+            // lock and counter on different granules
+            auto counter = reinterpret_cast<volatile u64 *>(data_host + (spin_lock ? 0x100 : 0));
+            std::vector<std::thread> threads;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < cores; ++i) {
+                threads.emplace_back([&svm, code, data_guest, spin_lock]() {
+                    auto context = SharedPtr<MyEmuThread>(new MyEmuThread(svm));
+                    context->RegisterCurrent();
+                    auto cpu = context->GetCpuContext();
+                    cpu->cpu_registers[0].X = data_guest;
+                    cpu->cpu_registers[3].X = data_guest + 0x100;
+                    cpu->cpu_registers[4].X = 1;
+                    cpu->pc = code;
+                    auto stack = malloc(64 * 1024);
+                    cpu->sp = reinterpret_cast<u64>(stack) + 64 * 1024;
+                    context->Run(run_ticks);
+                    free(stack);
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            LOGE("Exclusive %s %s: %d cores, %llu ops in %lld us, %lld ops/s",
+                 page_table ? "emulated" : "native", spin_lock ? "spinlock" : "atomic inc",
+                 cores, *counter, cost, cost ? *counter * 1000000 / cost : 0);
+            if (!page_table) {
+                free(reinterpret_cast<void *>(data_host));
+            }
+        }
+    }
+}
+
+// x3: data, integer ops and loads/stores the ir lifter takes
+void *InterpreterBenchCode() {
+    Label loop;
+    __ Reset();
+    __ SetStackPointer(sp);
+    __ Bind(&loop);
+    __ Ldr(x1, MemOperand(x3));
+    __ Add(x2, x2, x1);
+    __ Eor(x4, x2, Operand(x1, LSL, 3));
+    __ Ubfx(x5, x4, 8, 16);
+    __ Str(x5, MemOperand(x3, 8));
+    __ Add(x1, x1, 1);
+    __ Str(x1, MemOperand(x3));
+    __ Subs(x6, x1, 0x10);
+    __ B(ne, &loop);
+    __ B(&loop);
+    __ FinalizeCode();
+    return __ GetBuffer()->GetStartAddress<void*>();
+}
+
+// same guest loop in generated code and in the ir interpreter
+void RunInterpreterBench() {
+    constexpr size_t run_ticks = 0x100000;
+    auto svm = SharedPtr<Instance>(new Instance());
+    svm->Initialize();
+    auto code = reinterpret_cast<VAddr>(InterpreterBenchCode());
+    auto context = SharedPtr<MyEmuThread>(new MyEmuThread(svm));
+    context->RegisterCurrent();
+    auto cpu = context->GetCpuContext();
+    auto data = static_cast<u64 *>(calloc(2, sizeof(u64)));
+    for (int interpret = 0; interpret < 2; ++interpret) {
+        data[0] = 0;
+        cpu->cpu_registers[3].X = reinterpret_cast<u64>(data);
+        cpu->pc = code;
+        auto ticks_begin = cpu->ticks_now;
+        auto start = std::chrono::steady_clock::now();
+        if (interpret) {
+            context->RunInterpreter(run_ticks);
+        } else {
+            context->Run(run_ticks);
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        auto instrs = cpu->ticks_now - ticks_begin;
+        LOGE("%s: %llu instrs, %llu iterations in %lld us, %lld instrs/s", interpret ? "Interpreter" : "Native",
+             instrs, data[0], cost, cost ? instrs * 1000000 / cost : 0);
+    }
+    free(data);
+}
+
+// same guest loop in baseline code and tiered up to the ir backend
+void RunIRBackendBench() {
+    constexpr size_t run_ticks = 0x100000;
+    auto code = reinterpret_cast<VAddr>(InterpreterBenchCode());
+    auto data = static_cast<u64 *>(calloc(2, sizeof(u64)));
+    Instance defaults;
+    for (int optimize = 0; optimize < 2; ++optimize) {
+        auto jit_config = defaults.GetJitConfig();
+        jit_config.tier_up_threshold = optimize ? 64 : 0;
+        auto svm = SharedPtr<Instance>(new Instance(jit_config, defaults.GetMmuConfig()));
+        svm->Initialize();
+        auto context = SharedPtr<MyEmuThread>(new MyEmuThread(svm));
+        context->RegisterCurrent();
+        auto cpu = context->GetCpuContext();
+        data[0] = 0;
+        cpu->cpu_registers[3].X = reinterpret_cast<u64>(data);
+        cpu->pc = code;
+        // tier up happens in here
+        context->Run(run_ticks);
+        auto ticks_begin = cpu->ticks_now;
+        auto start = std::chrono::steady_clock::now();
+        context->Run(run_ticks);
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        auto instrs = cpu->ticks_now - ticks_begin;
+        LOGE("%s: %llu instrs in %lld us, %lld instrs/s, ir blocks %llu", optimize ? "IR backend" : "Baseline",
+             instrs, cost, cost ? instrs * 1000000 / cost : 0, svm->GetJitManager()->Stats().ir_blocks.load());
+    }
+    free(data);
+}
+
+// lifts the text of an nro block after block and logs what each ir pass removes
+void RunIRPassBench() {
+    Loader::Nro nro("/sdcard/barrier.nro");
+    auto code_set = std::make_shared<Jit::CodeSet>();
+    code_set->base_addr = 0x120000000;
+    Platform::MapExecutableMemory(nro.GetLoadSegmentsSize(), code_set->base_addr);
+    nro.Load(code_set.get());
+    auto text_start = code_set->CodeSegment().addr;
+    auto text_end = text_start + code_set->CodeSegment().size;
+    Instructions::A64::IRLifterA64 lifter;
+    Jit::IR::PassManagerIR passes;
+    passes.Add(std::make_unique<Instructions::A64::ContextForwardPassA64>());
+    passes.Add(std::make_unique<Jit::IR::ConstantFoldPass>());
+    passes.Add(std::make_unique<Jit::IR::DeadCodePass>());
+    u64 blocks{0}, instrs_before{0}, instrs_after{0};
+    auto start = std::chrono::steady_clock::now();
+    for (VAddr pc = text_start; pc < text_end;) {
+        {
+            Jit::IR::CodeBlock block{pc};
+            if (lifter.Lift(block, [text_end](VAddr va) -> VAddr { return va < text_end ? va : 0; })) {
+                instrs_before += block.Instrs().size();
+                passes.Run(block);
+                instrs_after += block.Instrs().size();
+                blocks++;
+                pc += block.GuestInstrCount() * 4;
+            } else {
+                pc += 4;
+            }
+        }
+        Instructions::IR::InstrIRArena::Current().Reset();
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    LOGE("IR passes: %llu blocks in %lld us, %llu ir instrs before, %llu after", blocks, cost,
+         instrs_before, instrs_after);
+    passes.DumpStats();
+}
+
 void RunTestNro() {
     struct sigaction sig{};
     sigemptyset(&sig.sa_mask);
@@ -122,12 +671,32 @@ void RunTestNro() {
     context->Run(0x4000000);
 }
 
+// everything that runs without the nro on the sdcard
+void RunBenches() {
+    RunTranslateBench();
+    RunArithTranslateBench();
+    RunDecodeBench();
+    RunVisitBench();
+    RunIRPoolBench();
+    RunStackBench();
+    RunExclusiveBench(false);
+    RunExclusiveBench(true);
+    RunInterpreterBench();
+    RunIRBackendBench();
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 load_test(JNIEnv *env, jobject instance) {
     RunTestNro();
 }
 
+extern "C"
+JNIEXPORT void JNICALL
+run_benches(JNIEnv *, jobject) {
+    RunBenches();
+}
+
 static bool registerNativeMethods(JNIEnv *env, const char *className, JNINativeMethod *jniMethods, int methods) {
     jclass clazz = env->FindClass(className);
     if (clazz == nullptr) {
@@ -141,6 +710,11 @@ static JNINativeMethod jniMethods[] = {
                 "launch",
                 "()V",
                 (void *) load_test
+        },
+        {
+                "bench",
+                "()V",
+                (void *) run_benches
         }
 };
 